@@ -31,6 +31,7 @@
 
 #define ERRLVL_CMDLINE 1
 #define ERRLVL_PASSWD  2
+#define ERRLVL_SERVICE 3
 
 
 //---------------------------------------------------------------------------
@@ -78,3 +79,11 @@ int DoQuery(void);
 
 
 int DoUpdate(void);
+
+
+//---------------------------------------------------------------------------
+// Stats
+//---------------------------------------------------------------------------
+
+
+int DoStats(void);
@@ -78,8 +78,10 @@ int __cdecl wmain(void)
     if (CmdIs(L"set") || CmdIs(L"append")
             || CmdIs(L"insert") || CmdIs(L"delete"))
         return DoUpdate();
+    if (CmdIs(L"stats"))
+        return DoStats();
     else {
-        UsageError(L"<query|queryex|set|append|insert|delete>");
+        UsageError(L"<query|queryex|set|append|insert|delete|stats>");
         return ERRLVL_CMDLINE;  // not reached
     }
 }
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2004-2020 Sandboxie Holdings, LLC 
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// SbieIni scripting utility
+//---------------------------------------------------------------------------
+
+#include <ntstatus.h>
+#define WIN32_NO_STATUS
+typedef long NTSTATUS;
+
+#include "global.h"
+#include "core/dll/sbiedll.h"
+#include "core/svc/pipewire.h"
+
+
+//---------------------------------------------------------------------------
+// DoStats
+//---------------------------------------------------------------------------
+
+
+int DoStats(void)
+{
+    PORT_GET_STATS_REQ req;
+    PORT_GET_STATS_RPL *rpl;
+    ULONG i;
+
+    if (CmdVerb(1)) {
+
+        const WCHAR *_usage =
+            L"stats\n"
+            L"- lists the worker threads of the Sandboxie service"
+                L" and the number of\n"
+            L"  calls and their time for each of its servers\n";
+
+        UsageError(_usage);
+    }
+
+    req.h.length = sizeof(PORT_GET_STATS_REQ);
+    req.h.msgid = MSGID_PORT_GET_STATS;
+
+    rpl = (PORT_GET_STATS_RPL *)SbieDll_CallServer(&req.h);
+    if (! rpl)
+        return ERRLVL_SERVICE;
+    if (rpl->h.status != 0) {
+        printf("Error %08X\n", rpl->h.status);
+        SbieDll_FreeMem(rpl);
+        return ERRLVL_SERVICE;
+    }
+
+    printf("threads %u (idle %u, min %u, max %u)\n\n",
+        rpl->num_threads, rpl->idle_threads,
+        rpl->min_threads, rpl->max_threads);
+
+    printf("server        calls      avg us      max us\n");
+
+    for (i = 0; i < rpl->num_targets; ++i) {
+
+        PORT_TARGET_STATS *stats = &rpl->targets[i];
+
+        printf("%04X   %12I64u  %10I64u  %10u\n", stats->server_id,
+            stats->call_count,
+            stats->call_count ? stats->total_time_us / stats->call_count : 0,
+            stats->max_time_us);
+    }
+
+    SbieDll_FreeMem(rpl);
+    return 0;
+}
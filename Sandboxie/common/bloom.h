@@ -0,0 +1,143 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Path Bloom Filter
+//---------------------------------------------------------------------------
+
+
+#ifndef _MY_BLOOM_H
+#define _MY_BLOOM_H
+
+
+//
+// a Bloom filter over the relative paths of all files and folders found
+// in a snapshot folder, it is written by CSandBox::TakeSnapshot and used
+// by SbieDll to skip probing snapshots which can not contain a given path
+//
+// paths are relative to the snapshot folder, without leading or trailing
+// backslash, e.g. drive\C\Windows\win.ini
+//
+// the file system compares names case insensitively using its own upcase
+// table, to stay on the safe side the hash folds ASCII letters to lower
+// case and skips all non ASCII characters, as well as 'i' and 's' which
+// some non ASCII characters upcase to, this only increases the rate of
+// false positives, a path which is present is never reported as absent
+//
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define BLOOM_FILE_NAME         L"SnapshotPaths.dat"
+
+#define BLOOM_SIGNATURE         0x4D4F4C42  // 'BLOM'
+#define BLOOM_VERSION           1
+
+#define BLOOM_HASH_COUNT        7           // ~1% false positives at 10 bits per path
+#define BLOOM_BITS_PER_PATH     10
+#define BLOOM_MIN_BITS          1024
+#define BLOOM_MAX_BITS          (1 << 24)   // 2 MB
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _BLOOM_HEADER {
+
+    ULONG Signature;
+    ULONG Version;
+    ULONG BitCount;         // always a power of 2
+    ULONG HashCount;
+    ULONG PathCount;
+
+    // followed by BitCount / 8 bytes
+
+} BLOOM_HEADER;
+
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+
+__inline ULONG Bloom_BitCount(ULONG PathCount)
+{
+    ULONG BitCount = BLOOM_MIN_BITS;
+    while (BitCount < BLOOM_MAX_BITS && BitCount / BLOOM_BITS_PER_PATH < PathCount)
+        BitCount <<= 1;
+    return BitCount;
+}
+
+
+__inline BOOLEAN Bloom_CheckHeader(const BLOOM_HEADER* Header)
+{
+    return Header->Signature == BLOOM_SIGNATURE && Header->Version == BLOOM_VERSION
+        && Header->BitCount >= BLOOM_MIN_BITS && Header->BitCount <= BLOOM_MAX_BITS
+        && (Header->BitCount & (Header->BitCount - 1)) == 0
+        && Header->HashCount > 0 && Header->HashCount <= 32;
+}
+
+
+__inline ULONG64 Bloom_HashPath(const WCHAR* Path, ULONG Length)
+{
+    // FNV-1a
+    ULONG64 Hash = 0xCBF29CE484222325ull;
+    for (ULONG i = 0; i < Length; i++) {
+        WCHAR c = Path[i];
+        if (c >= 0x80)
+            continue;
+        if (c >= L'A' && c <= L'Z')
+            c += L'a' - L'A';
+        if (c == L'i' || c == L's')
+            continue;
+        Hash ^= (UCHAR)c;
+        Hash *= 0x100000001B3ull;
+    }
+    return Hash;
+}
+
+
+__inline void Bloom_Add(UCHAR* Bits, ULONG BitCount, ULONG HashCount, ULONG64 Hash)
+{
+    ULONG h1 = (ULONG)Hash;
+    ULONG h2 = (ULONG)(Hash >> 32) | 1;
+    for (ULONG i = 0; i < HashCount; i++) {
+        ULONG Bit = (h1 + i * h2) & (BitCount - 1);
+        Bits[Bit >> 3] |= (UCHAR)(1 << (Bit & 7));
+    }
+}
+
+
+__inline BOOLEAN Bloom_Test(const UCHAR* Bits, ULONG BitCount, ULONG HashCount, ULONG64 Hash)
+{
+    ULONG h1 = (ULONG)Hash;
+    ULONG h2 = (ULONG)(Hash >> 32) | 1;
+    for (ULONG i = 0; i < HashCount; i++) {
+        ULONG Bit = (h1 + i * h2) & (BitCount - 1);
+        if ((Bits[Bit >> 3] & (1 << (Bit & 7))) == 0)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+
+#endif /* _MY_BLOOM_H */
@@ -5,6 +5,7 @@
 #include "common/pool.h"
 
 typedef struct _NETFW_RULE NETFW_RULE;
+typedef struct _NETFW_INDEX NETFW_INDEX;
 
 
 typedef struct _IP_ADDRESS
@@ -23,6 +24,12 @@ void NetFw_AddRule(LIST* list, NETFW_RULE* rule);
 
 BOOLEAN NetFw_BlockTraffic(LIST* list, IP_ADDRESS* Ip, USHORT Port, int Protocol);
 
+NETFW_INDEX* NetFw_CompileRules(LIST* list, POOL* pool);
+
+void NetFw_FreeIndex(NETFW_INDEX* index);
+
+BOOLEAN NetFw_BlockTrafficEx(NETFW_INDEX* index, LIST* list, IP_ADDRESS* Ip, USHORT Port, int Protocol);
+
 BOOLEAN NetFw_ParseRule(NETFW_RULE* rule, const WCHAR* RuleStr);
 
 void NetFw_FreeRule(NETFW_RULE* rule);
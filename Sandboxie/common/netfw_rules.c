@@ -0,0 +1,807 @@
+
+//
+// network firewall rules and their evaluation, with and without the compiled
+// rule index.  this file is included by netfw.c after the headers it needs,
+// and by tests/netfw_test.c which compares both evaluations
+//
+
+struct _NETFW_RULE 
+{
+    LIST_ELEM list_elem;
+
+	POOL* pool;
+
+	BOOLEAN action_block;
+
+	int proc_match_level;
+
+	rbtree_t port_map;
+	rbtree_t ip_map;
+
+	int protocol;
+};
+
+int NetFw_PortCmp(const void * l, const void * r)
+{
+	if (*((USHORT*)l) > *((USHORT*)r))
+		return 1;
+	if (*((USHORT*)l) < *((USHORT*)r))
+		return -1;
+	return 0;
+}
+
+int NetFw_IpCmp(const void * l, const void * r)
+{
+	IP_ADDRESS* L = (IP_ADDRESS*)l;
+	IP_ADDRESS* R = (IP_ADDRESS*)r;
+	/*if (L->Type != R->Type)
+		return L->Type > R->Type ? 1 : -1;
+	return memcmp(L->Data, R->Data, L->Type == AF_INET6 ? 16: 4);*/
+	return memcmp(L->Data, R->Data, 16);
+}
+
+#define NETFW_MATCH_NONE	0
+#define NETFW_MATCH_GLOBAL	1
+#define NETFW_MATCH_NOT		2
+#define NETFW_MATCH_RANGE	3
+#define NETFW_MATCH_EXACT	4
+
+NETFW_RULE* NetFw_AllocRule(POOL* pool, int MatchLevel)
+{
+#ifdef KERNEL_MODE
+//#if (NTDDI_VERSION >= NTDDI_WIN10_VB)
+//	NETFW_RULE* rule = ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(NETFW_RULE), tzuk);
+//#else
+#pragma warning(suppress: 4996) // suppress deprecation warning
+	NETFW_RULE* rule = ExAllocatePoolWithTag(NonPagedPool, sizeof(NETFW_RULE), tzuk);
+//#endif
+#else
+    NETFW_RULE* rule = Pool_Alloc(pool, sizeof(NETFW_RULE));
+#endif
+	if (rule == NULL)
+		return NULL;
+
+    memzero(&rule->list_elem, sizeof(LIST_ELEM));
+	rule->pool = pool;
+
+	rule->action_block = FALSE;
+
+	//rule->proc_match_level = MatchLevel;
+    // convert levels, todo: unify levels
+    switch (MatchLevel) {
+    case 0: rule->proc_match_level = NETFW_MATCH_EXACT; break;
+    case 1: rule->proc_match_level = NETFW_MATCH_NOT; break;
+    case 2: rule->proc_match_level = NETFW_MATCH_GLOBAL; break;
+    default: rule->proc_match_level = NETFW_MATCH_NONE; break;
+    }
+
+	rbtree_init(&rule->port_map, NetFw_PortCmp);
+	rbtree_init(&rule->ip_map, NetFw_IpCmp);
+	rule->protocol = IPPROTO_ANY;
+
+	return rule;
+}
+
+void NetFw_RuleSetBlockAction(NETFW_RULE* rule, BOOLEAN BlockAction)
+{
+	rule->action_block = BlockAction;
+}
+
+// Port ranges
+
+typedef struct _NETFW_PORTS
+{
+    rbnode_t tree_elem;
+
+	USHORT RangeBegin;
+	USHORT RangeEnd;
+} NETFW_PORTS;
+
+void NetFw_RuleAddPortRange(rbtree_t* tree, USHORT PortBegin, USHORT PortEnd, POOL* pool)
+{
+#ifdef KERNEL_MODE
+//#if (NTDDI_VERSION >= NTDDI_WIN10_VB)
+//	NETFW_PORTS* node = ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(NETFW_PORTS), tzuk);
+//#else
+#pragma warning(suppress: 4996) // suppress deprecation warning
+	NETFW_PORTS* node = ExAllocatePoolWithTag(NonPagedPool, sizeof(NETFW_PORTS), tzuk);
+//#endif
+#else
+	NETFW_PORTS* node = Pool_Alloc(pool, sizeof(NETFW_PORTS));
+#endif
+	node->tree_elem.key = &node->RangeBegin;
+	node->RangeBegin = PortBegin;
+	node->RangeEnd = PortEnd;
+	rbtree_insert(tree, (rbnode_t*)node);
+}
+
+static void NetFw_FreePort(rbnode_t* node, void* arg) 
+{
+#ifdef KERNEL_MODE
+	ExFreePoolWithTag(node, tzuk);
+#else
+	Pool_Free(node, sizeof(NETFW_PORTS));
+#endif
+}
+
+BOOLEAN NetFw_MatchPortMaps(rbtree_t* l_tree, rbtree_t* r_tree)
+{
+	NETFW_PORTS* l_node = (NETFW_PORTS*)rbtree_first(l_tree);
+	NETFW_PORTS* r_node = (NETFW_PORTS*)rbtree_first(r_tree);
+	while (1) {
+		if ((((rbnode_t*)l_node) != RBTREE_NULL) != (((rbnode_t*)r_node) != RBTREE_NULL))
+			break; // no match
+		if ((((rbnode_t*)l_node) == RBTREE_NULL) && (((rbnode_t*)r_node) == RBTREE_NULL))
+			return TRUE;
+		if (NetFw_PortCmp(&l_node->RangeBegin, &r_node->RangeBegin) != 0 || NetFw_PortCmp(&l_node->RangeEnd, &r_node->RangeEnd) != 0)
+			break; // no match
+
+		l_node = (NETFW_PORTS*)rbtree_next(((rbnode_t*)l_node));
+		r_node = (NETFW_PORTS*)rbtree_next(((rbnode_t*)r_node));
+	}
+	return FALSE;
+}
+
+BOOLEAN NetFw_MergePortMaps(rbtree_t* dst, rbtree_t* src, POOL* pool)
+{
+	//
+	// search for overlaps, and if found abort
+	// we merge only non overlapping ranges as single entries vs ranges have a different priority
+	//
+
+	for (NETFW_PORTS* src_node = (NETFW_PORTS*)rbtree_first(src); ((rbnode_t*)src_node) != RBTREE_NULL; src_node = (NETFW_PORTS*)rbtree_next((rbnode_t*)src_node)) {
+		
+		NETFW_PORTS* dst_node = NULL;
+		rbtree_find_less_equal(dst, &src_node->RangeBegin, (rbnode_t**)&dst_node);
+		if(dst_node && NetFw_PortCmp(&dst_node->RangeEnd, &src_node->RangeEnd) >= 0) // found overlap
+			return FALSE;
+	}
+
+	for (NETFW_PORTS* src_node = (NETFW_PORTS*)rbtree_first(src); ((rbnode_t*)src_node) != RBTREE_NULL; src_node = (NETFW_PORTS*)rbtree_next((rbnode_t*)src_node)) {
+		
+		NetFw_RuleAddPortRange(dst, src_node->RangeBegin, src_node->RangeEnd, pool);
+	}
+	return TRUE;
+}
+
+ULONG NetFw_MatchPort(rbtree_t* port_map, USHORT port)
+{
+	if (port_map->count == 0)
+		return NETFW_MATCH_GLOBAL;
+
+	NETFW_PORTS* node = NULL;
+	rbtree_find_less_equal(port_map, &port, (rbnode_t**)&node);
+	if (node == NULL)
+		return NETFW_MATCH_NONE;
+	if (NetFw_PortCmp(&port, &node->RangeBegin) < 0 || NetFw_PortCmp(&node->RangeEnd, &port) < 0)
+		return NETFW_MATCH_NONE;
+	return NetFw_PortCmp(&node->RangeBegin, &node->RangeEnd) == 0 ? NETFW_MATCH_EXACT : NETFW_MATCH_RANGE;
+}
+
+//
+
+// IP ranges
+
+typedef struct _NETFW_IPS
+{
+    rbnode_t tree_elem;
+
+	IP_ADDRESS RangeBegin;
+	IP_ADDRESS RangeEnd;
+} NETFW_IPS;
+
+void NetFw_RuleAddIpRange(rbtree_t* tree, IP_ADDRESS* IpBegin, IP_ADDRESS* IpEnd, POOL* pool)
+{
+#ifdef KERNEL_MODE
+//#if (NTDDI_VERSION >= NTDDI_WIN10_VB)
+//	NETFW_IPS* node = ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(NETFW_IPS), tzuk);
+//#else
+#pragma warning(suppress: 4996) // suppress deprecation warning
+	NETFW_IPS* node = ExAllocatePoolWithTag(NonPagedPool, sizeof(NETFW_IPS), tzuk);
+//#endif
+#else
+	NETFW_IPS* node = Pool_Alloc(pool, sizeof(NETFW_IPS));
+#endif
+	node->tree_elem.key = &node->RangeBegin;
+	node->RangeBegin = *IpBegin;
+	node->RangeEnd = *IpEnd;
+	rbtree_insert(tree, (rbnode_t*)node);
+}
+
+static void NetFw_FreeIp(rbnode_t* node, void* arg) 
+{
+#ifdef KERNEL_MODE
+	ExFreePoolWithTag(node, tzuk);
+#else
+	Pool_Free(node, sizeof(NETFW_IPS));
+#endif
+}
+
+BOOLEAN NetFw_MatchIPMaps(rbtree_t* l_tree, rbtree_t* r_tree)
+{
+	NETFW_IPS* l_node = (NETFW_IPS*)rbtree_first(l_tree);
+	NETFW_IPS* r_node = (NETFW_IPS*)rbtree_first(r_tree);
+	while (1) {
+		if ((((rbnode_t*)l_node) != RBTREE_NULL) != (((rbnode_t*)r_node) != RBTREE_NULL))
+			break; // no match
+		if ((((rbnode_t*)l_node) == RBTREE_NULL) && (((rbnode_t*)r_node) == RBTREE_NULL))
+			return TRUE;
+		if (NetFw_IpCmp(&l_node->RangeBegin, &r_node->RangeBegin) != 0 || NetFw_IpCmp(&l_node->RangeEnd, &r_node->RangeEnd) != 0)
+			break; // no match
+
+		l_node = (NETFW_IPS*)rbtree_next((rbnode_t*)l_node);
+		r_node = (NETFW_IPS*)rbtree_next((rbnode_t*)r_node);
+	}
+	return FALSE;
+}
+
+BOOLEAN NetFw_MergeIPMaps(rbtree_t* dst, rbtree_t* src, POOL* pool)
+{
+	//
+	// search for overlaps, and if found abort
+	// we merge only non overlapping ranges as single entries vs ranges have a different priority
+	//
+
+	for (NETFW_IPS* src_node = (NETFW_IPS*)rbtree_first(src); ((rbnode_t*)src_node) != RBTREE_NULL; src_node = (NETFW_IPS*)rbtree_next((rbnode_t*)src_node)) {
+		
+		NETFW_IPS* dst_node = NULL;
+		rbtree_find_less_equal(dst, &src_node->RangeBegin, (rbnode_t**)&dst_node);
+		if(dst_node && NetFw_IpCmp(&dst_node->RangeEnd, &src_node->RangeEnd) >= 0) // found overlap
+			return FALSE;
+	}
+
+	for (NETFW_IPS* src_node = (NETFW_IPS*)rbtree_first(src); ((rbnode_t*)src_node) != RBTREE_NULL; src_node = (NETFW_IPS*)rbtree_next((rbnode_t*)src_node)) {
+		
+		NetFw_RuleAddIpRange(dst, &src_node->RangeBegin, &src_node->RangeEnd, pool);
+	}
+	return TRUE;
+}
+
+ULONG NetFw_MatchAddress(rbtree_t* ip_map, IP_ADDRESS* ip)
+{
+	if (ip_map->count == 0)
+		return NETFW_MATCH_GLOBAL;
+
+	NETFW_IPS* node = NULL;
+	rbtree_find_less_equal(ip_map, ip, (rbnode_t**)&node);
+	if (node == NULL)
+		return NETFW_MATCH_NONE;
+	if (NetFw_IpCmp(ip, &node->RangeBegin) < 0 || NetFw_IpCmp(&node->RangeEnd, ip) < 0)
+		return NETFW_MATCH_NONE;
+	return NetFw_IpCmp(&node->RangeBegin, &node->RangeEnd) == 0 ? NETFW_MATCH_EXACT : NETFW_MATCH_RANGE;
+}
+
+//
+
+void NetFw_RuleSetProtocol(NETFW_RULE* rule, int Protocol)
+{
+	rule->protocol = Protocol;
+}
+
+ULONG NetFw_MatchProtocol(int protocol, int to_test)
+{
+	if (protocol == IPPROTO_ANY)
+		return NETFW_MATCH_GLOBAL;
+
+	if (protocol == to_test)
+		return NETFW_MATCH_EXACT;
+	return NETFW_MATCH_NONE;
+}
+
+void NetFw_FreeRule(NETFW_RULE* rule)
+{
+	traverse_postorder(&rule->port_map, NetFw_FreePort, NULL);
+	traverse_postorder(&rule->ip_map, NetFw_FreeIp, NULL);
+#ifdef KERNEL_MODE
+	ExFreePoolWithTag(rule, tzuk);
+#else
+	Pool_Free(rule, sizeof(NETFW_RULE));
+#endif
+}
+
+void NetFw_AddRule(LIST* list, NETFW_RULE* new_rule)
+{
+	NETFW_RULE* rule = List_Head(list);
+    while (rule) 
+    {
+		if (rule->proc_match_level != new_rule->proc_match_level || rule->action_block != new_rule->action_block)
+			goto next; // must be same level and same action
+
+		if ((rule->port_map.count != 0) != (new_rule->port_map.count != 0))
+			goto next; // both must, or must not, have Ports
+		
+		if ((rule->ip_map.count != 0) != (new_rule->ip_map.count != 0))
+			goto next; // both must, or must not, have IPs
+
+		if (rule->protocol != new_rule->protocol)
+			goto next; // must be same protocol
+
+		//
+		// it seems we might be able to merge these rules
+		// now we check the convoluted case when rules have IPs and ports set.
+		//
+
+		if ((rule->port_map.count != 0) && (rule->ip_map.count != 0)){
+			
+			BOOLEAN same_ports = NetFw_MatchPortMaps(&rule->port_map, &new_rule->port_map);
+			BOOLEAN same_ips = NetFw_MatchIPMaps(&rule->ip_map, &new_rule->ip_map);
+			if (!same_ports && !same_ips) { // if neither Ports nor IPs are same 
+				goto next; // we don't merge
+			}
+			else if (!same_ports) {
+				if (!NetFw_MergePortMaps(&rule->port_map, &new_rule->port_map, rule->pool))
+					goto next; // merge failed
+			}
+			else if (!same_ips) {
+				if (!NetFw_MergeIPMaps(&rule->ip_map, &new_rule->ip_map, rule->pool))
+					goto next; // merge failed
+			}
+			
+		}
+		// if we are here, it means that both rules heve either only ports or only IP's set
+		else if (rule->port_map.count != 0) {
+			if (!NetFw_MergePortMaps(&rule->port_map, &new_rule->port_map, rule->pool))
+				goto next; // merge failed
+		}
+		else if(rule->ip_map.count != 0) {
+			if (!NetFw_MergeIPMaps(&rule->ip_map, &new_rule->ip_map, rule->pool))
+				goto next; // merge failed
+		}
+
+		//
+		// if we are here, we either merged the rules or the rules are identical
+		//
+
+		NetFw_FreeRule(new_rule);
+		return;
+
+	next:
+        rule = List_Next(rule);
+    }
+
+	List_Insert_After(list, NULL, new_rule);
+}
+
+typedef struct _RULE_MATCH {
+	ULONG ByProg;
+	ULONG ByPort;
+	ULONG ByAddress;
+	ULONG ByEndPoint;
+	ULONG ByProtocol;
+	BOOLEAN BlockAction;
+} RULE_MATCH;
+
+BOOLEAN NetFw_MatchRule(NETFW_RULE* rule, USHORT TestPort, IP_ADDRESS* TestAddress, int TestProt, RULE_MATCH* Match) 
+{
+	Match->ByProg = rule->proc_match_level;
+
+	if (!(Match->ByPort = NetFw_MatchPort(&rule->port_map, TestPort)))
+		return FALSE;
+	if (!(Match->ByAddress = NetFw_MatchAddress(&rule->ip_map, TestAddress)))
+		return FALSE;
+	if (!(Match->ByProtocol = NetFw_MatchProtocol(rule->protocol, TestProt)))
+		return FALSE;
+
+	if (Match->ByAddress > NETFW_MATCH_GLOBAL && Match->ByPort > NETFW_MATCH_GLOBAL)
+		Match->ByEndPoint = Match->ByAddress > Match->ByPort ? Match->ByAddress : Match->ByPort; // max
+
+	Match->BlockAction = rule->action_block;
+
+	return TRUE;
+}
+
+
+#define COMPARE_AND_RETURN(x, y) if(x != y) return x > y
+
+BOOLEAN NetFw_IsBetterMatch(RULE_MATCH* MyMatch, RULE_MATCH* OtherMatch)
+{
+	// 1. A rule for a specified program trumps a rule for all programs except a given one, trumps a rule for all programs
+	COMPARE_AND_RETURN(MyMatch->ByProg, OtherMatch->ByProg);
+		
+	// 2. a rule with a Port or IP trumps a rule without
+	// 2a. a rule with ip and port trums a rule with ip or port only
+	// 2b. a rule with one ip trumps a rule with an ip range that is besides that on the same level
+	COMPARE_AND_RETURN(MyMatch->ByEndPoint, OtherMatch->ByEndPoint);
+	COMPARE_AND_RETURN(MyMatch->ByPort, OtherMatch->ByPort);
+	COMPARE_AND_RETURN(MyMatch->ByAddress, OtherMatch->ByAddress);
+
+	// 3. block rules trump allow rules
+	if(MyMatch->BlockAction == TRUE && OtherMatch->BlockAction != TRUE)
+		return TRUE;
+		
+	// 4-> a rule without a protocol means all protocols, a rule with a protocol trumps a rule without if its the only difference
+	COMPARE_AND_RETURN(MyMatch->ByProtocol, OtherMatch->ByProtocol);
+
+	return FALSE;
+}
+
+BOOLEAN NetFw_BlockTraffic(LIST* list, IP_ADDRESS* Ip, USHORT Port, int Protocol)
+{
+	NETFW_RULE* best_rule = NULL;
+	RULE_MATCH best_match = { 0 };
+
+	NETFW_RULE* rule = List_Head(list);
+    while (rule) 
+    {
+		RULE_MATCH match = { 0 };
+		if (NetFw_MatchRule(rule, Port, Ip, Protocol, &match))
+		{
+			if (!best_rule || NetFw_IsBetterMatch(&match, &best_match)) {
+				best_rule = rule;
+				best_match = match;
+			}
+		}
+
+        rule = List_Next(rule);
+    }
+
+	if (best_rule && best_rule->action_block)
+		return TRUE;
+	return FALSE;
+}
+
+// Compiled rule index
+
+//
+// NetFw_BlockTraffic tests every rule for every connection, the index below is built
+// once after all rules of a process are loaded and lets NetFw_BlockTrafficEx test only
+// the rules which can match: rules are grouped by their program match level, best first,
+// and by protocol, within a group rules with ports are found through their port ranges,
+// rules with addresses but no ports through their address ranges, both sorted by begin.
+//
+// as a rule with a better program match always trumps, a worse level needs to be checked
+// only when no rule of a better level matches, the candidates of a level are evaluated
+// in list order exactly as in NetFw_BlockTraffic, so both give the same result
+//
+
+#define NETFW_INDEX_MAX_BUCKETS		16
+#define NETFW_INDEX_MAX_CANDIDATES	64	// more rules to check, fall back to NetFw_BlockTraffic
+
+typedef struct _NETFW_PORT_SPAN
+{
+	USHORT RangeBegin;
+	USHORT RangeEnd;
+	USHORT MaxEnd;		// highest RangeEnd of this and all preceding spans
+	USHORT Reserved;
+	ULONG Rule;			// index into NETFW_INDEX::Rules
+} NETFW_PORT_SPAN;
+
+typedef struct _NETFW_IP_SPAN
+{
+	IP_ADDRESS RangeBegin;
+	IP_ADDRESS RangeEnd;
+	IP_ADDRESS MaxEnd;
+	ULONG Rule;
+} NETFW_IP_SPAN;
+
+typedef struct _NETFW_BUCKET
+{
+	int proc_match_level;
+	int protocol;
+
+	ULONG PortCount;
+	NETFW_PORT_SPAN* Ports;
+	ULONG IpCount;
+	NETFW_IP_SPAN* Ips;
+	ULONG AnyCount;
+	ULONG* Any;			// rules without ports and addresses
+} NETFW_BUCKET;
+
+struct _NETFW_INDEX
+{
+	POOL* pool;
+
+	void* Data;
+	ULONG DataSize;
+
+	ULONG RuleCount;
+	NETFW_RULE** Rules;	// in list order
+
+	ULONG BucketCount;
+	NETFW_BUCKET Buckets[NETFW_INDEX_MAX_BUCKETS]; // best proc_match_level first
+};
+
+static void* NetFw_IndexAlloc(POOL* pool, ULONG size)
+{
+#ifdef KERNEL_MODE
+#pragma warning(suppress: 4996) // suppress deprecation warning
+	return ExAllocatePoolWithTag(NonPagedPool, size, tzuk);
+#else
+	return Pool_Alloc(pool, size);
+#endif
+}
+
+static void NetFw_IndexFree(void* ptr, ULONG size)
+{
+#ifdef KERNEL_MODE
+	ExFreePoolWithTag(ptr, tzuk);
+#else
+	Pool_Free(ptr, size);
+#endif
+}
+
+static NETFW_BUCKET* NetFw_FindBucket(NETFW_INDEX* index, NETFW_RULE* rule)
+{
+	for (ULONG i = 0; i < index->BucketCount; i++) {
+		if (index->Buckets[i].proc_match_level == rule->proc_match_level && index->Buckets[i].protocol == rule->protocol)
+			return &index->Buckets[i];
+	}
+	return NULL;
+}
+
+static void NetFw_SortPortSpans(NETFW_PORT_SPAN* spans, ULONG count)
+{
+	for (ULONG gap = count / 2; gap > 0; gap /= 2) {
+		for (ULONG i = gap; i < count; i++) {
+			NETFW_PORT_SPAN tmp = spans[i];
+			ULONG j = i;
+			for (; j >= gap && NetFw_PortCmp(&spans[j - gap].RangeBegin, &tmp.RangeBegin) > 0; j -= gap)
+				spans[j] = spans[j - gap];
+			spans[j] = tmp;
+		}
+	}
+
+	for (ULONG i = 0; i < count; i++) {
+		spans[i].MaxEnd = spans[i].RangeEnd;
+		if (i > 0 && NetFw_PortCmp(&spans[i - 1].MaxEnd, &spans[i].MaxEnd) > 0)
+			spans[i].MaxEnd = spans[i - 1].MaxEnd;
+	}
+}
+
+static void NetFw_SortIpSpans(NETFW_IP_SPAN* spans, ULONG count)
+{
+	for (ULONG gap = count / 2; gap > 0; gap /= 2) {
+		for (ULONG i = gap; i < count; i++) {
+			NETFW_IP_SPAN tmp = spans[i];
+			ULONG j = i;
+			for (; j >= gap && NetFw_IpCmp(&spans[j - gap].RangeBegin, &tmp.RangeBegin) > 0; j -= gap)
+				spans[j] = spans[j - gap];
+			spans[j] = tmp;
+		}
+	}
+
+	for (ULONG i = 0; i < count; i++) {
+		spans[i].MaxEnd = spans[i].RangeEnd;
+		if (i > 0 && NetFw_IpCmp(&spans[i - 1].MaxEnd, &spans[i].MaxEnd) > 0)
+			spans[i].MaxEnd = spans[i - 1].MaxEnd;
+	}
+}
+
+NETFW_INDEX* NetFw_CompileRules(LIST* list, POOL* pool)
+{
+	if (list->count == 0)
+		return NULL;
+
+	NETFW_INDEX* index = NetFw_IndexAlloc(pool, sizeof(NETFW_INDEX));
+	if (index == NULL)
+		return NULL;
+	memzero(index, sizeof(NETFW_INDEX));
+	index->pool = pool;
+
+	//
+	// first pass, set up the buckets and count what goes into them
+	//
+
+	ULONG PortCount = 0, IpCount = 0, AnyCount = 0;
+
+	for (NETFW_RULE* rule = List_Head(list); rule; rule = List_Next(rule)) {
+
+		NETFW_BUCKET* bucket = NetFw_FindBucket(index, rule);
+		if (!bucket) {
+
+			if (index->BucketCount == NETFW_INDEX_MAX_BUCKETS)
+				goto fail;
+
+			ULONG pos = index->BucketCount++;
+			for (; pos > 0 && index->Buckets[pos - 1].proc_match_level < rule->proc_match_level; pos--)
+				index->Buckets[pos] = index->Buckets[pos - 1];
+
+			bucket = &index->Buckets[pos];
+			memzero(bucket, sizeof(NETFW_BUCKET));
+			bucket->proc_match_level = rule->proc_match_level;
+			bucket->protocol = rule->protocol;
+		}
+
+		if (rule->port_map.count != 0)
+			bucket->PortCount += (ULONG)rule->port_map.count;
+		else if (rule->ip_map.count != 0)
+			bucket->IpCount += (ULONG)rule->ip_map.count;
+		else
+			bucket->AnyCount++;
+
+		index->RuleCount++;
+	}
+
+	for (ULONG i = 0; i < index->BucketCount; i++) {
+		PortCount += index->Buckets[i].PortCount;
+		IpCount += index->Buckets[i].IpCount;
+		AnyCount += index->Buckets[i].AnyCount;
+	}
+
+	index->DataSize = index->RuleCount * sizeof(NETFW_RULE*)
+		+ IpCount * sizeof(NETFW_IP_SPAN) + PortCount * sizeof(NETFW_PORT_SPAN) + AnyCount * sizeof(ULONG);
+	index->Data = NetFw_IndexAlloc(pool, index->DataSize);
+	if (index->Data == NULL)
+		goto fail;
+
+	UCHAR* ptr = (UCHAR*)index->Data;
+	index->Rules = (NETFW_RULE**)ptr;
+	ptr += index->RuleCount * sizeof(NETFW_RULE*);
+	for (ULONG i = 0; i < index->BucketCount; i++) {
+		NETFW_BUCKET* bucket = &index->Buckets[i];
+		bucket->Ips = (NETFW_IP_SPAN*)ptr;
+		ptr += bucket->IpCount * sizeof(NETFW_IP_SPAN);
+		bucket->IpCount = 0;
+	}
+	for (ULONG i = 0; i < index->BucketCount; i++) {
+		NETFW_BUCKET* bucket = &index->Buckets[i];
+		bucket->Ports = (NETFW_PORT_SPAN*)ptr;
+		ptr += bucket->PortCount * sizeof(NETFW_PORT_SPAN);
+		bucket->PortCount = 0;
+		bucket->Any = (ULONG*)ptr;
+		ptr += bucket->AnyCount * sizeof(ULONG);
+		bucket->AnyCount = 0;
+	}
+
+	//
+	// second pass, fill in the rules and their ranges
+	//
+
+	ULONG i = 0;
+	for (NETFW_RULE* rule = List_Head(list); rule; rule = List_Next(rule), i++) {
+
+		NETFW_BUCKET* bucket = NetFw_FindBucket(index, rule);
+
+		index->Rules[i] = rule;
+
+		if (rule->port_map.count != 0) {
+			for (NETFW_PORTS* node = (NETFW_PORTS*)rbtree_first(&rule->port_map); ((rbnode_t*)node) != RBTREE_NULL; node = (NETFW_PORTS*)rbtree_next((rbnode_t*)node)) {
+				NETFW_PORT_SPAN* span = &bucket->Ports[bucket->PortCount++];
+				span->RangeBegin = node->RangeBegin;
+				span->RangeEnd = node->RangeEnd;
+				span->Rule = i;
+			}
+		}
+		else if (rule->ip_map.count != 0) {
+			for (NETFW_IPS* node = (NETFW_IPS*)rbtree_first(&rule->ip_map); ((rbnode_t*)node) != RBTREE_NULL; node = (NETFW_IPS*)rbtree_next((rbnode_t*)node)) {
+				NETFW_IP_SPAN* span = &bucket->Ips[bucket->IpCount++];
+				span->RangeBegin = node->RangeBegin;
+				span->RangeEnd = node->RangeEnd;
+				span->Rule = i;
+			}
+		}
+		else
+			bucket->Any[bucket->AnyCount++] = i;
+	}
+
+	for (ULONG j = 0; j < index->BucketCount; j++) {
+		NetFw_SortPortSpans(index->Buckets[j].Ports, index->Buckets[j].PortCount);
+		NetFw_SortIpSpans(index->Buckets[j].Ips, index->Buckets[j].IpCount);
+	}
+
+	return index;
+
+fail:
+	NetFw_FreeIndex(index);
+	return NULL;
+}
+
+void NetFw_FreeIndex(NETFW_INDEX* index)
+{
+	if (index->Data)
+		NetFw_IndexFree(index->Data, index->DataSize);
+	NetFw_IndexFree(index, sizeof(NETFW_INDEX));
+}
+
+static BOOLEAN NetFw_CollectCandidates(NETFW_BUCKET* bucket, IP_ADDRESS* Ip, USHORT Port, ULONG* Candidates, ULONG* Count)
+{
+	//
+	// collect all rules with a range which contains the port or address, the spans
+	// are sorted by begin, so starting with the last span which begins at or below
+	// the value, we go back until no preceding span reaches up to the value anymore
+	//
+
+	ULONG lo = 0, hi = bucket->PortCount;
+	while (lo < hi) {
+		ULONG mid = (lo + hi) / 2;
+		if (NetFw_PortCmp(&bucket->Ports[mid].RangeBegin, &Port) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	while (lo-- > 0 && NetFw_PortCmp(&bucket->Ports[lo].MaxEnd, &Port) >= 0) {
+		if (NetFw_PortCmp(&bucket->Ports[lo].RangeEnd, &Port) < 0)
+			continue;
+		if (*Count == NETFW_INDEX_MAX_CANDIDATES)
+			return FALSE;
+		Candidates[(*Count)++] = bucket->Ports[lo].Rule;
+	}
+
+	lo = 0;
+	hi = bucket->IpCount;
+	while (lo < hi) {
+		ULONG mid = (lo + hi) / 2;
+		if (NetFw_IpCmp(&bucket->Ips[mid].RangeBegin, Ip) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	while (lo-- > 0 && NetFw_IpCmp(&bucket->Ips[lo].MaxEnd, Ip) >= 0) {
+		if (NetFw_IpCmp(&bucket->Ips[lo].RangeEnd, Ip) < 0)
+			continue;
+		if (*Count == NETFW_INDEX_MAX_CANDIDATES)
+			return FALSE;
+		Candidates[(*Count)++] = bucket->Ips[lo].Rule;
+	}
+
+	for (ULONG i = 0; i < bucket->AnyCount; i++) {
+		if (*Count == NETFW_INDEX_MAX_CANDIDATES)
+			return FALSE;
+		Candidates[(*Count)++] = bucket->Any[i];
+	}
+
+	return TRUE;
+}
+
+BOOLEAN NetFw_BlockTrafficEx(NETFW_INDEX* index, LIST* list, IP_ADDRESS* Ip, USHORT Port, int Protocol)
+{
+	if (!index)
+		return NetFw_BlockTraffic(list, Ip, Port, Protocol);
+
+	ULONG Candidates[NETFW_INDEX_MAX_CANDIDATES];
+
+	for (ULONG i = 0; i < index->BucketCount; ) {
+
+		int level = index->Buckets[i].proc_match_level;
+		ULONG Count = 0;
+
+		for (; i < index->BucketCount && index->Buckets[i].proc_match_level == level; i++) {
+
+			NETFW_BUCKET* bucket = &index->Buckets[i];
+			if (!NetFw_MatchProtocol(bucket->protocol, Protocol))
+				continue;
+
+			if (!NetFw_CollectCandidates(bucket, Ip, Port, Candidates, &Count))
+				return NetFw_BlockTraffic(list, Ip, Port, Protocol);
+		}
+
+		//
+		// restore the list order, on a tie NetFw_BlockTraffic keeps the earlier rule,
+		// a rule with overlapping ranges may have been collected more than once
+		//
+
+		for (ULONG j = 1; j < Count; j++) {
+			ULONG tmp = Candidates[j];
+			ULONG k = j;
+			for (; k > 0 && Candidates[k - 1] > tmp; k--)
+				Candidates[k] = Candidates[k - 1];
+			Candidates[k] = tmp;
+		}
+
+		NETFW_RULE* best_rule = NULL;
+		RULE_MATCH best_match = { 0 };
+
+		for (ULONG j = 0; j < Count; j++) {
+
+			if (j > 0 && Candidates[j] == Candidates[j - 1])
+				continue;
+
+			NETFW_RULE* rule = index->Rules[Candidates[j]];
+
+			RULE_MATCH match = { 0 };
+			if (NetFw_MatchRule(rule, Port, Ip, Protocol, &match))
+			{
+				if (!best_rule || NetFw_IsBetterMatch(&match, &best_match)) {
+					best_rule = rule;
+					best_match = match;
+				}
+			}
+		}
+
+		if (best_rule)
+			return best_rule->action_block;
+	}
+
+	return FALSE;
+}
+
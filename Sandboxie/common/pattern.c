@@ -30,6 +30,10 @@
 //---------------------------------------------------------------------------
 
 
+typedef struct _PATTERN_TREE PATTERN_TREE;
+typedef struct _PATTERN_NODE PATTERN_NODE;
+
+
 struct _PATTERN {
 
     // unused list_elem can be used by caller
@@ -61,6 +65,10 @@ struct _PATTERN {
     // optional auxiliary data to be associated with this pattern
     PVOID aux;
 
+    // compiled prefix tree, set only on the head pattern of a list
+    // which was passed to Pattern_CompilePathList
+    PATTERN_TREE *tree;
+
     // array of pointers to constant parts.  the actual number of
     // elements is indicate by info.num_cons, and the strings are
     // allocated as part of this PATTERN object
@@ -74,6 +82,39 @@ struct _PATTERN {
 };
 
 
+struct _PATTERN_NODE {
+
+    // first child and next sibling in the prefix tree
+    PATTERN_NODE *child;
+    PATTERN_NODE *sibling;
+
+    // edge label, points into the first constant part of a pattern
+    const WCHAR *label;
+    ULONG label_len;
+
+    // list positions of the patterns whose constant prefix ends
+    // at this node, in ascending order
+    ULONG num_pats;
+    ULONG *pats;
+};
+
+
+struct _PATTERN_TREE {
+
+    // element count of the list at the time it was compiled
+    ULONG count;
+
+    // patterns in list order
+    PATTERN **pats;
+
+    // root node, holds patterns without a constant prefix
+    PATTERN_NODE root;
+};
+
+
+#define PATTERN_TREE_MAX_NODES 32
+
+
 //---------------------------------------------------------------------------
 // Functions
 //---------------------------------------------------------------------------
@@ -107,6 +148,19 @@ static const WCHAR *Pattern_wcsnstr(
 static const WCHAR *Pattern_wcsnstr_ex(
     const WCHAR *hstr, const WCHAR *nstr, int nlen, int no_bs);
 
+static const WCHAR *Pattern_Prefix(PATTERN *pat, ULONG *len);
+
+static PATTERN_NODE *Pattern_TreeInsert(
+    POOL *pool, PATTERN_NODE *node, const WCHAR *prefix, ULONG len);
+
+static BOOLEAN Pattern_MatchPathStep(
+    PATTERN *pat, WCHAR *path_lwr, ULONG path_len, int *pmatch_len,
+    ULONG *plevel, ULONG *pflags, USHORT *pwildc, PATTERN **found);
+
+static BOOLEAN Pattern_MatchPathTree(
+    PATTERN_TREE *tree, WCHAR *path_lwr, ULONG path_len, int *pmatch_len,
+    ULONG *plevel, ULONG *pflags, USHORT *pwildc, PATTERN **found);
+
 
 //---------------------------------------------------------------------------
 // Variables
@@ -253,6 +307,8 @@ _FX PATTERN *Pattern_Create(
 
     pat->aux = NULL;
 
+    pat->tree = NULL;
+
     pat->info.v = 0;
     pat->info.num_cons = (USHORT)num_cons;
 
@@ -665,6 +721,339 @@ _FX const WCHAR *Pattern_wcsnstr_ex(
 }
 
 
+//---------------------------------------------------------------------------
+// Pattern_Prefix
+//---------------------------------------------------------------------------
+
+
+_FX const WCHAR *Pattern_Prefix(PATTERN *pat, ULONG *len)
+{
+    const WCHAR *ptr;
+    const WCHAR *hex;
+    ULONG i;
+
+    //
+    // a pattern which does not begin with a star can only match strings
+    // that begin with its first constant part, up to the first question
+    // mark or __hex__ sequence
+    //
+
+    *len = 0;
+
+    if (pat->info.f.star_at_head || pat->info.num_cons == 0)
+        return NULL;
+
+    ptr = pat->cons[0].ptr;
+    for (i = 0; i < pat->cons[0].len; ++i) {
+        if (ptr[i] == L'?')
+            break;
+    }
+
+    if (pat->cons[0].hex) {
+        hex = Pattern_wcsnstr(ptr, Pattern_Hex, 5);
+        if (hex && (ULONG)(hex - ptr) < i)
+            i = (ULONG)(hex - ptr);
+    }
+
+    *len = i;
+    return ptr;
+}
+
+
+//---------------------------------------------------------------------------
+// Pattern_TreeInsert
+//---------------------------------------------------------------------------
+
+
+_FX PATTERN_NODE *Pattern_TreeInsert(
+    POOL *pool, PATTERN_NODE *node, const WCHAR *prefix, ULONG len)
+{
+    PATTERN_NODE **pchild;
+    PATTERN_NODE *child;
+    PATTERN_NODE *split;
+    ULONG i;
+
+    while (len) {
+
+        pchild = &node->child;
+        while (*pchild && (*pchild)->label[0] != *prefix)
+            pchild = &(*pchild)->sibling;
+        child = *pchild;
+
+        if (! child) {
+
+            child = (PATTERN_NODE*)Pool_Alloc(pool, sizeof(PATTERN_NODE));
+            if (! child)
+                return NULL;
+            memzero(child, sizeof(PATTERN_NODE));
+
+            child->label = prefix;
+            child->label_len = len;
+
+            *pchild = child;
+            return child;
+        }
+
+        for (i = 1; i < len && i < child->label_len; ++i) {
+            if (child->label[i] != prefix[i])
+                break;
+        }
+
+        //
+        // the prefix ends or diverges in the middle of the edge label,
+        // split the edge so that every prefix ends on a node boundary
+        //
+
+        if (i < child->label_len) {
+
+            split = (PATTERN_NODE*)Pool_Alloc(pool, sizeof(PATTERN_NODE));
+            if (! split)
+                return NULL;
+            memzero(split, sizeof(PATTERN_NODE));
+
+            split->label = child->label;
+            split->label_len = i;
+            split->child = child;
+            split->sibling = child->sibling;
+
+            child->sibling = NULL;
+            child->label += i;
+            child->label_len -= i;
+
+            *pchild = split;
+            child = split;
+        }
+
+        node = child;
+        prefix += i;
+        len -= i;
+    }
+
+    return node;
+}
+
+
+//---------------------------------------------------------------------------
+// Pattern_CompilePathList
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Pattern_CompilePathList(POOL *pool, LIST *list)
+{
+    PATTERN_TREE *tree;
+    PATTERN_NODE *node;
+    PATTERN *pat;
+    const WCHAR *prefix;
+    ULONG prefix_len;
+    ULONG count;
+    ULONG index;
+    ULONG pass;
+
+    pat = (PATTERN*)List_Head(list);
+    if (! pat)
+        return FALSE;
+
+    count = (ULONG)List_Count(list);
+
+    tree = (PATTERN_TREE*)Pool_Alloc(pool, sizeof(PATTERN_TREE));
+    if (! tree)
+        return FALSE;
+    memzero(tree, sizeof(PATTERN_TREE));
+
+    tree->count = count;
+    tree->pats = (PATTERN**)Pool_Alloc(pool, count * sizeof(PATTERN *));
+    if (! tree->pats)
+        return FALSE;
+
+    //
+    // the first pass builds the tree and counts the patterns which end
+    // at each node, the second pass allocates the per node arrays and
+    // records the list position of every pattern
+    //
+
+    for (pass = 0; pass < 2; ++pass) {
+
+        index = 0;
+        pat = (PATTERN*)List_Head(list);
+        while (pat && index < count) {
+
+            prefix = Pattern_Prefix(pat, &prefix_len);
+            node = Pattern_TreeInsert(pool, &tree->root, prefix, prefix_len);
+            if (! node)
+                return FALSE;
+
+            if (pass == 0)
+                ++node->num_pats;
+
+            else {
+
+                if (! node->pats) {
+                    node->pats = (ULONG*)Pool_Alloc(pool, node->num_pats * sizeof(ULONG));
+                    if (! node->pats)
+                        return FALSE;
+                    node->num_pats = 0;
+                }
+
+                node->pats[node->num_pats++] = index;
+                tree->pats[index] = pat;
+            }
+
+            ++index;
+            pat = (PATTERN*)List_Next(pat);
+        }
+    }
+
+    pat = (PATTERN*)List_Head(list);
+    pat->tree = tree;
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// Pattern_MatchPathStep
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Pattern_MatchPathStep(
+    PATTERN *pat, WCHAR *path_lwr, ULONG path_len, int *pmatch_len,
+    ULONG *plevel, ULONG *pflags, USHORT *pwildc, PATTERN **found)
+{
+    ULONG cur_level = Pattern_Level(pat);
+    if (cur_level > *plevel)
+        return FALSE; // no point testing patterns with a to weak level
+
+    BOOLEAN cur_exact = Pattern_Exact(pat);
+    if (!cur_exact && (*pflags & MATCH_FLAG_EXACT))
+        return FALSE;
+
+    USHORT cur_wildc = Pattern_Wildcards(pat);
+
+    int cur_len = Pattern_MatchX(pat, path_lwr, path_len);
+    if (cur_len > *pmatch_len) {
+        *pmatch_len = cur_len;
+        *plevel = cur_level;
+        *pflags = cur_exact ? MATCH_FLAG_EXACT : 0;
+        *pwildc = cur_wildc;
+        if (found) *found = pat;
+
+        // we need to test all entries to find the best match, so we don't break here
+        // unless we found an exact match, than there can't be a batter one
+        if (cur_exact)
+            return TRUE;
+    }
+
+    //
+    // if we have a pattern like C:\Windows\,
+    // we still want it to match a path like C:\Windows,
+    // hence we add a L'\\' to the path and check again
+    //
+
+    else if (path_lwr[path_len - 1] != L'\\') { 
+        path_lwr[path_len] = L'\\';
+        cur_len = Pattern_MatchX(pat, path_lwr, path_len + 1);
+        path_lwr[path_len] = L'\0';
+        if (cur_len > *pmatch_len) {
+            *pmatch_len = cur_len;
+            *plevel = cur_level;
+            *pflags = MATCH_FLAG_AUX | (cur_exact ? MATCH_FLAG_EXACT : 0);
+            *pwildc = cur_wildc;
+            if (found) *found = pat;
+        }
+    }
+
+    return FALSE;
+}
+
+
+//---------------------------------------------------------------------------
+// Pattern_MatchPathTree
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Pattern_MatchPathTree(
+    PATTERN_TREE *tree, WCHAR *path_lwr, ULONG path_len, int *pmatch_len,
+    ULONG *plevel, ULONG *pflags, USHORT *pwildc, PATTERN **found)
+{
+    PATTERN_NODE *nodes[PATTERN_TREE_MAX_NODES];
+    ULONG cursor[PATTERN_TREE_MAX_NODES];
+    PATTERN_NODE *node;
+    PATTERN_NODE *child;
+    ULONG num_nodes;
+    ULONG pos, len;
+    ULONG i, best;
+
+    //
+    // walk the tree along the path, including the backslash which
+    // Pattern_MatchPathStep may append, and collect every node that
+    // holds patterns.  all other patterns can not match this path
+    //
+
+    len = path_len;
+    if (path_lwr[path_len - 1] != L'\\') {
+        path_lwr[path_len] = L'\\';
+        ++len;
+    }
+
+    num_nodes = 0;
+    pos = 0;
+    node = &tree->root;
+
+    while (1) {
+
+        if (node->num_pats) {
+            if (num_nodes == PATTERN_TREE_MAX_NODES) {
+                path_lwr[path_len] = L'\0';
+                return FALSE;
+            }
+            cursor[num_nodes] = 0;
+            nodes[num_nodes++] = node;
+        }
+
+        if (pos == len)
+            break;
+
+        child = node->child;
+        while (child && child->label[0] != path_lwr[pos])
+            child = child->sibling;
+
+        if ((! child) || child->label_len > len - pos ||
+                wmemcmp(child->label, path_lwr + pos, child->label_len) != 0)
+            break;
+
+        pos += child->label_len;
+        node = child;
+    }
+
+    path_lwr[path_len] = L'\0';
+
+    //
+    // evaluate the candidates in their original list order, so the
+    // outcome is identical to a linear scan of the list
+    //
+
+    while (1) {
+
+        best = num_nodes;
+        for (i = 0; i < num_nodes; ++i) {
+            if (cursor[i] < nodes[i]->num_pats && (best == num_nodes ||
+                    nodes[i]->pats[cursor[i]] < nodes[best]->pats[cursor[best]]))
+                best = i;
+        }
+
+        if (best == num_nodes)
+            break;
+
+        i = nodes[best]->pats[cursor[best]++];
+        if (Pattern_MatchPathStep(tree->pats[i], path_lwr, path_len,
+                pmatch_len, plevel, pflags, pwildc, found))
+            break;
+    }
+
+    return TRUE;
+}
+
+
 //---------------------------------------------------------------------------
 // Pattern_MatchPathList
 //---------------------------------------------------------------------------
@@ -680,55 +1069,29 @@ _FX int Pattern_MatchPathList(
     USHORT wildc = pwildc ? *pwildc : -1; // lower is better
 
     pat = (PATTERN*)List_Head(list);
-    while (pat) {
-
-        ULONG cur_level = Pattern_Level(pat);
-        if (cur_level > level)
-            goto next; // no point testing patterns with a to weak level
 
-        BOOLEAN cur_exact = Pattern_Exact(pat);
-        if (!cur_exact && (flags & MATCH_FLAG_EXACT))
-            goto next;
-
-        USHORT cur_wildc = Pattern_Wildcards(pat);
+    //
+    // use the compiled prefix tree when the list has one and
+    // it was not modified since it was compiled
+    //
 
-        int cur_len = Pattern_MatchX(pat, path_lwr, path_len);
-        if (cur_len > match_len) {
-            match_len = cur_len;
-            level = cur_level;
-            flags = cur_exact ? MATCH_FLAG_EXACT : 0;
-            wildc = cur_wildc;
-            if (found) *found = pat;
-            
-            // we need to test all entries to find the best match, so we don't break here
-            // unless we found an exact match, than there can't be a batter one
-            if (cur_exact)
-                break;
-        }
+    if (pat && pat->tree && path_len &&
+            pat->tree->count == (ULONG)List_Count(list) &&
+            Pattern_MatchPathTree(pat->tree, path_lwr, path_len,
+                &match_len, &level, &flags, &wildc, found))
+        goto finish;
 
-        //
-        // if we have a pattern like C:\Windows\,
-        // we still want it to match a path like C:\Windows,
-        // hence we add a L'\\' to the path and check again
-        //
+    while (pat) {
 
-        else if (path_lwr[path_len - 1] != L'\\') { 
-            path_lwr[path_len] = L'\\';
-            cur_len = Pattern_MatchX(pat, path_lwr, path_len + 1);
-            path_lwr[path_len] = L'\0';
-            if (cur_len > match_len) {
-                match_len = cur_len;
-                level = cur_level;
-                flags = MATCH_FLAG_AUX | (cur_exact ? MATCH_FLAG_EXACT : 0);
-                wildc = cur_wildc;
-                if (found) *found = pat;
-            }
-        }
+        if (Pattern_MatchPathStep(pat, path_lwr, path_len,
+                &match_len, &level, &flags, &wildc, found))
+            break;
 
-    next:
         pat = (PATTERN*)List_Next(pat);
     }
 
+finish:
+
     if (plevel) *plevel = level;
     if (pflags) *pflags = flags;
     if (pwildc) *pwildc = wildc;
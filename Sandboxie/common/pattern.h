@@ -106,6 +106,17 @@ int Pattern_MatchX(PATTERN *pat, const WCHAR *string, int string_len);
 
 int Pattern_MatchPathList(
     WCHAR* path_lwr, ULONG path_len, LIST* list, ULONG* plevel, ULONG* pflags, USHORT* pwildc, PATTERN **found);
+
+//
+// Pattern_CompilePathList:  builds a prefix tree over the constant prefixes
+// of the patterns in 'list', allocated from 'pool'.  Pattern_MatchPathList
+// then only evaluates the patterns which can match a given path, in list
+// order, so the result is the same as for the uncompiled list.  The tree is
+// ignored once the element count of the list changes.
+//
+
+BOOLEAN Pattern_CompilePathList(POOL *pool, LIST *list);
+
 BOOLEAN Pattern_MatchPathListEx(
     WCHAR* path_lwr, ULONG path_len, LIST* list, ULONG* plevel, int* pmatch_len, ULONG* pflags, USHORT* pwildc, const WCHAR** patsrc);
 
@@ -1194,6 +1194,9 @@ typedef struct _THREAD_BASIC_INFORMATION {
 
 __declspec(dllimport) NTSTATUS __stdcall NtYieldExecution(void);
 
+__declspec(dllimport) NTSTATUS __stdcall NtQueryPerformanceCounter(
+    LARGE_INTEGER *PerformanceCounter, LARGE_INTEGER *PerformanceFrequency);
+
 //---------------------------------------------------------------------------
 
 typedef enum _KEY_INFORMATION_CLASS {
@@ -1874,6 +1877,14 @@ NtReplyWaitReceivePort(
     IN  PPORT_MESSAGE ReplyMessage OPTIONAL,
     OUT PPORT_MESSAGE ReceiveMessage);
 
+__declspec(dllimport) NTSTATUS __stdcall
+NtReplyWaitReceivePortEx(
+    IN  HANDLE PortHandle,
+    OUT PVOID *PortContext OPTIONAL,
+    IN  PPORT_MESSAGE ReplyMessage OPTIONAL,
+    OUT PPORT_MESSAGE ReceiveMessage,
+    IN  PLARGE_INTEGER Timeout OPTIONAL);
+
 __declspec(dllimport) NTSTATUS __stdcall
 NtImpersonateClientOfPort(
     IN  HANDLE PortHandle,
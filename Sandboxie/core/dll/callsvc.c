@@ -25,6 +25,7 @@
 #include "core/svc/QueueWire.h"
 #include "core/svc/SbieIniWire.h"
 #include "core/svc/ProcessWire.h"
+#include "core/svc/bulkwire.h"
 #include "common/my_version.h"
 
 
@@ -131,12 +132,130 @@ _FX NTSTATUS SbieDll_ConnectPort()
 #endif
 
         data->MaxDataLen -= data->SizeofPortMsg;
+
+        data->BulkDisabled = FALSE;
     }
 
     return STATUS_SUCCESS;
 }
 
 
+//---------------------------------------------------------------------------
+// SbieDll_FreeBulkView
+//---------------------------------------------------------------------------
+
+
+_FX void SbieDll_FreeBulkView(THREAD_DATA *data)
+{
+    if (data->BulkView) {
+        NtUnmapViewOfSection(NtCurrentProcess(), data->BulkView);
+        data->BulkView = NULL;
+    }
+
+    if (data->BulkSection) {
+        NtClose(data->BulkSection);
+        data->BulkSection = NULL;
+    }
+
+    data->BulkViewSize = 0;
+    data->BulkDisabled = FALSE;
+}
+
+
+//---------------------------------------------------------------------------
+// SbieDll_AttachBulkView
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN SbieDll_AttachBulkView(THREAD_DATA *data, ULONG length)
+{
+    PORT_BULK_ATTACH_REQ req;
+    MSG_HEADER *rpl;
+    NTSTATUS status;
+    LARGE_INTEGER size;
+    SIZE_T ViewSize;
+    HANDLE hSection;
+    void *pView;
+    ULONG view_size;
+
+    //
+    // attach a shared section to our service connection, so that large
+    // requests and replies can be passed in a single round-trip rather
+    // than in many short LPC chunks.  see also core/svc/bulkwire.h
+    //
+
+    if (data->BulkDisabled)
+        return FALSE;
+
+    if (data->BulkView && length <= data->BulkViewSize)
+        return TRUE;
+
+    view_size = PortBulk_ViewSize(length);
+    if (! view_size)
+        return FALSE;
+
+    hSection = NULL;
+    pView = NULL;
+
+    size.QuadPart = view_size;
+    status = NtCreateSection(&hSection,
+                SECTION_QUERY | SECTION_MAP_WRITE | SECTION_MAP_READ,
+                NULL, &size, PAGE_READWRITE, SEC_COMMIT, NULL);
+
+    if (NT_SUCCESS(status)) {
+
+        const ULONG xViewUnmap = 2;
+
+        ViewSize = view_size;
+        status = NtMapViewOfSection(
+            hSection, NtCurrentProcess(), &pView, 0, 0,
+            NULL, &ViewSize, xViewUnmap, 0, PAGE_READWRITE);
+    }
+
+    if (NT_SUCCESS(status)) {
+
+        req.h.length = sizeof(PORT_BULK_ATTACH_REQ);
+        req.h.msgid = MSGID_PORT_BULK_ATTACH;
+        req.view_size = view_size;
+        req.section_handle = (ULONG64)(ULONG_PTR)hSection;
+
+        rpl = SbieDll_CallServer(&req.h);
+        if (! rpl)
+            status = STATUS_SERVER_DISABLED;
+        else {
+            status = rpl->status;
+            Dll_Free(rpl);
+        }
+    }
+
+    //
+    // the service drops any previously attached section when it gets
+    // the request, so drop ours too.  if the service does not support
+    // sections (STATUS_INVALID_SYSTEM_SERVICE) or rejected this one,
+    // don't try again for the rest of this connection
+    //
+
+    SbieDll_FreeBulkView(data);
+
+    if (! NT_SUCCESS(status)) {
+
+        if (pView)
+            NtUnmapViewOfSection(NtCurrentProcess(), pView);
+        if (hSection)
+            NtClose(hSection);
+
+        data->BulkDisabled = TRUE;
+        return FALSE;
+    }
+
+    data->BulkSection = hSection;
+    data->BulkView = (UCHAR *)pView;
+    data->BulkViewSize = view_size;
+
+    return TRUE;
+}
+
+
 //---------------------------------------------------------------------------
 // SbieDll_CallServer
 //---------------------------------------------------------------------------
@@ -152,8 +271,9 @@ _FX MSG_HEADER *SbieDll_CallServer(MSG_HEADER *req)
     UCHAR spaceReq[MAX_PORTMSG_LENGTH], spaceRpl[MAX_PORTMSG_LENGTH];
     NTSTATUS status;
     PORT_MESSAGE *msg;
-    UCHAR *buf, *msg_data;
-    ULONG buf_len, send_len;
+    UCHAR *view, *msg_data;
+    ULONG buf_len, send_len, offset, received;
+    BOOLEAN in_view, first;
     MSG_HEADER *rpl;
 
     if (Dll_SbieTrace) {
@@ -226,32 +346,36 @@ _FX MSG_HEADER *SbieDll_CallServer(MSG_HEADER *req)
 
     //
     // transmit the request message on the port.  LPC ports are designed
-    // for short messages so we have to break the message into chunks.
+    // for short messages so we have to break the message into chunks,
+    // unless the message can be placed in the attached shared section,
+    // in which case we only send its header
     //
 
+    view = NULL;
+
+    if (req->length > PORT_BULK_MIN_LENGTH &&
+            SbieDll_AttachBulkView(data, req->length))
+        view = data->BulkView;
+
     curr_sequence = (UCHAR) InterlockedIncrement(&last_sequence);
 
-    buf = (UCHAR *)req;
-    buf_len = req->length;
+    offset = 0;
 
-    while (buf_len) {
+    while (offset < req->length) {
 
         msg = (PORT_MESSAGE *)spaceReq;
 
         memzero(msg, data->SizeofPortMsg);
         msg_data = (UCHAR *)msg + data->SizeofPortMsg;
 
-        if (buf_len > data->MaxDataLen)
-            send_len = data->MaxDataLen;
-        else
-            send_len = buf_len;
+        first = (offset == 0);
+        send_len = PortBulk_Send(req, &offset, msg_data, data->MaxDataLen,
+                                 view, data->BulkViewSize, NULL);
 
         msg->u1.s1.DataLength = (USHORT)send_len;
         msg->u1.s1.TotalLength = (USHORT)(data->SizeofPortMsg + send_len);
 
-        memcpy(msg_data, buf, send_len);
-
-        if (buf == (UCHAR *)req) {
+        if (first) {
 
             //
             // a service message must be shorter than 0x00FFFFFF bytes
@@ -263,9 +387,6 @@ _FX MSG_HEADER *SbieDll_CallServer(MSG_HEADER *req)
             msg_data[3] = curr_sequence;
         }
 
-        buf += send_len;
-        buf_len -= send_len;
-
         //
         // send the chunk on the LPC port and wait for acknowledgement.
         // while the service is collecting the incoming chunks on its end,
@@ -281,7 +402,7 @@ _FX MSG_HEADER *SbieDll_CallServer(MSG_HEADER *req)
 
         msg = (PORT_MESSAGE *)spaceRpl;
 
-        if (buf_len && msg->u1.s1.DataLength) {
+        if (offset < req->length && msg->u1.s1.DataLength) {
             SbieApi_Log(2203, L"early reply");
             return NULL;
         }
@@ -291,6 +412,7 @@ _FX MSG_HEADER *SbieDll_CallServer(MSG_HEADER *req)
 
         NtClose(data->PortHandle);
         data->PortHandle = NULL;
+        SbieDll_FreeBulkView(data);
 
         SbieApi_Log(2203, L"request %08X", status);
         return NULL;
@@ -305,6 +427,8 @@ _FX MSG_HEADER *SbieDll_CallServer(MSG_HEADER *req)
 
     msg_data = ((UCHAR *)msg + data->SizeofPortMsg);
 
+    buf_len = 0;
+
     if (msg->u1.s1.DataLength >= sizeof(MSG_HEADER)) {
 
         if (msg_data[3] != curr_sequence) {
@@ -313,10 +437,9 @@ _FX MSG_HEADER *SbieDll_CallServer(MSG_HEADER *req)
         }
 
         msg_data[3] = 0;
-        buf_len = ((MSG_HEADER *)msg_data)->length;
-
-    } else
-        buf_len = 0;
+        buf_len = PortBulk_Accept(msg_data, msg->u1.s1.DataLength,
+                        data->BulkView ? data->BulkViewSize : 0, &in_view);
+    }
 
     if (buf_len == 0) {
         SbieApi_Log(2203, L"null reply (msg %08X len %d)",
@@ -324,28 +447,38 @@ _FX MSG_HEADER *SbieDll_CallServer(MSG_HEADER *req)
         return NULL;
     }
 
+    rpl = Dll_AllocTemp(buf_len + 8);
+
+    //
+    // a reply which consists only of its header was placed in the
+    // attached shared section
+    //
+
+    if (in_view) {
+
+        PortBulk_ReadView(rpl, data->BulkView, msg_data, NULL);
+        memzero((UCHAR *)rpl + buf_len, 8);
+        return rpl;
+    }
+
     //
     // collect the chunks of the response message.  we have to keep sending
     // short dummy LPC chunks on the port in order to receive the next chunk
     // of the response
     //
 
-    rpl = Dll_AllocTemp(buf_len + 8);
-    buf = (UCHAR *)rpl;
+    received = 0;
 
     while (1) {
 
-        ULONG buf_len_plus_msg = (ULONG)(ULONG_PTR)(buf - (UCHAR *)rpl)
-                               + msg->u1.s1.DataLength;
-        if (buf_len_plus_msg > buf_len)
+        msg_data = ((UCHAR *)msg + data->SizeofPortMsg);
+
+        if (! PortBulk_Append(rpl, buf_len, &received,
+                              msg_data, msg->u1.s1.DataLength))
             status = STATUS_PORT_MESSAGE_TOO_LONG;
         else {
 
-            msg_data = ((UCHAR *)msg + data->SizeofPortMsg);
-            memcpy(buf, msg_data, msg->u1.s1.DataLength);
-
-            buf += msg->u1.s1.DataLength;
-            if ((ULONG_PTR)(buf - (UCHAR *)rpl) >= buf_len)
+            if (received >= buf_len)
                 break;
 
             msg = (PORT_MESSAGE *)spaceReq;
@@ -365,13 +498,23 @@ _FX MSG_HEADER *SbieDll_CallServer(MSG_HEADER *req)
 
             NtClose(data->PortHandle);
             data->PortHandle = NULL;
+            SbieDll_FreeBulkView(data);
 
             SbieApi_Log(2203, L"reply %08X", status);
             return NULL;
         }
     }
 
-    memzero(buf, 8);
+    memzero((UCHAR *)rpl + buf_len, 8);
+
+    //
+    // a large reply had to be collected in chunks, attach a shared
+    // section so the next one can be passed in a single round-trip
+    //
+
+    if (buf_len > PORT_BULK_MIN_LENGTH)
+        SbieDll_AttachBulkView(data, buf_len);
+
     return rpl;
 }
 
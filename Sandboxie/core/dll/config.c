@@ -24,13 +24,46 @@
 #include "dll.h"
 #include "common/pool.h"
 #include "common/pattern.h"
+#include "common/map.h"
 #include "core/svc/SbieIniWire.h"
+#include "core/drv/api_defs.h"
+#include "core/drv/conf_values.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define CONFIG_SNAPSHOT_FLAGS   (CONF_GET_NO_GLOBAL | CONF_GET_NO_EXPAND | CONF_GET_NO_TEMPLS)
+
+#define CONFIG_SNAPSHOT_TTL     1000    // ms between generation checks
+
+#define CONFIG_SNAPSHOT_UNCACHED ((ULONG)-1)
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _CONFIG_SNAPSHOT_ENTRY {
+
+    ULONG count;            // or CONFIG_SNAPSHOT_UNCACHED
+    WCHAR **values;         // follows the entry, then the string data
+
+} CONFIG_SNAPSHOT_ENTRY;
+
 
 //---------------------------------------------------------------------------
 // Functions
 //---------------------------------------------------------------------------
 
 
+static CONFIG_SNAPSHOT_ENTRY *Config_FetchSnapshotEntry(
+    const WCHAR *section_name, const WCHAR *setting_name, ULONG flags,
+    ULONG *conf_gen);
+
 
 //---------------------------------------------------------------------------
 // Variables
@@ -39,6 +72,12 @@
 extern POOL* Dll_Pool;
 extern POOL* Dll_PoolTemp;
 
+static BOOLEAN Config_SnapshotReady = FALSE;
+static HASH_MAP Config_SnapshotMap;
+static CRITICAL_SECTION Config_SnapshotCritSec;
+static ULONG Config_SnapshotGeneration = 0;
+static ULONG Config_SnapshotChecked = 0;
+
 //---------------------------------------------------------------------------
 // Config_MatchImage
 //---------------------------------------------------------------------------
@@ -703,4 +742,280 @@ finish:
 
     Config_FreePatternList(&Patterns);
     return ret;
-}
\ No newline at end of file
+}
+
+
+//---------------------------------------------------------------------------
+// Config_InitSnapshot
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Config_InitSnapshot(void)
+{
+    //
+    // sandboxed processes keep a snapshot of the values of every setting
+    // they have queried so far, indexed by section, setting and flags.
+    // each setting is fetched from the driver in one request with all its
+    // values, so that enumerating a list no longer costs one request per
+    // value, and repeated lookups are answered without any request
+    //
+
+    InitializeCriticalSection(&Config_SnapshotCritSec);
+    map_init(&Config_SnapshotMap, Dll_Pool);
+    Config_SnapshotMap.func_key_size = map_wcssize;
+
+    Config_SnapshotReady = TRUE;
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// Config_FlushSnapshot
+//---------------------------------------------------------------------------
+
+
+_FX void Config_FlushSnapshot(void)
+{
+    map_iter_t iter;
+
+    if (! Config_SnapshotReady)
+        return;
+
+    EnterCriticalSection(&Config_SnapshotCritSec);
+
+    iter = map_iter();
+    while (map_next(&Config_SnapshotMap, &iter))
+        Dll_Free(iter.value);
+    map_clear(&Config_SnapshotMap);
+
+    LeaveCriticalSection(&Config_SnapshotCritSec);
+}
+
+
+//---------------------------------------------------------------------------
+// Config_FetchSnapshotEntry
+//---------------------------------------------------------------------------
+
+
+_FX CONFIG_SNAPSHOT_ENTRY *Config_FetchSnapshotEntry(
+    const WCHAR *section_name, const WCHAR *setting_name, ULONG flags,
+    ULONG *conf_gen)
+{
+    NTSTATUS status;
+    __declspec(align(8)) UNICODE_STRING64 Output;
+    __declspec(align(8)) ULONG64 parms[API_NUM_ARGS];
+    WCHAR x_section[66];
+    WCHAR x_setting[66];
+    ULONG index;
+    ULONG buf_len;
+    UCHAR *buf;
+    CONFIG_SNAPSHOT_ENTRY *entry;
+    ULONG count, data_len, size;
+
+    memzero(x_section, sizeof(x_section));
+    memzero(x_setting, sizeof(x_setting));
+    wcsncpy(x_section, section_name, 64);
+    wcsncpy(x_setting, setting_name, 64);
+
+    //
+    // most settings fit into a small buffer, only retry with the largest
+    // buffer the driver can fill when it reports the buffer is too small
+    //
+
+    buf_len = 2048;
+
+    while (1) {
+
+        buf = Dll_AllocTemp(buf_len);
+        if (! buf)
+            return NULL;
+
+        index = CONF_GET_ALL | flags;
+
+        Output.Length        = 0;
+        Output.MaximumLength = (USHORT)buf_len;
+        Output.Buffer        = (ULONG64)(ULONG_PTR)buf;
+
+        memset(parms, 0, sizeof(parms));
+        parms[0] = API_QUERY_CONF;
+        parms[1] = (ULONG64)(ULONG_PTR)x_section;
+        parms[2] = (ULONG64)(ULONG_PTR)x_setting;
+        parms[3] = (ULONG64)(ULONG_PTR)&index;
+        parms[4] = (ULONG64)(ULONG_PTR)&Output;
+        parms[5] = (ULONG64)(ULONG_PTR)conf_gen;
+        status = SbieApi_Ioctl(parms);
+
+        if (status != STATUS_BUFFER_TOO_SMALL || buf_len == 0xFFFE)
+            break;
+
+        Dll_Free(buf);
+        buf_len = 0xFFFE;
+    }
+
+    entry = NULL;
+
+    if (status == STATUS_BUFFER_TOO_SMALL) {
+
+        //
+        // remember the setting has too many values to be fetched at once,
+        // so its values are queried one by one from the driver
+        //
+
+        entry = Dll_Alloc(sizeof(CONFIG_SNAPSHOT_ENTRY));
+        if (entry) {
+            entry->count = CONFIG_SNAPSHOT_UNCACHED;
+            entry->values = NULL;
+        }
+
+    } else if (NT_SUCCESS(status)) {
+
+        //
+        // the buffer holds the number of values followed by the values
+        // as null terminated strings, keep it as a single allocation
+        // with an array of pointers for direct access by index.  the
+        // driver reports a length without the trailing WCHAR
+        //
+
+        data_len = Output.Length + sizeof(WCHAR);
+
+        if (ConfValues_UnpackSize(buf, data_len, &count, &size))
+            entry = Dll_Alloc(sizeof(CONFIG_SNAPSHOT_ENTRY) + size);
+        if (entry) {
+
+            entry->count = count;
+            entry->values = (WCHAR **)(entry + 1);
+
+            if (! ConfValues_UnpackCopy(entry->values, buf, data_len)) {
+                Dll_Free(entry);
+                entry = NULL;
+            }
+        }
+    }
+
+    Dll_Free(buf);
+
+    return entry;
+}
+
+
+//---------------------------------------------------------------------------
+// Config_QuerySnapshot
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Config_QuerySnapshot(
+    const WCHAR *section_name, const WCHAR *setting_name,
+    ULONG setting_index, WCHAR *out_buffer, ULONG buffer_len,
+    LONG *status)
+{
+    WCHAR key[8 + 64 + 1 + 64 + 1];
+    CONFIG_SNAPSHOT_ENTRY *entry, *old_entry;
+    ULONG flags, index, now, conf_gen;
+    ULONG len;
+    BOOLEAN handled;
+
+    //
+    // only plain value lookups are answered from the snapshot,
+    // enumerations, properties and expand requests go to the driver
+    //
+
+    if (! Config_SnapshotReady)
+        return FALSE;
+
+    flags = setting_index & CONF_FLAG_MASK;
+    index = setting_index & CONF_INDEX_MASK;
+
+    if ((flags & ~CONFIG_SNAPSHOT_FLAGS) != 0 || index > CONF_MAX_LINES)
+        return FALSE;
+
+    if (! section_name || ! *section_name)
+        section_name = Dll_BoxName;
+    if (! setting_name || ! *setting_name)
+        return FALSE;
+    if (wcslen(section_name) > 64 || wcslen(setting_name) > 64)
+        return FALSE;
+
+    Sbie_snwprintf(key, ARRAYSIZE(key), L"%08X%s\\%s", flags, section_name, setting_name);
+    _wcslwr(key);
+
+    now = GetTickCount();
+
+    EnterCriticalSection(&Config_SnapshotCritSec);
+
+    //
+    // the snapshot is versioned by the configuration generation, once
+    // the last check is older than the TTL the next lookup refreshes
+    // its entry from the driver, which also revalidates the generation
+    //
+
+    if (now - Config_SnapshotChecked < CONFIG_SNAPSHOT_TTL)
+        entry = map_get(&Config_SnapshotMap, key);
+    else
+        entry = NULL;
+
+    if (! entry) {
+
+        LeaveCriticalSection(&Config_SnapshotCritSec);
+
+        entry = Config_FetchSnapshotEntry(section_name, setting_name, flags, &conf_gen);
+        if (! entry)
+            return FALSE;
+
+        EnterCriticalSection(&Config_SnapshotCritSec);
+
+        if (conf_gen != Config_SnapshotGeneration) {
+
+            map_iter_t iter = map_iter();
+            while (map_next(&Config_SnapshotMap, &iter))
+                Dll_Free(iter.value);
+            map_clear(&Config_SnapshotMap);
+
+            Config_SnapshotGeneration = conf_gen;
+        }
+
+        Config_SnapshotChecked = now;
+
+        old_entry = map_get(&Config_SnapshotMap, key);
+        if (old_entry) {
+            Dll_Free(entry);
+            entry = old_entry;
+        } else if (! map_insert(&Config_SnapshotMap, key, entry, 0)) {
+            LeaveCriticalSection(&Config_SnapshotCritSec);
+            Dll_Free(entry);
+            return FALSE;
+        }
+    }
+
+    //
+    // return the value the same way SbieApi_QueryConf would
+    //
+
+    handled = TRUE;
+
+    if (entry->count == CONFIG_SNAPSHOT_UNCACHED)
+        handled = FALSE;
+
+    else if (index >= entry->count)
+        *status = STATUS_RESOURCE_NAME_NOT_FOUND;
+
+    else {
+
+        len = (wcslen(entry->values[index]) + 1) * sizeof(WCHAR);
+        if (len > (USHORT)buffer_len)
+            *status = STATUS_BUFFER_TOO_SMALL;
+        else {
+            memcpy(out_buffer, entry->values[index], len);
+            *status = STATUS_SUCCESS;
+        }
+    }
+
+    LeaveCriticalSection(&Config_SnapshotCritSec);
+
+    if (handled && ! NT_SUCCESS(*status)) {
+        if (buffer_len > sizeof(WCHAR))
+            out_buffer[0] = L'\0';
+    }
+
+    return handled;
+}
@@ -231,6 +231,10 @@ typedef struct _THREAD_DATA {
     HANDLE          PortHandle;
     ULONG           MaxDataLen;
     ULONG           SizeofPortMsg;
+    HANDLE          BulkSection;
+    UCHAR          *BulkView;
+    ULONG           BulkViewSize;
+    BOOLEAN         BulkDisabled;
     BOOLEAN         bOperaFileDlgThread;
 
     //
@@ -410,6 +414,24 @@ void SbieDll_ReleaseFilePathLock();
 BOOLEAN SbieDll_HasReadableSubPath(WCHAR path_code, const WCHAR* TruePath);
 
 
+//---------------------------------------------------------------------------
+// Functions (callsvc)
+//---------------------------------------------------------------------------
+
+
+void SbieDll_FreeBulkView(THREAD_DATA *data);
+
+
+//---------------------------------------------------------------------------
+// Functions (sbieapi)
+//---------------------------------------------------------------------------
+
+
+void SbieApi_MonitorBatchInit(void);
+
+void SbieApi_MonitorFlush(BOOLEAN AtExit);
+
+
 //---------------------------------------------------------------------------
 // Functions (dllmain)
 //---------------------------------------------------------------------------
@@ -831,6 +853,15 @@ BOOLEAN Config_String2Bool(const WCHAR* value, BOOLEAN defval);
 
 BOOLEAN Config_GetSettingsForImageName_bool(const WCHAR* setting, BOOLEAN defval);
 
+BOOLEAN Config_InitSnapshot(void);
+
+void Config_FlushSnapshot(void);
+
+BOOLEAN Config_QuerySnapshot(
+    const WCHAR *section_name, const WCHAR *setting_name,
+    ULONG setting_index, WCHAR *out_buffer, ULONG buffer_len,
+    LONG *status);
+
 //---------------------------------------------------------------------------
 
 
@@ -209,6 +209,8 @@ _FX BOOL WINAPI DllMain(
             Gui_ResetClipCursor();
         }
 
+        SbieApi_MonitorFlush(TRUE);
+
         if(!SbieApi_data && SbieApi_DeviceHandle != INVALID_HANDLE_VALUE)
             NtClose(SbieApi_DeviceHandle);
     }
@@ -306,6 +308,10 @@ _FX void Dll_InitInjected(void)
 
     Trace_Init();
 
+    SbieApi_MonitorBatchInit();
+
+    Config_InitSnapshot();
+
     //
     // query Sandboxie home folder
     //
@@ -297,6 +297,8 @@ _FX void Dll_FreeTlsData(void)
         data->PortHandle = NULL;
 	}
 
+    SbieDll_FreeBulkView(data);
+
     TlsSetValue(Dll_TlsIndex, NULL);
 
     for (depth = 0; depth < NAME_BUFFER_DEPTH; ++depth) {
@@ -253,6 +253,14 @@ _FX BOOLEAN Dll_InitPathList3(POOL *pool, ULONG path_code, LIST *list)
         ptr += wcslen(ptr) + 1;
     }
 
+    //
+    // compile the list into a prefix tree, on failure the
+    // list is simply scanned linearly by Pattern_MatchPathList
+    //
+
+    if (ok)
+        Pattern_CompilePathList(pool, list);
+
     Dll_Free(path);
     return ok;
 }
@@ -27,6 +27,15 @@
 
 #define FILE_PATH_FILE_NAME     L"FilePaths.dat"
 
+// FilePaths.dat journal header, "#journal <generation> <base size>\r\n",
+// the line has no '|' so it is skipped by all path file parsers
+#define FILE_PATH_HEADER        L"#journal "
+#define FILE_PATH_HEADER_LEN    9
+#define FILE_PATH_HEADER_SIZE   (28 * sizeof(WCHAR))
+
+// journal size, in bytes, from which records are folded into a new snapshot
+#define FILE_PATH_JOURNAL_MIN   0x10000
+
 // path flags, saved to file
 #define FILE_DELETED_FLAG       0x0001
 #define FILE_RELOCATION_FLAG    0x0002
@@ -39,6 +48,9 @@
 #define FILE_DELETED_MASK   (FILE_DELETED_FLAG | FILE_PATH_DELETED_FLAG) 
 #define FILE_RELOCATED_MASK (FILE_RELOCATION_FLAG | FILE_PATH_RELOCATED_FLAG) 
 
+// child count from which a node keeps a hash index over its items
+#define FILE_PATH_MAP_MIN       16
+
 #define FILE_IS_DELETED(x)      ((x & FILE_DELETED_FLAG) != 0)
 #define FILE_PATH_DELETED(x)    ((x & FILE_DELETED_MASK) != 0)
 #define FILE_PARENT_DELETED(x)  ((x & FILE_PATH_DELETED_FLAG) != 0)
@@ -51,6 +63,10 @@
 typedef struct _PATH_NODE {
     LIST_ELEM list_elem;
     LIST items;
+    struct _PATH_NODE** items_map;  // hash index over items, in list order
+    ULONG items_map_size;
+    struct _PATH_NODE* map_next;    // next node in the parent's bucket
+    ULONG name_hash;
     ULONG flags;
     WCHAR* relocation;
     ULONG name_len;
@@ -58,6 +74,13 @@ typedef struct _PATH_NODE {
 } PATH_NODE;
 
 
+typedef struct _PATH_JOURNAL {
+    ULONG Generation;               // from the file header, 0 if none
+    ULONG BaseSize;                 // size of the compacted part, in bytes
+    ULONG Offset;                   // bytes applied to the in memory tree
+} PATH_JOURNAL;
+
+
 //---------------------------------------------------------------------------
 // Variables
 //---------------------------------------------------------------------------
@@ -73,15 +96,26 @@ static ULONG File_BoxRootChangeBits = 0;
 
 static ULONG64 File_PathsFileSize = 0;
 static ULONG64 File_PathsFileDate = 0;
+static PATH_JOURNAL File_PathsJournal = { 0 };
 
 //---------------------------------------------------------------------------
 // Functions
 //---------------------------------------------------------------------------
 
+VOID File_ClearPathBranche_internal(LIST* parent);
+static VOID File_FreePathNode_internal(PATH_NODE* node);
+static VOID File_InsertPathNode_internal(PATH_NODE* owner, LIST* parent, PATH_NODE* child);
+static VOID File_RemovePathNode_internal(PATH_NODE* owner, LIST* parent, PATH_NODE* child);
+
 static ULONG File_GetPathFlags(const WCHAR* Path, WCHAR** pRelocation);
 static BOOLEAN File_SavePathTree();
 static BOOLEAN File_LoadPathTree();
 static VOID File_RefreshPathTree();
+static VOID File_SyncPathTree();
+static BOOLEAN File_AppendPathJournal(const WCHAR* DatPath, ULONG SetFlags);
+BOOLEAN File_MarkDeleted_internal(LIST* Root, const WCHAR* Path, BOOLEAN* pTruncated);
+static VOID File_SavePathTreeEx_internal(LIST* Root, const WCHAR* name, WCHAR* (*TranslatePath)(const WCHAR *), PATH_JOURNAL* Journal);
+static BOOLEAN File_LoadPathTreeEx_internal(LIST* Root, const WCHAR* name, WCHAR* (*TranslatePath)(const WCHAR *), PATH_JOURNAL* Journal);
 BOOLEAN File_InitDelete_v2();
 
 static NTSTATUS File_MarkDeleted_v2(const WCHAR *TruePath);
@@ -99,6 +133,21 @@ HANDLE File_AcquireMutex(const WCHAR* MutexName);
 void File_ReleaseMutex(HANDLE hMutex);
 #define FILE_VFS_MUTEX SBIE L"_VFS_Mutex"
 
+//---------------------------------------------------------------------------
+// File_FreePathNode_internal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_FreePathNode_internal(PATH_NODE* node)
+{
+    File_ClearPathBranche_internal(&node->items);
+
+    if (node->items_map) Dll_Free(node->items_map);
+    if (node->relocation) Dll_Free(node->relocation);
+    Dll_Free(node);
+}
+
+
 //---------------------------------------------------------------------------
 // File_ClearPathBranche
 //---------------------------------------------------------------------------
@@ -111,33 +160,153 @@ _FX VOID File_ClearPathBranche_internal(LIST* parent)
 
         PATH_NODE* next_child = List_Next(child);
 
-        File_ClearPathBranche_internal(&child->items);
-
         List_Remove(parent, child);
-        if(child->relocation) Dll_Free(child->relocation);
-        Dll_Free(child);
+        File_FreePathNode_internal(child);
 
         child = next_child;
     }
 }
 
 
+//---------------------------------------------------------------------------
+// File_HashPathName_internal
+//---------------------------------------------------------------------------
+
+
+_FX ULONG File_HashPathName_internal(const WCHAR* name, ULONG name_len)
+{
+    ULONG hash = 5381;
+    for (ULONG i = 0; i < name_len; i++)
+        hash = ((hash << 5) + hash) ^ towlower(name[i]);
+    return hash;
+}
+
+
+//---------------------------------------------------------------------------
+// File_GetPathOwner_internal
+//---------------------------------------------------------------------------
+
+
+_FX PATH_NODE* File_GetPathOwner_internal(LIST* Root, LIST* parent)
+{
+    //
+    // the root list is a plain LIST, which has no hash index,
+    // all other lists are the items member of a PATH_NODE
+    //
+
+    if (parent == Root)
+        return NULL;
+    return CONTAINING_RECORD(parent, PATH_NODE, items);
+}
+
+
+//---------------------------------------------------------------------------
+// File_MapPathNode_internal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_MapPathNode_internal(PATH_NODE* owner, PATH_NODE* child)
+{
+    //
+    // append to the end of the bucket, so a lookup returns the same
+    // node as a scan of the items list would, even for duplicates
+    //
+
+    PATH_NODE** pnext = &owner->items_map[child->name_hash & (owner->items_map_size - 1)];
+    while (*pnext)
+        pnext = &(*pnext)->map_next;
+    child->map_next = NULL;
+    *pnext = child;
+}
+
+
+//---------------------------------------------------------------------------
+// File_InsertPathNode_internal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_InsertPathNode_internal(PATH_NODE* owner, LIST* parent, PATH_NODE* child)
+{
+    List_Insert_After(parent, NULL, child);
+
+    if (!owner || parent->count < FILE_PATH_MAP_MIN)
+        return;
+
+    if ((ULONG)parent->count > owner->items_map_size) {
+
+        //
+        // (re)build the index with twice the capacity, by walking
+        // the items list the order within each bucket is preserved
+        //
+
+        ULONG map_size = owner->items_map_size ? owner->items_map_size * 2 : FILE_PATH_MAP_MIN * 2;
+        PATH_NODE** map = Dll_Alloc(map_size * sizeof(PATH_NODE*));
+        memzero(map, map_size * sizeof(PATH_NODE*));
+
+        if (owner->items_map) Dll_Free(owner->items_map);
+        owner->items_map = map;
+        owner->items_map_size = map_size;
+
+        for (PATH_NODE* node = List_Head(parent); node; node = List_Next(node))
+            File_MapPathNode_internal(owner, node);
+    }
+    else
+        File_MapPathNode_internal(owner, child);
+}
+
+
+//---------------------------------------------------------------------------
+// File_RemovePathNode_internal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_RemovePathNode_internal(PATH_NODE* owner, LIST* parent, PATH_NODE* child)
+{
+    List_Remove(parent, child);
+
+    if (owner && owner->items_map) {
+
+        PATH_NODE** pnext = &owner->items_map[child->name_hash & (owner->items_map_size - 1)];
+        while (*pnext && *pnext != child)
+            pnext = &(*pnext)->map_next;
+        if (*pnext)
+            *pnext = child->map_next;
+        child->map_next = NULL;
+    }
+}
+
+
 //---------------------------------------------------------------------------
 // File_GetPathNode_internal
 //---------------------------------------------------------------------------
 
 
-_FX PATH_NODE* File_GetPathNode_internal(LIST* parent, const WCHAR* name, ULONG name_len, BOOLEAN can_add) 
+_FX PATH_NODE* File_GetPathNode_internal(PATH_NODE* owner, LIST* parent, const WCHAR* name, ULONG name_len, BOOLEAN can_add) 
 {
     PATH_NODE* child;
-    
-    child = List_Head(parent);
-    while (child) {
+    ULONG name_hash = File_HashPathName_internal(name, name_len);
 
-        if (child->name_len == name_len && _wcsnicmp(child->name, name, name_len) == 0)
-            break;
+    if (owner && owner->items_map) {
 
-        child = List_Next(child);
+        child = owner->items_map[name_hash & (owner->items_map_size - 1)];
+        while (child) {
+
+            if (child->name_hash == name_hash && child->name_len == name_len && _wcsnicmp(child->name, name, name_len) == 0)
+                break;
+
+            child = child->map_next;
+        }
+
+    } else {
+
+        child = List_Head(parent);
+        while (child) {
+
+            if (child->name_len == name_len && _wcsnicmp(child->name, name, name_len) == 0)
+                break;
+
+            child = List_Next(child);
+        }
     }
 
     if (!child && can_add) {
@@ -145,11 +314,12 @@ _FX PATH_NODE* File_GetPathNode_internal(LIST* parent, const WCHAR* name, ULONG
         child = Dll_Alloc(sizeof(PATH_NODE) + name_len*sizeof(WCHAR));
         memzero(child, sizeof(PATH_NODE));
         //List_Init(child->items); // done by memzero
+        child->name_hash = name_hash;
         child->name_len = name_len;
         wmemcpy(child->name, name, name_len);
         child->name[name_len] = L'\0';
 
-        List_Insert_After(parent, NULL, child);
+        File_InsertPathNode_internal(owner, parent, child);
     }
 
     return child;
@@ -172,7 +342,7 @@ _FX PATH_NODE* File_FindPathBranche_internal(LIST* Root, const WCHAR* Path, LIST
             continue;
         if(!next) next = wcschr(ptr, L'\0'); // last
         
-        Node = File_GetPathNode_internal(Parent, ptr, (ULONG)(next - ptr), can_add);
+        Node = File_GetPathNode_internal(File_GetPathOwner_internal(Root, Parent), Parent, ptr, (ULONG)(next - ptr), can_add);
         if (!Node)
             return NULL;
 
@@ -194,7 +364,8 @@ _FX PATH_NODE* File_FindPathBranche_internal(LIST* Root, const WCHAR* Path, LIST
 
 _FX VOID File_SetPathFlags_internal(LIST* Root, const WCHAR* Path, ULONG setFlags, ULONG clrFlags, const WCHAR* Relocation)
 {
-    PATH_NODE* Parent = Root;
+    LIST* Parent = Root;
+    PATH_NODE* Owner = NULL;
     PATH_NODE* Node;
     const WCHAR* next;
     for (const WCHAR* ptr = Path; *ptr; ptr = next + 1) {
@@ -203,7 +374,7 @@ _FX VOID File_SetPathFlags_internal(LIST* Root, const WCHAR* Path, ULONG setFlag
             continue;
         if(!next) next = wcschr(ptr, L'\0'); // last
         
-        Node = File_GetPathNode_internal(Parent, ptr, (ULONG)(next - ptr), TRUE);
+        Node = File_GetPathNode_internal(Owner, Parent, ptr, (ULONG)(next - ptr), TRUE);
 
         if (*next == L'\0') { // set flag always on the last element only
 
@@ -225,6 +396,7 @@ _FX VOID File_SetPathFlags_internal(LIST* Root, const WCHAR* Path, ULONG setFlag
 
             break;
         }
+        Owner = Node;
         Parent = &Node->items;
     }
 }
@@ -242,6 +414,7 @@ _FX ULONG File_GetPathFlags_internal(LIST* Root, const WCHAR* Path, WCHAR** pRel
     const WCHAR* SubPath = NULL;
 
     LIST* Parent = Root;
+    PATH_NODE* Owner = NULL;
     PATH_NODE* Node;
     PATH_NODE* child;
     const WCHAR* next;
@@ -251,7 +424,7 @@ _FX ULONG File_GetPathFlags_internal(LIST* Root, const WCHAR* Path, WCHAR** pRel
             continue;
         if(!next) next = wcschr(ptr, L'\0'); // last
         
-        Node = File_GetPathNode_internal(Parent, ptr, (ULONG)(next - ptr), FALSE);
+        Node = File_GetPathNode_internal(Owner, Parent, ptr, (ULONG)(next - ptr), FALSE);
         if (!Node)
             break;
 
@@ -298,6 +471,7 @@ _FX ULONG File_GetPathFlags_internal(LIST* Root, const WCHAR* Path, WCHAR** pRel
         else if ((Node->flags & FILE_DELETED_FLAG) != 0)
             Flags |= FILE_PATH_DELETED_FLAG; // flag set for ancestor
 
+        Owner = Node;
         Parent = &Node->items;
     }
 
@@ -533,10 +707,53 @@ _FX BOOLEAN File_OpenDataFile(const WCHAR* name, HANDLE* hPathsFile, BOOLEAN App
 
 
 _FX VOID File_SavePathTree_internal(LIST* Root, const WCHAR* name, WCHAR* (*TranslatePath)(const WCHAR *))
+{
+    File_SavePathTreeEx_internal(Root, name, TranslatePath, NULL);
+}
+
+
+//---------------------------------------------------------------------------
+// File_WritePathHeader_internal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_WritePathHeader_internal(HANDLE hPathsFile, PATH_JOURNAL* Journal)
+{
+    WCHAR Header[32];
+    IO_STATUS_BLOCK IoStatusBlock;
+    LARGE_INTEGER ByteOffset;
+
+    Sbie_snwprintf(Header, 32, FILE_PATH_HEADER L"%08X %08X\r\n", Journal->Generation, Journal->BaseSize);
+
+    ByteOffset.QuadPart = 0;
+    NtWriteFile(hPathsFile, NULL, NULL, NULL, &IoStatusBlock, Header, FILE_PATH_HEADER_SIZE, &ByteOffset, NULL);
+}
+
+
+//---------------------------------------------------------------------------
+// File_SavePathTreeEx_internal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_SavePathTreeEx_internal(LIST* Root, const WCHAR* name, WCHAR* (*TranslatePath)(const WCHAR *), PATH_JOURNAL* Journal)
 {
     HANDLE hPathsFile;
     if (!File_OpenDataFile(name, &hPathsFile, FALSE))
         return;
+
+    //
+    // a full save is a new snapshot of the journal, we bump the generation
+    // so that other processes know they can't continue from their offset,
+    // and once the size is known we fill in the base size in the header
+    //
+
+    if (Journal) {
+        Journal->Generation += 1;
+        if (Journal->Generation == 0)
+            Journal->Generation = 1;
+        Journal->BaseSize = 0;
+        File_WritePathHeader_internal(hPathsFile, Journal);
+    }
     
     WCHAR* Path = (WCHAR *)Dll_Alloc((0x7FFF + 1)*sizeof(WCHAR)); // max nt path
 
@@ -544,6 +761,17 @@ _FX VOID File_SavePathTree_internal(LIST* Root, const WCHAR* name, WCHAR* (*Tran
 
     Dll_Free(Path);
 
+    if (Journal) {
+
+        IO_STATUS_BLOCK IoStatusBlock;
+        FILE_STANDARD_INFORMATION fileStandardInfo;
+        if (NT_SUCCESS(NtQueryInformationFile(hPathsFile, &IoStatusBlock, &fileStandardInfo, sizeof(FILE_STANDARD_INFORMATION), FileStandardInformation)))
+            Journal->BaseSize = fileStandardInfo.EndOfFile.LowPart;
+
+        File_WritePathHeader_internal(hPathsFile, Journal);
+        Journal->Offset = Journal->BaseSize;
+    }
+
     NtClose(hPathsFile);
 }
 
@@ -635,7 +863,7 @@ _FX BOOLEAN File_SavePathTree()
 {
     EnterCriticalSection(File_PathRoot_CritSec);
 
-    File_SavePathTree_internal(&File_PathRoot, FILE_PATH_FILE_NAME, File_TranslateNtToDosPathForDatFile);
+    File_SavePathTreeEx_internal(&File_PathRoot, FILE_PATH_FILE_NAME, File_TranslateNtToDosPathForDatFile, &File_PathsJournal);
 
     File_GetAttributes_internal(FILE_PATH_FILE_NAME, &File_PathsFileSize, &File_PathsFileDate, NULL);
 
@@ -679,40 +907,34 @@ _FX void File_ReleaseMutex(HANDLE hMutex)
 
 
 //---------------------------------------------------------------------------
-// File_LoadPathTree_internal
+// File_ParsePathHeader_internal
 //---------------------------------------------------------------------------
 
 
-_FX BOOLEAN File_LoadPathTree_internal(LIST* Root, const WCHAR* name, WCHAR* (*TranslatePath)(const WCHAR *))
+_FX BOOLEAN File_ParsePathHeader_internal(const WCHAR* Buffer, PATH_JOURNAL* Journal)
 {
-    WCHAR PathsFile[MAX_PATH] = { 0 };
-    wcscpy(PathsFile, Dll_BoxFilePath);
-    wcscat(PathsFile, L"\\");
-    wcscat(PathsFile, name);
-
-    UNICODE_STRING objname;
-    RtlInitUnicodeString(&objname, PathsFile);
+    WCHAR* endptr;
 
-    OBJECT_ATTRIBUTES objattrs;
-    InitializeObjectAttributes(&objattrs, &objname, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    if (wcsncmp(Buffer, FILE_PATH_HEADER, FILE_PATH_HEADER_LEN) != 0)
+        return FALSE;
 
-    HANDLE hPathsFile;
-    IO_STATUS_BLOCK IoStatusBlock;
-    if (!NT_SUCCESS(NtCreateFile(&hPathsFile, GENERIC_READ | SYNCHRONIZE, &objattrs, &IoStatusBlock, NULL, 0, FILE_SHARE_READ, FILE_OPEN, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0))) {
-        if (NT_SUCCESS(NtCreateFile(&hPathsFile, GENERIC_WRITE | SYNCHRONIZE, &objattrs, &IoStatusBlock, NULL, 0, FILE_SHARE_READ, FILE_CREATE, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0)))
-            NtClose(hPathsFile);
+    Journal->Generation = wcstoul(Buffer + FILE_PATH_HEADER_LEN, &endptr, 16);
+    if (!endptr || *endptr != L' ')
         return FALSE;
-    }
+    Journal->BaseSize = wcstoul(endptr + 1, &endptr, 16);
 
-    File_ClearPathBranche_internal(Root);
+    return TRUE;
+}
 
-    LARGE_INTEGER fileSize;
-    GetFileSizeEx(hPathsFile, &fileSize);
 
-    WCHAR* Buffer = (WCHAR *)Dll_Alloc((ULONG)fileSize.QuadPart + 128);
-    DWORD bytesRead;
-    ReadFile(hPathsFile, Buffer, (DWORD)fileSize.QuadPart, &bytesRead, NULL);
-    Buffer[bytesRead/sizeof(WCHAR)] = L'\0';
+//---------------------------------------------------------------------------
+// File_ApplyPathEntries_internal
+//---------------------------------------------------------------------------
+
+
+_FX ULONG File_ApplyPathEntries_internal(LIST* Root, WCHAR* Buffer, WCHAR* (*TranslatePath)(const WCHAR *))
+{
+    ULONG Applied = 0;
 
     WCHAR* Next = Buffer;
     while (*Next) {
@@ -721,8 +943,10 @@ _FX BOOLEAN File_LoadPathTree_internal(LIST* Root, const WCHAR* name, WCHAR* (*T
         if (End == NULL) {
             End = wcschr(Line, L'\0');
             Next = End;
-        } else
+        } else {
             Next = End + 1;
+            Applied = (ULONG)(Next - Buffer);
+        }
         LONG LineLen = (LONG)(End - Line);
         if (LineLen >= 1 && Line[LineLen - 1] == L'\r')
             LineLen -= 1;
@@ -746,7 +970,15 @@ _FX BOOLEAN File_LoadPathTree_internal(LIST* Root, const WCHAR* name, WCHAR* (*T
         WCHAR* PathEx = TranslatePath ? TranslatePath(Path) : NULL;
         WCHAR* RelocationEx = TranslatePath ? TranslatePath(Relocation) : NULL;
 
-        File_SetPathFlags_internal(Root, PathEx ? PathEx : Path, Flags, 0, RelocationEx ? RelocationEx : Relocation);
+        //
+        // a plain delete entry is replayed the way it was recorded,
+        // it drops any branch that was listed below the path before
+        //
+
+        if (Flags == FILE_DELETED_FLAG && Relocation == NULL)
+            File_MarkDeleted_internal(Root, PathEx ? PathEx : Path, NULL);
+        else
+            File_SetPathFlags_internal(Root, PathEx ? PathEx : Path, Flags, 0, RelocationEx ? RelocationEx : Relocation);
 
         if (PathEx) Dll_Free(PathEx);
         if (RelocationEx) Dll_Free(RelocationEx);
@@ -755,6 +987,94 @@ _FX BOOLEAN File_LoadPathTree_internal(LIST* Root, const WCHAR* name, WCHAR* (*T
         Line[LineLen] = savechar;
     }
 
+    return Applied;
+}
+
+
+//---------------------------------------------------------------------------
+// File_LoadPathTree_internal
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_LoadPathTree_internal(LIST* Root, const WCHAR* name, WCHAR* (*TranslatePath)(const WCHAR *))
+{
+    return File_LoadPathTreeEx_internal(Root, name, TranslatePath, NULL);
+}
+
+
+//---------------------------------------------------------------------------
+// File_LoadPathTreeEx_internal
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_LoadPathTreeEx_internal(LIST* Root, const WCHAR* name, WCHAR* (*TranslatePath)(const WCHAR *), PATH_JOURNAL* Journal)
+{
+    WCHAR PathsFile[MAX_PATH] = { 0 };
+    wcscpy(PathsFile, Dll_BoxFilePath);
+    wcscat(PathsFile, L"\\");
+    wcscat(PathsFile, name);
+
+    UNICODE_STRING objname;
+    RtlInitUnicodeString(&objname, PathsFile);
+
+    OBJECT_ATTRIBUTES objattrs;
+    InitializeObjectAttributes(&objattrs, &objname, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    HANDLE hPathsFile;
+    IO_STATUS_BLOCK IoStatusBlock;
+    if (!NT_SUCCESS(NtCreateFile(&hPathsFile, GENERIC_READ | SYNCHRONIZE, &objattrs, &IoStatusBlock, NULL, 0, FILE_SHARE_READ, FILE_OPEN, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0))) {
+        if (NT_SUCCESS(NtCreateFile(&hPathsFile, GENERIC_WRITE | SYNCHRONIZE, &objattrs, &IoStatusBlock, NULL, 0, FILE_SHARE_READ, FILE_CREATE, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0)))
+            NtClose(hPathsFile);
+        if (Journal) memzero(Journal, sizeof(PATH_JOURNAL));
+        return FALSE;
+    }
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(hPathsFile, &fileSize);
+
+    //
+    // if the file still has the journal generation we loaded last time,
+    // it was only appended to since, so we replay just the new records
+    //
+
+    LARGE_INTEGER ByteOffset;
+    ByteOffset.QuadPart = 0;
+
+    if (Journal && Journal->Generation && Journal->Offset && fileSize.QuadPart >= Journal->Offset) {
+
+        WCHAR Header[FILE_PATH_HEADER_SIZE / sizeof(WCHAR) + 1];
+        PATH_JOURNAL Current;
+        if (NT_SUCCESS(NtReadFile(hPathsFile, NULL, NULL, NULL, &IoStatusBlock, Header, FILE_PATH_HEADER_SIZE, &ByteOffset, NULL))
+                && IoStatusBlock.Information == FILE_PATH_HEADER_SIZE) {
+
+            Header[FILE_PATH_HEADER_SIZE / sizeof(WCHAR)] = L'\0';
+            if (File_ParsePathHeader_internal(Header, &Current) && Current.Generation == Journal->Generation)
+                ByteOffset.QuadPart = Journal->Offset;
+        }
+    }
+
+    if (ByteOffset.QuadPart == 0) {
+
+        File_ClearPathBranche_internal(Root);
+
+        if (Journal) memzero(Journal, sizeof(PATH_JOURNAL));
+    }
+
+    ULONG ReadLen = (ULONG)(fileSize.QuadPart - ByteOffset.QuadPart);
+    WCHAR* Buffer = (WCHAR *)Dll_Alloc(ReadLen + 128);
+    ULONG bytesRead = 0;
+    if (ReadLen && NT_SUCCESS(NtReadFile(hPathsFile, NULL, NULL, NULL, &IoStatusBlock, Buffer, ReadLen, &ByteOffset, NULL)))
+        bytesRead = (ULONG)IoStatusBlock.Information;
+    Buffer[bytesRead/sizeof(WCHAR)] = L'\0';
+
+    if (ByteOffset.QuadPart == 0 && Journal)
+        File_ParsePathHeader_internal(Buffer, Journal);
+
+    ULONG Applied = File_ApplyPathEntries_internal(Root, Buffer, TranslatePath);
+
+    if (Journal)
+        Journal->Offset = (ULONG)ByteOffset.QuadPart + Applied * sizeof(WCHAR);
+
     Dll_Free(Buffer);
 
     NtClose(hPathsFile);
@@ -834,7 +1154,7 @@ _FX BOOLEAN File_LoadPathTree()
 
     EnterCriticalSection(File_PathRoot_CritSec);
 
-    File_LoadPathTree_internal(&File_PathRoot, FILE_PATH_FILE_NAME, File_TranslateDosToNtPathForDatFile);
+    File_LoadPathTreeEx_internal(&File_PathRoot, FILE_PATH_FILE_NAME, File_TranslateDosToNtPathForDatFile, &File_PathsJournal);
 
     LeaveCriticalSection(File_PathRoot_CritSec);
 
@@ -853,24 +1173,82 @@ _FX VOID File_RefreshPathTree()
 {
     if (File_TestBoxRootChange(0)) {
 
-        ULONG64 PathsFileSize = 0;
-        ULONG64 PathsFileDate = 0;
-        if (File_GetAttributes_internal(FILE_PATH_FILE_NAME, &PathsFileSize, &PathsFileDate, NULL)
-            && (File_PathsFileSize != PathsFileSize || File_PathsFileDate != PathsFileDate)) {
+        File_SyncPathTree();
+    }
+}
 
-            File_PathsFileSize = PathsFileSize;
-            File_PathsFileDate = PathsFileDate;
 
-            //
-            // something changed, reload the path tree
-            //
+//---------------------------------------------------------------------------
+// File_SyncPathTree
+//---------------------------------------------------------------------------
 
-            File_LoadPathTree();
-        }
+
+_FX VOID File_SyncPathTree()
+{
+    ULONG64 PathsFileSize = 0;
+    ULONG64 PathsFileDate = 0;
+    if (File_GetAttributes_internal(FILE_PATH_FILE_NAME, &PathsFileSize, &PathsFileDate, NULL)
+        && (File_PathsFileSize != PathsFileSize || File_PathsFileDate != PathsFileDate)) {
+
+        File_PathsFileSize = PathsFileSize;
+        File_PathsFileDate = PathsFileDate;
+
+        //
+        // something changed, reload the path tree, when other processes
+        // only appended records this replays just those
+        //
+
+        File_LoadPathTree();
     }
 }
 
 
+//---------------------------------------------------------------------------
+// File_AppendPathJournal
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_AppendPathJournal(const WCHAR* DatPath, ULONG SetFlags)
+{
+    //
+    // DatPath is already translated for the dat file.  the caller must
+    // hold the VFS mutex, which keeps the writers of all processes in
+    // order, but not the path tree lock
+    //
+
+    //
+    // without a journal header other processes could not tell an append
+    // from a rewrite, so the first change writes a fresh snapshot instead
+    //
+
+    if (File_PathsJournal.Generation == 0)
+        return FALSE;
+
+    HANDLE hPathsFile;
+    if (!File_OpenDataFile(FILE_PATH_FILE_NAME, &hPathsFile, TRUE))
+        return FALSE;
+
+    File_AppendPathEntry_internal(hPathsFile, DatPath, SetFlags, NULL, NULL);
+
+    NtClose(hPathsFile);
+
+    File_GetAttributes_internal(FILE_PATH_FILE_NAME, &File_PathsFileSize, &File_PathsFileDate, NULL);
+
+    File_PathsJournal.Offset = (ULONG)File_PathsFileSize;
+
+    //
+    // once the journal outgrows both the threshold and the snapshot
+    // fold it into a new snapshot, this keeps the cost amortized O(1)
+    //
+
+    ULONG JournalSize = File_PathsJournal.Offset - File_PathsJournal.BaseSize;
+    if (JournalSize > FILE_PATH_JOURNAL_MIN && JournalSize > File_PathsJournal.BaseSize)
+        File_SavePathTree();
+
+    return TRUE;
+}
+
+
 //---------------------------------------------------------------------------
 // File_InitDelete_v2
 //---------------------------------------------------------------------------
@@ -977,11 +1355,9 @@ _FX BOOLEAN File_MarkDeleted_internal(LIST* Root, const WCHAR* Path, BOOLEAN* pT
         if (Node->flags == FILE_DELETED_FLAG && Node->items.count == 0)
             return FALSE; // already marked deleted
 
-        List_Remove(Parent, Node);
+        File_RemovePathNode_internal(File_GetPathOwner_internal(Root, Parent), Parent, Node);
 
-        File_ClearPathBranche_internal(&Node->items);
-        if (Node->relocation) Dll_Free(Node->relocation);
-        Dll_Free(Node);
+        File_FreePathNode_internal(Node);
         if (pTruncated) *pTruncated = TRUE;
     }
 
@@ -1006,40 +1382,50 @@ _FX NTSTATUS File_MarkDeleted_v2(const WCHAR* TruePath)
     // add a file or directory to the deleted list
     //
 
+    WCHAR* DatPath = NULL;
+
     HANDLE hMutex = File_AcquireMutex(FILE_VFS_MUTEX);
 
     EnterCriticalSection(File_PathRoot_CritSec);
 
-    const WCHAR* Path = File_NormalizePath(TruePath, NORM_NAME_BUFFER);
-    BOOLEAN bTruncated = FALSE;
-    BOOLEAN bSet = File_MarkDeleted_internal(&File_PathRoot, Path, &bTruncated);
+    //
+    // replay what other processes appended, so our record goes on top
+    // of the current state of the journal
+    //
 
-    LeaveCriticalSection(File_PathRoot_CritSec);
+    File_SyncPathTree();
+
+    const WCHAR* Path = File_NormalizePath(TruePath, NORM_NAME_BUFFER);
+    BOOLEAN bSet = File_MarkDeleted_internal(&File_PathRoot, Path, NULL);
 
     if (bSet)
     {
         //
-        // Optimization: When marking a lot of host files as deleted, only append single line entries if possible instead of re creating the entire file
+        // build the journal record while the tree is locked, it is written
+        // once the lock is released, so other threads of this process can
+        // look up paths during the file I/O
         //
 
-        ULONG64 PathsFileSize = 0;
-        ULONG64 PathsFileDate = 0;
-        if (!bTruncated 
-            && File_GetAttributes_internal(FILE_PATH_FILE_NAME, &PathsFileSize, &PathsFileDate, NULL)
-            && (File_PathsFileSize == PathsFileSize && File_PathsFileDate == PathsFileDate)) {
+        DatPath = File_TranslateNtToDosPathForDatFile(Path);
+        if (!DatPath) {
+            DatPath = Dll_Alloc((wcslen(Path) + 1) * sizeof(WCHAR));
+            wcscpy(DatPath, Path);
+        }
+    }
 
-            HANDLE hPathsFile;
-            if (File_OpenDataFile(FILE_PATH_FILE_NAME, &hPathsFile, TRUE))
-            {
-                File_AppendPathEntry_internal(hPathsFile, Path, FILE_DELETED_FLAG, NULL, File_TranslateNtToDosPathForDatFile);
+    LeaveCriticalSection(File_PathRoot_CritSec);
 
-                NtClose(hPathsFile);
+    if (DatPath)
+    {
+        //
+        // Optimization: When marking a lot of host files as deleted, only append single line entries instead of re creating the entire file,
+        // a delete entry drops the branch below it also when replayed, so this works even if the marking truncated the tree
+        //
 
-                File_GetAttributes_internal(FILE_PATH_FILE_NAME, &File_PathsFileSize, &File_PathsFileDate, NULL);
-            }
-        }
-        else
+        if (!File_AppendPathJournal(DatPath, FILE_DELETED_FLAG))
             File_SavePathTree();
+
+        Dll_Free(DatPath);
     }
 
     File_ReleaseMutex(hMutex);
@@ -1143,9 +1529,9 @@ _FX VOID File_SetRelocation_internal(LIST* Root, const WCHAR *OldTruePath, const
 
             PATH_NODE* next_child = List_Next(child);
 
-            List_Remove(&Node->items, child);
+            File_RemovePathNode_internal(Node, &Node->items, child);
                 
-            List_Insert_After(&NewNode->items, NULL, child);
+            File_InsertPathNode_internal(NewNode, &NewNode->items, child);
 
             child = next_child;
         }
@@ -1179,6 +1565,8 @@ _FX NTSTATUS File_SetRelocation(const WCHAR* OldTruePath, const WCHAR* NewTruePa
 
     EnterCriticalSection(File_PathRoot_CritSec);
 
+    File_SyncPathTree();
+
     File_SetRelocation_internal(&File_PathRoot, File_NormalizePath(OldTruePath, NORM_NAME_BUFFER), File_NormalizePath(NewTruePath, MISC_NAME_BUFFER));
 
     LeaveCriticalSection(File_PathRoot_CritSec);
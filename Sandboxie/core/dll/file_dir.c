@@ -24,6 +24,7 @@
 #include "common/pool.h"
 #include "common/map.h"
 #include "common/pattern.h"
+#include "common/rbtree.h"
 
 //---------------------------------------------------------------------------
 // Structures and Types
@@ -33,6 +34,7 @@
 typedef struct _FILE_MERGE_CACHE_FILE {
 
     LIST_ELEM list_elem;
+    rbnode_t tree_node;
     ULONG info_len;
     UNICODE_STRING name_uni;
     FILE_ID_BOTH_DIR_INFORMATION info;
@@ -141,9 +143,16 @@ static NTSTATUS File_MergeCache(
     FILE_MERGE_FILE *qfile, UNICODE_STRING *FileMask, BOOLEAN ForceCache);
 
 static NTSTATUS File_MergeCacheWin2000(
-    FILE_MERGE_FILE *qfile, UNICODE_STRING *FileMask,
+    FILE_MERGE_FILE *qfile, UNICODE_STRING *FileMask, rbtree_t *cache_tree,
     FILE_ID_BOTH_DIR_INFORMATION *info_area, ULONG info_area_len);
 
+static int File_MergeCacheCompare(const void *key1, const void *key2);
+
+static int File_MergeCacheCompareEx(const void *key1, const void *key2);
+
+static BOOLEAN File_MergeCacheInsert(
+    LIST *cache_list, rbtree_t *cache_tree, FILE_MERGE_CACHE_FILE *cache_file);
+
 static NTSTATUS File_MergeDummy(
     WCHAR *TruePath, FILE_MERGE_FILE *qfile, UNICODE_STRING *FileMask);
 
@@ -1057,8 +1066,8 @@ _FX NTSTATUS File_MergeCache(
     FILE_ID_BOTH_DIR_INFORMATION *info_area;
     FILE_ID_BOTH_DIR_INFORMATION *info_ptr;
     LIST *cache_list;
+    rbtree_t cache_tree;
     FILE_MERGE_CACHE_FILE *cache_file;
-    FILE_MERGE_CACHE_FILE *ins_point;
     ULONG len;
     const ULONG INFO_AREA_LEN = 0x10000;  // the size used by cmd.exe
 
@@ -1097,6 +1106,8 @@ _FX NTSTATUS File_MergeCache(
     cache_list = &qfile->cache_list;
     List_Init(cache_list);
 
+    rbtree_init(&cache_tree, File_MergeCacheCompare);
+
     info_area = Pool_Alloc(qfile->cache_pool, INFO_AREA_LEN);
     if (! info_area)
         return STATUS_INSUFFICIENT_RESOURCES;
@@ -1136,7 +1147,7 @@ _FX NTSTATUS File_MergeCache(
                 // NetApp drive returns STATUS_INVALID_LEVEL error
                 //
 
-                status = File_MergeCacheWin2000(qfile, FileMask,
+                status = File_MergeCacheWin2000(qfile, FileMask, &cache_tree,
                                                 info_area, INFO_AREA_LEN);
             }
 
@@ -1147,7 +1158,6 @@ _FX NTSTATUS File_MergeCache(
 
         info_ptr = info_area;
         while (1) {
-            int cmp;
 
             len = sizeof(FILE_MERGE_CACHE_FILE)
                 + info_ptr->FileNameLength;
@@ -1171,30 +1181,15 @@ _FX NTSTATUS File_MergeCache(
 
             // insert file into the ordered list
 
-            ins_point = List_Head(cache_list);
-            cmp = -1;
-            while (ins_point) {
-                cmp = RtlCompareUnicodeString(
-                    &ins_point->name_uni, &cache_file->name_uni,
-                    TRUE);                      // CaseInSensitive
-                if ( (cmp > 0) || (cmp == 0) )
-                    break;
-                ins_point = List_Next(ins_point);
-            }
             // There is a bug with Isilon drives.  NtQueryDirectoryFile does not return STATUS_NO_MORE_FILES but always returns STATUS_SUCCESS with the same file name.
             // This causes an infinite loop in this code.  So, if the name_uni we just received is the same as what we just added to the list, assume it is the Isilon bug
             // and break out of this loop.
-            if (cmp == 0)
+            if (! File_MergeCacheInsert(cache_list, &cache_tree, cache_file))
             {
                 status = STATUS_NO_MORE_FILES;
                 break;
             }
 
-            if (ins_point)
-                List_Insert_Before(cache_list, ins_point, cache_file);
-            else
-                List_Insert_After(cache_list, NULL, cache_file);
-
             // process next file
 
             if (info_ptr->NextEntryOffset == 0)
@@ -1222,7 +1217,7 @@ _FX NTSTATUS File_MergeCache(
 
 
 _FX NTSTATUS File_MergeCacheWin2000(
-    FILE_MERGE_FILE *qfile, UNICODE_STRING *FileMask,
+    FILE_MERGE_FILE *qfile, UNICODE_STRING *FileMask, rbtree_t *cache_tree,
     FILE_ID_BOTH_DIR_INFORMATION *info_area, ULONG info_area_len)
 {
     NTSTATUS status;
@@ -1230,7 +1225,6 @@ _FX NTSTATUS File_MergeCacheWin2000(
     FILE_BOTH_DIRECTORY_INFORMATION *info_ptr;
     LIST *cache_list;
     FILE_MERGE_CACHE_FILE *cache_file;
-    FILE_MERGE_CACHE_FILE *ins_point;
     ULONG len;
 
     //
@@ -1246,6 +1240,13 @@ _FX NTSTATUS File_MergeCacheWin2000(
 
     cache_list = &qfile->cache_list;
 
+    //
+    // this code path never treated duplicate names as the end of the
+    // listing, so keep inserting them after the existing equal names
+    //
+
+    cache_tree->cmp = File_MergeCacheCompareEx;
+
     //
     // read entire directory, build a sorted files list
     //
@@ -1314,20 +1315,7 @@ _FX NTSTATUS File_MergeCacheWin2000(
 
             // insert file into the ordered list
 
-            ins_point = List_Head(cache_list);
-            while (ins_point) {
-                int cmp = RtlCompareUnicodeString(
-                    &ins_point->name_uni, &cache_file->name_uni,
-                    TRUE);                      // CaseInSensitive
-                if (cmp > 0)
-                    break;
-                ins_point = List_Next(ins_point);
-            }
-
-            if (ins_point)
-                List_Insert_Before(cache_list, ins_point, cache_file);
-            else
-                List_Insert_After(cache_list, NULL, cache_file);
+            File_MergeCacheInsert(cache_list, cache_tree, cache_file);
 
             // process next file
 
@@ -1345,6 +1333,9 @@ _FX NTSTATUS File_MergeCacheWin2000(
 }
 
 
+#include "file_merge_cache.c"
+
+
 //---------------------------------------------------------------------------
 // File_MergeDummy
 //---------------------------------------------------------------------------
@@ -1357,8 +1348,8 @@ _FX NTSTATUS File_MergeDummy(
     FILE_ID_BOTH_DIR_INFORMATION *info_area;
     FILE_ID_BOTH_DIR_INFORMATION *info_ptr;
     LIST *cache_list;
+    rbtree_t cache_tree;
     FILE_MERGE_CACHE_FILE *cache_file;
-    FILE_MERGE_CACHE_FILE *ins_point;
     ULONG len;
     const ULONG INFO_AREA_LEN = 0x10000;  // the size used by cmd.exe
 
@@ -1379,6 +1370,8 @@ _FX NTSTATUS File_MergeDummy(
     cache_list = &qfile->cache_list;
     List_Init(cache_list);
 
+    rbtree_init(&cache_tree, File_MergeCacheCompare);
+
     info_area = Pool_Alloc(qfile->cache_pool, INFO_AREA_LEN);
     if (! info_area)
         return STATUS_INSUFFICIENT_RESOURCES;
@@ -1516,7 +1509,6 @@ _FX NTSTATUS File_MergeDummy(
 
     info_ptr = info_area;
     while (1) {
-        int cmp;
 
         len = sizeof(FILE_MERGE_CACHE_FILE)
             + info_ptr->FileNameLength;
@@ -1538,26 +1530,9 @@ _FX NTSTATUS File_MergeDummy(
         cache_file->name_uni.MaximumLength = cache_file->name_uni.Length;
         cache_file->name_uni.Buffer = cache_file->info.FileName;
 
-        // insert file into the ordered list
+        // insert file into the ordered list, skip duplicates
 
-        ins_point = List_Head(cache_list);
-        cmp = -1;
-        while (ins_point) {
-            cmp = RtlCompareUnicodeString(
-                &ins_point->name_uni, &cache_file->name_uni,
-                TRUE);                      // CaseInSensitive
-            if ( (cmp > 0) || (cmp == 0) )
-                break;
-            ins_point = List_Next(ins_point);
-        }
-
-        if (cmp != 0) { // skip duplicates
-
-            if (ins_point)
-                List_Insert_Before(cache_list, ins_point, cache_file);
-            else
-                List_Insert_After(cache_list, NULL, cache_file);
-        }
+        File_MergeCacheInsert(cache_list, &cache_tree, cache_file);
 
         if (info_ptr->NextEntryOffset == 0)
             break;
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2004-2020 Sandboxie Holdings, LLC 
+ * Copyright 2020-2023 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// File (Dir) Merge Cache
+//---------------------------------------------------------------------------
+
+
+//
+// the sorted list of directory entries which File_MergeCache and
+// File_MergeDummy build.  this file is included by file_dir.c, and only
+// uses FILE_MERGE_CACHE_FILE, the list and rbtree from common and
+// RtlCompareUnicodeString, so the insertion can also be measured outside
+// of the DLL, see tests/merge_cache_test.c
+//
+
+
+//---------------------------------------------------------------------------
+// File_MergeCacheCompare
+//---------------------------------------------------------------------------
+
+
+_FX int File_MergeCacheCompare(const void *key1, const void *key2)
+{
+    return RtlCompareUnicodeString(
+        (UNICODE_STRING *)key1, (UNICODE_STRING *)key2,
+        TRUE);                      // CaseInSensitive
+}
+
+
+//---------------------------------------------------------------------------
+// File_MergeCacheCompareEx
+//---------------------------------------------------------------------------
+
+
+_FX int File_MergeCacheCompareEx(const void *key1, const void *key2)
+{
+    int cmp = File_MergeCacheCompare(key1, key2);
+    return cmp ? cmp : 1;           // equal names go after existing ones
+}
+
+
+//---------------------------------------------------------------------------
+// File_MergeCacheInsert
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_MergeCacheInsert(
+    LIST *cache_list, rbtree_t *cache_tree, FILE_MERGE_CACHE_FILE *cache_file)
+{
+    rbnode_t *next;
+
+    //
+    // the red black tree finds the position of the new entry in O(log n),
+    // its in-order successor is the list element to insert before.
+    // rbtree_insert fails if the tree already has an entry with this
+    // name, unless the compare function never reports equal names
+    //
+
+    cache_file->tree_node.key = &cache_file->name_uni;
+
+    if (! rbtree_insert(cache_tree, &cache_file->tree_node))
+        return FALSE;
+
+    next = rbtree_next(&cache_file->tree_node);
+    if (next != RBTREE_NULL) {
+        List_Insert_Before(cache_list, CONTAINING_RECORD(
+            next, FILE_MERGE_CACHE_FILE, tree_node), cache_file);
+    } else
+        List_Insert_After(cache_list, NULL, cache_file);
+
+    return TRUE;
+}
@@ -27,6 +27,8 @@
 
 #define FILE_INSNAPSHOT_FLAG    0x0004
 
+#include "common/bloom.h"
+
 //---------------------------------------------------------------------------
 // Structures and Types
 //---------------------------------------------------------------------------
@@ -39,6 +41,9 @@ typedef struct _FILE_SNAPSHOT {
 	//WCHAR					Name[BOXNAME_COUNT];
 	struct _FILE_SNAPSHOT*	Parent;
 	LIST					PathRoot;
+	UCHAR*					BloomBits;
+	ULONG					BloomBitCount;
+	ULONG					BloomHashCount;
 } FILE_SNAPSHOT, *PFILE_SNAPSHOT;
 
 
@@ -64,12 +69,14 @@ static void File_ScrambleShortName(WCHAR* ShortName, CCHAR* ShortNameLength, ULO
 static void File_UnScrambleShortName(WCHAR* ShortName, ULONG ScramKey);
 
 static WCHAR* File_MakeSnapshotPath(FILE_SNAPSHOT* Cur_Snapshot, const WCHAR* CopyPath);
+static BOOLEAN File_MayBeInSnapshot(FILE_SNAPSHOT* Cur_Snapshot, const WCHAR* CopyPath);
 static WCHAR* File_FindSnapshotPath(WCHAR* CopyPath);
 static WCHAR* File_ResolveTruePath(WCHAR* TruePath, WCHAR* CopyPath, ULONG* pFlags);
 static ULONG File_IsDeletedEx(const WCHAR* TruePath, const WCHAR* CopyPath, FILE_SNAPSHOT* snapshot);
 
 
 static void File_InitSnapshots(void);
+static void File_LoadSnapshotBloom(FILE_SNAPSHOT* Cur_Snapshot);
 
 //---------------------------------------------------------------------------
 // File_Scramble_Char
@@ -210,6 +217,46 @@ _FX WCHAR* File_MakeSnapshotPath(FILE_SNAPSHOT* Cur_Snapshot, const WCHAR* CopyP
 }
 
 
+//---------------------------------------------------------------------------
+// File_MayBeInSnapshot
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_MayBeInSnapshot(FILE_SNAPSHOT* Cur_Snapshot, const WCHAR* CopyPath)
+{
+	//
+	// check the snapshot's Bloom filter, when it says the path is not
+	// there we can skip probing the snapshot folder, without a filter
+	// or for paths we can not hash reliably we always have to probe
+	//
+
+	if (!Cur_Snapshot->BloomBits)
+		return TRUE;
+
+	ULONG prefixLen = File_FindBoxPrefix(CopyPath);
+	if (prefixLen == 0 || CopyPath[prefixLen] != L'\\')
+		return TRUE;
+
+	const WCHAR* RelPath = CopyPath + prefixLen + 1;
+	ULONG RelLen = wcslen(RelPath);
+	while (RelLen > 0 && RelPath[RelLen - 1] == L'\\')
+		RelLen--;
+	if (RelLen == 0)
+		return TRUE;
+
+	//
+	// stream names and short names are not in the filter
+	//
+
+	for (ULONG i = 0; i < RelLen; i++) {
+		if (RelPath[i] == L':' || RelPath[i] == L'~')
+			return TRUE;
+	}
+
+	return Bloom_Test(Cur_Snapshot->BloomBits, Cur_Snapshot->BloomBitCount, Cur_Snapshot->BloomHashCount, Bloom_HashPath(RelPath, RelLen));
+}
+
+
 //---------------------------------------------------------------------------
 // File_FindSnapshotPath
 //---------------------------------------------------------------------------
@@ -237,6 +284,9 @@ _FX WCHAR* File_FindSnapshotPath(WCHAR* CopyPath)
 
 	for (FILE_SNAPSHOT* Cur_Snapshot = File_Snapshot; Cur_Snapshot != NULL; Cur_Snapshot = Cur_Snapshot->Parent)
 	{
+		if (!File_MayBeInSnapshot(Cur_Snapshot, CopyPath))
+			continue;
+
 		WCHAR* TmplName = File_MakeSnapshotPath(Cur_Snapshot, CopyPath);
 		if (!TmplName)
 			break;
@@ -344,7 +394,7 @@ _FX ULONG File_GetPathFlagsEx(const WCHAR *TruePath, const WCHAR *CopyPath, WCHA
 			}
 		}
 
-		if (CopyPath) 
+		if (CopyPath && File_MayBeInSnapshot(Cur_Snapshot, CopyPath)) 
 		{
 			//
 			// check if the specified file is present in the current snapshot
@@ -569,6 +619,8 @@ _FX void File_InitSnapshots(void)
 			File_LoadPathTree_internal(&Cur_Snapshot->PathRoot, PathFile, File_TranslateDosToNtPath);
 		}
 
+		File_LoadSnapshotBloom(Cur_Snapshot);
+
 		//WCHAR SnapshotName[BOXNAME_COUNT] = { 0 };
 		//GetPrivateProfileStringW(SnapshotId, L"Name", L"", SnapshotName, BOXNAME_COUNT, SnapshotsIni);
 		//wcscpy(Cur_Snapshot->Name, SnapshotName);
@@ -586,3 +638,57 @@ _FX void File_InitSnapshots(void)
 		File_Snapshot_Count++;
 	}
 }
+
+
+//---------------------------------------------------------------------------
+// File_LoadSnapshotBloom
+//---------------------------------------------------------------------------
+
+
+_FX void File_LoadSnapshotBloom(FILE_SNAPSHOT* Cur_Snapshot)
+{
+	WCHAR BloomFile[MAX_PATH] = { 0 };
+	wcscpy(BloomFile, Dll_BoxFilePath);
+	wcscat(BloomFile, L"\\");
+	wcscat(BloomFile, File_Snapshot_Prefix);
+	wcscat(BloomFile, Cur_Snapshot->ID);
+	wcscat(BloomFile, L"\\");
+	wcscat(BloomFile, BLOOM_FILE_NAME);
+
+	UNICODE_STRING objname;
+	RtlInitUnicodeString(&objname, BloomFile);
+
+	OBJECT_ATTRIBUTES objattrs;
+	InitializeObjectAttributes(&objattrs, &objname, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+	HANDLE hBloomFile;
+	IO_STATUS_BLOCK IoStatusBlock;
+	if (!NT_SUCCESS(NtCreateFile(&hBloomFile, GENERIC_READ | SYNCHRONIZE, &objattrs, &IoStatusBlock, NULL, 0, FILE_SHARE_READ, FILE_OPEN, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0)))
+		return; // snapshot taken without a filter, always probe
+
+	//
+	// only accept a well formed filter, a missing or broken one just
+	// means every lookup probes the snapshot folder as before
+	//
+
+	BLOOM_HEADER Header;
+	if (NT_SUCCESS(NtReadFile(hBloomFile, NULL, NULL, NULL, &IoStatusBlock, &Header, sizeof(Header), NULL, NULL))
+		&& IoStatusBlock.Information == sizeof(Header)
+		&& Bloom_CheckHeader(&Header))
+	{
+		ULONG BloomSize = Header.BitCount / 8;
+		UCHAR* BloomBits = Dll_Alloc(BloomSize);
+
+		if (NT_SUCCESS(NtReadFile(hBloomFile, NULL, NULL, NULL, &IoStatusBlock, BloomBits, BloomSize, NULL, NULL))
+			&& IoStatusBlock.Information == BloomSize)
+		{
+			Cur_Snapshot->BloomBits = BloomBits;
+			Cur_Snapshot->BloomBitCount = Header.BitCount;
+			Cur_Snapshot->BloomHashCount = Header.HashCount;
+		}
+		else
+			Dll_Free(BloomBits);
+	}
+
+	NtClose(hBloomFile);
+}
@@ -562,6 +562,9 @@ import_fail:
 
     ok = TRUE;
 
+    if (Gui_UseProxyService)
+        Gui_InitWndCache();
+
     if (ok)
         ok = Gui_InitClass(module);
 
@@ -2685,6 +2688,50 @@ _FX void *Gui_CallProxy(void *req, ULONG req_len, ULONG rpl_min_len)
 }
 
 
+//---------------------------------------------------------------------------
+// Gui_CallProxyBatch
+//---------------------------------------------------------------------------
+
+
+_FX void *Gui_CallProxyBatch(void **reqs, ULONG *req_lens, ULONG count)
+{
+    //
+    // sends up to GUI_BATCH_MAX_COUNT window query requests to the
+    // GUI Proxy in a single call, the reply is a GUI_BATCH_RPL followed
+    // by the replies in the same order, but possibly fewer of them
+    //
+
+    GUI_BATCH_REQ *req;
+    GUI_BATCH_ENTRY *entry;
+    void *rpl;
+    ULONG req_len, i;
+
+    if ((! count) || count > GUI_BATCH_MAX_COUNT)
+        return NULL;
+
+    req_len = sizeof(GUI_BATCH_REQ);
+    for (i = 0; i < count; ++i)
+        req_len += sizeof(GUI_BATCH_ENTRY) + GUI_BATCH_ALIGN(req_lens[i]);
+
+    req = Dll_Alloc(req_len);
+    req->msgid = GUI_BATCH;
+    req->count = count;
+
+    entry = GUI_BATCH_FIRST(req);
+    for (i = 0; i < count; ++i) {
+        entry->len = req_lens[i];
+        entry->pad_word = 0;
+        memcpy(entry + 1, reqs[i], req_lens[i]);
+        entry = GUI_BATCH_NEXT(entry);
+    }
+
+    rpl = Gui_CallProxy(req, req_len, sizeof(GUI_BATCH_RPL));
+
+    Dll_Free(req);
+    return rpl;
+}
+
+
 //---------------------------------------------------------------------------
 // Gui_CallProxyEx
 //---------------------------------------------------------------------------
@@ -939,6 +939,24 @@ void *Gui_CallProxy(void *req, ULONG req_len, ULONG rpl_min_len);
 void *Gui_CallProxyEx(
     void *req, ULONG req_len, ULONG rpl_min_len, BOOLEAN msgwait);
 
+void *Gui_CallProxyBatch(void **reqs, ULONG *req_lens, ULONG count);
+
+
+//---------------------------------------------------------------------------
+
+
+void Gui_InitWndCache(void);
+
+ULONG_PTR Gui_QueryWndCache(HWND hWnd, ULONG_PTR type);
+
+void Gui_SetWndCacheQuery(
+    HWND hWnd, ULONG_PTR type, ULONG_PTR result,
+    ULONG req_error, ULONG rpl_error);
+
+ULONG Gui_GetWndCacheClassName(HWND hWnd, WCHAR *clsnm, ULONG maxlen);
+
+void Gui_SetWndCacheClassName(HWND hWnd, const WCHAR *clsnm, ULONG len);
+
 
 //---------------------------------------------------------------------------
 
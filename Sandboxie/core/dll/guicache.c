@@ -0,0 +1,300 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// GUI Services -- Window Attribute Cache
+//---------------------------------------------------------------------------
+
+//
+// windows which this process can not access directly are queried through
+// the SbieSvc GUI Proxy, at the cost of two calls to the service for each
+// query.  the owning process and thread, and the class name of a window
+// do not change during the lifetime of the window, so the replies for
+// these queries are kept here for a short while.
+//
+// a window handle may be reused for a new window after the old one is
+// destroyed, so each entry expires after GUI_WND_CACHE_TTL milliseconds.
+// the last error which the GUI Proxy returned with a query is kept along
+// with its result, so a query which is answered here leaves the same
+// last error as one that goes through the proxy
+//
+
+#include "dll.h"
+
+#include "gui_p.h"
+#include "common/map.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define GUI_WND_CACHE_TTL       1000        // milliseconds
+#define GUI_WND_CACHE_MAX       512         // entries
+#define GUI_WND_CACHE_CLSNM     256         // characters, the longest class name
+
+#define GUI_WND_CACHE_SAME_ERROR ((ULONG)-1) // the proxy did not change it
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _GUI_WND_CACHE_ENTRY {
+
+    ULONG expire;           // tick count
+    ULONG idProcess;        // 0 if not known
+    ULONG idThread;         // 0 if not known
+    ULONG errProcess;       // last error of the queries
+    ULONG errThread;
+    ULONG clsnm_len;        // 0 if not known
+    WCHAR clsnm[GUI_WND_CACHE_CLSNM + 1];
+
+} GUI_WND_CACHE_ENTRY;
+
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+
+static GUI_WND_CACHE_ENTRY *Gui_GetWndCacheEntry(HWND hWnd, BOOLEAN create);
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static HASH_MAP Gui_WndCache;
+static CRITICAL_SECTION Gui_WndCache_CritSec;
+static BOOLEAN Gui_WndCache_InitDone = FALSE;
+
+
+//---------------------------------------------------------------------------
+// Gui_InitWndCache
+//---------------------------------------------------------------------------
+
+
+_FX void Gui_InitWndCache(void)
+{
+    if (Gui_WndCache_InitDone)
+        return;
+
+    InitializeCriticalSection(&Gui_WndCache_CritSec);
+    map_init(&Gui_WndCache, Dll_Pool);
+
+    Gui_WndCache_InitDone = TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// Gui_GetWndCacheEntry
+//---------------------------------------------------------------------------
+
+
+_FX GUI_WND_CACHE_ENTRY *Gui_GetWndCacheEntry(HWND hWnd, BOOLEAN create)
+{
+    //
+    // the caller must hold Gui_WndCache_CritSec.  window handles are
+    // passed through the GUI Proxy as 32-bit values, so we use the
+    // same 32-bit value as the key
+    //
+
+    void *key = (void *)(ULONG_PTR)(ULONG)(ULONG_PTR)hWnd;
+    ULONG now = GetTickCount();
+
+    GUI_WND_CACHE_ENTRY *entry = map_get(&Gui_WndCache, key);
+    if (entry && (LONG)(entry->expire - now) <= 0) {
+
+        map_remove(&Gui_WndCache, key);
+        entry = NULL;
+    }
+
+    if (entry || (! create))
+        return entry;
+
+    if (Gui_WndCache.nnodes >= GUI_WND_CACHE_MAX) {
+
+        map_iter_t iter = map_iter();
+        for (map_next(&Gui_WndCache, &iter); iter.node; ) {
+            GUI_WND_CACHE_ENTRY *old = iter.value;
+            if ((LONG)(old->expire - now) <= 0)
+                map_erase(&Gui_WndCache, &iter);    // advances iter
+            else
+                map_next(&Gui_WndCache, &iter);
+        }
+
+        if (Gui_WndCache.nnodes >= GUI_WND_CACHE_MAX)
+            map_clear(&Gui_WndCache);
+    }
+
+    entry = map_insert(&Gui_WndCache, key, NULL, sizeof(GUI_WND_CACHE_ENTRY));
+    if (entry) {
+        entry->expire = now + GUI_WND_CACHE_TTL;
+        entry->idProcess = 0;
+        entry->idThread = 0;
+        entry->errProcess = GUI_WND_CACHE_SAME_ERROR;
+        entry->errThread = GUI_WND_CACHE_SAME_ERROR;
+        entry->clsnm_len = 0;
+    }
+
+    return entry;
+}
+
+
+//---------------------------------------------------------------------------
+// Gui_QueryWndCache
+//---------------------------------------------------------------------------
+
+
+_FX ULONG_PTR Gui_QueryWndCache(HWND hWnd, ULONG_PTR type)
+{
+    //
+    // type is as for NtUserQueryWindow, type 0 queries the process id
+    // and type 2 the thread id, other types are not cached.  returns 0
+    // if not cached, otherwise sets the last error like the GUI Proxy
+    //
+
+    GUI_WND_CACHE_ENTRY *entry;
+    ULONG_PTR result = 0;
+    ULONG error = GUI_WND_CACHE_SAME_ERROR;
+
+    if ((! Gui_WndCache_InitDone) || (type != 0 && type != 2))
+        return 0;
+
+    EnterCriticalSection(&Gui_WndCache_CritSec);
+
+    entry = Gui_GetWndCacheEntry(hWnd, FALSE);
+    if (entry) {
+        if (type == 2) {
+            result = entry->idThread;
+            error = entry->errThread;
+        } else {
+            result = entry->idProcess;
+            error = entry->errProcess;
+        }
+    }
+
+    LeaveCriticalSection(&Gui_WndCache_CritSec);
+
+    if (result && error != GUI_WND_CACHE_SAME_ERROR)
+        SetLastError(error);
+
+    return result;
+}
+
+
+//---------------------------------------------------------------------------
+// Gui_SetWndCacheQuery
+//---------------------------------------------------------------------------
+
+
+_FX void Gui_SetWndCacheQuery(
+    HWND hWnd, ULONG_PTR type, ULONG_PTR result,
+    ULONG req_error, ULONG rpl_error)
+{
+    //
+    // req_error is the last error which was sent to the GUI Proxy with
+    // the query, and rpl_error the one it returned
+    //
+
+    GUI_WND_CACHE_ENTRY *entry;
+    ULONG error;
+
+    if ((! Gui_WndCache_InitDone) || (type != 0 && type != 2) || (! result))
+        return;
+
+    error = (rpl_error == req_error) ? GUI_WND_CACHE_SAME_ERROR : rpl_error;
+
+    EnterCriticalSection(&Gui_WndCache_CritSec);
+
+    entry = Gui_GetWndCacheEntry(hWnd, TRUE);
+    if (entry) {
+        if (type == 2) {
+            entry->idThread = (ULONG)result;
+            entry->errThread = error;
+        } else {
+            entry->idProcess = (ULONG)result;
+            entry->errProcess = error;
+        }
+    }
+
+    LeaveCriticalSection(&Gui_WndCache_CritSec);
+}
+
+
+//---------------------------------------------------------------------------
+// Gui_GetWndCacheClassName
+//---------------------------------------------------------------------------
+
+
+_FX ULONG Gui_GetWndCacheClassName(HWND hWnd, WCHAR *clsnm, ULONG maxlen)
+{
+    //
+    // copies the class name like GetClassNameW, returns 0 if not cached
+    //
+
+    GUI_WND_CACHE_ENTRY *entry;
+    ULONG len = 0;
+
+    if ((! Gui_WndCache_InitDone) || (! maxlen))
+        return 0;
+
+    EnterCriticalSection(&Gui_WndCache_CritSec);
+
+    entry = Gui_GetWndCacheEntry(hWnd, FALSE);
+    if (entry && entry->clsnm_len) {
+
+        len = entry->clsnm_len;
+        if (len > maxlen - 1)
+            len = maxlen - 1;
+        wmemcpy(clsnm, entry->clsnm, len);
+        clsnm[len] = L'\0';
+    }
+
+    LeaveCriticalSection(&Gui_WndCache_CritSec);
+
+    return len;
+}
+
+
+//---------------------------------------------------------------------------
+// Gui_SetWndCacheClassName
+//---------------------------------------------------------------------------
+
+
+_FX void Gui_SetWndCacheClassName(HWND hWnd, const WCHAR *clsnm, ULONG len)
+{
+    GUI_WND_CACHE_ENTRY *entry;
+
+    if ((! Gui_WndCache_InitDone) || (! len) || len > GUI_WND_CACHE_CLSNM)
+        return;
+
+    EnterCriticalSection(&Gui_WndCache_CritSec);
+
+    entry = Gui_GetWndCacheEntry(hWnd, TRUE);
+    if (entry) {
+        wmemcpy(entry->clsnm, clsnm, len);
+        entry->clsnm[len] = L'\0';
+        entry->clsnm_len = len;
+    }
+
+    LeaveCriticalSection(&Gui_WndCache_CritSec);
+}
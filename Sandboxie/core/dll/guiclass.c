@@ -793,6 +793,12 @@ _FX ULONG Gui_GetClassName2(
     ULONG result;
     ULONG error;
 
+    if (unicode) {
+        result = Gui_GetWndCacheClassName(hWnd, clsnm, maxlen);
+        if (result)
+            return result;
+    }
+
     req.msgid = GUI_GET_CLASS_NAME;
     req.error = GetLastError();
     req.maxlen = maxlen;
@@ -813,6 +819,9 @@ _FX ULONG Gui_GetClassName2(
             if (unicode)
                 copy_len *= sizeof(WCHAR);
             memcpy(clsnm, rpl->name, copy_len);
+
+            if (unicode && result < maxlen - 1)
+                Gui_SetWndCacheClassName(hWnd, clsnm, result);
         }
 
         Dll_Free(rpl);
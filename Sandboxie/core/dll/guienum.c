@@ -48,6 +48,8 @@ static BOOLEAN Gui_HookQueryWindow(HMODULE module);
 
 static ULONG_PTR Gui_NtUserQueryWindow(HWND hWnd, ULONG_PTR type);
 
+static void Gui_PrefetchWindows(const ULONG *hwnds, ULONG num_hwnds);
+
 //---------------------------------------------------------------------------
 
 static BOOL Gui_EnumProc(HWND hWnd, LPARAM lParam);
@@ -391,6 +393,10 @@ _FX ULONG_PTR Gui_NtUserQueryWindow(HWND hWnd, ULONG_PTR type)
         if (result)
             return result;
 
+        result = Gui_QueryWndCache(hWnd, type);
+        if (result)
+            return result;
+
     } else if (hWnd && __sys_IsWindow(hWnd)) {
 
         return __sys_NtUserQueryWindow(hWnd, type);
@@ -412,11 +418,131 @@ _FX ULONG_PTR Gui_NtUserQueryWindow(HWND hWnd, ULONG_PTR type)
     result = (ULONG_PTR)rpl->result;
     error = rpl->error;
     Dll_Free(rpl);
+
+    Gui_SetWndCacheQuery(hWnd, type, result, req.error, error);
+
     SetLastError(error);
     return result;
 }
 
 
+//---------------------------------------------------------------------------
+// Gui_PrefetchWindows
+//---------------------------------------------------------------------------
+
+
+_FX void Gui_PrefetchWindows(const ULONG *hwnds, ULONG num_hwnds)
+{
+    //
+    // a program which enumerates windows usually goes on to ask for the
+    // owner and the class of each window it gets.  for windows which this
+    // process can not query directly, we ask the GUI Proxy for all three
+    // attributes of several windows in one batch, and keep the replies in
+    // the window cache, where Gui_NtUserQueryWindow and Gui_GetClassName2
+    // will find them.  windows left out of a short reply are not retried
+    //
+
+#define PREFETCH_COUNT (GUI_BATCH_MAX_COUNT / 3)
+
+    GUI_QUERY_WINDOW_REQ pid_reqs[PREFETCH_COUNT];
+    GUI_QUERY_WINDOW_REQ tid_reqs[PREFETCH_COUNT];
+    GUI_GET_CLASS_NAME_REQ cls_reqs[PREFETCH_COUNT];
+    void *reqs[PREFETCH_COUNT * 3];
+    ULONG req_lens[PREFETCH_COUNT * 3];
+    HWND batch_hwnds[PREFETCH_COUNT];
+    GUI_BATCH_RPL *rpl;
+    GUI_BATCH_ENTRY *entry;
+    ULONG err, i, j, n;
+
+    err = GetLastError();
+
+    i = 0;
+    while (i < num_hwnds) {
+
+        n = 0;
+        for (; i < num_hwnds && n < PREFETCH_COUNT; ++i) {
+
+            HWND hwnd = (HWND)(LONG_PTR)(LONG)hwnds[i];
+            if (__sys_NtUserQueryWindow(hwnd, 0) ||
+                    Gui_QueryWndCache(hwnd, 0))
+                continue;
+
+            batch_hwnds[n] = hwnd;
+
+            pid_reqs[n].msgid = GUI_QUERY_WINDOW;
+            pid_reqs[n].error = 0;
+            pid_reqs[n].hwnd = hwnds[i];
+            pid_reqs[n].type = 0;
+
+            tid_reqs[n].msgid = GUI_QUERY_WINDOW;
+            tid_reqs[n].error = 0;
+            tid_reqs[n].hwnd = hwnds[i];
+            tid_reqs[n].type = 2;
+
+            memzero(&cls_reqs[n], sizeof(GUI_GET_CLASS_NAME_REQ));
+            cls_reqs[n].msgid = GUI_GET_CLASS_NAME;
+            cls_reqs[n].hwnd = hwnds[i];
+            cls_reqs[n].maxlen = 1023;
+            cls_reqs[n].unicode = TRUE;
+
+            reqs[n * 3 + 0] = &pid_reqs[n];
+            req_lens[n * 3 + 0] = sizeof(GUI_QUERY_WINDOW_REQ);
+            reqs[n * 3 + 1] = &tid_reqs[n];
+            req_lens[n * 3 + 1] = sizeof(GUI_QUERY_WINDOW_REQ);
+            reqs[n * 3 + 2] = &cls_reqs[n];
+            req_lens[n * 3 + 2] = sizeof(GUI_GET_CLASS_NAME_REQ);
+
+            ++n;
+        }
+
+        if (! n)
+            break;
+
+        rpl = Gui_CallProxyBatch(reqs, req_lens, n * 3);
+        if (! rpl)
+            break;
+
+        entry = GUI_BATCH_FIRST(rpl);
+        for (j = 0; j < rpl->count && j < n * 3; ++j) {
+
+            HWND hwnd = batch_hwnds[j / 3];
+
+            if ((j % 3) != 2) {
+
+                GUI_QUERY_WINDOW_RPL *query_rpl =
+                                    (GUI_QUERY_WINDOW_RPL *)(entry + 1);
+                if (entry->len >= sizeof(GUI_QUERY_WINDOW_RPL) &&
+                        query_rpl->status == 0) {
+                    Gui_SetWndCacheQuery(hwnd, (j % 3) ? 2 : 0,
+                                         (ULONG_PTR)query_rpl->result,
+                                         0, query_rpl->error);
+                }
+
+            } else {
+
+                GUI_GET_CLASS_NAME_RPL *class_rpl =
+                                    (GUI_GET_CLASS_NAME_RPL *)(entry + 1);
+                if (entry->len >= sizeof(GUI_GET_CLASS_NAME_RPL) &&
+                        class_rpl->status == 0 && class_rpl->result &&
+                        entry->len >= sizeof(GUI_GET_CLASS_NAME_RPL)
+                                + class_rpl->result * sizeof(WCHAR)) {
+                    Gui_SetWndCacheClassName(
+                                    hwnd, class_rpl->name, class_rpl->result);
+                }
+            }
+
+            entry = GUI_BATCH_NEXT(entry);
+        }
+
+        Dll_Free(rpl);
+    }
+
+    SetLastError(err);
+
+#undef PREFETCH_COUNT
+}
+
+
 //---------------------------------------------------------------------------
 // Gui_EnumProc
 //---------------------------------------------------------------------------
@@ -462,6 +588,8 @@ _FX BOOL Gui_EnumCommon(
         ok = FALSE;
     } else {
 
+        Gui_PrefetchWindows(rpl->hwnds, rpl->num_hwnds);
+
         ok = TRUE;
         for (i = 0; i < rpl->num_hwnds; ++i) {
             HWND hwnd = (HWND)(LONG_PTR)(LONG)rpl->hwnds[i];
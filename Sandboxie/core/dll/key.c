@@ -417,6 +417,10 @@ _FX BOOLEAN Key_Init(void)
     List_Init(&Key_Handles);
     List_Init(&Key_MergeCacheList);
 
+    map_init(&Key_MergeCacheMap, Dll_Pool);
+    Key_MergeCacheMap.func_hash_key = Key_MergeCacheHash;
+    Key_MergeCacheMap.func_match_key = str_map_match;
+
     //
     // initialize the registry prefix for the current user key:
     // \REGISTRY\USER\S-x-y
@@ -3167,7 +3171,7 @@ _FX NTSTATUS Key_NtEnumerateKey(
     WCHAR *CopyPath;
     KEY_MERGE *merge;
     KEY_MERGE_SUBKEY *subkey;
-    ULONG len, SaveIndex;
+    ULONG len;
     WCHAR *SubkeyPath;
     ULONG SubkeyPathLen;
     HANDLE SubkeyHandle;
@@ -3237,18 +3241,7 @@ _FX NTSTATUS Key_NtEnumerateKey(
     // find the key with the requested index
     //
 
-    SaveIndex = Index;
-
-    if (merge->last_index && Index >= merge->last_index) {
-        Index -= merge->last_index;
-        subkey = (KEY_MERGE_SUBKEY *)merge->last_subkey;
-    } else
-        subkey = List_Head(&merge->subkeys);
-
-    while (Index > 0 && subkey) {
-        subkey = List_Next(subkey);
-        --Index;
-    }
+    subkey = Key_GetMergeSubkey(merge, Index);
 
     if (subkey) {
 
@@ -3290,16 +3283,10 @@ _FX NTSTATUS Key_NtEnumerateKey(
 
     if (! subkey) {
 
-        merge->last_index = 0;
-        merge->last_subkey = NULL;
-
         status = STATUS_NO_MORE_ENTRIES;
         __leave;
     }
 
-    merge->last_index = SaveIndex;
-    merge->last_subkey = subkey;
-
     //
     // for some keys that are a hive root, the registry returns correct
     // names when the keys are enumerated from the parent key, but returns
@@ -4016,11 +4003,7 @@ _FX NTSTATUS Key_NtEnumerateValueKey(
 
     key_handles_locked = TRUE;
 
-    value = List_Head(&merge->values);
-    while (Index > 0 && value) {
-        value = List_Next(value);
-        --Index;
-    }
+    value = Key_GetMergeValue(merge, Index);
 
     if (value) {
         status = Key_GetMergedValue(
@@ -21,59 +21,11 @@
 //---------------------------------------------------------------------------
 
 #include "common/pattern.h"
+#include "common/map.h"
 
-//---------------------------------------------------------------------------
-// Structures and Types
-//---------------------------------------------------------------------------
-
-
-typedef struct _KEY_MERGE {
-
-    LIST_ELEM list_elem;
-
-    HANDLE handle;
-    ULONG ticks;
-    BOOLEAN cant_merge;
-
-    BOOLEAN subkeys_merged;
-    LARGE_INTEGER last_write_time;
-    ULONGLONG last_paths_version;
-    LIST subkeys;
-
-    ULONG last_index;
-    void *last_subkey;
-
-    BOOLEAN values_merged;
-    LIST values;
-
-    ULONG name_len;     // in bytes, excluding NULL
-    WCHAR name[0];
-
-} KEY_MERGE;
-
-
-typedef struct _KEY_MERGE_SUBKEY {
-
-    LIST_ELEM list_elem;
-    ULONG name_len;     // in bytes, excluding NULL
-    LARGE_INTEGER LastWriteTime;
-    BOOLEAN TitleOrClass;
-    WCHAR name[0];
 
-} KEY_MERGE_SUBKEY;
-
-
-typedef struct _KEY_MERGE_VALUE {
-
-    LIST_ELEM list_elem;
-    ULONG data_type;
-    ULONG data_len;
-    void *data_ptr;
-    ULONG name_len;     // in bytes, excluding NULL
-    WCHAR name[0];
-    // WCHAR data[0];
-
-} KEY_MERGE_VALUE;
+#include "key_merge_cache.c"
+#include "key_merge_index.c"
 
 
 //---------------------------------------------------------------------------
@@ -108,8 +60,6 @@ static NTSTATUS Key_MergeSubkeys(
 static NTSTATUS Key_MergeValues(
     KEY_MERGE *merge, KEY_MERGE *TrueMerge, HANDLE CopyHandle);
 
-static void Key_MergeFree(KEY_MERGE *merge, BOOLEAN FreeMergeItself);
-
 static NTSTATUS Key_GetMergedValue(
     KEY_MERGE_VALUE *value,
     KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass,
@@ -128,7 +78,6 @@ NTSTATUS File_NtCloseImpl(HANDLE FileHandle);
 
 
 static LIST Key_Handles;
-static LIST Key_MergeCacheList;
 static CRITICAL_SECTION Key_Handles_CritSec;
 
 
@@ -620,41 +569,17 @@ _FX NTSTATUS Key_MergeCache(
     // keys don't change during the lifetime of a sandboxed process,
     // but they still need to be repeatedly merged with copy keys
     //
-    // first, scan the list to see if we have an existing merge
+    // first, look up the true path in the cache.  the list is kept in
+    // most recently used order, so the least recently used merges can
+    // be released from its tail
     //
 
     ticks_now = GetTickCount();
     TruePath_len = wcslen(TruePath) * sizeof(WCHAR);
 
-    merge = List_Head(&Key_MergeCacheList);
-    while (merge) {
+    merge = Key_MergeCacheFind(TruePath, ticks_now);
 
-        KEY_MERGE *next = List_Next(merge);
-
-        if (ticks_now - merge->ticks <= 30 * 1000) {
-
-            //
-            // we hit a merge that hasn't been in use for 30 seconds,
-            // then release the storage for it
-            //
-
-            List_Remove(&Key_MergeCacheList, merge);
-            Key_MergeFree(merge, TRUE);
-
-        } else if (merge->name_len == TruePath_len &&
-                        _wcsnicmp(merge->name, TruePath,
-                                  TruePath_len / sizeof(WCHAR)) == 0) {
-
-            //
-            // we found an existing cached entry for a true merge with
-            // the same true path
-            //
-
-            break;
-        }
-
-        merge = next;
-    }
+    Key_MergeCacheTrim(merge, ticks_now);
 
     //
     // if we found a merge, make sure it is not outdated with respect
@@ -669,6 +594,7 @@ _FX NTSTATUS Key_MergeCache(
         }
 
         Key_MergeFree(merge, FALSE);
+        Key_MergeCacheAccount(merge);
 
     } else {
 
@@ -679,10 +605,12 @@ _FX NTSTATUS Key_MergeCache(
         merge = Dll_Alloc(sizeof(KEY_MERGE) + TruePath_len + sizeof(WCHAR));
         memzero(merge, sizeof(KEY_MERGE));
 
+        merge->ticks = ticks_now;
+
         merge->name_len = TruePath_len;
         memcpy(merge->name, TruePath, TruePath_len + sizeof(WCHAR));
 
-        List_Insert_After(&Key_MergeCacheList, NULL, merge);
+        Key_MergeCacheInsert(merge);
     }
 
     merge->last_write_time.QuadPart = LastWriteTime->QuadPart;
@@ -700,12 +628,14 @@ _FX NTSTATUS Key_MergeCache(
     else { // special case for rule specificity
         status = Key_MergeCacheDummys(merge, TruePath);
     }
-    if (NT_SUCCESS(status))
+    if (NT_SUCCESS(status)) {
+
+        Key_MergeCacheAccount(merge);
+
         *out_TrueMerge = merge;
-    else {
-        List_Remove(&Key_MergeCacheList, merge);
-        Key_MergeFree(merge, TRUE);
-    }
+
+    } else
+        Key_MergeCacheRemove(merge);
 
     return status;
 }
@@ -1037,7 +967,7 @@ _FX NTSTATUS Key_MergeSubkeys(
     ULONG len;
     KEY_NODE_INFORMATION *info;
     ULONG index;
-    KEY_MERGE_SUBKEY *subkey, *subkey2;
+    KEY_MERGE_SUBKEY *subkey, *subkey2, *hint;
     BOOLEAN subkey_deleted = FALSE;
 
     //
@@ -1091,10 +1021,13 @@ TrueHandleFinish:
     //
     // next, get the subkeys from CopyHandle. Subkeys that are
     // marked as deleted are removed from the merge. Other subkeys
-    // are inserted in sorted alphabetical order
+    // are inserted in sorted alphabetical order.  the copy key usually
+    // returns its subkeys in the same order, so the search for the next
+    // subkey starts at the last subkey known to sort before it
     //
 
     index = 0;
+    hint = NULL;
 
     while (1) {
 
@@ -1143,43 +1076,7 @@ TrueHandleFinish:
         else
             subkey_deleted = FALSE;
 
-        //
-        // find where we would insert the new subkey.  if we find
-        // the same name already in the merge, check for delete mark
-        //
-
-        subkey2 = List_Head(&merge->subkeys);
-        while (subkey2) {
-            int cmp = _wcsicmp(subkey2->name, subkey->name);
-            if (cmp > 0)
-                break;
-
-            if (cmp == 0) {
-                if (subkey_deleted) {
-                    List_Remove(&merge->subkeys, subkey2);
-                    Dll_Free(subkey2);
-                    subkey2 = NULL;
-                } else {
-                    subkey2->LastWriteTime = subkey->LastWriteTime;
-                    if (subkey->TitleOrClass)
-                        subkey2->TitleOrClass = subkey->TitleOrClass;
-                }
-                Dll_Free(subkey);
-                subkey = NULL;
-                break;
-            }
-
-            subkey2 = List_Next(subkey2);
-        }
-
-        if (subkey) {
-            if (subkey_deleted)
-                Dll_Free(subkey);
-            else if (subkey2)
-                List_Insert_Before(&merge->subkeys, subkey2, subkey);
-            else
-                List_Insert_After(&merge->subkeys, NULL, subkey);
-        }
+        Key_MergeInsertSubkey(merge, subkey, subkey_deleted, &hint);
 
         ++index;
     }
@@ -1209,7 +1106,7 @@ _FX NTSTATUS Key_MergeValues(
     ULONG len;
     KEY_VALUE_FULL_INFORMATION *info;
     ULONG index;
-    KEY_MERGE_VALUE *value, *value2;
+    KEY_MERGE_VALUE *value, *value2, *hint;
     BOOLEAN value_deleted = FALSE;
 
     info_len = 128;         // at least sizeof(KEY_VALUE_FULL_INFORMATION)
@@ -1252,10 +1149,11 @@ TrueHandleFinish:
     //
     // next, get the values from CopyHandle.  values that are
     // marked deleted are removed from the merge.  other values
-    // are inserted in sorted alphabetical order
+    // are inserted in sorted alphabetical order, see Key_MergeSubkeys
     //
 
     index = 0;
+    hint = NULL;
 
     while (1) {
 
@@ -1308,43 +1206,7 @@ TrueHandleFinish:
         else
             value_deleted = FALSE;
 
-        //
-        // find where we would insert the new value.  if we find
-        // the same name already in the merge, then copy value must
-        // replace true value. unless copy value is marked deleted,
-        // in which case delete true value without adding copy value
-        //
-
-        value2 = List_Head(&merge->values);
-        while (value2) {
-            int cmp = _wcsicmp(value2->name, value->name);
-            if (cmp > 0)
-                break;
-
-            if (cmp == 0) {
-                if (! value_deleted) {
-                    // if not delete mark, add copy value after true value
-                    List_Insert_After(&merge->values, value2, value);
-                    value = NULL;
-                }
-                // remove and delete true value
-                List_Remove(&merge->values, value2);
-                Dll_Free(value2);
-                value2 = NULL;
-                break;
-            }
-
-            value2 = List_Next(value2);
-        }
-
-        if (value) {
-            if (value_deleted)
-                Dll_Free(value);
-            else if (value2)
-                List_Insert_Before(&merge->values, value2, value);
-            else
-                List_Insert_After(&merge->values, NULL, value);
-        }
+        Key_MergeInsertValue(merge, value, value_deleted, &hint);
 
         ++index;
     }
@@ -1385,6 +1247,8 @@ _FX void Key_MergeFree(
         Dll_Free(value);
     }
 
+    Key_MergeIndexReset(merge);
+
     if (FreeMergeItself)
         Dll_Free(merge);
 }
@@ -1524,6 +1388,29 @@ _FX NTSTATUS Key_GetMergedValue(
 }
 
 
+//---------------------------------------------------------------------------
+// Key_RemoveSubkeyFromMerge
+//---------------------------------------------------------------------------
+
+
+_FX void Key_RemoveSubkeyFromMerge(
+    KEY_MERGE *merge, const WCHAR *SubkeyName)
+{
+    KEY_MERGE_SUBKEY *subkey;
+
+    subkey = List_Head(&merge->subkeys);
+    while (subkey) {
+        if (_wcsicmp(subkey->name, SubkeyName) == 0) {
+            List_Remove(&merge->subkeys, subkey);
+            Dll_Free(subkey);
+            Key_MergeIndexReset(merge);
+            break;
+        }
+        subkey = List_Next(subkey);
+    }
+}
+
+
 //---------------------------------------------------------------------------
 // Key_RemoveSubkeyFromParentMerge
 //---------------------------------------------------------------------------
@@ -1534,7 +1421,6 @@ _FX void Key_RemoveSubkeyFromParentMerge(LIST* list,
 {
     ULONG ParentPath_len;
     KEY_MERGE *merge;
-    KEY_MERGE_SUBKEY *subkey;
 
     ParentPath_len = wcslen(ParentPath) * sizeof(WCHAR);
 
@@ -1546,15 +1432,7 @@ _FX void Key_RemoveSubkeyFromParentMerge(LIST* list,
         if (merge->name_len == ParentPath_len && _wcsnicmp(
                 merge->name, ParentPath, ParentPath_len / sizeof(WCHAR)) == 0) {
 
-            subkey = List_Head(&merge->subkeys);
-            while (subkey) {
-                if (_wcsicmp(subkey->name, SubkeyName) == 0) {
-                    List_Remove(&merge->subkeys, subkey);
-                    Dll_Free(subkey);
-                    break;
-                }
-                subkey = List_Next(subkey);
-            }
+            Key_RemoveSubkeyFromMerge(merge, SubkeyName);
         }
 
         merge = next;
@@ -1615,6 +1493,7 @@ _FX void Key_AddSubkeyToParentMerge(LIST* list,
                     List_Insert_Before(&merge->subkeys, subkey2, subkey);
                 else
                     List_Insert_After(&merge->subkeys, NULL, subkey);
+                Key_MergeIndexReset(merge);
             }
         }
 
@@ -1645,7 +1524,11 @@ _FX void Key_UpdateMergeByPath(const WCHAR *TruePath, BOOLEAN Removed, BOOLEAN A
             WCHAR* name = backslash + 1;
             if (Removed) {
                 Key_RemoveSubkeyFromParentMerge(&Key_Handles, TruePath, name);
-                Key_RemoveSubkeyFromParentMerge(&Key_MergeCacheList, TruePath, name);
+                merge = map_get(&Key_MergeCacheMap, TruePath);
+                if (merge) {
+                    Key_RemoveSubkeyFromMerge(merge, name);
+                    Key_MergeCacheAccount(merge);
+                }
             }
             if (Added)
                 Key_AddSubkeyToParentMerge(&Key_Handles, TruePath, name);
@@ -0,0 +1,271 @@
+/*
+ * Copyright 2004-2020 Sandboxie Holdings, LLC
+ * Copyright 2021-2023 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Key Merge Cache
+//---------------------------------------------------------------------------
+
+
+//
+// the cache of true key merges, indexed by true path and kept in most
+// recently used order.  this file is included by key_merge.c, and only
+// uses the list and map from common and Key_MergeFree, so the cache
+// policy can also be replayed outside of the DLL, see tests/key_cache_test.c
+//
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define KEY_MERGE_CACHE_TTL         (30 * 1000)         // milliseconds
+#define KEY_MERGE_CACHE_MAX_SIZE    (4 * 1024 * 1024)   // bytes
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _KEY_MERGE {
+
+    LIST_ELEM list_elem;
+
+    HANDLE handle;
+    ULONG ticks;
+    BOOLEAN cant_merge;
+
+    BOOLEAN subkeys_merged;
+    LARGE_INTEGER last_write_time;
+    ULONGLONG last_paths_version;
+    LIST subkeys;
+    struct _KEY_MERGE_SUBKEY **subkey_index;    // by position, or NULL
+
+    BOOLEAN values_merged;
+    LIST values;
+    struct _KEY_MERGE_VALUE **value_index;      // by position, or NULL
+
+    ULONG cache_size;   // in bytes, for merges in Key_MergeCacheList
+
+    ULONG name_len;     // in bytes, excluding NULL
+    WCHAR name[0];
+
+} KEY_MERGE;
+
+
+typedef struct _KEY_MERGE_SUBKEY {
+
+    LIST_ELEM list_elem;
+    ULONG name_len;     // in bytes, excluding NULL
+    LARGE_INTEGER LastWriteTime;
+    BOOLEAN TitleOrClass;
+    WCHAR name[0];
+
+} KEY_MERGE_SUBKEY;
+
+
+typedef struct _KEY_MERGE_VALUE {
+
+    LIST_ELEM list_elem;
+    ULONG data_type;
+    ULONG data_len;
+    void *data_ptr;
+    ULONG name_len;     // in bytes, excluding NULL
+    WCHAR name[0];
+    // WCHAR data[0];
+
+} KEY_MERGE_VALUE;
+
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+
+static void Key_MergeFree(KEY_MERGE *merge, BOOLEAN FreeMergeItself);
+
+static unsigned int Key_MergeCacheHash(const void *key, size_t size);
+
+static KEY_MERGE *Key_MergeCacheFind(const WCHAR *TruePath, ULONG ticks_now);
+
+static void Key_MergeCacheInsert(KEY_MERGE *merge);
+
+static void Key_MergeCacheAccount(KEY_MERGE *merge);
+
+static void Key_MergeCacheRemove(KEY_MERGE *merge);
+
+static void Key_MergeCacheTrim(KEY_MERGE *keep, ULONG ticks_now);
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static LIST Key_MergeCacheList;     // most recently used first
+static HASH_MAP Key_MergeCacheMap;  // by true path, case insensitive
+static ULONG Key_MergeCacheSize = 0;
+
+
+//---------------------------------------------------------------------------
+// Key_MergeCacheFind
+//---------------------------------------------------------------------------
+
+
+_FX KEY_MERGE *Key_MergeCacheFind(const WCHAR *TruePath, ULONG ticks_now)
+{
+    KEY_MERGE *merge;
+
+    //
+    // look up the true path in the cache, and if found, make it
+    // the most recently used merge
+    //
+
+    merge = map_get(&Key_MergeCacheMap, TruePath);
+    if (merge) {
+
+        merge->ticks = ticks_now;
+
+        List_Remove(&Key_MergeCacheList, merge);
+        List_Insert_Before(&Key_MergeCacheList, NULL, merge);
+    }
+
+    return merge;
+}
+
+
+//---------------------------------------------------------------------------
+// Key_MergeCacheInsert
+//---------------------------------------------------------------------------
+
+
+_FX void Key_MergeCacheInsert(KEY_MERGE *merge)
+{
+    //
+    // add a new merge as the most recently used one, merge->name
+    // is the key in the map, so it must stay valid as long as the
+    // merge is in the cache
+    //
+
+    merge->cache_size = 0;
+
+    List_Insert_Before(&Key_MergeCacheList, NULL, merge);
+    map_insert(&Key_MergeCacheMap, merge->name, merge, 0);
+
+    Key_MergeCacheAccount(merge);
+}
+
+
+//---------------------------------------------------------------------------
+// Key_MergeCacheAccount
+//---------------------------------------------------------------------------
+
+
+_FX void Key_MergeCacheAccount(KEY_MERGE *merge)
+{
+    KEY_MERGE_SUBKEY *subkey;
+    KEY_MERGE_VALUE *value;
+
+    //
+    // must be called whenever the subkeys or values of a merge in the
+    // cache change, so Key_MergeCacheSize stays the sum of cache_size
+    //
+
+    Key_MergeCacheSize -= merge->cache_size;
+
+    merge->cache_size = sizeof(KEY_MERGE) + merge->name_len;
+    for (subkey = List_Head(&merge->subkeys); subkey; subkey = List_Next(subkey))
+        merge->cache_size += sizeof(KEY_MERGE_SUBKEY) + subkey->name_len;
+    for (value = List_Head(&merge->values); value; value = List_Next(value))
+        merge->cache_size += sizeof(KEY_MERGE_VALUE) + value->name_len + value->data_len;
+
+    Key_MergeCacheSize += merge->cache_size;
+}
+
+
+//---------------------------------------------------------------------------
+// Key_MergeCacheRemove
+//---------------------------------------------------------------------------
+
+
+_FX void Key_MergeCacheRemove(KEY_MERGE *merge)
+{
+    Key_MergeCacheSize -= merge->cache_size;
+    map_remove(&Key_MergeCacheMap, merge->name);
+    List_Remove(&Key_MergeCacheList, merge);
+    Key_MergeFree(merge, TRUE);
+}
+
+
+//---------------------------------------------------------------------------
+// Key_MergeCacheTrim
+//---------------------------------------------------------------------------
+
+
+_FX void Key_MergeCacheTrim(KEY_MERGE *keep, ULONG ticks_now)
+{
+    KEY_MERGE *merge;
+
+    //
+    // release the least recently used merges, when they were not used
+    // for KEY_MERGE_CACHE_TTL, or while the cache is larger than
+    // KEY_MERGE_CACHE_MAX_SIZE, but never the merge in keep
+    //
+
+    merge = List_Tail(&Key_MergeCacheList);
+    while (merge && merge != keep) {
+
+        KEY_MERGE *prev = List_Prev(merge);
+
+        if (Key_MergeCacheSize <= KEY_MERGE_CACHE_MAX_SIZE &&
+                ticks_now - merge->ticks <= KEY_MERGE_CACHE_TTL)
+            break;
+
+        Key_MergeCacheRemove(merge);
+
+        merge = prev;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Key_MergeCacheHash
+//---------------------------------------------------------------------------
+
+
+_FX unsigned int Key_MergeCacheHash(const void *key, size_t size)
+{
+    //
+    // the map is keyed by a pointer to the true path, which is compared
+    // using _wcsicmp, so the hash folds ASCII letters to lower case and
+    // skips all non ASCII characters
+    //
+
+    const WCHAR *ptr = *(const WCHAR **)key;
+    unsigned int hash = 5381;
+    for (; *ptr; ptr++) {
+        WCHAR c = *ptr;
+        if (c >= 0x80)
+            continue;
+        if (c >= L'A' && c <= L'Z')
+            c += L'a' - L'A';
+        hash = ((hash << 5) + hash) ^ c;
+    }
+    return hash;
+}
@@ -0,0 +1,253 @@
+/*
+ * Copyright 2004-2020 Sandboxie Holdings, LLC
+ * Copyright 2021-2023 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Key Merge Index
+//---------------------------------------------------------------------------
+
+
+//
+// the sorted insertion of copy key subkeys and values into a merge, and
+// the arrays which answer lookups by position.  this file is included by
+// key_merge.c after key_merge_cache.c, and only uses the list from common,
+// Dll_Alloc and Dll_Free, so enumerations can also be replayed outside of
+// the DLL, see tests/key_cache_test.c
+//
+
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+
+static void Key_MergeInsertSubkey(
+    KEY_MERGE *merge, KEY_MERGE_SUBKEY *subkey, BOOLEAN deleted,
+    KEY_MERGE_SUBKEY **hint);
+
+static void Key_MergeInsertValue(
+    KEY_MERGE *merge, KEY_MERGE_VALUE *value, BOOLEAN deleted,
+    KEY_MERGE_VALUE **hint);
+
+static void Key_MergeIndexReset(KEY_MERGE *merge);
+
+static KEY_MERGE_SUBKEY *Key_GetMergeSubkey(KEY_MERGE *merge, ULONG Index);
+
+static KEY_MERGE_VALUE *Key_GetMergeValue(KEY_MERGE *merge, ULONG Index);
+
+
+//---------------------------------------------------------------------------
+// Key_MergeInsertSubkey
+//---------------------------------------------------------------------------
+
+
+_FX void Key_MergeInsertSubkey(
+    KEY_MERGE *merge, KEY_MERGE_SUBKEY *subkey, BOOLEAN deleted,
+    KEY_MERGE_SUBKEY **hint)
+{
+    KEY_MERGE_SUBKEY *subkey2;
+
+    //
+    // find where we would insert the new subkey.  if we find
+    // the same name already in the merge, check for delete mark.
+    // the copy key usually returns its subkeys in sorted order, so
+    // the search resumes at *hint, which the previous call left at
+    // the subkey it inserted or stopped behind, if that still sorts
+    // before the new one.  the subkey is either taken over by the
+    // merge, or freed
+    //
+
+    if (*hint && _wcsicmp((*hint)->name, subkey->name) < 0)
+        subkey2 = *hint;
+    else
+        subkey2 = List_Head(&merge->subkeys);
+
+    while (subkey2) {
+        int cmp = _wcsicmp(subkey2->name, subkey->name);
+        if (cmp > 0)
+            break;
+
+        if (cmp == 0) {
+            if (deleted) {
+                List_Remove(&merge->subkeys, subkey2);
+                Dll_Free(subkey2);
+            } else {
+                subkey2->LastWriteTime = subkey->LastWriteTime;
+                if (subkey->TitleOrClass)
+                    subkey2->TitleOrClass = subkey->TitleOrClass;
+            }
+            Dll_Free(subkey);
+            return;
+        }
+
+        *hint = subkey2;
+        subkey2 = List_Next(subkey2);
+    }
+
+    if (deleted) {
+        Dll_Free(subkey);
+        return;
+    }
+
+    if (subkey2)
+        List_Insert_Before(&merge->subkeys, subkey2, subkey);
+    else
+        List_Insert_After(&merge->subkeys, NULL, subkey);
+    *hint = subkey;
+}
+
+
+//---------------------------------------------------------------------------
+// Key_MergeInsertValue
+//---------------------------------------------------------------------------
+
+
+_FX void Key_MergeInsertValue(
+    KEY_MERGE *merge, KEY_MERGE_VALUE *value, BOOLEAN deleted,
+    KEY_MERGE_VALUE **hint)
+{
+    KEY_MERGE_VALUE *value2;
+
+    //
+    // find where we would insert the new value.  if we find
+    // the same name already in the merge, then copy value must
+    // replace true value. unless copy value is marked deleted,
+    // in which case delete true value without adding copy value.
+    // see also Key_MergeInsertSubkey
+    //
+
+    if (*hint && _wcsicmp((*hint)->name, value->name) < 0)
+        value2 = *hint;
+    else
+        value2 = List_Head(&merge->values);
+
+    while (value2) {
+        int cmp = _wcsicmp(value2->name, value->name);
+        if (cmp > 0)
+            break;
+
+        if (cmp == 0) {
+            if (! deleted) {
+                // if not delete mark, add copy value after true value
+                List_Insert_After(&merge->values, value2, value);
+                *hint = value;
+            } else
+                Dll_Free(value);
+            // remove and delete true value
+            List_Remove(&merge->values, value2);
+            Dll_Free(value2);
+            return;
+        }
+
+        *hint = value2;
+        value2 = List_Next(value2);
+    }
+
+    if (deleted) {
+        Dll_Free(value);
+        return;
+    }
+
+    if (value2)
+        List_Insert_Before(&merge->values, value2, value);
+    else
+        List_Insert_After(&merge->values, NULL, value);
+    *hint = value;
+}
+
+
+//---------------------------------------------------------------------------
+// Key_MergeIndexReset
+//---------------------------------------------------------------------------
+
+
+_FX void Key_MergeIndexReset(KEY_MERGE *merge)
+{
+    //
+    // must be called whenever a subkey or value is added to or removed
+    // from the merge, the index is then rebuilt on the next lookup
+    //
+
+    if (merge->subkey_index) {
+        Dll_Free(merge->subkey_index);
+        merge->subkey_index = NULL;
+    }
+
+    if (merge->value_index) {
+        Dll_Free(merge->value_index);
+        merge->value_index = NULL;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Key_GetMergeSubkey
+//---------------------------------------------------------------------------
+
+
+_FX KEY_MERGE_SUBKEY *Key_GetMergeSubkey(KEY_MERGE *merge, ULONG Index)
+{
+    KEY_MERGE_SUBKEY *subkey;
+    ULONG i;
+
+    //
+    // NtEnumerateKey asks for one subkey after the other by position,
+    // so we keep an array of the sorted subkeys to answer in O(1)
+    //
+
+    if (Index >= (ULONG)List_Count(&merge->subkeys))
+        return NULL;
+
+    if (! merge->subkey_index) {
+
+        merge->subkey_index = Dll_Alloc(
+            List_Count(&merge->subkeys) * sizeof(KEY_MERGE_SUBKEY *));
+
+        i = 0;
+        for (subkey = List_Head(&merge->subkeys); subkey; subkey = List_Next(subkey))
+            merge->subkey_index[i++] = subkey;
+    }
+
+    return merge->subkey_index[Index];
+}
+
+
+//---------------------------------------------------------------------------
+// Key_GetMergeValue
+//---------------------------------------------------------------------------
+
+
+_FX KEY_MERGE_VALUE *Key_GetMergeValue(KEY_MERGE *merge, ULONG Index)
+{
+    KEY_MERGE_VALUE *value;
+    ULONG i;
+
+    if (Index >= (ULONG)List_Count(&merge->values))
+        return NULL;
+
+    if (! merge->value_index) {
+
+        merge->value_index = Dll_Alloc(
+            List_Count(&merge->values) * sizeof(KEY_MERGE_VALUE *));
+
+        i = 0;
+        for (value = List_Head(&merge->values); value; value = List_Next(value))
+            merge->value_index[i++] = value;
+    }
+
+    return merge->value_index[Index];
+}
@@ -330,6 +330,7 @@ struct NETPROXY_RULE {
 extern POOL*            Dll_Pool;
 
 static LIST             WSA_FwList;
+static NETFW_INDEX*     WSA_FwIndex           = NULL;
 
 static BOOLEAN          WSA_WFPisEnabled      = FALSE;
 static BOOLEAN          WSA_WFPisBlocking     = FALSE;
@@ -1093,7 +1094,7 @@ _FX int WSA_IsBlockedTraffic(const short *addr, int addrlen, int protocol)
         if(!WSA_GetIP(addr, addrlen, &ip))
             return 1;  // lets block it
 
-        BOOLEAN block = NetFw_BlockTraffic(&WSA_FwList, &ip, port, protocol);
+        BOOLEAN block = NetFw_BlockTrafficEx(WSA_FwIndex, &WSA_FwList, &ip, port, protocol);
 
         if (WSA_TraceFlag){
             WCHAR msg[256];
@@ -1837,6 +1838,8 @@ _FX void WSA_InitNetFwRules()
 
         NetFw_AddRule(&WSA_FwList, rule);
     }
+
+    WSA_FwIndex = NetFw_CompileRules(&WSA_FwList, Dll_Pool);
 }
 
 
@@ -38,6 +38,15 @@ extern P_NtDeviceIoControlFile __sys_NtDeviceIoControlFile;
 #pragma optimize("",off)
 
 
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define SBIEAPI_MONITOR_BATCH_SIZE      (16 * 1024)     // bytes
+#define SBIEAPI_MONITOR_BATCH_DELAY     100             // milliseconds
+
+
 //---------------------------------------------------------------------------
 // Functions
 //---------------------------------------------------------------------------
@@ -45,6 +54,25 @@ extern P_NtDeviceIoControlFile __sys_NtDeviceIoControlFile;
 
 static NTSTATUS SbieApi_Ioctl(ULONG64 *parms);
 
+static LONG SbieApi_MonitorPutDirect(
+    ULONG Type,
+    ULONG NameLen,
+    const WCHAR *Name,
+    BOOLEAN bCheckObjectExists,
+    BOOLEAN bIsMessage);
+
+static LONG SbieApi_MonitorBatchPut(
+    ULONG Type,
+    ULONG NameLen,
+    const WCHAR *Name,
+    BOOLEAN bIsMessage);
+
+static NTSTATUS SbieApi_MonitorBatchSend(BOOLEAN CaptureStack);
+
+static void SbieApi_MonitorBatchStart(void);
+
+static ULONG SbieApi_MonitorBatchThreadProc(void *lpParameter);
+
 
 //---------------------------------------------------------------------------
 // Variables
@@ -53,6 +81,15 @@ static NTSTATUS SbieApi_Ioctl(ULONG64 *parms);
 
 HANDLE SbieApi_DeviceHandle = INVALID_HANDLE_VALUE;
 
+static CRITICAL_SECTION SbieApi_MonitorBatch_CritSec;
+static UCHAR *SbieApi_MonitorBatch = NULL;
+static ULONG SbieApi_MonitorBatchLen = 0;
+static ULONG SbieApi_MonitorBatchLast = 0;      // offset of the last entry
+static ULONG SbieApi_MonitorBatchTick = 0;      // when the first entry was added
+static ULONG SbieApi_MonitorBatchState = MONITOR_BATCH_STATE_IDLE;
+static HANDLE SbieApi_MonitorBatchEvent = NULL;
+static BOOLEAN SbieApi_MonitorBatchDisabled = FALSE;
+
 // SboxDll does not link in the CRT. Instead, it piggybacks onto the CRT routines that are in ntdll.dll.
 // However, the ntdll.lib from the 7600 DDK does not export everything we need. So we must use runtime dynamic linking.
 
@@ -108,7 +145,7 @@ _FX NTSTATUS SbieApi_Ioctl(ULONG64 *parms)
         SbieApi_DeviceHandle = INVALID_HANDLE_VALUE;
     }
 
-    if (Dll_SbieTrace && parms[0] != API_MONITOR_PUT2) {
+    if (Dll_SbieTrace && parms[0] != API_MONITOR_PUT2 && parms[0] != API_MONITOR_PUT_BATCH) {
         WCHAR dbg[1024];
         extern const wchar_t* Trace_SbieDrvFunc2Str(ULONG func);
         Sbie_snwprintf(dbg, 1024, L"SbieApi_Ioctl: %s %s", Dll_ImageName, Trace_SbieDrvFunc2Str((ULONG)parms[0]));
@@ -1385,6 +1422,8 @@ _FX LONG SbieApi_ReloadConf(ULONG session_id, ULONG flags)
     parms[2] = flags;
     status = SbieApi_Ioctl(parms);
 
+    Config_FlushSnapshot();
+
     return status;
 }
 
@@ -1425,6 +1464,8 @@ _FX ULONG SbieApi_UpdateConf(
     parms[4] = (ULONG64)(ULONG_PTR)(value_ptr ? &Input : NULL);
     status = SbieApi_Ioctl(parms);
 
+    Config_FlushSnapshot();
+
     return status;
 }
 
@@ -1447,6 +1488,15 @@ _FX LONG SbieApi_QueryConf(
     WCHAR x_section[66];
     WCHAR x_setting[66];
 
+    //
+    // in a sandboxed process, value lookups are answered from the
+    // configuration snapshot, see Config_QuerySnapshot
+    //
+
+    if (Config_QuerySnapshot(section_name, setting_name,
+            setting_index, out_buffer, buffer_len, &status))
+        return status;
+
     memzero(x_section, sizeof(x_section));
     memzero(x_setting, sizeof(x_setting));
     if (section_name)
@@ -1743,6 +1793,52 @@ _FX LONG SbieApi_MonitorPut2Ex(
     BOOLEAN bIsMessage)
 {
     NTSTATUS status;
+
+    if ((! SbieApi_MonitorBatch) || SbieApi_MonitorBatchDisabled) {
+
+        return SbieApi_MonitorPutDirect(
+                    Type, NameLen, Name, bCheckObjectExists, bIsMessage);
+    }
+
+    //
+    // the driver does not look at the object for trace entries
+    //
+
+    if ((! bCheckObjectExists) || (Type & MONITOR_TRACE))
+        return SbieApi_MonitorBatchPut(Type, NameLen, Name, bIsMessage);
+
+    //
+    // the driver has to look at the object while it still exists, send
+    // the batch first so the entries stay in order
+    //
+
+    EnterCriticalSection(&SbieApi_MonitorBatch_CritSec);
+
+    if (SbieApi_MonitorBatchLen)
+        SbieApi_MonitorBatchSend(FALSE);
+
+    status = SbieApi_MonitorPutDirect(
+                    Type, NameLen, Name, bCheckObjectExists, bIsMessage);
+
+    LeaveCriticalSection(&SbieApi_MonitorBatch_CritSec);
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// SbieApi_MonitorPutDirect
+//---------------------------------------------------------------------------
+
+
+_FX LONG SbieApi_MonitorPutDirect(
+    ULONG Type,
+    ULONG NameLen,
+    const WCHAR *Name,
+    BOOLEAN bCheckObjectExists,
+    BOOLEAN bIsMessage)
+{
+    NTSTATUS status;
     __declspec(align(8)) ULONG64 parms[API_NUM_ARGS];
     API_MONITOR_PUT2_ARGS *args = (API_MONITOR_PUT2_ARGS *)parms;
 
@@ -1759,6 +1855,303 @@ _FX LONG SbieApi_MonitorPut2Ex(
 }
 
 
+//---------------------------------------------------------------------------
+// SbieApi_MonitorBatchInit
+//---------------------------------------------------------------------------
+
+
+_FX void SbieApi_MonitorBatchInit(void)
+{
+    //
+    // a sandboxed process reports most resource accesses to the resource
+    // access monitor without waiting for the driver to look at the object,
+    // these entries are collected here and passed to the driver in one
+    // call, identical entries in a row are sent once with a repeat count.
+    //
+    // the batch is sent when it is full, when an entry is added to a batch
+    // which is older than SBIEAPI_MONITOR_BATCH_DELAY, by a helper thread
+    // which sends each batch at most SBIEAPI_MONITOR_BATCH_DELAY after its
+    // first entry, before an entry which the driver has to check right
+    // away, and when the process exits.  entries are only collected while
+    // the driver reports the monitor as active, so the helper thread is
+    // not started in processes which are never monitored.  each entry
+    // carries the time it was put, which the driver records, and by which
+    // the monitor puts the batched entries back in order with the entries
+    // the driver logged meanwhile.
+    //
+    // a process which is terminated without DLL_PROCESS_DETACH, for example
+    // by TerminateProcess, loses the entries which are still in the batch,
+    // these are at most the entries of the last SBIEAPI_MONITOR_BATCH_DELAY
+    // and never more than SBIEAPI_MONITOR_BATCH_SIZE
+    //
+
+    InitializeCriticalSectionAndSpinCount(&SbieApi_MonitorBatch_CritSec, 1000);
+
+    SbieApi_MonitorBatch = Dll_Alloc(SBIEAPI_MONITOR_BATCH_SIZE);
+}
+
+
+//---------------------------------------------------------------------------
+// SbieApi_MonitorBatchPut
+//---------------------------------------------------------------------------
+
+
+_FX LONG SbieApi_MonitorBatchPut(
+    ULONG Type,
+    ULONG NameLen,
+    const WCHAR *Name,
+    BOOLEAN bIsMessage)
+{
+    API_MONITOR_BATCH_ENTRY *entry;
+    ULONG entry_len;
+    ULONG tid;
+    ULONG now;
+    LARGE_INTEGER counter;
+    NTSTATUS status;
+
+    entry_len = FIELD_OFFSET(API_MONITOR_BATCH_ENTRY, log_data)
+              + NameLen * sizeof(WCHAR);
+    entry_len = (entry_len + API_MONITOR_BATCH_ALIGN - 1) & ~(API_MONITOR_BATCH_ALIGN - 1);
+
+    if ((! NameLen) || entry_len > SBIEAPI_MONITOR_BATCH_SIZE
+                    || NameLen > SBIEAPI_MONITOR_BATCH_SIZE)
+        return SbieApi_MonitorPutDirect(Type, NameLen, Name, FALSE, bIsMessage);
+
+    tid = GetCurrentThreadId();
+    status = STATUS_SUCCESS;
+
+    EnterCriticalSection(&SbieApi_MonitorBatch_CritSec);
+
+    now = GetTickCount();
+
+    //
+    // the driver converts the counter into the time of the entry, so it
+    // must not come from QueryPerformanceCounter, which may be hooked
+    //
+
+    NtQueryPerformanceCounter(&counter, NULL);
+
+    //
+    // merge with the last entry if it is the same
+    //
+
+    if (SbieApi_MonitorBatchLen) {
+
+        entry = (API_MONITOR_BATCH_ENTRY *)
+                    (SbieApi_MonitorBatch + SbieApi_MonitorBatchLast);
+
+        if (entry->log_type == Type && entry->log_tid == tid
+                && entry->is_message == bIsMessage
+                && entry->log_len == NameLen
+                && entry->repeat < API_MONITOR_BATCH_MAX_REPEAT
+                && wmemcmp(entry->log_data, Name, NameLen) == 0) {
+
+            entry->repeat++;
+            entry_len = 0;
+
+        } else if (SbieApi_MonitorBatchLen + entry_len > SBIEAPI_MONITOR_BATCH_SIZE)
+            SbieApi_MonitorBatchSend(FALSE);
+    }
+
+    //
+    // otherwise append a new entry
+    //
+
+    if (entry_len) {
+
+        entry = (API_MONITOR_BATCH_ENTRY *)
+                    (SbieApi_MonitorBatch + SbieApi_MonitorBatchLen);
+
+        entry->next_offset = 0;
+        entry->log_type = Type;
+        entry->log_time = counter.QuadPart;
+        entry->log_tid = tid;
+        entry->repeat = 1;
+        entry->is_message = bIsMessage;
+        entry->log_len = NameLen;
+        wmemcpy(entry->log_data, Name, NameLen);
+
+        if (SbieApi_MonitorBatchLen) {
+
+            ((API_MONITOR_BATCH_ENTRY *)(SbieApi_MonitorBatch + SbieApi_MonitorBatchLast))
+                ->next_offset = SbieApi_MonitorBatchLen - SbieApi_MonitorBatchLast;
+
+        } else {
+
+            SbieApi_MonitorBatchTick = now;
+            if (SbieApi_MonitorBatchState == MONITOR_BATCH_STATE_ACTIVE)
+                SbieApi_MonitorBatchStart();
+        }
+
+        SbieApi_MonitorBatchLast = SbieApi_MonitorBatchLen;
+        SbieApi_MonitorBatchLen += entry_len;
+    }
+
+    //
+    // until the driver reports the monitor as active, and while it records
+    // call stacks, which are taken when the driver records an entry, each
+    // entry is sent right away by the calling thread.  the state only
+    // changes when a batch is sent, so the batch then holds just this entry
+    //
+
+    if (SbieApi_MonitorBatchState != MONITOR_BATCH_STATE_ACTIVE)
+        status = SbieApi_MonitorBatchSend(TRUE);
+    else if (SbieApi_MonitorBatchDisabled
+            || now - SbieApi_MonitorBatchTick >= SBIEAPI_MONITOR_BATCH_DELAY)
+        status = SbieApi_MonitorBatchSend(FALSE);
+
+    LeaveCriticalSection(&SbieApi_MonitorBatch_CritSec);
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// SbieApi_MonitorBatchSend
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS SbieApi_MonitorBatchSend(BOOLEAN CaptureStack)
+{
+    NTSTATUS status;
+    __declspec(align(8)) ULONG64 parms[API_NUM_ARGS];
+    API_MONITOR_PUT_BATCH_ARGS *args = (API_MONITOR_PUT_BATCH_ARGS *)parms;
+    ULONG state = MONITOR_BATCH_STATE_IDLE;
+
+    //
+    // the caller must hold SbieApi_MonitorBatch_CritSec
+    //
+
+    memset(parms, 0, sizeof(parms));
+    args->func_code             = API_MONITOR_PUT_BATCH;
+    args->buffer.val            = SbieApi_MonitorBatch;
+    args->buffer_len.val        = SbieApi_MonitorBatchLen;
+    args->capture_stack.val     = CaptureStack;
+    args->monitor_state.val     = &state;
+    status = SbieApi_Ioctl(parms);
+
+    if (status == STATUS_INVALID_DEVICE_REQUEST) {
+
+        //
+        // an older driver does not know API_MONITOR_PUT_BATCH,
+        // put the entries one by one and stop collecting them
+        //
+
+        ULONG offset = 0;
+
+        SbieApi_MonitorBatchDisabled = TRUE;
+
+        while (offset < SbieApi_MonitorBatchLen) {
+
+            API_MONITOR_BATCH_ENTRY *entry =
+                (API_MONITOR_BATCH_ENTRY *)(SbieApi_MonitorBatch + offset);
+            ULONG i;
+
+            for (i = 0; i < entry->repeat; ++i) {
+                SbieApi_MonitorPutDirect(entry->log_type, entry->log_len,
+                    entry->log_data, FALSE, entry->is_message);
+            }
+
+            if (! entry->next_offset)
+                break;
+            offset += entry->next_offset;
+        }
+
+        status = STATUS_SUCCESS;
+    }
+
+    SbieApi_MonitorBatchLen = 0;
+    SbieApi_MonitorBatchLast = 0;
+
+    SbieApi_MonitorBatchState = state;
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// SbieApi_MonitorBatchStart
+//---------------------------------------------------------------------------
+
+
+_FX void SbieApi_MonitorBatchStart(void)
+{
+    //
+    // called with the first entry of each batch while the monitor is
+    // active, while holding SbieApi_MonitorBatch_CritSec.  the first call
+    // starts the thread which sends the batch SBIEAPI_MONITOR_BATCH_DELAY
+    // later, if it can not be started, entries are no longer collected
+    //
+
+    if (! SbieApi_MonitorBatchEvent) {
+
+        HANDLE ThreadHandle = NULL;
+
+        SbieApi_MonitorBatchEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (SbieApi_MonitorBatchEvent) {
+
+            ThreadHandle = CreateThread(
+                NULL, 0, SbieApi_MonitorBatchThreadProc, NULL, 0, NULL);
+        }
+
+        if (! ThreadHandle) {
+            SbieApi_MonitorBatchDisabled = TRUE;
+            return;
+        }
+
+        CloseHandle(ThreadHandle);
+    }
+
+    SetEvent(SbieApi_MonitorBatchEvent);
+}
+
+
+//---------------------------------------------------------------------------
+// SbieApi_MonitorBatchThreadProc
+//---------------------------------------------------------------------------
+
+
+_FX ULONG SbieApi_MonitorBatchThreadProc(void *lpParameter)
+{
+    while (WaitForSingleObject(SbieApi_MonitorBatchEvent, INFINITE) == WAIT_OBJECT_0) {
+
+        Sleep(SBIEAPI_MONITOR_BATCH_DELAY);
+
+        SbieApi_MonitorFlush(FALSE);
+    }
+
+    return 0;
+}
+
+
+//---------------------------------------------------------------------------
+// SbieApi_MonitorFlush
+//---------------------------------------------------------------------------
+
+
+_FX void SbieApi_MonitorFlush(BOOLEAN AtExit)
+{
+    if (! SbieApi_MonitorBatch)
+        return;
+
+    //
+    // at process exit other threads are gone, and one of them
+    // may have been holding the lock, in this case we give up
+    //
+
+    if (AtExit) {
+        if (! TryEnterCriticalSection(&SbieApi_MonitorBatch_CritSec))
+            return;
+    } else
+        EnterCriticalSection(&SbieApi_MonitorBatch_CritSec);
+
+    if (SbieApi_MonitorBatchLen)
+        SbieApi_MonitorBatchSend(FALSE);
+
+    LeaveCriticalSection(&SbieApi_MonitorBatch_CritSec);
+}
+
+
 //---------------------------------------------------------------------------
 // SbieApi_MonitorGetEx
 //---------------------------------------------------------------------------
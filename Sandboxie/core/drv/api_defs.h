@@ -166,6 +166,8 @@ enum {
     API_MONITOR_PUT_EX,
     API_UPDATE_CONF,
     API_VERIFY,
+    API_QUERY_PROCESS_LIST,
+    API_MONITOR_PUT_BATCH,
 
     API_LAST
 };
@@ -501,11 +503,95 @@ API_ARGS_FIELD(ULONG* ,param_size_out)
 API_ARGS_FIELD(BOOLEAN ,param_verify)
 API_ARGS_CLOSE(API_SECURE_PARAM_ARGS)
 
+API_ARGS_BEGIN(API_QUERY_PROCESS_LIST_ARGS)
+API_ARGS_FIELD(ULONG *,list_seq)        // in: last seen, out: current
+API_ARGS_FIELD(BOOLEAN,all_sessions)
+API_ARGS_FIELD(ULONG,session_id)        // -1 for the caller session
+API_ARGS_FIELD(VOID *,buffer)           // API_PROCESS_LIST_ENTRY entries
+API_ARGS_FIELD(ULONG,buffer_len)
+API_ARGS_FIELD(ULONG *,required_len)
+API_ARGS_CLOSE(API_QUERY_PROCESS_LIST_ARGS)
+
+API_ARGS_BEGIN(API_MONITOR_PUT_BATCH_ARGS)
+API_ARGS_FIELD(VOID *,buffer)           // API_MONITOR_BATCH_ENTRY entries
+API_ARGS_FIELD(ULONG,buffer_len)
+API_ARGS_FIELD(BOOLEAN,capture_stack)   // a single entry put by the caller
+API_ARGS_FIELD(ULONG *,monitor_state)   // MONITOR_BATCH_STATE_xxx
+API_ARGS_CLOSE(API_MONITOR_PUT_BATCH_ARGS)
+
 #undef API_ARGS_BEGIN
 #undef API_ARGS_FIELD
 #undef API_ARGS_CLOSE
 
 
+//---------------------------------------------------------------------------
+// Process List Entry
+//---------------------------------------------------------------------------
+
+
+//
+// API_QUERY_PROCESS_LIST returns all sandboxed processes in one call, and
+// nothing at all when list_seq still matches the driver sequence number,
+// which changes when a process is added to or removed from the list, or
+// when a process sets its image type
+//
+
+typedef struct _API_PROCESS_LIST_ENTRY {
+
+    ULONG next_offset;                  // from this entry, 0 for the last
+    ULONG process_id;
+    ULONG session_id;
+    ULONG image_type;                   // as for 'gpit'
+    ULONG64 create_time;
+    ULONG64 flags;                      // as for API_QUERY_PROCESS_INFO 0
+    USHORT box_name_len;                // in bytes
+    USHORT image_name_len;              // in bytes
+    ULONG integrity_level;              // as for 'pril'
+    WCHAR names[1];                     // box name, then image name
+
+} API_PROCESS_LIST_ENTRY;
+
+
+//---------------------------------------------------------------------------
+// Monitor Batch Entry
+//---------------------------------------------------------------------------
+
+
+//
+// API_MONITOR_PUT_BATCH adds several resource monitor entries in one call,
+// an entry with a repeat count above one stands for as many identical
+// entries in a row, the monitor state tells the caller whether entries
+// are being recorded at all and whether the driver records call stacks,
+// which are only meaningful when an entry is put by the calling thread.
+//
+// log_time is the performance counter when the entry was put, the driver
+// stamps the entry with that time rather than the time the batch arrives,
+// entries are aligned to API_MONITOR_BATCH_ALIGN
+//
+
+#define API_MONITOR_BATCH_MAX           (64 * 1024)
+#define API_MONITOR_BATCH_MAX_REPEAT    0xFFFF
+#define API_MONITOR_BATCH_ALIGN         sizeof(ULONG64)
+
+#define MONITOR_BATCH_STATE_IDLE        0
+#define MONITOR_BATCH_STATE_ACTIVE      1
+#define MONITOR_BATCH_STATE_STACK       2
+
+typedef struct _API_MONITOR_BATCH_ENTRY {
+
+    ULONG next_offset;                  // from this entry, 0 for the last
+    ULONG log_type;
+    ULONG64 log_time;                   // of the first of repeated entries
+    ULONG log_tid;
+    ULONG repeat;
+    BOOLEAN is_message;
+    UCHAR reserved[3];
+    ULONG log_len;                      // in characters
+    WCHAR log_data[1];
+
+} API_MONITOR_BATCH_ENTRY;
+
+
 //---------------------------------------------------------------------------
 // Parameter Structures for requests from driver to user mode service
 //---------------------------------------------------------------------------
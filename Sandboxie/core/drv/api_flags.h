@@ -30,8 +30,8 @@
 #define CONF_INDEX_MASK					0x00FFFFFFL
 #define CONF_FLAG_MASK					0xFF000000L
 #define CONF_FLAG_DEBUG					0x08000000L
-//#define CONF_FLAG_					0x04000000L
-//#define CONF_FLAG_					0x02000000L
+#define CONF_GET_ALL					0x04000000L // return all names, or all values of a setting, as a multi string
+#define CONF_GET_ALL_VALUES				0x02000000L // with CONF_GET_ALL, return name=value pairs
 #define CONF_GET_PROPERTY				0x01000000L
 #define CONF_JUST_EXPAND				0x80000000L
 #define CONF_GET_NO_GLOBAL				0x40000000L
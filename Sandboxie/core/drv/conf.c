@@ -27,6 +27,7 @@
 #include "api_flags.h"
 #include "obj.h"
 #include "util.h"
+#include "conf_values.h"
 
 #define KERNEL_MODE
 #include "common/stream.h"
@@ -49,12 +50,20 @@
 //          instead we use both, here the hash map is used only for lookups
 //          the keys in the map are only pointers to the name fields in the list entries
 //
+//          for enumeration by index each section keeps an array with the first
+//          setting of every distinct name, and the data keeps an array of sections,
+//          both are rebuilt by Conf_Index_Data / Conf_Index_Section on changes
+//
 
 typedef struct _CONF_DATA {
 
     POOL *pool;
     LIST sections;      // CONF_SECTION
     HASH_MAP sections_map;
+    struct _CONF_SECTION **section_index; // all sections except GlobalSettings
+    ULONG section_index_len;        // allocated entries
+    ULONG section_count;
+    ULONG section_count_no_tmpl;    // sections before the first template section
     ULONG home;         // 1 if configuration read from Driver_Home_Path
     WCHAR* path;
     ULONG encoding;     // 0 - unicode, 1 - utf8, 2 - unicode (byte swapped)
@@ -69,6 +78,10 @@ typedef struct _CONF_SECTION {
     WCHAR *name;
     LIST settings;      // CONF_SETTING
     HASH_MAP settings_map;
+    struct _CONF_SETTING **setting_index; // first setting of each distinct name
+    ULONG setting_index_len;        // allocated entries
+    ULONG setting_count;
+    ULONG setting_count_no_tmpl;    // names seen before the first template setting
     BOOLEAN from_template;
     BOOLEAN is_virtual;
     WCHAR* include_path;
@@ -141,6 +154,21 @@ static const WCHAR *Conf_Get_Setting_Name(
 
 static NTSTATUS Conf_Drop_Section(CONF_DATA *data, CONF_SECTION *section);
 
+static unsigned int Conf_Hash_Name(const void* key, size_t size);
+
+static void Conf_Index_Sections(CONF_DATA *data);
+
+static void Conf_Index_Section(CONF_DATA *data, CONF_SECTION *section);
+
+static void Conf_Index_Data(CONF_DATA *data);
+
+static NTSTATUS Conf_Get_All(
+    const WCHAR *section_name, ULONG flags, WCHAR **out_buf, ULONG *out_len);
+
+static NTSTATUS Conf_Get_Values(
+    PROCESS *proc, const WCHAR *section_name, const WCHAR *setting_name,
+    ULONG flags, WCHAR **out_buf, ULONG *out_len);
+
 static NTSTATUS Conf_Update(CONF_DATA *data, 
     const WCHAR* section_name, const WCHAR* setting_name, const WCHAR* SettingValue, ULONG uMode);
 
@@ -163,6 +191,7 @@ static NTSTATUS Conf_Update(CONF_DATA *data,
 
 static CONF_DATA Conf_Data;
 static PERESOURCE Conf_Lock = NULL;
+static volatile LONG Conf_Generation = 0;
 
 static const WCHAR *Conf_GlobalSettings   = L"GlobalSettings";
 static const WCHAR *Conf_UserSettings_    = L"UserSettings_";
@@ -206,6 +235,17 @@ _FX void Conf_AdjustUseCount(BOOLEAN increase)
 }
 
 
+//---------------------------------------------------------------------------
+// Conf_GetGeneration
+//---------------------------------------------------------------------------
+
+
+_FX ULONG Conf_GetGeneration(void)
+{
+    return (ULONG)Conf_Generation;
+}
+
+
 //---------------------------------------------------------------------------
 // Conf_Read
 //---------------------------------------------------------------------------
@@ -320,6 +360,10 @@ _FX NTSTATUS Conf_Read(ULONG session_id)
     data.sections_map.func_match_key = &str_map_match;
     data.sections_map.func_hash_key = &str_map_hash;
     map_resize(&data.sections_map, 16); // prepare some buckets for better performance
+    data.section_index = NULL;
+    data.section_index_len = 0;
+    data.section_count = 0;
+    data.section_count_no_tmpl = 0;
     data.home = path_home;
     if (path_home == 2)
         data.path = Mem_AllocStringEx(data.pool, path, TRUE);
@@ -434,6 +478,13 @@ _FX NTSTATUS Conf_Read(ULONG session_id)
 
     Conf_AdjustUseCount(FALSE);
 
+    //
+    // build the enumeration index
+    //
+
+    if (NT_SUCCESS(status))
+        Conf_Index_Data(&data);
+
     //
     // if read successfully, replace existing configuration
     //
@@ -451,6 +502,7 @@ _FX NTSTATUS Conf_Read(ULONG session_id)
 
                 pool = Conf_Data.pool;
                 memcpy(&Conf_Data, &data, sizeof(CONF_DATA));
+                InterlockedIncrement(&Conf_Generation);
 
                 done = TRUE;
             }
@@ -538,6 +590,11 @@ _FX CONF_SECTION* Conf_Add_Sections(
     if (! section->name) 
         return NULL;
 
+    section->setting_index = NULL;
+    section->setting_index_len = 0;
+    section->setting_count = 0;
+    section->setting_count_no_tmpl = 0;
+
     List_Init(&section->settings);
     map_init(&section->settings_map, data->pool);
     section->settings_map.func_key_size = NULL;
@@ -1370,6 +1427,18 @@ _FX const WCHAR *Conf_Get_Section_Name(ULONG index, BOOLEAN skip_tmpl)
 
     value = NULL;
 
+    //
+    // use the section index when available
+    //
+
+    if (Conf_Data.section_index) {
+
+        if (index < (skip_tmpl ? Conf_Data.section_count_no_tmpl : Conf_Data.section_count))
+            value = Conf_Data.section_index[index]->name;
+
+        return value;
+    }
+
     section = List_Head(&Conf_Data.sections);
     while (section) {
         CONF_SECTION *next_section = List_Next(section);
@@ -1420,6 +1489,18 @@ _FX const WCHAR *Conf_Get_Setting_Name(
     if (skip_tmpl && section && section->from_template)
         section = NULL;
 
+    //
+    // use the setting name index when available
+    //
+
+    if (section && section->setting_index) {
+
+        if (index < (skip_tmpl ? section->setting_count_no_tmpl : section->setting_count))
+            value = section->setting_index[index]->name;
+
+        return value;
+    }
+
     if (section) {
         setting = List_Head(&section->settings);
         while (setting) {
@@ -1460,6 +1541,174 @@ _FX const WCHAR *Conf_Get_Setting_Name(
 }
 
 
+//---------------------------------------------------------------------------
+// Conf_Hash_Name
+//---------------------------------------------------------------------------
+
+
+_FX unsigned int Conf_Hash_Name(const void* key, size_t size)
+{
+    //
+    // case insensitive variant of str_map_hash, to match the
+    // _wcsicmp comparison used when looking for duplicate names
+    //
+
+    const WCHAR** str = (const WCHAR**)key;
+    unsigned int hash = 5381;
+    for (const WCHAR* ptr = *str; *ptr != 0; ptr++) {
+        WCHAR c = *ptr;
+        if (c >= L'A' && c <= L'Z')
+            c += L'a' - L'A';
+        hash = ((hash << 5) + hash) ^ c;
+    }
+    return hash;
+}
+
+
+//---------------------------------------------------------------------------
+// Conf_Index_Sections
+//---------------------------------------------------------------------------
+
+
+_FX void Conf_Index_Sections(CONF_DATA *data)
+{
+    CONF_SECTION *section;
+    BOOLEAN in_tmpl;
+    ULONG count;
+
+    if (data->section_index) {
+        Mem_Free(data->section_index, data->section_index_len * sizeof(CONF_SECTION *));
+        data->section_index = NULL;
+    }
+
+    data->section_index_len = 0;
+    data->section_count = 0;
+    data->section_count_no_tmpl = 0;
+
+    count = List_Count(&data->sections);
+    if (! count)
+        return;
+
+    data->section_index = Mem_Alloc(data->pool, count * sizeof(CONF_SECTION *));
+    if (! data->section_index)
+        return; // Conf_Get_Section_Name falls back to the list
+
+    data->section_index_len = count;
+
+    in_tmpl = FALSE;
+
+    for (section = List_Head(&data->sections); section; section = List_Next(section)) {
+
+        if (_wcsicmp(section->name, Conf_GlobalSettings) == 0)
+            continue;
+
+        if (section->from_template && ! in_tmpl) {
+            in_tmpl = TRUE;
+            data->section_count_no_tmpl = data->section_count;
+        }
+
+        data->section_index[data->section_count++] = section;
+    }
+
+    if (! in_tmpl)
+        data->section_count_no_tmpl = data->section_count;
+}
+
+
+//---------------------------------------------------------------------------
+// Conf_Index_Section
+//---------------------------------------------------------------------------
+
+
+_FX void Conf_Index_Section(CONF_DATA *data, CONF_SECTION *section)
+{
+    CONF_SETTING *setting;
+    HASH_MAP names;
+    BOOLEAN in_tmpl;
+    ULONG count;
+
+    if (section->setting_index) {
+        Mem_Free(section->setting_index, section->setting_index_len * sizeof(CONF_SETTING *));
+        section->setting_index = NULL;
+    }
+
+    section->setting_index_len = 0;
+    section->setting_count = 0;
+    section->setting_count_no_tmpl = 0;
+
+    count = List_Count(&section->settings);
+    if (! count)
+        return;
+
+    section->setting_index = Mem_Alloc(data->pool, count * sizeof(CONF_SETTING *));
+    if (! section->setting_index)
+        return; // Conf_Get_Setting_Name falls back to the list
+
+    section->setting_index_len = count;
+
+    //
+    // collect the first setting of every distinct name, in list order,
+    // the names before the first template setting are the ones
+    // enumerated when templates are skipped
+    //
+
+    map_init(&names, data->pool);
+    names.func_key_size = NULL;
+    names.func_match_key = &str_map_match;
+    names.func_hash_key = &Conf_Hash_Name;
+    map_resize(&names, 16);
+
+    in_tmpl = FALSE;
+
+    for (setting = List_Head(&section->settings); setting; setting = List_Next(setting)) {
+
+        if (setting->from_template && ! in_tmpl) {
+            in_tmpl = TRUE;
+            section->setting_count_no_tmpl = section->setting_count;
+        }
+
+        if (map_get(&names, setting->name))
+            continue;
+
+        if (! map_insert(&names, setting->name, setting, 0)) {
+
+            //
+            // can't verify uniqueness, fall back to the list
+            //
+
+            Mem_Free(section->setting_index, section->setting_index_len * sizeof(CONF_SETTING *));
+            section->setting_index = NULL;
+            section->setting_index_len = 0;
+            section->setting_count = 0;
+            break;
+        }
+
+        section->setting_index[section->setting_count++] = setting;
+    }
+
+    if (! in_tmpl)
+        section->setting_count_no_tmpl = section->setting_count;
+
+    map_clear(&names);
+}
+
+
+//---------------------------------------------------------------------------
+// Conf_Index_Data
+//---------------------------------------------------------------------------
+
+
+_FX void Conf_Index_Data(CONF_DATA *data)
+{
+    CONF_SECTION *section;
+
+    for (section = List_Head(&data->sections); section; section = List_Next(section))
+        Conf_Index_Section(data, section);
+
+    Conf_Index_Sections(data);
+}
+
+
 //---------------------------------------------------------------------------
 // Conf_Get_Helper
 //---------------------------------------------------------------------------
@@ -1733,11 +1982,17 @@ _FX NTSTATUS Conf_Api_Reload(PROCESS *proc, ULONG64 *parms)
 		Conf_Data.sections_map.func_match_key = &str_map_match;
 		Conf_Data.sections_map.func_hash_key = &str_map_hash;
         map_resize(&Conf_Data.sections_map, 16); // prepare some buckets for better performance  
+        Conf_Data.section_index = NULL;
+        Conf_Data.section_index_len = 0;
+        Conf_Data.section_count = 0;
+        Conf_Data.section_count_no_tmpl = 0;
 
 		Conf_Data.home = FALSE;
         Conf_Data.path = NULL;
         Conf_Data.encoding = 0;
 
+        InterlockedIncrement(&Conf_Generation);
+
         ExReleaseResourceLite(Conf_Lock);
         KeLowerIrql(irql);
 
@@ -1874,6 +2129,47 @@ _FX NTSTATUS Conf_Api_Query(PROCESS *proc, ULONG64 *parms)
 
     no_expand = (index & CONF_GET_NO_EXPAND) != 0;
 
+    //
+    // when a setting name is specified, return all values of the setting
+    // in the order Conf_Get returns them, otherwise see Conf_Get_All.
+    // the optional parms[5] receives the configuration generation the
+    // values were taken from
+    //
+
+    if (index & CONF_GET_ALL) {
+
+        WCHAR *buf;
+        ULONG buf_len;
+        ULONG conf_gen;
+
+        conf_gen = Conf_GetGeneration();
+
+        if (setting_name[0])
+            status = Conf_Get_Values(proc, section_name, setting_name, index, &buf, &buf_len);
+        else
+            status = Conf_Get_All(section_name, index, &buf, &buf_len);
+        if (NT_SUCCESS(status)) {
+
+            __try {
+
+                Api_CopyStringToUser((UNICODE_STRING64 *)parms[4], buf, buf_len);
+
+            } __except (EXCEPTION_EXECUTE_HANDLER) {
+                status = GetExceptionCode();
+            }
+
+            Mem_Free(buf, buf_len);
+        }
+
+        parm2 = (ULONG *)parms[5];
+        if (parm2) {
+            ProbeForWrite(parm2, sizeof(ULONG), sizeof(ULONG));
+            *parm2 = conf_gen;
+        }
+
+        return status;
+    }
+
     //
     // get value
     //
@@ -1968,6 +2264,308 @@ release_and_return:
 }
 
 
+//---------------------------------------------------------------------------
+// Conf_Get_All
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS Conf_Get_All(
+    const WCHAR *section_name, ULONG flags, WCHAR **out_buf, ULONG *out_len)
+{
+    NTSTATUS status;
+    CONF_SECTION *section;
+    CONF_SETTING *setting;
+    const WCHAR *name;
+    BOOLEAN skip_tmpl;
+    BOOLEAN with_values;
+    WCHAR *buf, *ptr;
+    ULONG buf_len;
+    ULONG index;
+    ULONG pass;
+    KIRQL irql;
+
+    skip_tmpl = ((flags & CONF_GET_NO_TEMPLS) != 0);
+    with_values = ((flags & CONF_GET_ALL_VALUES) != 0) && *section_name;
+
+    buf = NULL;
+    buf_len = 0;
+    status = STATUS_SUCCESS;
+
+    KeRaiseIrql(APC_LEVEL, &irql);
+    ExAcquireResourceSharedLite(Conf_Lock, TRUE);
+
+    section = NULL;
+    if (*section_name) {
+
+        section = map_get(&Conf_Data.sections_map, section_name);
+        if (skip_tmpl && section && section->from_template)
+            section = NULL;
+
+        if (! section)
+            status = STATUS_RESOURCE_NAME_NOT_FOUND;
+    }
+
+    //
+    // the first pass computes the size, the second one fills the buffer
+    //
+
+    for (pass = 0; pass < 2 && NT_SUCCESS(status); ++pass) {
+
+        ULONG len = 0;
+
+        if (pass == 1) {
+
+            buf = Mem_Alloc(Driver_Pool, buf_len);
+            if (! buf) {
+                status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+        }
+
+        ptr = buf;
+
+        for (index = 0; ; ++index) {
+
+            if (section)
+                name = Conf_Get_Setting_Name(section_name, index, skip_tmpl);
+            else
+                name = Conf_Get_Section_Name(index, skip_tmpl);
+            if (! name)
+                break;
+
+            if (! with_values) {
+
+                ULONG name_len = wcslen(name) + 1;
+                if (ptr) {
+                    wmemcpy(ptr, name, name_len);
+                    ptr += name_len;
+                }
+                len += name_len;
+                continue;
+            }
+
+            //
+            // values are listed in the same order as Conf_Get returns them
+            //
+
+            map_iter_t iter = map_key_iter(&section->settings_map, name);
+            while (map_next(&section->settings_map, &iter)) {
+                setting = iter.value;
+                if (skip_tmpl && setting->from_template)
+                    break;
+
+                ULONG name_len = wcslen(setting->name);
+                ULONG value_len = wcslen(setting->value) + 1;
+                if (ptr) {
+                    wmemcpy(ptr, setting->name, name_len);
+                    ptr += name_len;
+                    *ptr++ = L'=';
+                    wmemcpy(ptr, setting->value, value_len);
+                    ptr += value_len;
+                }
+                len += name_len + 1 + value_len;
+            }
+        }
+
+        if (ptr)
+            *ptr = L'\0';
+        len += 1;
+
+        if (pass == 0) {
+
+            buf_len = len * sizeof(WCHAR);
+
+            // the length is returned in an USHORT field
+            if (buf_len > 0xFFFF)
+                status = STATUS_BUFFER_TOO_SMALL;
+        }
+    }
+
+    ExReleaseResourceLite(Conf_Lock);
+    KeLowerIrql(irql);
+
+    if (! NT_SUCCESS(status)) {
+        if (buf)
+            Mem_Free(buf, buf_len);
+        return status;
+    }
+
+    *out_buf = buf;
+    *out_len = buf_len;
+    return STATUS_SUCCESS;
+}
+
+
+//---------------------------------------------------------------------------
+// Conf_Get_Values
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS Conf_Get_Values(
+    PROCESS *proc, const WCHAR *section_name, const WCHAR *setting_name,
+    ULONG flags, WCHAR **out_buf, ULONG *out_len)
+{
+    NTSTATUS status;
+    const WCHAR *sections[2];
+    CONF_SECTION *section;
+    CONF_SETTING *setting;
+    const WCHAR **values;
+    WCHAR **expanded;
+    ULONG count, max_count;
+    ULONG i, pass;
+    BOOLEAN skip_tmpl;
+    BOOLEAN no_expand;
+    WCHAR *buf;
+    ULONG buf_len;
+    KIRQL irql;
+
+    //
+    // the values are expanded using the expand_args of the calling
+    // process, so only sandboxed callers can ask for expanded values
+    //
+
+    skip_tmpl = ((flags & CONF_GET_NO_TEMPLS) != 0);
+    no_expand = ((flags & CONF_GET_NO_EXPAND) != 0);
+
+    if ((! *section_name) || (! no_expand && ! proc))
+        return STATUS_INVALID_PARAMETER;
+
+    sections[0] = section_name;
+    sections[1] = NULL;
+    if ((flags & CONF_GET_NO_GLOBAL) == 0 &&
+            _wcsicmp(section_name, Conf_GlobalSettings) != 0)
+        sections[1] = Conf_GlobalSettings;
+
+    values = NULL;
+    expanded = NULL;
+    count = 0;
+    max_count = 0;
+    status = STATUS_SUCCESS;
+
+    Conf_AdjustUseCount(TRUE);
+
+    //
+    // collect the values like Conf_GetEx does, first all values from the
+    // section and then from the global section, the first pass counts
+    // and the second one fills the array, all under one lock
+    //
+
+    KeRaiseIrql(APC_LEVEL, &irql);
+    ExAcquireResourceSharedLite(Conf_Lock, TRUE);
+
+    for (pass = 0; pass < 2; ++pass) {
+
+        if (pass == 1) {
+
+            if (! max_count)
+                break;
+
+            values = Mem_Alloc(Driver_Pool, max_count * sizeof(WCHAR *));
+            if (! values) {
+                status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+        }
+
+        count = 0;
+
+        for (i = 0; i < 2 && sections[i]; ++i) {
+
+            section = Conf_Find_Sections(&Conf_Data, sections[i]);
+            if (skip_tmpl && section && section->from_template)
+                section = NULL;
+            if (! section)
+                continue;
+
+            map_iter_t iter = map_key_iter(&section->settings_map, setting_name);
+            while (map_next(&section->settings_map, &iter)) {
+                setting = iter.value;
+                if (skip_tmpl && setting->from_template)
+                    break;
+                if (count >= CONF_MAX_LINES)
+                    break;
+                if (values)
+                    values[count] = setting->value;
+                ++count;
+            }
+        }
+
+        max_count = count;
+    }
+
+    ExReleaseResourceLite(Conf_Lock);
+    KeLowerIrql(irql);
+
+    if (! NT_SUCCESS(status))
+        goto release_and_return;
+
+    //
+    // expand the values outside the lock, as expanding may have to
+    // look up registry keys, like Conf_Api_Query does
+    //
+
+    if (count && ! no_expand) {
+
+        expanded = Mem_Alloc(Driver_Pool, count * sizeof(WCHAR *));
+        if (! expanded) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto release_and_return;
+        }
+        memzero(expanded, count * sizeof(WCHAR *));
+
+        for (i = 0; i < count; ++i) {
+
+            expanded[i] = Conf_Expand(proc->box->expand_args, values[i], setting_name);
+            if (! expanded[i]) {
+                status = STATUS_INSUFFICIENT_RESOURCES;
+                goto release_and_return;
+            }
+            values[i] = expanded[i];
+        }
+    }
+
+    //
+    // the buffer starts with the number of values, followed by the
+    // values as null terminated strings, the length is returned in
+    // an USHORT field, larger lists have to be queried one by one
+    //
+
+    buf_len = ConfValues_Pack(NULL, values, count);
+    if (buf_len > 0xFFFF) {
+        status = STATUS_BUFFER_TOO_SMALL;
+        goto release_and_return;
+    }
+
+    buf = Mem_Alloc(Driver_Pool, buf_len);
+    if (! buf) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto release_and_return;
+    }
+
+    ConfValues_Pack(buf, values, count);
+
+    *out_buf = buf;
+    *out_len = buf_len;
+
+release_and_return:
+
+    if (expanded) {
+        for (i = 0; i < count; ++i) {
+            if (expanded[i])
+                Mem_FreeString(expanded[i]);
+        }
+        Mem_Free(expanded, count * sizeof(WCHAR *));
+    }
+
+    if (values)
+        Mem_Free(values, max_count * sizeof(WCHAR *));
+
+    Conf_AdjustUseCount(FALSE);
+
+    return status;
+}
+
+
 //---------------------------------------------------------------------------
 // Conf_Drop_Section
 //---------------------------------------------------------------------------
@@ -1994,12 +2592,16 @@ _FX NTSTATUS Conf_Drop_Section(CONF_DATA *data, CONF_SECTION *section)
         setting = next_setting;
     }
 
+    if(section->setting_index)
+        Mem_Free(section->setting_index, section->setting_index_len * sizeof(CONF_SETTING *));
     if(section->include_path)
         Mem_FreeString(section->include_path);
     if(section->name)
         Mem_FreeString(section->name);
     Mem_Free(section, sizeof(CONF_SECTION));
 
+    Conf_Index_Sections(data);
+
     return STATUS_SUCCESS;
 }
 
@@ -2034,6 +2636,8 @@ _FX NTSTATUS Conf_Update(
             return STATUS_INSUFFICIENT_RESOURCES;
 
         section->is_virtual = TRUE;
+
+        Conf_Index_Sections(data);
     }
 
     if (uMode == CONF_REMOVE_SECTION)
@@ -2082,8 +2686,10 @@ _FX NTSTATUS Conf_Update(
 
             setting = Conf_Add_Setting(data, section, setting_name, value_ptr, TRUE);
 
-            if (!setting)
+            if (!setting) {
+                Conf_Index_Section(data, section);
                 return STATUS_INSUFFICIENT_RESOURCES;
+            }
         }
     }
 
@@ -2126,6 +2732,8 @@ _FX NTSTATUS Conf_Update(
 		}   
     }
 
+    Conf_Index_Section(data, section);
+
     return status;
 }
 
@@ -2212,6 +2820,7 @@ _FX NTSTATUS Conf_Api_Update(PROCESS *proc, ULONG64 *parms)
     ExAcquireResourceExclusiveLite(Conf_Lock, TRUE);
 
 	status = Conf_Update(&Conf_Data, section_name, setting_name, value_ptr, uMode);
+    InterlockedIncrement(&Conf_Generation);
 
     ExReleaseResourceLite(Conf_Lock);
     KeLowerIrql(irql);
@@ -2236,6 +2845,10 @@ _FX BOOLEAN Conf_Init(void)
     Conf_Data.sections_map.func_key_size = NULL;
 	Conf_Data.sections_map.func_match_key = &str_map_match;
 	Conf_Data.sections_map.func_hash_key = &str_map_hash;
+    Conf_Data.section_index = NULL;
+    Conf_Data.section_index_len = 0;
+    Conf_Data.section_count = 0;
+    Conf_Data.section_count_no_tmpl = 0;
 
     Conf_Data.home = FALSE;
     Conf_Data.path = NULL;
@@ -98,6 +98,13 @@ ULONG Conf_Get_Number(
 NTSTATUS Conf_IsValidBox(const WCHAR *section_name);
 
 
+// Conf_GetGeneration:  returns a counter which changes every time the
+// configuration is reloaded or updated, can be used to check if data
+// derived from the configuration is still current
+
+ULONG Conf_GetGeneration(void);
+
+
 // Conf_Expand:  expands %-variables in a string which was retrieved
 // using Conf_Get or by any other means
 
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Setting Values Buffer -- Conf_Get_Values and Config_FetchSnapshotEntry
+//---------------------------------------------------------------------------
+
+
+#ifndef _MY_CONF_VALUES_H
+#define _MY_CONF_VALUES_H
+
+
+//
+// API_QUERY_CONF with CONF_GET_ALL and a setting name returns all values
+// of the setting in one buffer, which starts with the number of values,
+// followed by the values as null terminated strings
+//
+
+
+//---------------------------------------------------------------------------
+// ConfValues_Pack
+//---------------------------------------------------------------------------
+
+
+__inline ULONG ConfValues_Pack(void *buf, const WCHAR **values, ULONG count)
+{
+    //
+    // returns the length of the buffer in bytes,
+    // the buffer is only filled when buf is not NULL
+    //
+
+    WCHAR *ptr;
+    ULONG i, len, buf_len;
+
+    buf_len = sizeof(ULONG);
+    for (i = 0; i < count; ++i)
+        buf_len += (ULONG)(wcslen(values[i]) + 1) * sizeof(WCHAR);
+
+    if (buf) {
+
+        *(ULONG *)buf = count;
+        ptr = (WCHAR *)((UCHAR *)buf + sizeof(ULONG));
+        for (i = 0; i < count; ++i) {
+            len = (ULONG)wcslen(values[i]) + 1;
+            wmemcpy(ptr, values[i], len);
+            ptr += len;
+        }
+    }
+
+    return buf_len;
+}
+
+
+//---------------------------------------------------------------------------
+// ConfValues_Unpack
+//---------------------------------------------------------------------------
+
+
+__inline BOOLEAN ConfValues_Unpack(
+    WCHAR **values, ULONG count, WCHAR *data, ULONG data_len)
+{
+    //
+    // data and data_len describe the strings which follow the count,
+    // fills values with pointers into data and fails if the strings
+    // are not all terminated within the buffer
+    //
+
+    WCHAR *ptr, *end;
+    ULONG i;
+
+    ptr = data;
+    end = (WCHAR *)((UCHAR *)data + (data_len & ~(sizeof(WCHAR) - 1)));
+
+    for (i = 0; i < count; ++i) {
+
+        values[i] = ptr;
+        while (ptr < end && *ptr)
+            ++ptr;
+        if (ptr >= end)
+            return FALSE;
+        ++ptr;
+    }
+
+    return TRUE;
+}
+
+
+
+//---------------------------------------------------------------------------
+// ConfValues_UnpackSize
+//---------------------------------------------------------------------------
+
+
+__inline BOOLEAN ConfValues_UnpackSize(
+    const void *buf, ULONG buf_len, ULONG *count, ULONG *size)
+{
+    //
+    // buf and buf_len describe a whole buffer from ConfValues_Pack, gets
+    // the number of values and the size of a block for ConfValues_UnpackCopy,
+    // fails if the buffer can not hold its count or that many values
+    //
+
+    ULONG data_len;
+
+    if (buf_len < sizeof(ULONG))
+        return FALSE;
+
+    *count = *(ULONG *)buf;
+    data_len = buf_len - sizeof(ULONG);
+
+    if (*count > data_len / sizeof(WCHAR))
+        return FALSE;
+
+    *size = *count * sizeof(WCHAR *) + data_len;
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// ConfValues_UnpackCopy
+//---------------------------------------------------------------------------
+
+
+__inline BOOLEAN ConfValues_UnpackCopy(
+    WCHAR **values, const void *buf, ULONG buf_len)
+{
+    //
+    // values is a block of the size from ConfValues_UnpackSize, it gets
+    // the array of pointers to the values followed by a copy of the strings
+    //
+
+    ULONG count, data_len;
+    WCHAR *data;
+
+    count = *(ULONG *)buf;
+    data_len = buf_len - sizeof(ULONG);
+
+    data = (WCHAR *)&values[count];
+    memcpy(data, (UCHAR *)buf + sizeof(ULONG), data_len);
+
+    return ConfValues_Unpack(values, count, data, data_len);
+}
+
+
+#endif /* _MY_CONF_VALUES_H */
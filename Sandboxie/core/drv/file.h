@@ -41,6 +41,8 @@ NTSTATUS File_TranslateDosToNt(
 
 WCHAR *File_TranslateReparsePoints(const WCHAR *path, POOL *pool);
 
+ULONG File_GetReparseGeneration(void);
+
 BOOLEAN File_CreateBoxPath(PROCESS *proc);
 
 BOOLEAN File_InitProcess(PROCESS *proc);
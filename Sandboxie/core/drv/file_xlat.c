@@ -83,6 +83,7 @@ static LIST File_ReparsePointsList;
 static PERESOURCE File_ReparsePointsLock = NULL;
 static ULONG64 File_ReparsePointsCleanupTime = 0;
 static volatile LONG File_ReparsePointsBusy = 0;
+static volatile LONG File_ReparsePointsGeneration = 0;
 
 
 //---------------------------------------------------------------------------
@@ -606,6 +607,8 @@ _FX WCHAR *File_TranslateReparsePoints_2(
 
     if (now.QuadPart - File_ReparsePointsCleanupTime > SECONDS(1)) {
 
+        BOOLEAN expired = FALSE;
+
         File_ReparsePointsCleanupTime = now.QuadPart;
 
         entry = List_Head(&File_ReparsePointsList);
@@ -617,9 +620,18 @@ _FX WCHAR *File_TranslateReparsePoints_2(
                 List_Remove(&File_ReparsePointsList, entry);
                 Mem_Free(entry, entry->alloc_len);
 
+                expired = TRUE;
             }
             entry = next_entry;
         }
+
+        //
+        // paths translated before this point may translate differently
+        // now, see File_GetReparseGeneration
+        //
+
+        if (expired)
+            InterlockedIncrement(&File_ReparsePointsGeneration);
     }
 
     //
@@ -684,6 +696,24 @@ _FX WCHAR *File_TranslateReparsePoints_2(
 }
 
 
+//---------------------------------------------------------------------------
+// File_GetReparseGeneration
+//---------------------------------------------------------------------------
+
+
+_FX ULONG File_GetReparseGeneration(void)
+{
+    //
+    // the counter changes whenever cached reparse point translations
+    // expire, so callers which keep translated paths can tell when to
+    // translate them again.  it does not change while nothing translates
+    // paths, so such callers should also limit the age of their paths
+    //
+
+    return (ULONG)File_ReparsePointsGeneration;
+}
+
+
 //---------------------------------------------------------------------------
 // File_TranslateReparsePoints_3
 //---------------------------------------------------------------------------
@@ -15,7 +15,11 @@
  *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+// tests/log_ring_test.c builds this file in user mode, with its own
+// definitions of the few kernel functions used here
+#ifndef LOG_BUFFER_USER_MODE
 #include "driver.h"
+#endif
 #include "log_buff.h"
 
 LOG_BUFFER* log_buffer_init(SIZE_T buffer_size)
@@ -24,8 +28,7 @@ LOG_BUFFER* log_buffer_init(SIZE_T buffer_size)
 	LOG_BUFFER* ptr_buffer = (LOG_BUFFER*)ExAllocatePoolWithTag(PagedPool, sizeof(LOG_BUFFER) + buffer_size, tzuk);
 	if (ptr_buffer != NULL)
 	{
-		ptr_buffer->seq_counter = 0;
-		ptr_buffer->buffer_used = 0;
+		ptr_buffer->buffer_state = 0;
 		ptr_buffer->buffer_size = buffer_size;
 		ptr_buffer->buffer_start_ptr = ptr_buffer->buffer_data;
 	}
@@ -38,6 +41,17 @@ void log_buffer_free(LOG_BUFFER* ptr_buffer)
 	ExFreePoolWithTag(ptr_buffer, tzuk);
 }
 
+CHAR* log_buffer_write_header(LOG_BUFFER_SIZE_T size, LOG_BUFFER_SEQ_T seq_number, CHAR* write_ptr, LOG_BUFFER* ptr_buffer)
+{
+	log_buffer_push_bytes((CHAR*)&size, sizeof(LOG_BUFFER_SIZE_T), &write_ptr, ptr_buffer);
+	log_buffer_push_bytes((CHAR*)&seq_number, sizeof(LOG_BUFFER_SEQ_T), &write_ptr, ptr_buffer);
+
+	CHAR* end_ptr = write_ptr + size;
+	log_buffer_push_bytes((CHAR*)&size, sizeof(LOG_BUFFER_SIZE_T), &end_ptr, ptr_buffer);
+
+	return write_ptr;
+}
+
 CHAR* log_buffer_push_entry(LOG_BUFFER_SIZE_T size, LOG_BUFFER* ptr_buffer, BOOLEAN can_pop)
 {
 	SIZE_T total_size = size + sizeof(LOG_BUFFER_SIZE_T) * 2 + sizeof(LOG_BUFFER_SEQ_T);
@@ -53,14 +67,44 @@ CHAR* log_buffer_push_entry(LOG_BUFFER_SIZE_T size, LOG_BUFFER* ptr_buffer, BOOL
 	}
 
 	CHAR* write_ptr = ptr_buffer->buffer_start_ptr + ptr_buffer->buffer_used;
-	ptr_buffer->buffer_used += total_size;
-	log_buffer_push_bytes((CHAR*)&size, sizeof(LOG_BUFFER_SIZE_T), &write_ptr, ptr_buffer);
-	log_buffer_push_bytes((CHAR*)&ptr_buffer->seq_counter, sizeof(LOG_BUFFER_SEQ_T), &write_ptr, ptr_buffer);
+	ptr_buffer->buffer_used += (LOG_BUFFER_SIZE_T)total_size;
 
-	CHAR* end_ptr = write_ptr + size;
-	log_buffer_push_bytes((CHAR*)&size, sizeof(LOG_BUFFER_SIZE_T), &end_ptr, ptr_buffer);
+	return log_buffer_write_header(size, ptr_buffer->seq_counter, write_ptr, ptr_buffer);
+}
 
-	return write_ptr;
+CHAR* log_buffer_reserve_entry(LOG_BUFFER_SIZE_T size, LOG_BUFFER* ptr_buffer)
+{
+	//
+	// lock free variant of log_buffer_push_entry without can_pop, multiple writers
+	// can reserve entries at the same time and fill them in concurrently, the used size
+	// and the sequence number are advanced together so that the entries in the ring
+	// stay in sequence order, a failed reservation still consumes a sequence number
+	// the caller must make sure that no entry is popped while writers are active
+	//
+
+	SIZE_T total_size = size + sizeof(LOG_BUFFER_SIZE_T) * 2 + sizeof(LOG_BUFFER_SEQ_T);
+	if (total_size > ptr_buffer->buffer_size)
+		return NULL;
+
+	LONG64 old_state, new_state;
+	LOG_BUFFER_SIZE_T used;
+	LOG_BUFFER_SEQ_T seq_number;
+	BOOLEAN fits;
+
+	do {
+		old_state = ptr_buffer->buffer_state;
+		used = (LOG_BUFFER_SIZE_T)old_state;
+		seq_number = (LOG_BUFFER_SEQ_T)(old_state >> 32) + 1;
+
+		fits = (ptr_buffer->buffer_size - used >= total_size);
+		new_state = ((LONG64)seq_number << 32) | (fits ? used + total_size : used);
+
+	} while (InterlockedCompareExchange64(&ptr_buffer->buffer_state, new_state, old_state) != old_state);
+
+	if (!fits)
+		return NULL;
+
+	return log_buffer_write_header(size, seq_number, ptr_buffer->buffer_start_ptr + used, ptr_buffer);
 }
 
 void log_buffer_pop_entry(LOG_BUFFER* ptr_buffer)
@@ -74,32 +118,55 @@ void log_buffer_pop_entry(LOG_BUFFER* ptr_buffer)
 		ptr_buffer->buffer_start_ptr += total_size;
 		if (ptr_buffer->buffer_start_ptr >= ptr_buffer->buffer_data + ptr_buffer->buffer_size) // wrap around
 			ptr_buffer->buffer_start_ptr -= ptr_buffer->buffer_size;
-		ptr_buffer->buffer_used -= total_size;
+		ptr_buffer->buffer_used -= (LOG_BUFFER_SIZE_T)total_size;
 	}
 }
 
+CHAR* log_buffer_wrap_ptr(CHAR* data_ptr, LOG_BUFFER* ptr_buffer)
+{
+	if (data_ptr >= ptr_buffer->buffer_data + ptr_buffer->buffer_size) // wrap around
+		data_ptr -= ptr_buffer->buffer_size;
+	else if (data_ptr < ptr_buffer->buffer_data) // wrap around
+		data_ptr += ptr_buffer->buffer_size;
+	return data_ptr;
+}
+
 CHAR* log_buffer_byte_at(CHAR** data_ptr, LOG_BUFFER* ptr_buffer)
 {
-	if (*data_ptr >= ptr_buffer->buffer_data + ptr_buffer->buffer_size) // wrap around
-		*data_ptr -= ptr_buffer->buffer_size;
-	else if (*data_ptr < ptr_buffer->buffer_data) // wrap around
-		*data_ptr += ptr_buffer->buffer_size;
-	char* data = *data_ptr;
-	*data_ptr += 1;
+	char* data = log_buffer_wrap_ptr(*data_ptr, ptr_buffer);
+	*data_ptr = data + 1;
 	return data;
 }
 
 BOOLEAN log_buffer_push_bytes(CHAR* data, SIZE_T size, CHAR** write_ptr, LOG_BUFFER* ptr_buffer)
 {
-	for (ULONG i = 0; i < size; i++)
-		*log_buffer_byte_at(write_ptr, ptr_buffer) = data[i];
+	CHAR* ptr = log_buffer_wrap_ptr(*write_ptr, ptr_buffer);
+	SIZE_T tail = (ptr_buffer->buffer_data + ptr_buffer->buffer_size) - ptr;
+	if (size <= tail) {
+		memcpy(ptr, data, size);
+		*write_ptr = ptr + size;
+	}
+	else { // split copy at the wrap around
+		memcpy(ptr, data, tail);
+		memcpy(ptr_buffer->buffer_data, data + tail, size - tail);
+		*write_ptr = ptr_buffer->buffer_data + (size - tail);
+	}
 	return TRUE;
 }
 
 BOOLEAN log_buffer_get_bytes(CHAR* data, SIZE_T size, CHAR** read_ptr, LOG_BUFFER* ptr_buffer)
 {
-	for (ULONG i = 0; i < size; i++)
-		data[i] = *log_buffer_byte_at(read_ptr, ptr_buffer);
+	CHAR* ptr = log_buffer_wrap_ptr(*read_ptr, ptr_buffer);
+	SIZE_T tail = (ptr_buffer->buffer_data + ptr_buffer->buffer_size) - ptr;
+	if (size <= tail) {
+		memcpy(data, ptr, size);
+		*read_ptr = ptr + size;
+	}
+	else { // split copy at the wrap around
+		memcpy(data, ptr, tail);
+		memcpy(data + tail, ptr_buffer->buffer_data, size - tail);
+		*read_ptr = ptr_buffer->buffer_data + (size - tail);
+	}
 	return TRUE;
 }
 
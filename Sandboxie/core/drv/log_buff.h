@@ -21,20 +21,33 @@
 #define LOG_BUFFER_SIZE_T ULONG
 #define LOG_BUFFER_SEQ_T ULONG
 
+#pragma warning(push)
+#pragma warning(disable: 4201)	// nameless struct/union
+
 typedef struct _LOG_BUFFER
 {
-	LOG_BUFFER_SEQ_T seq_counter;
+	union {
+		struct {
+			LOG_BUFFER_SIZE_T buffer_used;
+			LOG_BUFFER_SEQ_T seq_counter;
+		};
+		volatile LONG64 buffer_state; // used and seq_counter as one value for log_buffer_reserve_entry
+	};
 	SIZE_T buffer_size;
-	SIZE_T buffer_used;
 	CHAR* buffer_start_ptr;
 	CHAR buffer_data[0]; // [[SIZE 4][DATA n][SEQ 4][SITE 4]][...] // Note 2nd size tags allows to traverse the ring in both directions
 } LOG_BUFFER;
 
+#pragma warning(pop)
+
 LOG_BUFFER* log_buffer_init(SIZE_T buffer_size);
 void log_buffer_free(LOG_BUFFER* ptr_buffer);
 
 CHAR* log_buffer_push_entry(LOG_BUFFER_SIZE_T size, LOG_BUFFER* ptr_buffer, BOOLEAN can_pop);
+CHAR* log_buffer_reserve_entry(LOG_BUFFER_SIZE_T size, LOG_BUFFER* ptr_buffer);
 void log_buffer_pop_entry(LOG_BUFFER* ptr_buffer);
+CHAR* log_buffer_write_header(LOG_BUFFER_SIZE_T size, LOG_BUFFER_SEQ_T seq_number, CHAR* write_ptr, LOG_BUFFER* ptr_buffer);
+CHAR* log_buffer_wrap_ptr(CHAR* data_ptr, LOG_BUFFER* ptr_buffer);
 CHAR* log_buffer_byte_at(CHAR** data_ptr, LOG_BUFFER* ptr_buffer);
 BOOLEAN log_buffer_push_bytes(CHAR* data, SIZE_T size, CHAR** write_ptr, LOG_BUFFER* ptr_buffer);
 BOOLEAN log_buffer_get_bytes(CHAR* data, SIZE_T size, CHAR** read_ptr, LOG_BUFFER* ptr_buffer);
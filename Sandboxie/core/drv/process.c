@@ -103,6 +103,7 @@ HASH_MAP Process_Map;
 HASH_MAP Process_MapDfp;
 HASH_MAP Process_MapFcp;
 PERESOURCE Process_ListLock = NULL;
+volatile LONG Process_ListSeq = 0;
 
 static BOOLEAN Process_NotifyImageInstalled = FALSE;
 static BOOLEAN Process_NotifyProcessInstalled = FALSE;
@@ -139,6 +140,9 @@ _FX BOOLEAN Process_Init(void)
     if (! Mem_GetLockResource(&Process_ListLock, TRUE))
         return FALSE;
 
+    if (! Process_InitForceData())
+        return FALSE;
+
     if (! Process_Low_Init())
         return FALSE;
 
@@ -210,6 +214,7 @@ _FX BOOLEAN Process_Init(void)
     Api_SetFunction(API_QUERY_PATH_LIST,      Process_Api_QueryPathList);
     Api_SetFunction(API_ENUM_PROCESSES,       Process_Api_Enum);
     Api_SetFunction(API_KILL_PROCESS,         Process_Api_Kill);
+    Api_SetFunction(API_QUERY_PROCESS_LIST,   Process_Api_QueryList);
 
     return TRUE;
 }
@@ -260,6 +265,8 @@ _FX void Process_Unload(BOOLEAN FreeLock)
 
     Process_Low_Unload();
 
+    Process_UnloadForceData(FreeLock);
+
     if (FreeLock)
         Mem_FreeLockResource(&Process_ListLock);
 }
@@ -592,6 +599,7 @@ _FX void Process_CreateTerminated(HANDLE ProcessId, ULONG SessionId)
         ExAcquireResourceExclusiveLite(Process_ListLock, TRUE);
 
         map_insert(&Process_Map, ProcessId, proc, 0);
+        InterlockedIncrement(&Process_ListSeq);
 
         ExReleaseResourceLite(Process_ListLock);
         KeLowerIrql(irql);
@@ -912,6 +920,7 @@ _FX PROCESS *Process_Create(
     ExAcquireResourceExclusiveLite(Process_ListLock, TRUE);
 
     map_insert(&Process_Map, ProcessId, proc, 0);
+    InterlockedIncrement(&Process_ListSeq);
 
     *out_irql = irql;
 
@@ -1587,7 +1596,8 @@ _FX void Process_Delete(HANDLE ProcessId)
     KeRaiseIrql(APC_LEVEL, &irql);
     ExAcquireResourceExclusiveLite(Process_ListLock, TRUE);
 
-    map_take(&Process_Map, ProcessId, &proc, 0);
+    if (map_take(&Process_Map, ProcessId, &proc, 0))
+        InterlockedIncrement(&Process_ListSeq);
 
     Process_DfpDelete(ProcessId);
 
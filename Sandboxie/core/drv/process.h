@@ -447,6 +447,11 @@ void Process_DfpDelete(HANDLE ProcessId);
 
 BOOLEAN Process_DfpCheck(HANDLE ProcessId, BOOLEAN *silent);
 
+// Compiled forced process rules, cached per user and session
+
+BOOLEAN Process_InitForceData(void);
+void Process_UnloadForceData(BOOLEAN FreeLock);
+
 // Force Child Processes
 
 VOID Process_FcpInsert(HANDLE ProcessId, const WCHAR* boxname);
@@ -531,6 +536,8 @@ NTSTATUS Process_Api_Enum(PROCESS *proc, ULONG64 *parms);
 
 NTSTATUS Process_Api_Kill(PROCESS *proc, ULONG64 *parms);
 
+NTSTATUS Process_Api_QueryList(PROCESS *proc, ULONG64 *parms);
+
 
 //---------------------------------------------------------------------------
 // Variables
@@ -541,6 +548,7 @@ extern HASH_MAP Process_Map;
 extern HASH_MAP Process_MapDfp;
 extern HASH_MAP Process_MapFcp;
 extern PERESOURCE Process_ListLock;
+extern volatile LONG Process_ListSeq;
 
 extern volatile BOOLEAN Process_ReadyToSandbox;
 
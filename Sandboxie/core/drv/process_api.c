@@ -46,6 +46,8 @@ static NTSTATUS Process_Api_CopyBoxPathsToUser(
     UNICODE_STRING64 *key_path,
     UNICODE_STRING64 *ipc_path);
 
+static ULONG64 Process_GetSbieFlags(PROCESS *proc);
+
 
 //---------------------------------------------------------------------------
 // Process_Api_Start
@@ -319,6 +321,69 @@ _FX NTSTATUS Process_Api_Query(PROCESS *proc, ULONG64 *parms)
 }
 
 
+//---------------------------------------------------------------------------
+// Process_GetSbieFlags
+//---------------------------------------------------------------------------
+
+
+_FX ULONG64 Process_GetSbieFlags(PROCESS *proc)
+{
+    ULONG64 flags = 0;
+
+    if (!proc->bHostInject)
+    {
+        flags = SBIE_FLAG_VALID_PROCESS;
+
+        if (proc->forced_process)
+            flags |= SBIE_FLAG_FORCED_PROCESS;
+        if (proc->is_start_exe)
+            flags |= SBIE_FLAG_PROCESS_IS_START_EXE;
+        if (proc->parent_was_start_exe)
+            flags |= SBIE_FLAG_PARENT_WAS_START_EXE;
+        if (proc->drop_rights)
+            flags |= SBIE_FLAG_DROP_RIGHTS;
+        if (proc->rights_dropped)
+            flags |= SBIE_FLAG_RIGHTS_DROPPED;
+        if (proc->box->fake_admin)
+            flags |= SBIE_FLAG_FAKE_ADMIN;
+        if (proc->untouchable)
+            flags |= SBIE_FLAG_PROTECTED_PROCESS;
+        if (proc->image_sbie)
+            flags |= SBIE_FLAG_IMAGE_FROM_SBIE_DIR;
+        if (proc->image_from_box)
+            flags |= SBIE_FLAG_IMAGE_FROM_SANDBOX;
+        if (proc->in_pca_job)
+            flags |= SBIE_FLAG_PROCESS_IN_PCA_JOB;
+        if (proc->in_app_pkg)
+            flags |= SBIE_FLAG_PROCESS_IN_APP_PKG;
+
+        if (proc->create_console_flag == 'S')
+            flags |= SBIE_FLAG_CREATE_CONSOLE_SHOW;
+        else if (proc->create_console_flag == 'H')
+            flags |= SBIE_FLAG_CREATE_CONSOLE_HIDE;
+
+        if (proc->open_all_win_classes)
+            flags |= SBIE_FLAG_OPEN_ALL_WIN_CLASS;
+        extern ULONG Syscall_MaxIndex32;
+        if (Syscall_MaxIndex32 != 0)
+            flags |= SBIE_FLAG_WIN32K_HOOKABLE;
+
+        if (proc->use_rule_specificity)
+            flags |= SBIE_FLAG_RULE_SPECIFICITY;
+        if (proc->use_privacy_mode)
+            flags |= SBIE_FLAG_PRIVACY_MODE;
+        if (proc->bAppCompartment)
+            flags |= SBIE_FLAG_APP_COMPARTMENT;
+    }
+    else
+    {
+        flags = SBIE_FLAG_HOST_INJECT_PROCESS;
+    }
+
+    return flags;
+}
+
+
 //---------------------------------------------------------------------------
 // Process_Api_QueryInfo
 //---------------------------------------------------------------------------
@@ -365,57 +430,7 @@ _FX NTSTATUS Process_Api_QueryInfo(PROCESS *proc, ULONG64 *parms)
 
         if (args->info_type.val == 0) {
 
-            ULONG64 flags = 0;
-
-            if (!proc->bHostInject)
-            {
-                flags = SBIE_FLAG_VALID_PROCESS;
-
-                if (proc->forced_process)
-                    flags |= SBIE_FLAG_FORCED_PROCESS;
-                if (proc->is_start_exe)
-                    flags |= SBIE_FLAG_PROCESS_IS_START_EXE;
-                if (proc->parent_was_start_exe)
-                    flags |= SBIE_FLAG_PARENT_WAS_START_EXE;
-                if (proc->drop_rights)
-                    flags |= SBIE_FLAG_DROP_RIGHTS;
-                if (proc->rights_dropped)
-                    flags |= SBIE_FLAG_RIGHTS_DROPPED;
-                if (proc->box->fake_admin)
-                    flags |= SBIE_FLAG_FAKE_ADMIN;
-                if (proc->untouchable)
-                    flags |= SBIE_FLAG_PROTECTED_PROCESS;
-                if (proc->image_sbie)
-                    flags |= SBIE_FLAG_IMAGE_FROM_SBIE_DIR;
-                if (proc->image_from_box)
-                    flags |= SBIE_FLAG_IMAGE_FROM_SANDBOX;
-                if (proc->in_pca_job)
-                    flags |= SBIE_FLAG_PROCESS_IN_PCA_JOB;
-                if (proc->in_app_pkg)
-                    flags |= SBIE_FLAG_PROCESS_IN_APP_PKG;
-
-                if (proc->create_console_flag == 'S')
-                    flags |= SBIE_FLAG_CREATE_CONSOLE_SHOW;
-                else if (proc->create_console_flag == 'H')
-                    flags |= SBIE_FLAG_CREATE_CONSOLE_HIDE;
-
-                if (proc->open_all_win_classes)
-                    flags |= SBIE_FLAG_OPEN_ALL_WIN_CLASS;
-                extern ULONG Syscall_MaxIndex32;
-                if (Syscall_MaxIndex32 != 0)
-                    flags |= SBIE_FLAG_WIN32K_HOOKABLE;
-
-                if (proc->use_rule_specificity)
-                    flags |= SBIE_FLAG_RULE_SPECIFICITY;
-                if (proc->use_privacy_mode)
-                    flags |= SBIE_FLAG_PRIVACY_MODE;
-                if (proc->bAppCompartment)
-                    flags |= SBIE_FLAG_APP_COMPARTMENT;
-            }
-            else
-            {
-                flags = SBIE_FLAG_HOST_INJECT_PROCESS;
-            }
+            ULONG64 flags = Process_GetSbieFlags(proc);
 
             ProbeForWrite(args->info_data.val, sizeof(ULONG64), sizeof(ULONG64));
             *args->info_data.val = flags;
@@ -542,6 +557,7 @@ _FX NTSTATUS Process_Api_QueryInfo(PROCESS *proc, ULONG64 *parms)
                 status = STATUS_ACCESS_DENIED;
             
             proc->detected_image_type = (ULONG)(args->ext_data.val);
+            InterlockedIncrement(&Process_ListSeq);
 
         } else if (args->info_type.val == 'gpit') { // get process image type
             
@@ -1127,6 +1143,146 @@ _FX NTSTATUS Process_Api_Enum(PROCESS *proc, ULONG64 *parms)
 }
 
 
+//---------------------------------------------------------------------------
+// Process_Api_QueryList
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS Process_Api_QueryList(PROCESS *proc, ULONG64 *parms)
+{
+    API_QUERY_PROCESS_LIST_ARGS *args = (API_QUERY_PROCESS_LIST_ARGS *)parms;
+    NTSTATUS status;
+    ULONG *user_seq;
+    ULONG *user_required_len;
+    UCHAR *user_buffer;
+    ULONG buffer_len;
+    ULONG list_seq;
+    ULONG session_id;
+    BOOLEAN all_sessions;
+    ULONG required_len;
+    API_PROCESS_LIST_ENTRY *prev_entry;
+    PROCESS *proc1;
+    KIRQL irql;
+
+    //
+    // this replaces API_ENUM_PROCESSES followed by one API_QUERY_PROCESS
+    // and API_QUERY_PROCESS_INFO for each process, for the non sandboxed
+    // process which keeps a list of all sandboxed processes
+    //
+
+    if (proc)
+        return STATUS_NOT_IMPLEMENTED;
+
+    user_seq = args->list_seq.val;
+    user_required_len = args->required_len.val;
+    user_buffer = args->buffer.val;
+    buffer_len = args->buffer_len.val;
+    all_sessions = args->all_sessions.val ? TRUE : FALSE;
+    session_id = args->session_id.val;
+
+    if (! user_seq || ! user_required_len)
+        return STATUS_INVALID_PARAMETER;
+
+    ProbeForWrite(user_seq, sizeof(ULONG), sizeof(ULONG));
+    ProbeForWrite(user_required_len, sizeof(ULONG), sizeof(ULONG));
+    if (user_buffer && buffer_len)
+        ProbeForWrite(user_buffer, buffer_len, sizeof(ULONG64));
+    else
+        buffer_len = 0;
+
+    if ((! all_sessions) && (session_id == -1)) {
+
+        status = MyGetSessionId(&session_id);
+        if (! NT_SUCCESS(status))
+            return status;
+    }
+
+    //
+    // the sequence number is read before the list is walked, a change
+    // which happens while we walk the list is then reported again on
+    // the next call
+    //
+
+    list_seq = (ULONG)Process_ListSeq;
+    if (*user_seq == list_seq) {
+        *user_required_len = 0;
+        return STATUS_SUCCESS;
+    }
+
+    KeRaiseIrql(APC_LEVEL, &irql);
+    ExAcquireResourceSharedLite(Process_ListLock, TRUE);
+
+    __try {
+
+        required_len = 0;
+        prev_entry = NULL;
+
+        map_iter_t iter = map_iter();
+        while (map_next(&Process_Map, &iter)) {
+            proc1 = iter.value;
+
+            BOX *box1 = proc1->box;
+            if ((! box1) || proc1->bHostInject)
+                continue;
+            if ((! all_sessions) && box1->session_id != session_id)
+                continue;
+
+            ULONG box_name_len = box1->name_len - sizeof(WCHAR);
+            ULONG image_name_len = 0;
+            if (proc1->image_name && proc1->image_name_len >= sizeof(WCHAR))
+                image_name_len = proc1->image_name_len - sizeof(WCHAR);
+            if (image_name_len > 0xFFF0)
+                image_name_len = 0xFFF0;
+            ULONG entry_len = FIELD_OFFSET(API_PROCESS_LIST_ENTRY, names)
+                            + box_name_len + image_name_len;
+            entry_len = (entry_len + 7) & ~7;
+
+            if (required_len + entry_len <= buffer_len) {
+
+                API_PROCESS_LIST_ENTRY *entry =
+                    (API_PROCESS_LIST_ENTRY *)(user_buffer + required_len);
+
+                entry->next_offset = 0;
+                entry->process_id = (ULONG)(ULONG_PTR)proc1->pid;
+                entry->session_id = box1->session_id;
+                entry->image_type = proc1->detected_image_type;
+                entry->create_time = proc1->create_time;
+                entry->flags = Process_GetSbieFlags(proc1);
+                entry->box_name_len = (USHORT)box_name_len;
+                entry->image_name_len = (USHORT)image_name_len;
+                entry->integrity_level = proc1->integrity_level;
+                memcpy(entry->names, box1->name, box_name_len);
+                memcpy((UCHAR *)entry->names + box_name_len,
+                       proc1->image_name, image_name_len);
+
+                if (prev_entry)
+                    prev_entry->next_offset = (ULONG)((UCHAR *)entry - (UCHAR *)prev_entry);
+                prev_entry = entry;
+            }
+
+            required_len += entry_len;
+        }
+
+        *user_required_len = required_len;
+
+        if (required_len > buffer_len)
+            status = STATUS_BUFFER_TOO_SMALL;
+        else {
+            *user_seq = list_seq;
+            status = STATUS_SUCCESS;
+        }
+
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+    }
+
+    ExReleaseResourceLite(Process_ListLock);
+    KeLowerIrql(irql);
+
+    return status;
+}
+
+
 //---------------------------------------------------------------------------
 // Process_Api_Enum
 //---------------------------------------------------------------------------
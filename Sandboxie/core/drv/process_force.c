@@ -32,6 +32,9 @@
 #include "common/my_version.h"
 
 
+#include "process_force_tree.c"
+
+
 //---------------------------------------------------------------------------
 // Structures and Types
 //---------------------------------------------------------------------------
@@ -41,15 +44,43 @@ typedef struct _FORCE_BOX {
 
     LIST_ELEM list_elem;
     BOX *box;
+    struct _FORCE_BOX *cached;  // for the path rules, see Process_CreateForcePaths
     LIST ForceFolder;
     LIST ForceProcess;
     LIST ForceChildren;
 	LIST AlertFolder;
     LIST AlertProcess;
     LIST HostInjectProcess;
+    HASH_MAP ForceProcessNames;
+    HASH_MAP ForceChildrenNames;
+    HASH_MAP AlertProcessNames;
 
 } FORCE_BOX;
 
+typedef struct _FORCE_PATHS {
+
+    LONG ref_count;
+    ULONG reparse_gen;
+    LONGLONG time;
+    LIST boxes;
+    FORCE_TREE ForceFolder;     // folders without wildcards, by box index
+    FORCE_TREE AlertFolder;
+
+} FORCE_PATHS;
+
+typedef struct _FORCE_DATA {
+
+    LIST_ELEM list_elem;
+    LONG ref_count;
+    ULONG conf_gen;
+    ULONG SessionId;
+    ULONG sid_len;
+    WCHAR *SidString;
+    LIST boxes;
+    FORCE_PATHS *paths;
+
+} FORCE_DATA;
+
 typedef struct _FORCE_ENTRY {
 
     LIST_ELEM list_elem;
@@ -84,6 +115,14 @@ typedef struct _FORCE_PROCESS_3 {
 
 } FORCE_PROCESS_3;
 
+
+#define FORCE_DATA_CACHE_MAX    16
+
+#define FORCE_PATHS_MAX_AGE     SECONDS(10)     // as cached reparse points
+
+#define FORCE_ADD_NAMES         0x01    // image names and name patterns
+#define FORCE_ADD_PATHS         0x02    // expanded paths with translated reparse points
+
 //---------------------------------------------------------------------------
 // Functions
 //---------------------------------------------------------------------------
@@ -115,16 +154,39 @@ void Process_CreateForceData(
 
 void Process_DeleteForceData(LIST *boxes);
 
+static FORCE_PATHS *Process_CreateForcePaths(LIST *boxes);
+
+static void Process_AddForceTree(
+    FORCE_TREE *tree, LIST *Folders, ULONG index);
+
+static void Process_DeleteForcePaths(FORCE_PATHS *paths);
+
+static FORCE_DATA *Process_AcquireForceData(
+    const WCHAR *SidString, ULONG SessionId);
+
+static void Process_ReleaseForceData(FORCE_DATA *data);
+
+static FORCE_PATHS *Process_AcquireForcePaths(FORCE_DATA *data);
+
+static void Process_ReleaseForcePaths(FORCE_PATHS *paths);
+
+static void Process_FreeForceData(FORCE_DATA *data);
+
+static void Process_InitForceNames(HASH_MAP *Names);
+
+static void Process_DeleteForceNames(HASH_MAP *Names);
+
 static BOX *Process_CheckBoxPath(LIST *boxes, const WCHAR *path);
 
 static BOX *Process_CheckForceFolder(
-    LIST *boxes, const WCHAR *path, BOOLEAN alert, ULONG *IsAlert);
+    LIST *boxes, FORCE_TREE *tree,
+    const WCHAR *path, BOOLEAN alert, ULONG *IsAlert);
 
 static BOX *Process_CheckForceProcess(
     LIST *boxes, const WCHAR *name, const WCHAR* path, BOOLEAN alert, ULONG *IsAlert, const WCHAR *ParentName, const WCHAR *ParentPath);
 
 static void Process_CheckAlertFolder(
-	LIST *boxes, const WCHAR *path, ULONG *IsAlert);
+	LIST *boxes, FORCE_TREE *tree, const WCHAR *path, ULONG *IsAlert);
 
 static void Process_CheckAlertProcess(
     LIST *boxes, const WCHAR *name, const WCHAR *path, ULONG *IsAlert);
@@ -135,6 +197,15 @@ static BOX *Process_CheckHostInjectProcess(
 static BOOLEAN Process_CheckMoTW(const WCHAR *path);
 
 
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static LIST Process_ForceDataCache;
+static PERESOURCE Process_ForceDataLock = NULL;
+
+
 //---------------------------------------------------------------------------
 // Process_GetForcedStartBox
 //---------------------------------------------------------------------------
@@ -153,7 +224,11 @@ _FX BOX *Process_GetForcedStartBox(
     PEPROCESS ProcessObject;
     WCHAR *CurDir, *DocArg;
     ULONG CurDir_len, DocArg_len;
-    LIST boxes;
+    FORCE_DATA *force_data;
+    FORCE_PATHS *force_paths;
+    FORCE_TREE *ForceFolder, *AlertFolder;
+    LIST no_boxes;
+    LIST *boxes;
     BOX *box;
     ULONG alert;
     BOOLEAN check_force;
@@ -250,7 +325,25 @@ _FX BOX *Process_GetForcedStartBox(
     box = NULL;
     alert = 0;
 
-    Process_CreateForceData(&boxes, pSidString, SessionId);
+    //
+    // the boxes and the image name rules are compiled once per user and
+    // session, and reused until the configuration is reloaded.  the path
+    // rules depend on reparse points and on expansions, these are kept
+    // with the force data until cached reparse points expire
+    //
+
+    force_data = Process_AcquireForceData(pSidString, SessionId);
+    force_paths = force_data ? Process_AcquireForcePaths(force_data) : NULL;
+
+    if (force_paths) {
+        boxes = &force_paths->boxes;
+        ForceFolder = &force_paths->ForceFolder;
+        AlertFolder = &force_paths->AlertFolder;
+    } else {
+        List_Init(&no_boxes);
+        boxes = &no_boxes;
+        ForceFolder = AlertFolder = NULL;
+    }
 
     //
     // check if process can be forced
@@ -258,7 +351,7 @@ _FX BOX *Process_GetForcedStartBox(
 
     if (check_force) {
 
-        box = Process_CheckBoxPath(&boxes, ImagePath2);
+        box = Process_CheckBoxPath(boxes, ImagePath2);
 
         //
         // when the process is start.exe we ignore the CurDir and DocArg
@@ -267,29 +360,29 @@ _FX BOX *Process_GetForcedStartBox(
         Process_IsSbieImage(ImagePath, &image_sbie, &is_start_exe);
 
         if ((! box) && CurDir && !is_start_exe)
-            box = Process_CheckBoxPath(&boxes, CurDir);
+            box = Process_CheckBoxPath(boxes, CurDir);
 
         if ((! box) && DocArg && !is_start_exe && Conf_Get_Boolean(NULL, L"ForceBoxDocs", 0, FALSE))
-            box = Process_CheckBoxPath(&boxes, DocArg);
+            box = Process_CheckBoxPath(boxes, DocArg);
 
         if (!box) {
 
             box = Process_CheckForceFolder(
-                        &boxes, ImagePath2, force_alert, &alert);
+                        boxes, ForceFolder, ImagePath2, force_alert, &alert);
 
             if ((! box) && (! alert)) {
                 box = Process_CheckForceProcess(
-                    &boxes, ImageName, ImagePath2, force_alert, &alert, ParentName, ParentPath);
+                    boxes, ImageName, ImagePath2, force_alert, &alert, ParentName, ParentPath);
             }
 
             if ((! box) && CurDir && !is_start_exe && (! alert)) {
                 box = Process_CheckForceFolder(
-                        &boxes, CurDir, force_alert, &alert);
+                        boxes, ForceFolder, CurDir, force_alert, &alert);
             }
 
             if ((! box) && DocArg && !is_start_exe && (! alert)) {
                 box = Process_CheckForceFolder(
-                        &boxes, DocArg, force_alert, &alert);
+                        boxes, ForceFolder, DocArg, force_alert, &alert);
             }
 
             if (box && (! Conf_Get_Boolean(NULL, L"AllowForceImmersive", 0, FALSE)) &&
@@ -319,7 +412,7 @@ _FX BOX *Process_GetForcedStartBox(
             if (Process_FcpCheck(ParentId, boxname)) {
 
                 ULONG boxname_len = (wcslen(boxname) + 1) * sizeof(WCHAR);
-                for (FORCE_BOX* cur_box = List_Head(&boxes); cur_box; cur_box = List_Next(cur_box)) {
+                for (FORCE_BOX* cur_box = List_Head(boxes); cur_box; cur_box = List_Next(cur_box)) {
                     if (cur_box->box->name_len == boxname_len
                         && _wcsicmp(cur_box->box->name, boxname) == 0) {
                         box = cur_box->box;
@@ -333,14 +426,14 @@ _FX BOX *Process_GetForcedStartBox(
 			force_alert = FALSE;
 
 		if ((! box) && (alert != 1))
-			Process_CheckAlertFolder(&boxes, ImagePath2, &alert);
+			Process_CheckAlertFolder(boxes, AlertFolder, ImagePath2, &alert);
 
 		//
 		// for alerting we only care about the process path not about the working dir or command line
 		//
 
         if ((! box) && (alert != 1))
-            Process_CheckAlertProcess(&boxes, ImageName, ImagePath2, &alert);
+            Process_CheckAlertProcess(boxes, ImageName, ImagePath2, &alert);
     
 
         //
@@ -364,7 +457,7 @@ _FX BOX *Process_GetForcedStartBox(
                     box = (BOX*)-1; // when box not found cancel process
 
                     ULONG MoTW_Box_len = (wcslen(MoTW_Box) + 1) * sizeof(WCHAR);
-                    FORCE_BOX* fbox = List_Head(&boxes);
+                    FORCE_BOX* fbox = List_Head(boxes);
                     while (fbox) {
                         if (MoTW_Box_len == fbox->box->name_len && _wcsicmp(MoTW_Box, fbox->box->name) == 0) {
                             box = fbox->box;
@@ -384,7 +477,7 @@ _FX BOX *Process_GetForcedStartBox(
 
     if ((! box) && (alert != 1) && pHostInject != NULL) {
         
-        box = Process_CheckHostInjectProcess(&boxes, ImageName);
+        box = Process_CheckHostInjectProcess(boxes, ImageName);
 
         if (box)
             *pHostInject = TRUE;
@@ -425,7 +518,11 @@ _FX BOX *Process_GetForcedStartBox(
     // finish
     //
 
-    Process_DeleteForceData(&boxes);
+    if (force_paths)
+        Process_ReleaseForcePaths(force_paths);
+
+    if (force_data)
+        Process_ReleaseForceData(force_data);
 
     if (nbuf)
 		Mem_Free(nbuf, nlen);
@@ -988,7 +1085,7 @@ _FX BOOLEAN Process_IsImmersiveProcess(
 
 
 _FX void Process_AddForceFolders(
-    LIST* Folders, const WCHAR* Setting, BOX *box, const WCHAR *section)
+    LIST* Folders, HASH_MAP* Names, const WCHAR* Setting, BOX *box, const WCHAR *section, ULONG Kinds)
 {
     ULONG index2;
     const WCHAR *value;
@@ -1008,6 +1105,9 @@ _FX void Process_AddForceFolders(
 
         if (wcschr(value, L'\\') != NULL) { // folder, full_path or path_pattern
 
+            if (! (Kinds & FORCE_ADD_PATHS))
+                continue;
+
             expnd = Conf_Expand(box->expand_args, value, Setting);
 
             buf = NULL;
@@ -1054,10 +1154,31 @@ _FX void Process_AddForceFolders(
         }
         else { // image name
 
+            if (! (Kinds & FORCE_ADD_NAMES))
+                continue;
+
             buf_len = (wcslen(value) + 1) * sizeof(WCHAR);
             buf = Mem_Alloc(Driver_Pool, buf_len);
             if (buf)
                 wcscpy(buf, value);
+
+            //
+            // a plain image name without wildcards, variables or a
+            // process group is matched through a hash of lower case names
+            //
+
+            if (buf && Names && *buf != L'<' && ! wcspbrk(buf, L"*?%")) {
+
+                _wcslwr(buf);
+
+                if (map_get(Names, buf)) {
+                    Mem_Free(buf, buf_len);
+                    continue;
+                }
+
+                if (map_insert(Names, buf, buf, 0))
+                    continue;
+            }
         }
 
         if (! buf)
@@ -1140,6 +1261,38 @@ _FX void Process_AddForceProcesses(
 }
 
 
+//---------------------------------------------------------------------------
+// Process_InitForceNames
+//---------------------------------------------------------------------------
+
+
+_FX void Process_InitForceNames(HASH_MAP *Names)
+{
+    map_init(Names, Driver_Pool);
+    Names->func_key_size = NULL;
+    Names->func_match_key = &str_map_match;
+    Names->func_hash_key = &str_map_hash;
+}
+
+
+//---------------------------------------------------------------------------
+// Process_DeleteForceNames
+//---------------------------------------------------------------------------
+
+
+_FX void Process_DeleteForceNames(HASH_MAP *Names)
+{
+    map_iter_t iter = map_iter();
+    while (map_next(Names, &iter)) {
+
+        WCHAR *buf = iter.value;
+        Mem_Free(buf, (wcslen(buf) + 1) * sizeof(WCHAR));
+    }
+
+    map_clear(Names);
+}
+
+
 //---------------------------------------------------------------------------
 // Process_CreateForceData
 //---------------------------------------------------------------------------
@@ -1197,40 +1350,39 @@ _FX void Process_CreateForceData(
         List_Init(&box->AlertProcess);
         List_Init(&box->HostInjectProcess);
 
+        Process_InitForceNames(&box->ForceProcessNames);
+        Process_InitForceNames(&box->ForceChildrenNames);
+        Process_InitForceNames(&box->AlertProcessNames);
+
         List_Insert_After(boxes, NULL, box);
 
+        box->cached = NULL;
+
         //
-        // scan list of ForceFolder settings for the box
+        // ForceFolder and AlertFolder settings are paths, these are added
+        // by Process_CreateForcePaths, as are path entries of the lists below
         //
 
-        Process_AddForceFolders(&box->ForceFolder, L"ForceFolder", box->box, section);
-
         //
         // scan list of ForceProcess settings for the box
         //
 
         //Process_AddForceProcesses(&box->ForceProcess, L"ForceProcess", section);
-        Process_AddForceFolders(&box->ForceProcess, L"ForceProcess", box->box, section);
+        Process_AddForceFolders(&box->ForceProcess, &box->ForceProcessNames, L"ForceProcess", box->box, section, FORCE_ADD_NAMES);
 
         //
         // scan list of ForceChildren settings for the box
         //
 
         //Process_AddForceProcesses(&box->ForceChildren, L"ForceChildren", section);
-        Process_AddForceFolders(&box->ForceChildren, L"ForceChildren", box->box, section);
-
-		//
-        // scan list of AlertFolder settings for the box
-        //
-
-        Process_AddForceFolders(&box->AlertFolder, L"AlertFolder", box->box, section);
+        Process_AddForceFolders(&box->ForceChildren, &box->ForceChildrenNames, L"ForceChildren", box->box, section, FORCE_ADD_NAMES);
 
         //
         // scan list of AlertProcess settings for the box
         //
 
         //Process_AddForceProcesses(&box->AlertProcess, L"AlertProcess", section);
-        Process_AddForceFolders(&box->AlertProcess, L"AlertProcess", box->box, section);
+        Process_AddForceFolders(&box->AlertProcess, &box->AlertProcessNames, L"AlertProcess", box->box, section, FORCE_ADD_NAMES);
 
         //
         // scan list of HostInjectProcess settings for the box
@@ -1317,6 +1469,9 @@ _FX void Process_DeleteForceData(LIST *boxes)
         //Process_DeleteForceDataProcesses(&box->AlertProcess);
         Process_DeleteForceDataFolders(&box->AlertProcess);
         Process_DeleteForceDataProcesses(&box->HostInjectProcess);
+        Process_DeleteForceNames(&box->ForceProcessNames);
+        Process_DeleteForceNames(&box->ForceChildrenNames);
+        Process_DeleteForceNames(&box->AlertProcessNames);
 
         Box_Free(box->box);
 
@@ -1325,6 +1480,489 @@ _FX void Process_DeleteForceData(LIST *boxes)
 }
 
 
+
+//---------------------------------------------------------------------------
+// Process_CreateForcePaths
+//---------------------------------------------------------------------------
+
+
+_FX FORCE_PATHS *Process_CreateForcePaths(LIST *boxes)
+{
+    FORCE_PATHS *paths;
+    FORCE_BOX *cached;
+    FORCE_BOX *box;
+    ULONG index;
+
+    //
+    // create a FORCE_BOX for each cached one, in the same order, holding
+    // the ForceFolder and AlertFolder rules and the path entries of the
+    // process lists.  these are expanded and their reparse points are
+    // translated, so they are built again when cached reparse points
+    // expire, see Process_AcquireForcePaths.  the image name rules and
+    // the HostInjectProcess list are used through the cached FORCE_BOX
+    //
+
+    paths = Mem_Alloc(Driver_Pool, sizeof(FORCE_PATHS));
+    if (! paths)
+        return NULL;
+
+    paths->ref_count = 1;
+    List_Init(&paths->boxes);
+    Process_ForceTreeInit(&paths->ForceFolder);
+    Process_ForceTreeInit(&paths->AlertFolder);
+
+    Conf_AdjustUseCount(TRUE);
+
+    index = 0;
+
+    for (cached = List_Head(boxes); cached; cached = List_Next(cached)) {
+
+        const WCHAR *section = cached->box->name;
+
+        box = Mem_Alloc(Driver_Pool, sizeof(FORCE_BOX));
+        if (! box)
+            break;
+
+        box->box = cached->box;
+        box->cached = cached;
+
+        List_Init(&box->ForceFolder);
+        List_Init(&box->ForceProcess);
+        List_Init(&box->ForceChildren);
+        List_Init(&box->AlertFolder);
+        List_Init(&box->AlertProcess);
+        List_Init(&box->HostInjectProcess);
+
+        List_Insert_After(&paths->boxes, NULL, box);
+
+        Process_AddForceFolders(&box->ForceFolder, NULL, L"ForceFolder", box->box, section, FORCE_ADD_NAMES | FORCE_ADD_PATHS);
+        Process_AddForceFolders(&box->ForceProcess, NULL, L"ForceProcess", box->box, section, FORCE_ADD_PATHS);
+        Process_AddForceFolders(&box->ForceChildren, NULL, L"ForceChildren", box->box, section, FORCE_ADD_PATHS);
+        Process_AddForceFolders(&box->AlertFolder, NULL, L"AlertFolder", box->box, section, FORCE_ADD_NAMES | FORCE_ADD_PATHS);
+        Process_AddForceFolders(&box->AlertProcess, NULL, L"AlertProcess", box->box, section, FORCE_ADD_PATHS);
+
+        Process_AddForceTree(&paths->ForceFolder, &box->ForceFolder, index);
+        Process_AddForceTree(&paths->AlertFolder, &box->AlertFolder, index);
+
+        ++index;
+    }
+
+    Conf_AdjustUseCount(FALSE);
+
+    return paths;
+}
+
+
+//---------------------------------------------------------------------------
+// Process_AddForceTree
+//---------------------------------------------------------------------------
+
+
+_FX void Process_AddForceTree(FORCE_TREE *tree, LIST *Folders, ULONG index)
+{
+    FORCE_ENTRY *folder, *next;
+
+    //
+    // move the folders without wildcards into the tree, only those with
+    // wildcards stay in the list of the box.  a folder which could not
+    // be inserted stays in the list as well
+    //
+
+    folder = List_Head(Folders);
+    while (folder) {
+
+        next = List_Next(folder);
+
+        if ((! folder->pat) &&
+                Process_ForceTreeInsert(tree, folder->buf, folder->len, index)) {
+
+            List_Remove(Folders, folder);
+
+            Mem_Free(folder->buf, folder->buf_len);
+            Mem_Free(folder, sizeof(FORCE_ENTRY));
+        }
+
+        folder = next;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Process_DeleteForcePaths
+//---------------------------------------------------------------------------
+
+
+_FX void Process_DeleteForcePaths(FORCE_PATHS *paths)
+{
+    FORCE_BOX *box;
+
+    while (1) {
+
+        box = List_Head(&paths->boxes);
+        if (! box)
+            break;
+
+        List_Remove(&paths->boxes, box);
+
+        Process_DeleteForceDataFolders(&box->ForceFolder);
+        Process_DeleteForceDataFolders(&box->ForceProcess);
+        Process_DeleteForceDataFolders(&box->ForceChildren);
+        Process_DeleteForceDataFolders(&box->AlertFolder);
+        Process_DeleteForceDataFolders(&box->AlertProcess);
+
+        // box->box belongs to the cached FORCE_BOX
+
+        Mem_Free(box, sizeof(FORCE_BOX));
+    }
+
+    Process_ForceTreeFree(&paths->ForceFolder);
+    Process_ForceTreeFree(&paths->AlertFolder);
+
+    Mem_Free(paths, sizeof(FORCE_PATHS));
+}
+
+
+//---------------------------------------------------------------------------
+// Process_FreeForceData
+//---------------------------------------------------------------------------
+
+
+_FX void Process_FreeForceData(FORCE_DATA *data)
+{
+    //
+    // the path rules refer to the boxes, and whoever still holds them
+    // also holds a reference on this force data, so only the reference
+    // of the force data itself is left at this point
+    //
+
+    if (data->paths)
+        Process_ReleaseForcePaths(data->paths);
+
+    Process_DeleteForceData(&data->boxes);
+
+    Mem_Free(data->SidString, data->sid_len);
+    Mem_Free(data, sizeof(FORCE_DATA));
+}
+
+
+//---------------------------------------------------------------------------
+// Process_AcquireForceData
+//---------------------------------------------------------------------------
+
+
+_FX FORCE_DATA *Process_AcquireForceData(
+    const WCHAR *SidString, ULONG SessionId)
+{
+    FORCE_DATA *data, *next, *found;
+    LIST stale;
+    ULONG conf_gen;
+    ULONG sid_len;
+    KIRQL irql;
+
+    //
+    // look for compiled force data for this user and session which was
+    // created from the current configuration.  the cache holds one
+    // reference on each of its entries, outdated entries are unlinked
+    // and freed once the last user releases them
+    //
+
+    conf_gen = Conf_GetGeneration();
+    sid_len = (wcslen(SidString) + 1) * sizeof(WCHAR);
+
+    found = NULL;
+    List_Init(&stale);
+
+    KeRaiseIrql(APC_LEVEL, &irql);
+    ExAcquireResourceExclusiveLite(Process_ForceDataLock, TRUE);
+
+    data = List_Head(&Process_ForceDataCache);
+    while (data) {
+
+        next = List_Next(data);
+
+        if (data->conf_gen != conf_gen) {
+
+            List_Remove(&Process_ForceDataCache, data);
+            if (--data->ref_count == 0)
+                List_Insert_After(&stale, NULL, data);
+
+        } else if (! found && data->SessionId == SessionId
+                && data->sid_len == sid_len
+                && _wcsicmp(data->SidString, SidString) == 0) {
+
+            ++data->ref_count;
+            found = data;
+        }
+
+        data = next;
+    }
+
+    if (found && found != List_Head(&Process_ForceDataCache)) {
+
+        List_Remove(&Process_ForceDataCache, found);
+        List_Insert_Before(&Process_ForceDataCache, NULL, found);
+    }
+
+    ExReleaseResourceLite(Process_ForceDataLock);
+    KeLowerIrql(irql);
+
+    while ((data = List_Head(&stale)) != NULL) {
+
+        List_Remove(&stale, data);
+        Process_FreeForceData(data);
+    }
+
+    if (found)
+        return found;
+
+    //
+    // otherwise compile the force rules, outside of the lock
+    //
+
+    data = Mem_Alloc(Driver_Pool, sizeof(FORCE_DATA));
+    if (! data)
+        return NULL;
+
+    data->SidString = Mem_Alloc(Driver_Pool, sid_len);
+    if (! data->SidString) {
+        Mem_Free(data, sizeof(FORCE_DATA));
+        return NULL;
+    }
+    memcpy(data->SidString, SidString, sid_len);
+
+    data->sid_len = sid_len;
+    data->SessionId = SessionId;
+    data->conf_gen = conf_gen;
+    data->ref_count = 1;
+    data->paths = NULL;
+
+    Process_CreateForceData(&data->boxes, SidString, SessionId);
+
+    //
+    // insert the new entry into the cache, unless another thread
+    // was faster, and drop the least recently used unused entries
+    //
+
+    KeRaiseIrql(APC_LEVEL, &irql);
+    ExAcquireResourceExclusiveLite(Process_ForceDataLock, TRUE);
+
+    if (conf_gen == Conf_GetGeneration()) {
+
+        found = List_Head(&Process_ForceDataCache);
+        while (found) {
+
+            if (found->conf_gen == conf_gen && found->SessionId == SessionId
+                    && found->sid_len == sid_len
+                    && _wcsicmp(found->SidString, SidString) == 0) {
+
+                ++found->ref_count;
+                break;
+            }
+
+            found = List_Next(found);
+        }
+
+        if (! found) {
+
+            ++data->ref_count;
+            List_Insert_Before(&Process_ForceDataCache, NULL, data);
+
+            next = List_Tail(&Process_ForceDataCache);
+            while (next && List_Count(&Process_ForceDataCache) > FORCE_DATA_CACHE_MAX) {
+
+                FORCE_DATA *prev = List_Prev(next);
+
+                if (next->ref_count == 1) {
+
+                    List_Remove(&Process_ForceDataCache, next);
+                    --next->ref_count;
+                    List_Insert_After(&stale, NULL, next);
+                }
+
+                next = prev;
+            }
+        }
+    }
+
+    ExReleaseResourceLite(Process_ForceDataLock);
+    KeLowerIrql(irql);
+
+    while ((next = List_Head(&stale)) != NULL) {
+
+        List_Remove(&stale, next);
+        Process_FreeForceData(next);
+    }
+
+    if (found) {
+
+        Process_FreeForceData(data);
+        data = found;
+    }
+
+    return data;
+}
+
+
+//---------------------------------------------------------------------------
+// Process_ReleaseForceData
+//---------------------------------------------------------------------------
+
+
+_FX void Process_ReleaseForceData(FORCE_DATA *data)
+{
+    KIRQL irql;
+    LONG ref_count;
+
+    KeRaiseIrql(APC_LEVEL, &irql);
+    ExAcquireResourceExclusiveLite(Process_ForceDataLock, TRUE);
+
+    ref_count = --data->ref_count;
+
+    ExReleaseResourceLite(Process_ForceDataLock);
+    KeLowerIrql(irql);
+
+    if (ref_count == 0)
+        Process_FreeForceData(data);
+}
+
+
+//---------------------------------------------------------------------------
+// Process_AcquireForcePaths
+//---------------------------------------------------------------------------
+
+
+_FX FORCE_PATHS *Process_AcquireForcePaths(FORCE_DATA *data)
+{
+    FORCE_PATHS *paths, *stale;
+    LARGE_INTEGER now;
+    ULONG reparse_gen;
+    KIRQL irql;
+
+    //
+    // reuse the path rules of the force data while no cached reparse
+    // point translation has expired since they were built, and they are
+    // not older than such a translation may be.  the force data holds
+    // one reference on its path rules, replaced rules are freed once
+    // the last user releases them
+    //
+
+    reparse_gen = File_GetReparseGeneration();
+    KeQuerySystemTime(&now);
+
+    KeRaiseIrql(APC_LEVEL, &irql);
+    ExAcquireResourceExclusiveLite(Process_ForceDataLock, TRUE);
+
+    paths = data->paths;
+    if (paths && paths->reparse_gen == reparse_gen
+              && now.QuadPart - paths->time < FORCE_PATHS_MAX_AGE)
+        ++paths->ref_count;
+    else
+        paths = NULL;
+
+    ExReleaseResourceLite(Process_ForceDataLock);
+    KeLowerIrql(irql);
+
+    if (paths)
+        return paths;
+
+    //
+    // otherwise build the path rules again, outside of the lock
+    //
+
+    paths = Process_CreateForcePaths(&data->boxes);
+    if (! paths)
+        return NULL;
+
+    paths->reparse_gen = reparse_gen;
+    paths->time = now.QuadPart;
+
+    KeRaiseIrql(APC_LEVEL, &irql);
+    ExAcquireResourceExclusiveLite(Process_ForceDataLock, TRUE);
+
+    stale = data->paths;
+    if (stale && --stale->ref_count != 0)
+        stale = NULL;
+
+    ++paths->ref_count;
+    data->paths = paths;
+
+    ExReleaseResourceLite(Process_ForceDataLock);
+    KeLowerIrql(irql);
+
+    if (stale)
+        Process_DeleteForcePaths(stale);
+
+    return paths;
+}
+
+
+//---------------------------------------------------------------------------
+// Process_ReleaseForcePaths
+//---------------------------------------------------------------------------
+
+
+_FX void Process_ReleaseForcePaths(FORCE_PATHS *paths)
+{
+    KIRQL irql;
+    LONG ref_count;
+
+    KeRaiseIrql(APC_LEVEL, &irql);
+    ExAcquireResourceExclusiveLite(Process_ForceDataLock, TRUE);
+
+    ref_count = --paths->ref_count;
+
+    ExReleaseResourceLite(Process_ForceDataLock);
+    KeLowerIrql(irql);
+
+    if (ref_count == 0)
+        Process_DeleteForcePaths(paths);
+}
+
+
+//---------------------------------------------------------------------------
+// Process_InitForceData
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Process_InitForceData(void)
+{
+    List_Init(&Process_ForceDataCache);
+
+    if (! Mem_GetLockResource(&Process_ForceDataLock, TRUE))
+        return FALSE;
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// Process_UnloadForceData
+//---------------------------------------------------------------------------
+
+
+_FX void Process_UnloadForceData(BOOLEAN FreeLock)
+{
+    FORCE_DATA *data;
+
+    if (! Process_ForceDataLock)
+        return;
+
+    //
+    // the process notify routines are removed at this point, so the
+    // cached entries are no longer referenced by anyone else
+    //
+
+    while ((data = List_Head(&Process_ForceDataCache)) != NULL) {
+
+        List_Remove(&Process_ForceDataCache, data);
+        Process_FreeForceData(data);
+    }
+
+    if (FreeLock)
+        Mem_FreeLockResource(&Process_ForceDataLock);
+}
+
+
 //---------------------------------------------------------------------------
 // Process_CheckBoxPath
 //---------------------------------------------------------------------------
@@ -1356,10 +1994,12 @@ _FX BOX *Process_CheckBoxPath(LIST *boxes, const WCHAR *path)
 
 
 _FX BOOLEAN Process_CheckForceFolderList(
-    BOX *box, LIST* ForceFolder, ULONG prefix_len, const WCHAR *path)
+    BOX *box, LIST* ForceFolder, ULONG prefix_len,
+    const WCHAR *path, const WCHAR *path_lwr)
 {
-    ULONG path_lwr_len = 0;
-    WCHAR *path_lwr = NULL;
+    //
+    // path_lwr is the lower case path up to prefix_len, or NULL
+    //
 
     FORCE_ENTRY *folder = List_Head(ForceFolder);
     while (folder) {
@@ -1372,18 +2012,9 @@ _FX BOOLEAN Process_CheckForceFolderList(
             // wildcards in ForceFolder:  match using pattern
             //
 
-            if (! path_lwr) {
-                path_lwr = Mem_AllocString(Driver_Pool, path);
-                if (path_lwr) {
-                    path_lwr[prefix_len] = L'\0';
-                    _wcslwr(path_lwr);
-                    path_lwr_len = wcslen(path_lwr);
-                }
-            }
-
             if (path_lwr) {
                 match = Pattern_Match(
-                                    folder->pat, path_lwr, path_lwr_len);
+                                    folder->pat, path_lwr, prefix_len);
             }
 
         } else {
@@ -1409,22 +2040,77 @@ _FX BOOLEAN Process_CheckForceFolderList(
         folder = List_Next(folder);
     }
 
-    if (path_lwr)
-        Mem_FreeString(path_lwr);
-
     if (folder) // found
         return TRUE;
     return FALSE;
 }
 
 
+//---------------------------------------------------------------------------
+// Process_CheckForceFolderBoxes
+//---------------------------------------------------------------------------
+
+
+_FX FORCE_BOX *Process_CheckForceFolderBoxes(
+    LIST *boxes, FORCE_TREE *tree, BOOLEAN alert_list,
+    ULONG prefix_len, const WCHAR *path)
+{
+    FORCE_BOX *box;
+    WCHAR *path_lwr;
+    ULONG first;
+    ULONG index;
+
+    //
+    // the lower case path for the folders with wildcards is made once
+    // for all boxes
+    //
+
+    path_lwr = Mem_AllocString(Driver_Pool, path);
+    if (path_lwr) {
+        path_lwr[prefix_len] = L'\0';
+        _wcslwr(path_lwr);
+    }
+
+    //
+    // the folders without wildcards are found through the tree, which
+    // gives the index of the first box with such a folder, boxes before
+    // that one only need to be checked for folders with wildcards
+    //
+
+    first = tree ? Process_ForceTreeMatch(tree, path, prefix_len)
+                 : FORCE_TREE_NONE;
+
+    index = 0;
+
+    box = List_Head(boxes);
+    while (box) {
+
+        if (index == first || Process_CheckForceFolderList(box->box,
+                alert_list ? &box->AlertFolder : &box->ForceFolder,
+                prefix_len, path, path_lwr)) {
+
+            break;
+        }
+
+        box = List_Next(box);
+        ++index;
+    }
+
+    if (path_lwr)
+        Mem_FreeString(path_lwr);
+
+    return box;
+}
+
+
 //---------------------------------------------------------------------------
 // Process_CheckForceFolder
 //---------------------------------------------------------------------------
 
 
 _FX BOX *Process_CheckForceFolder(
-    LIST *boxes, const WCHAR *path, BOOLEAN alert, ULONG *IsAlert)
+    LIST *boxes, FORCE_TREE *tree,
+    const WCHAR *path, BOOLEAN alert, ULONG *IsAlert)
 {
     const WCHAR *ptr;
     ULONG prefix_len;
@@ -1459,20 +2145,15 @@ _FX BOX *Process_CheckForceFolder(
     // check if the folder is forced to any box
     //
 
-    box = List_Head(boxes);
-    while (box) {
+    box = Process_CheckForceFolderBoxes(boxes, tree, FALSE, prefix_len, path);
+    if (box) {
 
-        if (Process_CheckForceFolderList(box->box, &box->ForceFolder, prefix_len, path)) {
-
-            if (alert) {
-                *IsAlert = 1;
-                return NULL;
-            }
-
-            return box->box;
+        if (alert) {
+            *IsAlert = 1;
+            return NULL;
         }
 
-        box = List_Next(box);
+        return box->box;
     }
 
     return NULL;
@@ -1485,22 +2166,17 @@ _FX BOX *Process_CheckForceFolder(
 
 
 _FX BOOLEAN Process_CheckForceProcessList(
-    BOX *box, LIST* ForceProcess, const WCHAR* name, const WCHAR* path)
+    BOX *box, LIST* ForceProcess, HASH_MAP* Names,
+    const WCHAR* name, const WCHAR* name_lwr, const WCHAR* path_lwr)
 {
-    //FORCE_PROCESS *process = List_Head(ForceProcess);
-    //while (process) {
-
-    //    const WCHAR *value = process->value;
-    //    if (Process_MatchImage(box, value, 0, name, 1)) {
-
-    //        return TRUE;
-    //    }
-
-    //    process = List_Next(process);
-    //}
+    //
+    // name_lwr and path_lwr are the lower case name and path, or NULL
+    //
 
     ULONG path_lwr_len = 0;
-    WCHAR *path_lwr = NULL;
+
+    if (Names && Names->nnodes && name_lwr && map_get(Names, name_lwr))
+        return TRUE;
 
     FORCE_ENTRY *folder = List_Head(ForceProcess);
     while (folder) {
@@ -1513,22 +2189,15 @@ _FX BOOLEAN Process_CheckForceProcessList(
             // wildcards in ForceProcess:  match using pattern
             //
 
-            if (! path_lwr) {
-                path_lwr = Mem_AllocString(Driver_Pool, path);
-                if (path_lwr) {
-                    _wcslwr(path_lwr);
-                    path_lwr_len = wcslen(path_lwr);
-                }
-            }
-
             if (path_lwr) {
+                if (! path_lwr_len)
+                    path_lwr_len = wcslen(path_lwr);
                 match = Pattern_Match(
                                     folder->pat, path_lwr, path_lwr_len);
             }
 
         } else {
 
-            ULONG folder_len = folder->len;
             if (Process_MatchImage(box, folder->buf, 0, name, 1)) {
 
                 match = TRUE;
@@ -1543,9 +2212,6 @@ _FX BOOLEAN Process_CheckForceProcessList(
         folder = List_Next(folder);
     }
 
-    if (path_lwr)
-        Mem_FreeString(path_lwr);
-
     if (folder) // found
         return TRUE;
     return FALSE;
@@ -1561,6 +2227,9 @@ _FX BOX *Process_CheckForceProcess(
     LIST *boxes, const WCHAR *name, const WCHAR* path, BOOLEAN alert, ULONG *IsAlert, const WCHAR *ParentName, const WCHAR *ParentPath)
 {
     FORCE_BOX *box;
+    BOX *found;
+    WCHAR *name_lwr, *ParentName_lwr;
+    WCHAR *path_lwr, *ParentPath_lwr;
 
     //
     // never force a program from the Sandboxie home directory
@@ -1574,29 +2243,58 @@ _FX BOX *Process_CheckForceProcess(
         return NULL;
     }
 
+    //
+    // lower case names for the hashed image name lookup, and lower case
+    // paths for the patterns, made once for all boxes
+    //
+
+    name_lwr = Mem_AllocString(Driver_Pool, name);
+    if (name_lwr)
+        _wcslwr(name_lwr);
+
+    path_lwr = Mem_AllocString(Driver_Pool, path);
+    if (path_lwr)
+        _wcslwr(path_lwr);
+
+    ParentName_lwr = NULL;
+    if (ParentName) {
+        ParentName_lwr = Mem_AllocString(Driver_Pool, ParentName);
+        if (ParentName_lwr)
+            _wcslwr(ParentName_lwr);
+    }
+
+    ParentPath_lwr = NULL;
+    if (ParentPath) {
+        ParentPath_lwr = Mem_AllocString(Driver_Pool, ParentPath);
+        if (ParentPath_lwr)
+            _wcslwr(ParentPath_lwr);
+    }
+
     //
     // check if the process name is forced to any box
     //
 
+    found = NULL;
+
     box = List_Head(boxes);
     while (box) {
 
-        if (Process_CheckForceProcessList(box->box, &box->ForceProcess, name, path)) {
-            if (alert) {
+        if (Process_CheckForceProcessList(box->box, &box->cached->ForceProcess, &box->cached->ForceProcessNames, name, name_lwr, path_lwr)
+                || Process_CheckForceProcessList(box->box, &box->ForceProcess, NULL, name, NULL, path_lwr)) {
+            if (alert)
                 *IsAlert = 1;
-                return NULL;
-            }
-
-            return box->box;
+            else
+                found = box->box;
+            break;
         }
 
-        if (ParentName && Process_CheckForceProcessList(box->box, &box->ForceChildren, ParentName, ParentPath) && _wcsicmp(name, L"Sandman.exe") != 0) { // except for sandman exe
-            if (alert) {
+        if (ParentName && (Process_CheckForceProcessList(box->box, &box->cached->ForceChildren, &box->cached->ForceChildrenNames, ParentName, ParentName_lwr, ParentPath_lwr)
+                || Process_CheckForceProcessList(box->box, &box->ForceChildren, NULL, ParentName, NULL, ParentPath_lwr)) && _wcsicmp(name, L"Sandman.exe") != 0) { // except for sandman exe
+            if (alert)
                 *IsAlert = 1;
-                return NULL;
-            }
-
-            return box->box;
+            else
+                found = box->box;
+            break;
         }
 
         //if (Process_IsWindowsExplorerParent(ParentId) && Conf_Get_Boolean(box->box->name, L"ForceExplorerChild", 0, FALSE)) {
@@ -1607,7 +2305,16 @@ _FX BOX *Process_CheckForceProcess(
         box = List_Next(box);
     }
 
-    return NULL;
+    if (ParentPath_lwr)
+        Mem_FreeString(ParentPath_lwr);
+    if (ParentName_lwr)
+        Mem_FreeString(ParentName_lwr);
+    if (path_lwr)
+        Mem_FreeString(path_lwr);
+    if (name_lwr)
+        Mem_FreeString(name_lwr);
+
+    return found;
 }
 
 
@@ -1617,7 +2324,7 @@ _FX BOX *Process_CheckForceProcess(
 
 
 _FX void Process_CheckAlertFolder(
-    LIST *boxes, const WCHAR *path, ULONG *IsAlert)
+    LIST *boxes, FORCE_TREE *tree, const WCHAR *path, ULONG *IsAlert)
 {
     const WCHAR *ptr;
     ULONG prefix_len;
@@ -1640,17 +2347,9 @@ _FX void Process_CheckAlertFolder(
     // check if the folder is alerted to any box
     //
 
-    box = List_Head(boxes);
-    while (box) {
-
-        if (Process_CheckForceFolderList(box->box, &box->AlertFolder, prefix_len, path)) {
-
-            *IsAlert = 1;
-			return;
-        }
-
-        box = List_Next(box);
-    }
+    box = Process_CheckForceFolderBoxes(boxes, tree, TRUE, prefix_len, path);
+    if (box)
+        *IsAlert = 1;
 }
 
 
@@ -1663,6 +2362,15 @@ static _FX void Process_CheckAlertProcess(
     LIST *boxes, const WCHAR *name, const WCHAR* path, ULONG *IsAlert)
 {
     FORCE_BOX *box;
+    WCHAR *name_lwr, *path_lwr;
+
+    name_lwr = Mem_AllocString(Driver_Pool, name);
+    if (name_lwr)
+        _wcslwr(name_lwr);
+
+    path_lwr = Mem_AllocString(Driver_Pool, path);
+    if (path_lwr)
+        _wcslwr(path_lwr);
 
     //
     // check if the process name has an alert in any box
@@ -1671,13 +2379,19 @@ static _FX void Process_CheckAlertProcess(
     box = List_Head(boxes);
     while (box) {
 
-        if (Process_CheckForceProcessList(box->box, &box->AlertProcess, name, path)) {
+        if (Process_CheckForceProcessList(box->box, &box->cached->AlertProcess, &box->cached->AlertProcessNames, name, name_lwr, path_lwr)
+                || Process_CheckForceProcessList(box->box, &box->AlertProcess, NULL, name, NULL, path_lwr)) {
             *IsAlert = 1;
-            return;
+            break;
         }
 
         box = List_Next(box);
     }
+
+    if (path_lwr)
+        Mem_FreeString(path_lwr);
+    if (name_lwr)
+        Mem_FreeString(name_lwr);
 }
 
 _FX BOX *Process_CheckHostInjectProcess(
@@ -1692,7 +2406,7 @@ _FX BOX *Process_CheckHostInjectProcess(
     box = List_Head(boxes);
     while (box) {
 
-        FORCE_PROCESS *process = List_Head(&box->HostInjectProcess);
+        FORCE_PROCESS *process = List_Head(&box->cached->HostInjectProcess);
         while (process) {
 
             const WCHAR *value = process->value;
@@ -1728,6 +2442,7 @@ _FX BOOLEAN Process_IsBreakoutProcess(
     LIST BreakoutFolder;
     LIST BreakoutProcess;
     WCHAR *ImagePath2 = L"";
+    WCHAR *ImagePath2_lwr;
     ULONG ImagePath2_len;
     const WCHAR *ImageName = L"";
     BOOLEAN IsBreakout = FALSE;
@@ -1772,13 +2487,21 @@ _FX BOOLEAN Process_IsBreakoutProcess(
 
     Conf_AdjustUseCount(TRUE);
 
-    Process_AddForceFolders(&BreakoutFolder, L"BreakoutFolder", box, box->name);
+    Process_AddForceFolders(&BreakoutFolder, NULL, L"BreakoutFolder", box, box->name, FORCE_ADD_NAMES | FORCE_ADD_PATHS);
 
-    Process_AddForceProcesses(&BreakoutProcess, L"BreakoutProcess", box->name);
+    Process_AddForceFolders(&BreakoutProcess, NULL, L"BreakoutProcess", box, box->name, FORCE_ADD_NAMES | FORCE_ADD_PATHS);
         
     Conf_AdjustUseCount(FALSE);
 
-    IsBreakout = Process_CheckForceProcessList(box, &BreakoutProcess, ImageName);
+    //
+    // the lower case path is only used for patterns
+    //
+
+    ImagePath2_lwr = Mem_AllocString(Driver_Pool, ImagePath2);
+    if (ImagePath2_lwr)
+        _wcslwr(ImagePath2_lwr);
+
+    IsBreakout = Process_CheckForceProcessList(box, &BreakoutProcess, NULL, ImageName, NULL, ImagePath2_lwr);
     if (!IsBreakout) {
         const WCHAR *ptr;
         ULONG prefix_len;
@@ -1789,12 +2512,18 @@ _FX BOOLEAN Process_IsBreakoutProcess(
         else
             prefix_len = 0;
 
-        if (prefix_len > 0)
-            IsBreakout = Process_CheckForceFolderList(box, &BreakoutFolder, prefix_len, ImagePath2);
+        if (prefix_len > 0) {
+            if (ImagePath2_lwr)
+                ImagePath2_lwr[prefix_len] = L'\0';
+            IsBreakout = Process_CheckForceFolderList(box, &BreakoutFolder, prefix_len, ImagePath2, ImagePath2_lwr);
+        }
     }
 
+    if (ImagePath2_lwr)
+        Mem_FreeString(ImagePath2_lwr);
+
     Process_DeleteForceDataFolders(&BreakoutFolder);
-    Process_DeleteForceDataProcesses(&BreakoutProcess);
+    Process_DeleteForceDataFolders(&BreakoutProcess);
 
 finish:
     Mem_Free(ImagePath2, ImagePath2_len);
@@ -0,0 +1,311 @@
+/*
+ * Copyright 2004-2020 Sandboxie Holdings, LLC
+ * Copyright 2020 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Process Force Folder Tree
+//---------------------------------------------------------------------------
+
+
+//
+// a prefix tree of the ForceFolder and AlertFolder entries without
+// wildcards of all boxes, which finds the first box forcing a folder in
+// one walk along the path, instead of comparing the path against every
+// folder of every box.  characters are kept in upper case, which is how
+// Box_NlsStrCmp compares them.  this file is included by process_force.c,
+// and only uses Mem_Alloc, Mem_Free and RtlUpcaseUnicodeChar, so it can
+// also be built outside of the driver, see tests/force_tree_test.c
+//
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define FORCE_TREE_NONE     ((ULONG)-1)
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _FORCE_TREE_NODE {
+
+    // first child and next sibling in the tree
+    struct _FORCE_TREE_NODE *child;
+    struct _FORCE_TREE_NODE *sibling;
+
+    // lowest box index of a folder which ends at this node,
+    // or FORCE_TREE_NONE
+    ULONG index;
+
+    // edge label in upper case, allocated as part of this node
+    ULONG label_len;
+    ULONG alloc_len;
+    WCHAR label[1];
+
+} FORCE_TREE_NODE;
+
+
+typedef struct _FORCE_TREE {
+
+    // children of the root are the first characters of the folders
+    FORCE_TREE_NODE *root;
+
+} FORCE_TREE;
+
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+
+static FORCE_TREE_NODE *Process_ForceTreeAlloc(
+    const WCHAR *label, ULONG label_len);
+
+static void Process_ForceTreeInit(FORCE_TREE *tree);
+
+static BOOLEAN Process_ForceTreeInsert(
+    FORCE_TREE *tree, const WCHAR *folder, ULONG len, ULONG index);
+
+static ULONG Process_ForceTreeMatch(
+    FORCE_TREE *tree, const WCHAR *path, ULONG prefix_len);
+
+static void Process_ForceTreeFree(FORCE_TREE *tree);
+
+
+//---------------------------------------------------------------------------
+// Process_ForceTreeAlloc
+//---------------------------------------------------------------------------
+
+
+_FX FORCE_TREE_NODE *Process_ForceTreeAlloc(
+    const WCHAR *label, ULONG label_len)
+{
+    FORCE_TREE_NODE *node;
+    ULONG alloc_len;
+    ULONG i;
+
+    alloc_len = sizeof(FORCE_TREE_NODE) + label_len * sizeof(WCHAR);
+    node = Mem_Alloc(Driver_Pool, alloc_len);
+    if (! node)
+        return NULL;
+
+    node->child = NULL;
+    node->sibling = NULL;
+    node->index = FORCE_TREE_NONE;
+    node->label_len = label_len;
+    node->alloc_len = alloc_len;
+
+    for (i = 0; i < label_len; ++i)
+        node->label[i] = RtlUpcaseUnicodeChar(label[i]);
+    node->label[label_len] = L'\0';
+
+    return node;
+}
+
+
+//---------------------------------------------------------------------------
+// Process_ForceTreeInit
+//---------------------------------------------------------------------------
+
+
+_FX void Process_ForceTreeInit(FORCE_TREE *tree)
+{
+    tree->root = NULL;
+}
+
+
+//---------------------------------------------------------------------------
+// Process_ForceTreeInsert
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Process_ForceTreeInsert(
+    FORCE_TREE *tree, const WCHAR *folder, ULONG len, ULONG index)
+{
+    FORCE_TREE_NODE **pchild;
+    FORCE_TREE_NODE *child;
+    FORCE_TREE_NODE *split;
+    WCHAR ch;
+    ULONG i;
+
+    //
+    // the root itself never holds a folder, an empty folder never matches
+    //
+
+    if (! len)
+        return FALSE;
+
+    pchild = &tree->root;
+
+    while (1) {
+
+        ch = RtlUpcaseUnicodeChar(*folder);
+        while (*pchild && (*pchild)->label[0] != ch)
+            pchild = &(*pchild)->sibling;
+        child = *pchild;
+
+        if (! child) {
+
+            child = Process_ForceTreeAlloc(folder, len);
+            if (! child)
+                return FALSE;
+
+            child->index = index;
+            *pchild = child;
+            return TRUE;
+        }
+
+        for (i = 1; i < len && i < child->label_len; ++i) {
+            if (child->label[i] != RtlUpcaseUnicodeChar(folder[i]))
+                break;
+        }
+
+        //
+        // the folder ends or diverges in the middle of the edge label,
+        // split the edge so that every folder ends on a node boundary
+        //
+
+        if (i < child->label_len) {
+
+            split = Process_ForceTreeAlloc(child->label, i);
+            if (! split)
+                return FALSE;
+
+            split->child = child;
+            split->sibling = child->sibling;
+
+            child->sibling = NULL;
+            child->label_len -= i;
+            memmove(child->label, child->label + i,
+                    (child->label_len + 1) * sizeof(WCHAR));
+
+            *pchild = split;
+            child = split;
+        }
+
+        folder += i;
+        len -= i;
+
+        if (! len) {
+
+            //
+            // boxes are inserted in ascending order, so an index which
+            // is already set is the first box forcing this folder
+            //
+
+            if (child->index == FORCE_TREE_NONE || index < child->index)
+                child->index = index;
+            return TRUE;
+        }
+
+        pchild = &child->child;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Process_ForceTreeMatch
+//---------------------------------------------------------------------------
+
+
+_FX ULONG Process_ForceTreeMatch(
+    FORCE_TREE *tree, const WCHAR *path, ULONG prefix_len)
+{
+    FORCE_TREE_NODE *node;
+    ULONG best;
+    ULONG pos;
+    ULONG i;
+    WCHAR ch;
+
+    //
+    // a folder matches when it is a prefix of the path which ends at a
+    // backslash, no further than the backslash before the last path
+    // component, see Process_CheckForceFolderList.  the lowest box index
+    // of all folders along the way is the first box forcing the path
+    //
+
+    best = FORCE_TREE_NONE;
+    node = tree->root;
+    pos = 0;
+
+    while (node && pos < prefix_len) {
+
+        ch = RtlUpcaseUnicodeChar(path[pos]);
+        while (node && node->label[0] != ch)
+            node = node->sibling;
+
+        if ((! node) || node->label_len > prefix_len - pos)
+            break;
+
+        for (i = 1; i < node->label_len; ++i) {
+            if (node->label[i] != RtlUpcaseUnicodeChar(path[pos + i]))
+                break;
+        }
+        if (i < node->label_len)
+            break;
+
+        pos += node->label_len;
+
+        if (node->index < best && path[pos] == L'\\')
+            best = node->index;
+
+        node = node->child;
+    }
+
+    return best;
+}
+
+
+//---------------------------------------------------------------------------
+// Process_ForceTreeFree
+//---------------------------------------------------------------------------
+
+
+_FX void Process_ForceTreeFree(FORCE_TREE *tree)
+{
+    FORCE_TREE_NODE *node;
+    FORCE_TREE_NODE *next;
+
+    //
+    // free the nodes in sibling order, moving the children of each node
+    // up into the sibling chain first, so no recursion is needed
+    //
+
+    node = tree->root;
+    while (node) {
+
+        if (node->child) {
+
+            next = node->child;
+            while (next->sibling)
+                next = next->sibling;
+            next->sibling = node->sibling;
+            node->sibling = node->child;
+            node->child = NULL;
+        }
+
+        next = node->sibling;
+        Mem_Free(node, node->alloc_len);
+        node = next;
+    }
+
+    tree->root = NULL;
+}
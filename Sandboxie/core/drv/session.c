@@ -37,6 +37,8 @@
 
 #define SESSION_MONITOR_BUF_SIZE    (PAGE_SIZE * 32)
 
+#define SESSION_MONITOR_BATCH_AGE   10          // seconds
+
 
 //---------------------------------------------------------------------------
 // Structures and Types
@@ -76,7 +78,7 @@ struct _SESSION {
 
     BOOLEAN monitor_stack_trace;
 
-    BOOLEAN monitor_overflow;
+    volatile LONG monitor_overflow;
 
 };
 
@@ -94,8 +96,19 @@ static void Session_Unlock(KIRQL irql);
 static SESSION *Session_Get(
     BOOLEAN create, ULONG SessionId, KIRQL *out_irql);
 
+static SESSION *Session_GetShared(ULONG SessionId, KIRQL *out_irql);
+
 static BOOLEAN Session_CheckAdminAccess2(const WCHAR *setting);
 
+static void Session_MonitorWrite(
+    ULONG type, const WCHAR** strings, ULONG* lengths,
+    HANDLE hpid, HANDLE htid, ULONG repeat, BOOLEAN capture_stack,
+    const LARGE_INTEGER *timestamp);
+
+static ULONG Session_MonitorGetState(void);
+
+static HANDLE Session_MonitorBatchThread(PROCESS *proc, ULONG tid, ULONG *valid_tid);
+
 
 //---------------------------------------------------------------------------
 
@@ -114,6 +127,8 @@ static NTSTATUS Session_Api_MonitorPut2(PROCESS *proc, ULONG64 *parms);
 
 static NTSTATUS Session_Api_MonitorPutEx(PROCESS *proc, ULONG64 *parms);
 
+static NTSTATUS Session_Api_MonitorPutBatch(PROCESS *proc, ULONG64 *parms);
+
 //static NTSTATUS Session_Api_MonitorGet(PROCESS *proc, ULONG64 *parms);
 
 static NTSTATUS Session_Api_MonitorGetEx(PROCESS *proc, ULONG64 *parms);
@@ -150,6 +165,7 @@ _FX BOOLEAN Session_Init(void)
     //Api_SetFunction(API_MONITOR_PUT,            Session_Api_MonitorPut);
     Api_SetFunction(API_MONITOR_PUT2,           Session_Api_MonitorPut2);
     Api_SetFunction(API_MONITOR_PUT_EX,         Session_Api_MonitorPutEx);
+    Api_SetFunction(API_MONITOR_PUT_BATCH,      Session_Api_MonitorPutBatch);
     //Api_SetFunction(API_MONITOR_GET,            Session_Api_MonitorGet);
 	Api_SetFunction(API_MONITOR_GET_EX,			Session_Api_MonitorGetEx);
     Api_SetFunction(API_MONITOR_GET2,            Session_Api_MonitorGet2);
@@ -236,6 +252,44 @@ _FX SESSION *Session_Get(BOOLEAN create, ULONG SessionId, KIRQL *out_irql)
 }
 
 
+//---------------------------------------------------------------------------
+// Session_GetShared
+//---------------------------------------------------------------------------
+
+
+_FX SESSION *Session_GetShared(ULONG SessionId, KIRQL *out_irql)
+{
+    NTSTATUS status;
+    SESSION *session;
+
+    if (SessionId == -1) {
+        status = MyGetSessionId(&SessionId);
+        if (! NT_SUCCESS(status))
+            return NULL;
+    }
+
+    //
+    // find an existing SESSION block, holding the lock shared,
+    // the SESSION block may be used but not modified by the caller
+    //
+
+    KeRaiseIrql(APC_LEVEL, out_irql);
+    ExAcquireResourceSharedLite(Session_ListLock, TRUE);
+
+    session = List_Head(&Session_List);
+    while (session) {
+        if (session->session_id == SessionId)
+            break;
+        session = List_Next(session);
+    }
+
+    if (! session)
+        Session_Unlock(*out_irql);
+
+    return session;
+}
+
+
 //---------------------------------------------------------------------------
 // Session_Cancel
 //---------------------------------------------------------------------------
@@ -593,17 +647,37 @@ _FX void Session_MonitorPut(ULONG type, const WCHAR *name, HANDLE pid)
 
 
 _FX void Session_MonitorPutEx(ULONG type, const WCHAR** strings, ULONG* lengths, HANDLE hpid, HANDLE htid)
+{
+    Session_MonitorWrite(type, strings, lengths, hpid, htid, 1, TRUE, NULL);
+}
+
+
+//---------------------------------------------------------------------------
+// Session_MonitorWrite
+//---------------------------------------------------------------------------
+
+
+_FX void Session_MonitorWrite(
+    ULONG type, const WCHAR** strings, ULONG* lengths,
+    HANDLE hpid, HANDLE htid, ULONG repeat, BOOLEAN capture_stack,
+    const LARGE_INTEGER *timestamp_ptr)
 {
     SESSION *session;
     KIRQL irql;
 
-    session = Session_Get(FALSE, -1, &irql);
+    //
+    // the monitor log is filled in by all threads in parallel, each one
+    // reserves its entry without locking and copies the data in while
+    // holding the session lock shared, readers take it exclusively
+    //
+
+    session = Session_GetShared(-1, &irql);
     if (! session)
         return;
 
     if (session->monitor_log) {
 
-        LARGE_INTEGER timestamp = Util_GetTimestamp();
+        LARGE_INTEGER timestamp = timestamp_ptr ? *timestamp_ptr : Util_GetTimestamp();
 
 		ULONG pid = (ULONG)hpid;
         ULONG tid = (ULONG)htid;
@@ -618,12 +692,18 @@ _FX void Session_MonitorPutEx(ULONG type, const WCHAR** strings, ULONG* lengths,
 
         PVOID backTrace[MAX_STACK_DEPTH];
         ULONG frames = 0;
-        if (session->monitor_stack_trace) {
+        if (session->monitor_stack_trace && capture_stack) {
             frames = Util_CaptureStack(backTrace, MAX_STACK_DEPTH);
-            entry_size += sizeof(WCHAR) + sizeof(ULONG) + sizeof(ULONG) + (frames * sizeof(PVOID));
+            entry_size += sizeof(ULONG) + sizeof(ULONG) + (frames * sizeof(PVOID));
         }
 
-		CHAR* write_ptr = log_buffer_push_entry((LOG_BUFFER_SIZE_T)entry_size, session->monitor_log, FALSE);
+        if (repeat > 1)
+            entry_size += sizeof(ULONG) + sizeof(ULONG) + sizeof(ULONG);
+
+        if (frames || repeat > 1)
+            entry_size += sizeof(WCHAR);
+
+		CHAR* write_ptr = log_buffer_reserve_entry((LOG_BUFFER_SIZE_T)entry_size, session->monitor_log);
 		if (write_ptr) {
             WCHAR null_char = L'\0';
             log_buffer_push_bytes((CHAR*)&timestamp.QuadPart, 8, &write_ptr, session->monitor_log);
@@ -637,10 +717,20 @@ _FX void Session_MonitorPutEx(ULONG type, const WCHAR** strings, ULONG* lengths,
                 log_buffer_push_bytes((CHAR*)&null_char, sizeof(WCHAR), &write_ptr, session->monitor_log);
             }
 
-            if (frames) {
+            if (frames || repeat > 1) {
                 WCHAR strings_end = 0xFFFF;
                 log_buffer_push_bytes((CHAR*)&strings_end, sizeof(WCHAR), &write_ptr, session->monitor_log);
+            }
+
+            if (repeat > 1) {
+                ULONG tag_id = 'RPTC';
+                ULONG tag_len = sizeof(ULONG);
+                log_buffer_push_bytes((CHAR*)&tag_id, sizeof(ULONG), &write_ptr, session->monitor_log);
+                log_buffer_push_bytes((CHAR*)&tag_len, sizeof(ULONG), &write_ptr, session->monitor_log);
+                log_buffer_push_bytes((CHAR*)&repeat, sizeof(ULONG), &write_ptr, session->monitor_log);
+            }
 
+            if (frames) {
                 ULONG tag_id = 'STCK';
                 ULONG tag_len = frames * sizeof(PVOID);
                 log_buffer_push_bytes((CHAR*)&tag_id, sizeof(ULONG), &write_ptr, session->monitor_log);
@@ -648,8 +738,7 @@ _FX void Session_MonitorPutEx(ULONG type, const WCHAR** strings, ULONG* lengths,
                 log_buffer_push_bytes((CHAR*)backTrace, frames * sizeof(PVOID), &write_ptr, session->monitor_log);
             }
 		}
-        else if (!session->monitor_overflow) {
-            session->monitor_overflow = TRUE;
+        else if (InterlockedCompareExchange(&session->monitor_overflow, TRUE, FALSE) == FALSE) {
             Log_Msg0(MSG_MONITOR_OVERFLOW);
         }
     }
@@ -1023,6 +1112,202 @@ _FX NTSTATUS Session_Api_MonitorPutEx(PROCESS* proc, ULONG64* parms)
 }
 
 
+//---------------------------------------------------------------------------
+// Session_MonitorGetState
+//---------------------------------------------------------------------------
+
+
+_FX ULONG Session_MonitorGetState(void)
+{
+    SESSION *session;
+    KIRQL irql;
+    ULONG state = MONITOR_BATCH_STATE_IDLE;
+
+    session = Session_GetShared(-1, &irql);
+    if (! session)
+        return state;
+
+    if (session->monitor_log) {
+        state = session->monitor_stack_trace
+              ? MONITOR_BATCH_STATE_STACK : MONITOR_BATCH_STATE_ACTIVE;
+    }
+
+    Session_Unlock(irql);
+
+    return state;
+}
+
+
+//---------------------------------------------------------------------------
+// Session_Api_MonitorPutBatch
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS Session_Api_MonitorPutBatch(PROCESS *proc, ULONG64 *parms)
+{
+    API_MONITOR_PUT_BATCH_ARGS *args = (API_MONITOR_PUT_BATCH_ARGS *)parms;
+    NTSTATUS status;
+    ULONG *user_state;
+    UCHAR *user_buffer;
+    UCHAR *buffer;
+    ULONG buffer_len;
+    ULONG state;
+    ULONG offset;
+    ULONG valid_tid;
+    LARGE_INTEGER counter_now;
+    LARGE_INTEGER frequency;
+    LONGLONG max_age;
+
+    //
+    // the batch is put together by SbieDll in the sandboxed process, see
+    // SbieApi_MonitorPut2Ex, entries are recorded for the calling process
+    // in the order they appear in the batch, each one with the time it
+    // was put, which may be at most SESSION_MONITOR_BATCH_AGE ago
+    //
+
+    if (! proc)
+        return STATUS_NOT_IMPLEMENTED;
+
+    user_state = args->monitor_state.val;
+    if (! user_state)
+        return STATUS_INVALID_PARAMETER;
+    ProbeForWrite(user_state, sizeof(ULONG), sizeof(ULONG));
+
+    if (! Session_MonitorCount || proc->disable_monitor) {
+        *user_state = MONITOR_BATCH_STATE_IDLE;
+        return STATUS_SUCCESS;
+    }
+
+    state = Session_MonitorGetState();
+    *user_state = state;
+
+    user_buffer = args->buffer.val;
+    buffer_len = args->buffer_len.val;
+    if (state == MONITOR_BATCH_STATE_IDLE || ! user_buffer || ! buffer_len)
+        return STATUS_SUCCESS;
+
+    if (buffer_len > API_MONITOR_BATCH_MAX)
+        return STATUS_INVALID_PARAMETER;
+
+    //
+    // the caller can modify its buffer at any time, so work on a copy
+    //
+
+    buffer = Mem_Alloc(proc->pool, buffer_len);
+    if (! buffer)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    __try {
+
+        ProbeForRead(user_buffer, buffer_len, sizeof(ULONG));
+        memcpy(buffer, user_buffer, buffer_len);
+        status = STATUS_SUCCESS;
+
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+    }
+
+    counter_now = KeQueryPerformanceCounter(&frequency);
+    max_age = frequency.QuadPart * SESSION_MONITOR_BATCH_AGE;
+
+    valid_tid = 0;
+    offset = 0;
+
+    while (NT_SUCCESS(status)) {
+
+        API_MONITOR_BATCH_ENTRY *entry;
+        ULONG entry_len;
+
+        if (buffer_len - offset < FIELD_OFFSET(API_MONITOR_BATCH_ENTRY, log_data)) {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        entry = (API_MONITOR_BATCH_ENTRY *)(buffer + offset);
+
+        entry_len = FIELD_OFFSET(API_MONITOR_BATCH_ENTRY, log_data);
+        if (entry->log_len > (buffer_len - offset - entry_len) / sizeof(WCHAR)) {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+        entry_len += entry->log_len * sizeof(WCHAR);
+
+        if (entry->repeat > API_MONITOR_BATCH_MAX_REPEAT)
+            entry->repeat = API_MONITOR_BATCH_MAX_REPEAT;
+
+        if (entry->log_type && entry->log_len && entry->repeat) {
+
+            const WCHAR* strings[3] = { entry->is_message ? Driver_Empty : entry->log_data, entry->is_message ? entry->log_data : NULL, NULL };
+            ULONG lengths[3] = { entry->is_message ? 0 : entry->log_len, entry->is_message ? entry->log_len : 0, 0 };
+            LARGE_INTEGER counter, timestamp;
+
+            counter.QuadPart = (LONGLONG)entry->log_time;
+            if (counter.QuadPart > counter_now.QuadPart)
+                counter.QuadPart = counter_now.QuadPart;
+            else if (counter_now.QuadPart - counter.QuadPart > max_age)
+                counter.QuadPart = counter_now.QuadPart - max_age;
+            timestamp = Util_CounterToTimestamp(counter);
+
+            Session_MonitorWrite(entry->log_type | MONITOR_USER, strings, lengths,
+                proc->pid, Session_MonitorBatchThread(proc, entry->log_tid, &valid_tid),
+                entry->repeat, args->capture_stack.val ? TRUE : FALSE, &timestamp);
+        }
+
+        if (! entry->next_offset)
+            break;
+
+        if (entry->next_offset < entry_len
+                || (entry->next_offset & (API_MONITOR_BATCH_ALIGN - 1))
+                || entry->next_offset > buffer_len - offset) {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        offset += entry->next_offset;
+    }
+
+    Mem_Free(buffer, buffer_len);
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// Session_MonitorBatchThread
+//---------------------------------------------------------------------------
+
+
+_FX HANDLE Session_MonitorBatchThread(PROCESS *proc, ULONG tid, ULONG *valid_tid)
+{
+    PETHREAD Thread;
+    HANDLE ThreadId = (HANDLE)(ULONG_PTR)tid;
+    BOOLEAN valid = FALSE;
+
+    //
+    // the batch may be sent by another thread than the one which put an
+    // entry, so the entry names its thread.  we only accept a thread of
+    // the calling process, and otherwise record the calling thread.
+    // *valid_tid remembers the last thread which was accepted
+    //
+
+    if ((tid && tid == *valid_tid) || ThreadId == PsGetCurrentThreadId())
+        return ThreadId;
+
+    if (tid && NT_SUCCESS(PsLookupThreadByThreadId(ThreadId, &Thread))) {
+
+        valid = (PsGetThreadProcessId(Thread) == proc->pid);
+
+        ObDereferenceObject(Thread);
+    }
+
+    if (! valid)
+        return PsGetCurrentThreadId();
+
+    *valid_tid = tid;
+    return ThreadId;
+}
+
+
 //---------------------------------------------------------------------------
 // Session_Api_MonitorGet
 //---------------------------------------------------------------------------
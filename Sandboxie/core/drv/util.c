@@ -691,18 +691,33 @@ _FX BOOLEAN Util_IsProtectedProcess(HANDLE pid)
 
 
 _FX LARGE_INTEGER Util_GetTimestamp(void)
+{
+    return Util_CounterToTimestamp(KeQueryPerformanceCounter(NULL));
+}
+
+
+//---------------------------------------------------------------------------
+// Util_CounterToTimestamp
+//---------------------------------------------------------------------------
+
+
+_FX LARGE_INTEGER Util_CounterToTimestamp(LARGE_INTEGER CounterNow)
 {
     static LARGE_INTEGER gMonitorStartCounter;
     static LARGE_INTEGER gPerformanceFrequency;
     static LARGE_INTEGER gMonitorStartTime = { 0 };
 
+    //
+    // converts a performance counter value, which can also come from
+    // QueryPerformanceCounter in user mode, to the system time
+    //
+
     if (gMonitorStartTime.QuadPart == 0) {
         KeQuerySystemTime(&gMonitorStartTime);
         gMonitorStartCounter = KeQueryPerformanceCounter(&gPerformanceFrequency);
     }
 
 	LARGE_INTEGER Time;
-	LARGE_INTEGER CounterNow = KeQueryPerformanceCounter(NULL);
 	LONGLONG CounterOff = CounterNow.QuadPart - gMonitorStartCounter.QuadPart;
 
 	Time.QuadPart = gMonitorStartTime.QuadPart +
@@ -127,6 +127,8 @@ BOOLEAN Util_IsProtectedProcess(HANDLE pid);
 
 LARGE_INTEGER Util_GetTimestamp(void);
 
+LARGE_INTEGER Util_CounterToTimestamp(LARGE_INTEGER Counter);
+
 
 // Sensible limit that may or may not correspond to the actual Windows value.
 #define MAX_STACK_DEPTH 256
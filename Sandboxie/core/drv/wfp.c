@@ -98,6 +98,7 @@ typedef struct _WFP_PROCESS {
 	BOOLEAN LogTraffic;
 	BOOLEAN BlockInternet;
 	LIST NetFwRules;
+	NETFW_INDEX* NetFwIndex;
 
 } WFP_PROCESS;
 
@@ -118,7 +119,7 @@ const WCHAR* Process_MatchImageAndGetValue(BOX* box, const WCHAR* value, const W
 
 ULONG Process_GetTraceFlag(PROCESS *proc, const WCHAR *setting);
 
-void WFP_FreeRules(LIST* NetFwRules);
+void WFP_FreeRules(LIST* NetFwRules, NETFW_INDEX* NetFwIndex);
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (INIT, WFP_Init)
@@ -336,7 +337,7 @@ _FX void WFP_Unload(void)
 		while (map_next(&WFP_Processes, &iter)) {
 			WFP_PROCESS* wfp_proc = iter.value;
 			
-			WFP_FreeRules(&wfp_proc->NetFwRules);
+			WFP_FreeRules(&wfp_proc->NetFwRules, wfp_proc->NetFwIndex);
 			WFP_Free(NULL, wfp_proc);
 		}
 
@@ -576,8 +577,12 @@ Exit:
 //---------------------------------------------------------------------------
 
 
-void WFP_FreeRules(LIST* NetFwRules)
+void WFP_FreeRules(LIST* NetFwRules, NETFW_INDEX* NetFwIndex)
 {
+	// the index points to the rules, free it first
+	if (NetFwIndex)
+		NetFw_FreeIndex(NetFwIndex);
+
 	// clear Firewall Rules
 	while (1) {
 		NETFW_RULE* rule = List_Head(NetFwRules);
@@ -594,9 +599,10 @@ void WFP_FreeRules(LIST* NetFwRules)
 //---------------------------------------------------------------------------
 
 
-BOOLEAN WFP_LoadRules(LIST* NetFwRules, PROCESS* proc)
+BOOLEAN WFP_LoadRules(LIST* NetFwRules, NETFW_INDEX** NetFwIndex, PROCESS* proc)
 {
 	List_Init(NetFwRules);
+	*NetFwIndex = NULL;
 
     for (ULONG index = 0; ; ++index) {
 
@@ -620,6 +626,9 @@ BOOLEAN WFP_LoadRules(LIST* NetFwRules, PROCESS* proc)
 		NetFw_AddRule(NetFwRules, rule);
     }
 
+	// without an index NetFw_BlockTrafficEx checks all rules
+	*NetFwIndex = NetFw_CompileRules(NetFwRules, NULL);
+
 	return TRUE;
 }
 
@@ -688,6 +697,7 @@ BOOLEAN WFP_UpdateProcess(PROCESS* proc)
 	BOOLEAN LogTraffic = FALSE;
 	BOOLEAN BlockInternet = FALSE;
 	LIST NewNetFwRules, OldNetFwRules;
+	NETFW_INDEX *NewNetFwIndex = NULL, *OldNetFwIndex = NULL;
 	
 	List_Init(&NewNetFwRules);
 	List_Init(&OldNetFwRules);
@@ -701,10 +711,11 @@ BOOLEAN WFP_UpdateProcess(PROCESS* proc)
 
 	if (!BlockInternet) {
 
-		ok = WFP_LoadRules(&NewNetFwRules, proc);
+		ok = WFP_LoadRules(&NewNetFwRules, &NewNetFwIndex, proc);
 
 		if (!ok) {
 			memcpy(&OldNetFwRules, &NewNetFwRules, sizeof(LIST));
+			OldNetFwIndex = NewNetFwIndex;
 			BlockInternet = TRUE; // on roule failure we lust block everything
 			// todo: log error
 		}
@@ -725,19 +736,22 @@ BOOLEAN WFP_UpdateProcess(PROCESS* proc)
 		if (ok) {
 			memcpy(&OldNetFwRules, &wfp_proc->NetFwRules, sizeof(LIST));
 			memcpy(&wfp_proc->NetFwRules, &NewNetFwRules, sizeof(LIST));
+			OldNetFwIndex = wfp_proc->NetFwIndex;
+			wfp_proc->NetFwIndex = NewNetFwIndex;
 		}
 		ok = TRUE;
 	}
 	else {
 		if (ok) {
 			memcpy(&OldNetFwRules, &NewNetFwRules, sizeof(LIST));
+			OldNetFwIndex = NewNetFwIndex;
 		}
 		ok = FALSE;
 	}
     
 	KeReleaseSpinLock(&WFP_MapLock, irql);
 
-	WFP_FreeRules(&OldNetFwRules);
+	WFP_FreeRules(&OldNetFwRules, OldNetFwIndex);
 
 	return ok;
 }
@@ -769,7 +783,7 @@ void WFP_DeleteProcess(PROCESS* proc)
 
 	if (wfp_proc)
 	{
-		WFP_FreeRules(&wfp_proc->NetFwRules);
+		WFP_FreeRules(&wfp_proc->NetFwRules, wfp_proc->NetFwIndex);
 		WFP_Free(NULL, wfp_proc);
 	}
 }
@@ -860,7 +874,7 @@ void WFP_classify(
 
 			if (!block) {
 
-				block = NetFw_BlockTraffic(&wfp_proc->NetFwRules, &remote_ip, remote_port, protocol);
+				block = NetFw_BlockTrafficEx(wfp_proc->NetFwIndex, &wfp_proc->NetFwRules, &remote_ip, remote_port, protocol);
 			}
 		}
     
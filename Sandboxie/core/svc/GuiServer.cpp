@@ -798,6 +798,7 @@ bool GuiServer::CreateQueueSlave(const WCHAR *cmdline)
     m_SlaveFuncs[GUI_WND_HOOK_NOTIFY]       = &GuiServer::WndHookNotifySlave;
     m_SlaveFuncs[GUI_WND_HOOK_REGISTER]     = &GuiServer::WndHookRegisterSlave;
     m_SlaveFuncs[GUI_KILL_JOB]              = &GuiServer::KillJob;
+    m_SlaveFuncs[GUI_BATCH]                 = &GuiServer::BatchSlave;
 
 
     //
@@ -4692,6 +4693,111 @@ ULONG GuiServer::KillJob(SlaveArgs* args)
 }
 
 
+//---------------------------------------------------------------------------
+// BatchSlave
+//---------------------------------------------------------------------------
+
+
+ULONG GuiServer::BatchSlave(SlaveArgs *args)
+{
+    GUI_BATCH_REQ *req = (GUI_BATCH_REQ *)args->req_buf;
+    GUI_BATCH_RPL *rpl = (GUI_BATCH_RPL *)args->rpl_buf;
+
+    if (args->req_len < sizeof(GUI_BATCH_REQ))
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    if (req->count > GUI_BATCH_MAX_COUNT)
+        return STATUS_INVALID_PARAMETER;
+
+    //
+    // each request is processed by its own handler, into a scratch buffer
+    // because the handlers assume they may use all of MAX_RPL_BUF_SIZE,
+    // and the reply is then appended to the batch reply if it still fits
+    //
+
+    ULONG *sub_rpl_buf = (ULONG *)
+                    HeapAlloc(GetProcessHeap(), 0, MAX_RPL_BUF_SIZE);
+    if (! sub_rpl_buf)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    ULONG status = STATUS_SUCCESS;
+
+    UCHAR *req_end = (UCHAR *)req + args->req_len;
+    UCHAR *rpl_end = (UCHAR *)rpl + MAX_RPL_BUF_SIZE;
+
+    GUI_BATCH_ENTRY *req_entry = GUI_BATCH_FIRST(req);
+    GUI_BATCH_ENTRY *rpl_entry = GUI_BATCH_FIRST(rpl);
+
+    rpl->count = 0;
+
+    for (ULONG i = 0; i < req->count; ++i) {
+
+        if ((UCHAR *)(req_entry + 1) > req_end ||
+                req_entry->len < sizeof(ULONG) ||
+                req_entry->len > (ULONG)(req_end - (UCHAR *)(req_entry + 1))) {
+            status = STATUS_INFO_LENGTH_MISMATCH;
+            break;
+        }
+
+        ULONG msgid = *(ULONG *)(req_entry + 1);
+
+        ULONG sub_status = STATUS_INVALID_SYSTEM_SERVICE;
+        ULONG sub_rpl_len = sizeof(ULONG);
+
+        if (msgid == GUI_QUERY_WINDOW       ||
+            msgid == GUI_IS_WINDOW          ||
+            msgid == GUI_GET_WINDOW_LONG    ||
+            msgid == GUI_GET_WINDOW_PROP    ||
+            msgid == GUI_GET_WINDOW_HANDLE  ||
+            msgid == GUI_GET_CLASS_NAME     ||
+            msgid == GUI_GET_WINDOW_RECT    ||
+            msgid == GUI_GET_WINDOW_INFO) {
+
+            SlaveArgs sub_args;
+            sub_args.pid     = args->pid;
+            sub_args.req_len = req_entry->len;
+            sub_args.req_buf = req_entry + 1;
+            sub_args.rpl_len = sizeof(ULONG);
+            sub_args.rpl_buf = sub_rpl_buf;
+
+            sub_status = (this->*m_SlaveFuncs[msgid])(&sub_args);
+            if (sub_status == 0)
+                sub_rpl_len = sub_args.rpl_len;
+        }
+
+        *sub_rpl_buf = sub_status;
+
+        //
+        // the padding is cleared so no stale data from our stack is
+        // passed back to the caller
+        //
+
+        ULONG pad_len = GUI_BATCH_ALIGN(sub_rpl_len) - sub_rpl_len;
+
+        if ((UCHAR *)(rpl_entry + 1) + sub_rpl_len + pad_len > rpl_end)
+            break;
+
+        rpl_entry->len = sub_rpl_len;
+        rpl_entry->pad_word = 0;
+        memcpy(rpl_entry + 1, sub_rpl_buf, sub_rpl_len);
+        memzero((UCHAR *)(rpl_entry + 1) + sub_rpl_len, pad_len);
+
+        ++rpl->count;
+
+        rpl_entry = GUI_BATCH_NEXT(rpl_entry);
+        req_entry = GUI_BATCH_NEXT(req_entry);
+    }
+
+    HeapFree(GetProcessHeap(), 0, sub_rpl_buf);
+
+    if (status != STATUS_SUCCESS)
+        return status;
+
+    args->rpl_len = (ULONG)((UCHAR *)rpl_entry - (UCHAR *)rpl);
+    return STATUS_SUCCESS;
+}
+
+
 //---------------------------------------------------------------------------
 // StartAsync
 //---------------------------------------------------------------------------
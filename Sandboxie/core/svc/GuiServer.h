@@ -172,6 +172,8 @@ protected:
 
     ULONG KillJob(SlaveArgs *args);
 
+    ULONG BatchSlave(SlaveArgs *args);
+
     //
     // window access check utilities
     //
@@ -63,6 +63,7 @@ enum {
     GUI_WND_HOOK_NOTIFY,
     GUI_WND_HOOK_REGISTER,
     GUI_KILL_JOB,
+    GUI_BATCH,
     GUI_MAX_REQUEST_CODE
 };
 
@@ -770,6 +771,60 @@ struct tagGUI_KILL_JOB_REQ
 
 typedef struct tagGUI_KILL_JOB_REQ GUI_KILL_JOB_REQ;
 
+
+//---------------------------------------------------------------------------
+// Batch of Window Queries
+//---------------------------------------------------------------------------
+
+
+//
+// a batch request carries several complete GUI_xxx_REQ requests, each in
+// a GUI_BATCH_ENTRY, and the batch reply carries one GUI_BATCH_ENTRY with
+// the corresponding GUI_xxx_RPL reply for each processed request.  a
+// failed request is answered by a reply which holds only its status.
+//
+// only requests which query window attributes are accepted in a batch.
+// the reply may hold fewer entries than the request, if the reply buffer
+// is full, the caller should then resubmit the remaining requests
+//
+
+
+#define GUI_BATCH_MAX_COUNT     64
+
+#define GUI_BATCH_ALIGN(len)    (((len) + 7) & ~7)
+
+#define GUI_BATCH_FIRST(hdr)    ((GUI_BATCH_ENTRY *)((hdr) + 1))
+
+#define GUI_BATCH_NEXT(entry)   ((GUI_BATCH_ENTRY *)                    \
+    ((UCHAR *)((entry) + 1) + GUI_BATCH_ALIGN((entry)->len)))
+
+
+struct tagGUI_BATCH_ENTRY
+{
+    ULONG len;
+    ULONG pad_word;
+    // followed by len bytes, padded to GUI_BATCH_ALIGN(len)
+};
+
+struct tagGUI_BATCH_REQ
+{
+    ULONG msgid;
+    ULONG count;
+    // followed by count entries
+};
+
+struct tagGUI_BATCH_RPL
+{
+    ULONG status;
+    ULONG count;
+    // followed by count entries
+};
+
+typedef struct tagGUI_BATCH_ENTRY GUI_BATCH_ENTRY;
+typedef struct tagGUI_BATCH_REQ GUI_BATCH_REQ;
+typedef struct tagGUI_BATCH_RPL GUI_BATCH_RPL;
+
+
 //---------------------------------------------------------------------------
 
 
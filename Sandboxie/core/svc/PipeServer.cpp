@@ -30,6 +30,9 @@
 #include "common/my_version.h"
 #include <psapi.h> // For access to GetModuleFileNameEx
 #include "sbieiniserver.h"
+#include "bulkwire.h"
+#include "pipewire.h"
+#include "core/dll/sbieapi.h"
 
 //---------------------------------------------------------------------------
 // Defines
@@ -38,6 +41,7 @@
 
 #define MAX_REQUEST_LENGTH      (0x40000000) // 1GB
 #define MSG_DATA_LEN            (MAX_PORTMSG_LENGTH - sizeof(PORT_MESSAGE))
+#define THREAD_IDLE_TIMEOUT     (30 * 1000)         // ms, see Thread
 
 
 //---------------------------------------------------------------------------
@@ -51,6 +55,9 @@ typedef struct tagTARGET
     ULONG serverId;
     void *context;
     PipeServer::Handler handler;
+    volatile LONG64 calls;
+    volatile LONG64 ticks;
+    volatile LONG64 max_ticks;
 } TARGET;
 
 
@@ -71,6 +78,8 @@ typedef struct tagCLIENT_THREAD
     HANDLE hPort;
     MSG_HEADER *buf_hdr;
     UCHAR *buf_ptr;
+    UCHAR *bulk_view;
+    ULONG bulk_size;
 } CLIENT_THREAD;
 #endif
 
@@ -133,12 +142,32 @@ PipeServer::PipeServer()
 
     m_hServerPort = NULL;
 
-    ULONG len_threads = (NUMBER_OF_THREADS) * sizeof(HANDLE);
-    m_Threads = (HANDLE *)HeapAlloc(GetProcessHeap(), 0, len_threads);
-    if (m_Threads)
-        memzero(m_Threads, len_threads);
+    //
+    // start with NUMBER_OF_THREADS worker threads, and add more when all
+    // of them are busy at the same time, e.g. with handlers that block.
+    // the destructor waits for all of them in a single call, so we can
+    // have at most MAXIMUM_WAIT_OBJECTS threads.  the extra threads retire
+    // again once the pool has been idle for THREAD_IDLE_TIMEOUT
+    //
+
+    ULONG MinThreads = NUMBER_OF_THREADS;
+    ULONG MaxThreads = MinThreads * 4;
+    if (MaxThreads > MAXIMUM_WAIT_OBJECTS)
+        MaxThreads = MAXIMUM_WAIT_OBJECTS;
+
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    m_TicksPerSecond = Frequency.QuadPart;
+
+    ULONG len_threads = MaxThreads * (sizeof(HANDLE) + sizeof(ULONG));
+    HANDLE *Threads = (HANDLE *)HeapAlloc(GetProcessHeap(), 0, len_threads);
+    if (Threads)
+        memzero(Threads, len_threads);
     else
         LogEvent(MSG_9234, 0x9251, GetLastError());
+
+    WorkPool_Init(&m_Pool, MinThreads, MaxThreads,
+                  Threads, (ULONG *)(Threads + MaxThreads));
 }
 
 
@@ -173,6 +202,15 @@ PipeServer::~PipeServer()
 
     HANDLE PortHandle = InterlockedExchangePointer(&m_hServerPort, NULL);
 
+    //
+    // AddThread checks m_hServerPort while holding the lock,
+    // so no more threads are started after this point
+    //
+
+    EnterCriticalSection(&m_lock);
+    ULONG NumThreads = m_Pool.num_threads;
+    LeaveCriticalSection(&m_lock);
+
     if (PortHandle) {
 
         //
@@ -182,7 +220,7 @@ PipeServer::~PipeServer()
 
         UCHAR space[MAX_PORTMSG_LENGTH];
 
-        for (i = 0; i < NUMBER_OF_THREADS; ++i) {
+        for (i = 0; i < NumThreads; ++i) {
             PORT_MESSAGE *msg = (PORT_MESSAGE *)space;
             memzero(msg, MAX_PORTMSG_LENGTH);
             msg->u1.s1.TotalLength = (USHORT)sizeof(PORT_MESSAGE);
@@ -190,14 +228,14 @@ PipeServer::~PipeServer()
         }
     }
 
-    if (m_Threads) {
+    if (m_Pool.threads && NumThreads) {
 
         if (WAIT_TIMEOUT == WaitForMultipleObjects(
-                                NUMBER_OF_THREADS, m_Threads, TRUE, 5000)) {
+                                NumThreads, m_Pool.threads, TRUE, 5000)) {
 
-            for (i = 0; i < NUMBER_OF_THREADS; ++i)
-                TerminateThread(m_Threads[i], 0);
-            WaitForMultipleObjects(NUMBER_OF_THREADS, m_Threads, TRUE, 5000);
+            for (i = 0; i < NumThreads; ++i)
+                TerminateThread(m_Pool.threads[i], 0);
+            WaitForMultipleObjects(NumThreads, m_Pool.threads, TRUE, 5000);
         }
     }
 
@@ -227,6 +265,9 @@ void PipeServer::Register(ULONG serverId, void *context, Handler handler)
         target->serverId = serverId;
         target->context = context;
         target->handler = handler;
+        target->calls = 0;
+        target->ticks = 0;
+        target->max_ticks = 0;
         List_Insert_After(&m_targets, NULL, target);
     }
 #endif
@@ -283,16 +324,75 @@ bool PipeServer::Start()
     // create server threads
     //
 
-    for (i = 0; i < NUMBER_OF_THREADS; ++i) {
+    if (! m_Pool.threads)
+        return false;
+
+    for (i = 0; i < m_Pool.min_threads; ++i) {
 
-        m_Threads[i] = CreateThread(
+        HANDLE hThread = CreateThread(
             NULL, 0, (LPTHREAD_START_ROUTINE)ThreadStub, this, 0, &idThread);
-        if (! m_Threads[i]) {
+        if (! hThread) {
             LogEvent(MSG_9234, 0x9253, GetLastError());
             return false;
         }
+
+        EnterCriticalSection(&m_lock);
+        WorkPool_Add(&m_Pool, hThread, idThread);
+        LeaveCriticalSection(&m_lock);
+    }
+
+    return true;
+}
+
+
+//---------------------------------------------------------------------------
+// AddThread
+//---------------------------------------------------------------------------
+
+
+void PipeServer::AddThread(void)
+{
+    ULONG idThread;
+
+    EnterCriticalSection(&m_lock);
+
+    if (m_hServerPort && WorkPool_CanAdd(&m_Pool)) {
+
+        HANDLE hThread = CreateThread(
+            NULL, 0, (LPTHREAD_START_ROUTINE)ThreadStub, this, 0, &idThread);
+        if (hThread)
+            WorkPool_Add(&m_Pool, hThread, idThread);
     }
 
+    LeaveCriticalSection(&m_lock);
+}
+
+
+//---------------------------------------------------------------------------
+// RemoveThread
+//---------------------------------------------------------------------------
+
+
+bool PipeServer::RemoveThread(void)
+{
+    HANDLE hThread = NULL;
+
+    //
+    // once the service is shutting down, the destructor waits for all
+    // threads in the pool, so none of them leaves it anymore
+    //
+
+    EnterCriticalSection(&m_lock);
+
+    if (m_hServerPort)
+        hThread = WorkPool_Remove(&m_Pool, GetCurrentThreadId());
+
+    LeaveCriticalSection(&m_lock);
+
+    if (! hThread)
+        return false;
+
+    CloseHandle(hThread);
     return true;
 }
 
@@ -321,6 +421,9 @@ void PipeServer::Thread()
     HANDLE hReplyPort;
     PORT_MESSAGE *ReplyMsg;
     PVOID PortContext;
+    LARGE_INTEGER IdleTimeout;
+
+    IdleTimeout.QuadPart = -(LONGLONG)THREAD_IDLE_TIMEOUT * 10000;
 
     //
     // initially we have no reply to send.  we will also revert to
@@ -346,11 +449,38 @@ void PipeServer::Thread()
             ReplyMsg = (PORT_MESSAGE *)spaceReply;
         }
 
-        status = NtReplyWaitReceivePort(hReplyPort, &PortContext, ReplyMsg, msg);
+        //
+        // while the pool is larger than its minimum, wait only for
+        // THREAD_IDLE_TIMEOUT.  a thread which times out while others are
+        // still idle as well is not needed anymore, and retires
+        //
+
+        BOOLEAN UseTimeout = WorkPool_Waiting(&m_Pool);
+
+        status = NtReplyWaitReceivePortEx(hReplyPort, &PortContext, ReplyMsg, msg,
+                    UseTimeout ? &IdleTimeout : NULL);
 
         if (! m_hServerPort)    // service is shutting down
             break;
 
+        if (status == STATUS_TIMEOUT) {
+
+            hReplyPort = m_hServerPort;
+            ReplyMsg = NULL;
+
+            if (WorkPool_TimedOut(&m_Pool) && RemoveThread())
+                return;
+            continue;
+        }
+
+        //
+        // if this was the last idle thread, start another one, so
+        // that new clients don't have to wait for a busy handler
+        //
+
+        if (WorkPool_Received(&m_Pool))
+            AddThread();
+
         if (ReplyMsg) {
 
             hReplyPort = m_hServerPort;
@@ -443,6 +573,8 @@ void PipeServer::PortConnect(PORT_MESSAGE* msg)
     client->hPort = NULL;
     client->buf_hdr = NULL;
     client->buf_ptr = NULL;
+    client->bulk_view = NULL;
+    client->bulk_size = 0;
 
     //
 	// accept the connection, set the address of the client structure as PortContext
@@ -562,6 +694,8 @@ void PipeServer::PortConnect(PORT_MESSAGE *msg)
         NtClose(clientThread->hPort);
         if (clientThread->buf_hdr)
             FreeMsg(clientThread->buf_hdr);
+        if (clientThread->bulk_view)
+            UnmapViewOfFile(clientThread->bulk_view);
 
         clientThread->replying = FALSE;
         clientThread->in_use = FALSE;
@@ -569,6 +703,8 @@ void PipeServer::PortConnect(PORT_MESSAGE *msg)
         clientThread->hPort = NULL;
         clientThread->buf_hdr = NULL;
         clientThread->buf_ptr = NULL;
+        clientThread->bulk_view = NULL;
+        clientThread->bulk_size = 0;
     }
 
     //
@@ -606,6 +742,8 @@ void PipeServer::PortDisconnectHelper(CLIENT_PROCESS *clientProcess, CLIENT_THRE
         NtClose(clientThread->hPort);
         if (clientThread->buf_hdr)
             FreeMsg(clientThread->buf_hdr);
+        if (clientThread->bulk_view)
+            UnmapViewOfFile(clientThread->bulk_view);
         Pool_Free(clientThread, sizeof(CLIENT_THREAD));
     }
 
@@ -633,8 +771,11 @@ void PipeServer::PortDisconnect(PVOID PortContext)
     EnterCriticalSection(&m_lock);
 
     auto F = m_Clients.find(PortContext);
-    if (F != m_Clients.end())
+    if (F != m_Clients.end()) {
+        if (F->second->bulk_view)
+            UnmapViewOfFile(F->second->bulk_view);
 		m_Clients.erase(F);
+    }
 
     LeaveCriticalSection(&m_lock);
 }
@@ -785,26 +926,42 @@ void PipeServer::PortRequest(HANDLE PortHandle, PORT_MESSAGE *msg, void *voidCli
 #ifndef USE_NEW_LPC_IMPL
     CLIENT_THREAD *client = (CLIENT_THREAD *)voidClient;
 #endif
-    ULONG buf_len;
+    ULONG buf_len, received;
     void *buf_ptr = NULL;
 
     if (! client->buf_hdr) {
 
         ULONG *msg_Data = (ULONG *)msg->Data;
         ULONG msgid = msg_Data[1];
+        BOOLEAN in_view = FALSE;
 
         client->sequence = ((UCHAR *)msg_Data)[3];
         ((UCHAR *)msg_Data)[3] = 0;
 
-        buf_len = msg_Data[0];
+        buf_len = 0;
+        if (msgid && msg_Data[0] < MAX_REQUEST_LENGTH) {
 
-        if (msgid && buf_len &&
-                buf_len < MAX_REQUEST_LENGTH &&
-                buf_len >= sizeof(MSG_HEADER) &&
-                buf_len >= msg->u1.s1.DataLength) {
+            buf_len = PortBulk_Accept(msg_Data, msg->u1.s1.DataLength,
+                        client->bulk_view ? client->bulk_size : 0, &in_view);
+        }
 
+        if (buf_len)
             client->buf_hdr = AllocMsg(buf_len);
-            client->buf_ptr = (UCHAR *)client->buf_hdr;
+
+        if (client->buf_hdr && in_view) {
+
+            //
+            // the message was placed in the attached section, copy it
+            // out before looking at it, as the client can still modify
+            // the section while we process the request
+            //
+
+            if (PortBulk_ReadView(client->buf_hdr, client->bulk_view,
+                                  msg_Data, PortCopyView))
+                goto dispatch;
+
+            FreeMsg(client->buf_hdr);
+            client->buf_hdr = NULL;
         }
 
         if (! client->buf_hdr) {
@@ -812,24 +969,36 @@ void PipeServer::PortRequest(HANDLE PortHandle, PORT_MESSAGE *msg, void *voidCli
             goto finish;
         }
 
-        buf_len = 0;
+        received = 0;
 
     } else {
 
-        buf_len = (ULONG)(client->buf_ptr - (UCHAR *)client->buf_hdr);
-
-        if (buf_len + msg->u1.s1.DataLength > client->buf_hdr->length)
-            goto finish;
+        received = (ULONG)(client->buf_ptr - (UCHAR *)client->buf_hdr);
+        buf_len = client->buf_hdr->length;
     }
 
-    memcpy(client->buf_ptr, msg->Data, msg->u1.s1.DataLength);
-    client->buf_ptr += msg->u1.s1.DataLength;
-    buf_len += msg->u1.s1.DataLength;
+    if (! PortBulk_Append(client->buf_hdr, buf_len, &received,
+                          msg->Data, msg->u1.s1.DataLength))
+        goto finish;
+
+    client->buf_ptr = (UCHAR *)client->buf_hdr + received;
 
-    if (buf_len < client->buf_hdr->length)
+    if (received < buf_len)
         return;
 
-    buf_ptr = CallTarget(client->buf_hdr, PortHandle, msg);
+dispatch:
+
+    if (client->buf_hdr->msgid == MSGID_PORT_BULK_ATTACH) {
+
+        buf_ptr = PortAttachView(
+            client->bulk_view, client->bulk_size, client->buf_hdr, msg);
+
+    } else if (client->buf_hdr->msgid == MSGID_PORT_GET_STATS) {
+
+        buf_ptr = GetStats(client->buf_hdr, msg);
+
+    } else
+        buf_ptr = CallTarget(client->buf_hdr, PortHandle, msg);
 
 finish:
 
@@ -953,6 +1122,9 @@ MSG_HEADER *PipeServer::CallTarget(
 
     MSG_HEADER *msgOut = NULL;
 
+    LARGE_INTEGER StartTime, EndTime;
+    QueryPerformanceCounter(&StartTime);
+
     __try {
 
         msgOut = (*target->handler)(target->context, msg);
@@ -966,6 +1138,25 @@ MSG_HEADER *PipeServer::CallTarget(
     RevertToSelf();
     TlsSetValue(m_TlsIndex, NULL);
 
+    //
+    // update the call statistics of the target, see GetStats
+    //
+
+    QueryPerformanceCounter(&EndTime);
+    LONG64 ticks = EndTime.QuadPart - StartTime.QuadPart;
+
+    InterlockedIncrement64(&target->calls);
+    InterlockedExchangeAdd64(&target->ticks, ticks);
+
+    LONG64 max_ticks = target->max_ticks;
+    while (ticks > max_ticks) {
+        LONG64 old_ticks = InterlockedCompareExchange64(
+                                    &target->max_ticks, ticks, max_ticks);
+        if (old_ticks == max_ticks)
+            break;
+        max_ticks = old_ticks;
+    }
+
     return msgOut;
 }
 
@@ -984,7 +1175,7 @@ void PipeServer::PortReply(PORT_MESSAGE *msg, void *voidClient)
 #ifndef USE_NEW_LPC_IMPL
     CLIENT_THREAD *client = (CLIENT_THREAD *)voidClient;
 #endif
-    ULONG buf_len;
+    ULONG buf_len, offset;
 
     if (! client->buf_ptr) {
         msg->u1.s1.DataLength = (USHORT) 0;
@@ -993,22 +1184,38 @@ void PipeServer::PortReply(PORT_MESSAGE *msg, void *voidClient)
         return;
     }
 
-    buf_len = client->buf_hdr->length
-            - (ULONG)(client->buf_ptr - (UCHAR *)client->buf_hdr);
-    if (buf_len > MSG_DATA_LEN)
-        buf_len = MSG_DATA_LEN;
+    //
+    // a reply which fits into the attached section is placed there and
+    // only its header is sent, see core/svc/bulkwire.h.  if the section
+    // can not be written, the client gets a short failure reply instead
+    //
+
+    offset = (ULONG)(client->buf_ptr - (UCHAR *)client->buf_hdr);
+
+    buf_len = PortBulk_Send(client->buf_hdr, &offset, (UCHAR *)msg->Data,
+                MSG_DATA_LEN, client->bulk_view, client->bulk_size,
+                PortCopyView);
+
+    if (! buf_len) {
+
+        MSG_HEADER rpl;
+        rpl.length = sizeof(MSG_HEADER);
+        rpl.status = STATUS_IN_PAGE_ERROR;
+
+        memcpy(msg->Data, &rpl, sizeof(MSG_HEADER));
+        buf_len = sizeof(MSG_HEADER);
+        offset = client->buf_hdr->length;
+    }
 
     msg->u1.s1.DataLength = (USHORT) buf_len;
     msg->u1.s1.TotalLength = (USHORT)(sizeof(PORT_MESSAGE) + buf_len);
-    memcpy(msg->Data, client->buf_ptr, buf_len);
 
     if (client->buf_ptr == (UCHAR *)client->buf_hdr)
         ((UCHAR *)msg->Data)[3] = client->sequence;
 
-    client->buf_ptr += buf_len;
+    client->buf_ptr = (UCHAR *)client->buf_hdr + offset;
 
-    buf_len = (ULONG)(client->buf_ptr - (UCHAR *)client->buf_hdr);
-    if (buf_len >= client->buf_hdr->length) {
+    if (offset >= client->buf_hdr->length) {
         FreeMsg(client->buf_hdr);
         client->buf_hdr = NULL;
         client->buf_ptr = NULL;
@@ -1017,6 +1224,193 @@ void PipeServer::PortReply(PORT_MESSAGE *msg, void *voidClient)
 }
 
 
+//---------------------------------------------------------------------------
+// PortAttachView
+//---------------------------------------------------------------------------
+
+
+MSG_HEADER *PipeServer::PortAttachView(
+    UCHAR *&view, ULONG &view_size, MSG_HEADER *msg, PORT_MESSAGE *PortMessage)
+{
+    PORT_BULK_ATTACH_REQ *req = (PORT_BULK_ATTACH_REQ *)msg;
+    NTSTATUS status;
+
+    if (req->h.length < sizeof(PORT_BULK_ATTACH_REQ))
+        return AllocShortMsg(STATUS_INVALID_PARAMETER);
+
+    if (view) {
+        UnmapViewOfFile(view);
+        view = NULL;
+        view_size = 0;
+    }
+
+    if (! req->view_size)
+        return AllocShortMsg(STATUS_SUCCESS);
+
+    if (req->view_size < PORT_BULK_MIN_VIEW ||
+            req->view_size > PORT_BULK_MAX_VIEW)
+        return AllocShortMsg(STATUS_INVALID_PARAMETER);
+
+    //
+    // duplicate the section handle with the same access the client has,
+    // so attaching can not give the client access it did not have, and
+    // only accept a pagefile-backed section, so reading from the view
+    // can not fail with an in-page error
+    //
+
+    HANDLE hSection = NULL;
+    HANDLE hProcess = OpenProcess(PROCESS_DUP_HANDLE, FALSE,
+                    (ULONG)(ULONG_PTR)PortMessage->ClientId.UniqueProcess);
+    if (! hProcess)
+        return AllocShortMsg(STATUS_ACCESS_DENIED);
+
+    BOOL ok = DuplicateHandle(
+        hProcess, (HANDLE)(ULONG_PTR)req->section_handle,
+        GetCurrentProcess(), &hSection, 0, FALSE, DUPLICATE_SAME_ACCESS);
+
+    CloseHandle(hProcess);
+
+    if (! ok)
+        return AllocShortMsg(STATUS_INVALID_HANDLE);
+
+    OBJECT_BASIC_INFORMATION obi;
+    status = NtQueryObject(
+        hSection, ObjectBasicInformation, &obi, sizeof(obi), NULL);
+    if (NT_SUCCESS(status)) {
+        const ACCESS_MASK access = SECTION_MAP_READ | SECTION_MAP_WRITE;
+        if ((obi.DesiredAccess & access) != access)
+            status = STATUS_ACCESS_DENIED;
+    }
+
+    //
+    // the section must be committed as a whole, a SEC_RESERVE section
+    // could have pages which are not backed, and accessing them would
+    // raise an exception in the service
+    //
+
+    if (NT_SUCCESS(status)) {
+        SECTION_BASIC_INFORMATION sbi;
+        status = NtQuerySection(
+            hSection, SectionBasicInformation, &sbi, sizeof(sbi), NULL);
+        if (NT_SUCCESS(status) &&
+                ((sbi.AllocationAttributes & (SEC_FILE | SEC_IMAGE | SEC_RESERVE)) ||
+                 (sbi.AllocationAttributes & SEC_COMMIT) == 0 ||
+                 sbi.MaximumSize.QuadPart < req->view_size))
+            status = STATUS_INVALID_PARAMETER;
+    }
+
+    if (NT_SUCCESS(status)) {
+        view = (UCHAR *)MapViewOfFile(
+            hSection, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, req->view_size);
+        if (! view)
+            status = STATUS_NO_MEMORY;
+    }
+
+    if (NT_SUCCESS(status)) {
+        MEMORY_BASIC_INFORMATION mbi;
+        if (VirtualQuery(view, &mbi, sizeof(mbi)) != sizeof(mbi) ||
+                mbi.State != MEM_COMMIT ||
+                mbi.RegionSize < req->view_size) {
+            UnmapViewOfFile(view);
+            view = NULL;
+            status = STATUS_INVALID_PARAMETER;
+        } else
+            view_size = req->view_size;
+    }
+
+    CloseHandle(hSection);
+
+    return AllocShortMsg(status);
+}
+
+
+//---------------------------------------------------------------------------
+// PortCopyView
+//---------------------------------------------------------------------------
+
+
+BOOLEAN PipeServer::PortCopyView(void *dst, const void *src, ULONG len)
+{
+    //
+    // the client controls the section and may still unmap or decommit
+    // its pages, so a fault while copying fails only the one request
+    //
+
+    __try {
+
+        memcpy(dst, src, len);
+
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// GetStats
+//---------------------------------------------------------------------------
+
+
+MSG_HEADER *PipeServer::GetStats(MSG_HEADER *msg, PORT_MESSAGE *PortMessage)
+{
+    //
+    // only callers outside the sandbox may read the statistics
+    //
+
+    if (msg->length < sizeof(PORT_GET_STATS_REQ))
+        return AllocShortMsg(STATUS_INVALID_PARAMETER);
+
+    if (SbieApi_QueryProcess(
+            PortMessage->ClientId.UniqueProcess, NULL, NULL, NULL, NULL) == 0)
+        return AllocShortMsg(STATUS_ACCESS_DENIED);
+
+#ifdef USE_NEW_LPC_IMPL
+    ULONG num_targets = (ULONG)m_Targets.size();
+#else
+    ULONG num_targets = List_Count(&m_targets);
+#endif
+
+    ULONG rpl_len = sizeof(PORT_GET_STATS_RPL)
+                  + num_targets * sizeof(PORT_TARGET_STATS);
+    PORT_GET_STATS_RPL *rpl = (PORT_GET_STATS_RPL *)AllocMsg(rpl_len);
+    if (! rpl)
+        return AllocShortMsg(STATUS_INSUFFICIENT_RESOURCES);
+
+    rpl->h.status = STATUS_SUCCESS;
+    rpl->num_threads = m_Pool.num_threads;
+    rpl->min_threads = m_Pool.min_threads;
+    rpl->max_threads = m_Pool.max_threads;
+    rpl->idle_threads = m_Pool.idle_threads;
+    rpl->num_targets = 0;
+    rpl->reserved = 0;
+
+    const LONG64 ticks_per_us = m_TicksPerSecond / 1000000
+                              ? m_TicksPerSecond / 1000000 : 1;
+
+#ifdef USE_NEW_LPC_IMPL
+    for (auto& pair : m_Targets) {
+        SPipeTarget *target = &pair.second;
+#else
+    for (TARGET *target = (TARGET *)List_Head(&m_targets);
+            target; target = (TARGET *)List_Next(target)) {
+#endif
+        if (rpl->num_targets >= num_targets)
+            break;
+
+        PORT_TARGET_STATS *stats = &rpl->targets[rpl->num_targets++];
+        stats->server_id = target->serverId;
+        stats->call_count = target->calls;
+        stats->total_time_us = target->ticks / ticks_per_us;
+        stats->max_time_us = (ULONG)(target->max_ticks / ticks_per_us);
+    }
+
+    return &rpl->h;
+}
+
+
 //---------------------------------------------------------------------------
 // NotifyTargets
 //---------------------------------------------------------------------------
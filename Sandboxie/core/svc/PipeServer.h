@@ -31,6 +31,7 @@
 #include "common/map.h"
 #include "common/pool.h"
 #include "msgids.h"
+#include "workpool.h"
 #include <unordered_map>
 #include <memory>
 
@@ -152,6 +153,9 @@ protected:
         ULONG serverId;
         void *context;
         PipeServer::Handler handler;
+        volatile LONG64 calls;
+        volatile LONG64 ticks;
+        volatile LONG64 max_ticks;
     };
 
     struct SClient
@@ -163,6 +167,8 @@ protected:
         HANDLE hPort;
         MSG_HEADER *buf_hdr;
         UCHAR *buf_ptr;
+        UCHAR *bulk_view;
+        ULONG bulk_size;
     };
     typedef std::shared_ptr<SClient> SClientPtr;
 #endif
@@ -191,6 +197,18 @@ protected:
 
     void Thread(void);
 
+    /*
+     * Start one more worker thread, when all of them are busy
+     */
+
+    void AddThread(void);
+
+    /*
+     * Retire the calling worker thread, when the pool was idle for a while
+     */
+
+    bool RemoveThread(void);
+
     /*
      * Port Connect
      */
@@ -243,6 +261,25 @@ protected:
     void *PortFindClient(PORT_MESSAGE *msg);
 #endif
 
+    /*
+     * Attach or detach the shared section of a client
+     */
+
+    MSG_HEADER *PortAttachView(
+        UCHAR *&view, ULONG &view_size, MSG_HEADER *msg, PORT_MESSAGE *PortMessage);
+
+    /*
+     * Copy to or from the shared section of a client
+     */
+
+    static BOOLEAN PortCopyView(void *dst, const void *src, ULONG len);
+
+    /*
+     * Report worker thread and per sub-server call statistics
+     */
+
+    MSG_HEADER *GetStats(MSG_HEADER *msg, PORT_MESSAGE *PortMessage);
+
     /*
      * Call a registered sub-server
      */
@@ -276,7 +313,8 @@ protected:
     ULONG m_TlsIndex;
 
     volatile HANDLE m_hServerPort;
-    HANDLE *m_Threads;
+    WORK_POOL m_Pool;
+    LONG64 m_TicksPerSecond;
 
     static PipeServer *m_instance;
 };
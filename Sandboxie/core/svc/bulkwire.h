@@ -0,0 +1,231 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Bulk Transport -- PipeServer
+//---------------------------------------------------------------------------
+
+
+#ifndef _MY_BULKWIRE_H
+#define _MY_BULKWIRE_H
+
+
+#include "msgids.h"
+
+
+//
+// messages are normally sent to and from the service in chunks which fit
+// into a single LPC message, see SbieDll_CallServer and PipeServer.  for
+// large messages a client can attach a shared section to its connection,
+// once attached, either side may place a message which is longer than
+// PORT_BULK_MIN_LENGTH into the section and send only its MSG_HEADER.
+//
+// a chunked message always starts with a chunk of min(length, max chunk)
+// bytes, so a first chunk which holds only a MSG_HEADER, while the header
+// specifies a longer message, can not occur in the chunked protocol and
+// marks a message which is to be read from the section.
+//
+// an older service does not know MSGID_PORT_BULK_ATTACH and rejects it
+// with STATUS_INVALID_SYSTEM_SERVICE, the client then keeps chunking
+//
+// the receiver must copy a message out of the section before it looks at
+// it, as the other side is able to modify the section at any time
+//
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define PORT_BULK_MIN_LENGTH    1024
+#define PORT_BULK_MIN_VIEW      (64 * 1024)
+#define PORT_BULK_MAX_VIEW      (16 * 1024 * 1024)
+
+
+//---------------------------------------------------------------------------
+// Attach Section
+//---------------------------------------------------------------------------
+
+
+struct tagPORT_BULK_ATTACH_REQ
+{
+    MSG_HEADER h;
+    ULONG view_size;                    // 0 to detach
+    __declspec(align(8)) ULONG64 section_handle;    // in the caller process
+};
+
+typedef struct tagPORT_BULK_ATTACH_REQ PORT_BULK_ATTACH_REQ;
+
+
+//---------------------------------------------------------------------------
+// Framing
+//---------------------------------------------------------------------------
+
+
+//
+// the functions below carry out the framing for both sides, the sender
+// in SbieDll_CallServer and PipeServer::PortReply, the receiver in
+// PipeServer::PortRequest and the reply loop of SbieDll_CallServer.
+// the copy function is used for the section, the service passes one which
+// survives a section that is unmapped by the client, NULL is memcpy.
+// the caller clears the sequence number in the high byte of the length
+// in a first chunk, before it passes the chunk to PortBulk_Accept
+//
+
+
+typedef BOOLEAN (*P_PortBulk_Copy)(void *dst, const void *src, ULONG len);
+
+
+__inline BOOLEAN PortBulk_IsMarker(const void *chunk, ULONG chunk_len)
+{
+    ULONG length = ((const MSG_HEADER *)chunk)->length & 0x00FFFFFF;
+    return (chunk_len == sizeof(MSG_HEADER) && length > sizeof(MSG_HEADER));
+}
+
+
+__inline ULONG PortBulk_ViewSize(ULONG length)
+{
+    ULONG view_size = PORT_BULK_MIN_VIEW;
+    while (view_size < length && view_size < PORT_BULK_MAX_VIEW)
+        view_size <<= 1;
+    return (view_size >= length) ? view_size : 0;
+}
+
+
+__inline BOOLEAN PortBulk_Fits(ULONG length, ULONG view_size)
+{
+    return (length > PORT_BULK_MIN_LENGTH && length <= view_size);
+}
+
+
+__inline BOOLEAN PortBulk_Copy(
+    P_PortBulk_Copy copy, void *dst, const void *src, ULONG len)
+{
+    if (copy)
+        return copy(dst, src, len);
+    memcpy(dst, src, len);
+    return TRUE;
+}
+
+
+__inline ULONG PortBulk_Send(
+    const MSG_HEADER *msg, ULONG *offset, UCHAR *chunk, ULONG max_chunk,
+    void *view, ULONG view_size, P_PortBulk_Copy copy)
+{
+    //
+    // fills chunk with the next chunk of msg at *offset and advances it.
+    // a message which fits into the attached section is placed there and
+    // its header is the only chunk.  returns the length of the chunk,
+    // or zero if the section could not be written
+    //
+
+    ULONG len;
+
+    if (*offset == 0 && view && PortBulk_Fits(msg->length, view_size)) {
+
+        if (! PortBulk_Copy(copy, view, msg, msg->length))
+            return 0;
+
+        memcpy(chunk, msg, sizeof(MSG_HEADER));
+        *offset = msg->length;
+        return sizeof(MSG_HEADER);
+    }
+
+    len = msg->length - *offset;
+    if (len > max_chunk)
+        len = max_chunk;
+
+    memcpy(chunk, (const UCHAR *)msg + *offset, len);
+    *offset += len;
+    return len;
+}
+
+
+__inline ULONG PortBulk_Accept(
+    const void *chunk, ULONG chunk_len, ULONG view_size, BOOLEAN *in_view)
+{
+    //
+    // checks the first chunk of a message and returns the length of the
+    // message, or zero if it is invalid.  *in_view is set if the message
+    // is to be read from the section with PortBulk_ReadView, view_size
+    // is zero while no section is attached
+    //
+
+    ULONG length = ((const MSG_HEADER *)chunk)->length;
+
+    *in_view = FALSE;
+
+    if (chunk_len < sizeof(MSG_HEADER))
+        return 0;
+
+    if (view_size && PortBulk_IsMarker(chunk, chunk_len)) {
+
+        if (! PortBulk_Fits(length, view_size))
+            return 0;
+
+        *in_view = TRUE;
+        return length;
+    }
+
+    if (length < sizeof(MSG_HEADER) || length < chunk_len)
+        return 0;
+
+    return length;
+}
+
+
+__inline BOOLEAN PortBulk_ReadView(
+    MSG_HEADER *msg, const void *view, const void *chunk,
+    P_PortBulk_Copy copy)
+{
+    //
+    // copies a message accepted by PortBulk_Accept out of the section,
+    // the header is taken from the chunk, as the other side is able to
+    // modify the section at any time
+    //
+
+    const MSG_HEADER *hdr = (const MSG_HEADER *)chunk;
+
+    if (! PortBulk_Copy(copy, msg, view, hdr->length))
+        return FALSE;
+
+    msg->length = hdr->length;
+    msg->msgid = hdr->msgid;
+    return TRUE;
+}
+
+
+__inline BOOLEAN PortBulk_Append(
+    MSG_HEADER *msg, ULONG length, ULONG *received,
+    const void *chunk, ULONG chunk_len)
+{
+    //
+    // adds the next chunk to a message of the length that was accepted
+    // for its first chunk, fails if the chunk goes past its end
+    //
+
+    if (*received + chunk_len > length)
+        return FALSE;
+
+    memcpy((UCHAR *)msg + *received, chunk, chunk_len);
+    *received += chunk_len;
+    return TRUE;
+}
+
+
+#endif /* _MY_BULKWIRE_H */
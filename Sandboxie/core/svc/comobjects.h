@@ -0,0 +1,184 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// COM Proxy Server -- Slave Object Index
+//---------------------------------------------------------------------------
+
+
+#ifndef _MY_COMOBJECTS_H
+#define _MY_COMOBJECTS_H
+
+
+#include "common/list.h"
+#include "common/map.h"
+
+
+//
+// the objects list of a COM slave is indexed by object index, by process
+// and by interface pointer, so that a lookup does not depend on the number
+// of objects hosted by the slave.  the object type T must start with a
+// LIST_ELEM and have the members idProcess, objidx, pUnknown, proc_prev
+// and proc_next.  object indexes are unique, except for -1 which is used
+// by all dummy objects, those are only found through their process chain
+//
+
+
+template <class T> class ComObjectIndex
+{
+
+public:
+
+    void Init(void *pool,
+              void *(*func_malloc)(void *pool, size_t size),
+              void (*func_free)(void *pool, void *ptr))
+    {
+        HASH_MAP *maps[3] = { &m_ObjectsMap, &m_ProcessMap, &m_UnknownMap };
+
+        for (ULONG i = 0; i < 3; ++i) {
+
+            map_init(maps[i], pool);
+            maps[i]->func_malloc = func_malloc;
+            maps[i]->func_free = func_free;
+        }
+    }
+
+    void Insert(T *obj, LIST *ObjectsList)
+    {
+        List_Insert_After(ObjectsList, NULL, obj);
+
+        //
+        // if an index can not be updated, the object still works but may
+        // not be found by its index, same as when allocating it had failed
+        //
+
+        if (obj->objidx != -1)
+            map_insert(&m_ObjectsMap, (void *)(ULONG_PTR)obj->objidx, obj, 0);
+
+        PROCESS_OBJECTS *proc = (PROCESS_OBJECTS *)
+            map_get(&m_ProcessMap, (void *)(ULONG_PTR)obj->idProcess);
+        if (! proc) {
+            proc = (PROCESS_OBJECTS *)map_insert(&m_ProcessMap,
+                (void *)(ULONG_PTR)obj->idProcess, NULL, sizeof(PROCESS_OBJECTS));
+        }
+        if (proc) {
+            obj->proc_prev = proc->tail;
+            obj->proc_next = NULL;
+            if (proc->tail)
+                proc->tail->proc_next = obj;
+            else
+                proc->head = obj;
+            proc->tail = obj;
+        }
+
+        ULONG *pCount = (ULONG *)map_get(&m_UnknownMap, obj->pUnknown);
+        if (pCount)
+            ++(*pCount);
+        else {
+            ULONG count = 1;
+            map_insert(&m_UnknownMap, obj->pUnknown, &count, sizeof(ULONG));
+        }
+    }
+
+    void Remove(T *obj, LIST *ObjectsList)
+    {
+        List_Remove(ObjectsList, obj);
+
+        if (obj->objidx != -1 &&
+                map_get(&m_ObjectsMap, (void *)(ULONG_PTR)obj->objidx) == obj)
+            map_remove(&m_ObjectsMap, (void *)(ULONG_PTR)obj->objidx);
+
+        PROCESS_OBJECTS *proc = (PROCESS_OBJECTS *)
+            map_get(&m_ProcessMap, (void *)(ULONG_PTR)obj->idProcess);
+        if (proc) {
+            if (obj->proc_prev)
+                obj->proc_prev->proc_next = obj->proc_next;
+            else if (proc->head == obj)
+                proc->head = obj->proc_next;
+            if (obj->proc_next)
+                obj->proc_next->proc_prev = obj->proc_prev;
+            else if (proc->tail == obj)
+                proc->tail = obj->proc_prev;
+            if (! proc->head)
+                map_remove(&m_ProcessMap, (void *)(ULONG_PTR)obj->idProcess);
+        }
+        obj->proc_prev = obj->proc_next = NULL;
+
+        ULONG *pCount = (ULONG *)map_get(&m_UnknownMap, obj->pUnknown);
+        if (pCount && --(*pCount) == 0)
+            map_remove(&m_UnknownMap, obj->pUnknown);
+    }
+
+    T *Find(ULONG idProcess, ULONG objidx)
+    {
+        T *obj;
+
+        if (objidx != -1) {
+
+            obj = (T *)map_get(&m_ObjectsMap, (void *)(ULONG_PTR)objidx);
+            if (obj && obj->idProcess != idProcess)
+                obj = NULL;
+
+        } else {
+
+            obj = GetProcessObjects(idProcess);
+            while (obj) {
+                if (obj->objidx == objidx)
+                    break;
+                obj = obj->proc_next;
+            }
+        }
+
+        return obj;
+    }
+
+    T *GetProcessObjects(ULONG idProcess)
+    {
+        // objects of the process, in the order they were created,
+        // continue with obj->proc_next
+
+        PROCESS_OBJECTS *proc = (PROCESS_OBJECTS *)
+            map_get(&m_ProcessMap, (void *)(ULONG_PTR)idProcess);
+
+        return proc ? proc->head : NULL;
+    }
+
+    ULONG GetUnknownCount(void *pUnknown)
+    {
+        // number of objects which share the interface pointer
+
+        ULONG *pCount = (ULONG *)map_get(&m_UnknownMap, pUnknown);
+
+        return pCount ? *pCount : 0;
+    }
+
+protected:
+
+    struct PROCESS_OBJECTS {
+
+        T *head;
+        T *tail;
+    };
+
+    HASH_MAP m_ObjectsMap;              // objidx --> T
+    HASH_MAP m_ProcessMap;              // idProcess --> PROCESS_OBJECTS
+    HASH_MAP m_UnknownMap;              // pUnknown --> number of T
+
+};
+
+
+#endif /* _MY_COMOBJECTS_H */
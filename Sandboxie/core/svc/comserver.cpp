@@ -129,6 +129,9 @@ typedef struct _COM_OBJECT {
     IRpcChannelBuffer *pChannel;
     ULONG Flags;
 
+    struct _COM_OBJECT *proc_prev;      // see ComObjectIndex
+    struct _COM_OBJECT *proc_next;
+
 } COM_OBJECT;
 
 
@@ -1329,6 +1332,8 @@ extern "C" void ComServer_Main9(const WCHAR *cmdline);   // comserver9.cpp
 
 bool ComServer::m_AnySlaveObjectCreated = false;
 
+ComObjectIndex<COM_OBJECT> ComServer::m_SlaveObjects;
+
 
 //---------------------------------------------------------------------------
 // RunSlave
@@ -1417,6 +1422,8 @@ void ComServer::RunSlave(const WCHAR *cmdline)
     LIST ObjectsList;
     List_Init(&ObjectsList);
 
+    InitSlaveObjects();
+
     CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
 
     CoInitializeSecurity(
@@ -1527,15 +1534,7 @@ void *ComServer::FindSlaveObject(void *_map, LIST *ObjectsList,
 {
     COM_SLAVE_MAP *pMap = (COM_SLAVE_MAP *)_map;
 
-    COM_OBJECT *obj = (COM_OBJECT *)List_Head(ObjectsList);
-    while (obj) {
-        if (pMap->idProcess == obj->idProcess &&
-            pMap->objidx    == obj->objidx)
-        {
-            break;
-        }
-        obj = (COM_OBJECT *)List_Next(obj);
-    }
+    COM_OBJECT *obj = m_SlaveObjects.Find(pMap->idProcess, pMap->objidx);
 
 #ifdef DEBUG_COMSERVER
     WCHAR txt[256]; wsprintf(txt, L"FindSlaveObject         objidx=%08X idProcess=%06d obj=%08X\n",
@@ -1560,15 +1559,22 @@ void *ComServer::RefOrAllocSlaveObject(ULONG idProcess, void *pUnknown,
                                        LIST *ObjectsList,
                                        ULONG *exc, HRESULT *hr)
 {
-    COM_OBJECT *obj = (COM_OBJECT *)List_Head(ObjectsList);
+    COM_OBJECT *obj = NULL;
+
+    //
+    // only look through the objects of the process when the interface
+    // pointer is already known to be used by some object
+    //
+
+    if (m_SlaveObjects.GetUnknownCount(pUnknown))
+        obj = m_SlaveObjects.GetProcessObjects(idProcess);
     while (obj) {
-        if (idProcess == obj->idProcess &&
-            pUnknown  == obj->pUnknown)
+        if (pUnknown == obj->pUnknown)
         {
             obj->pUnknown->AddRef();
             break;
         }
-        obj = (COM_OBJECT *)List_Next(obj);
+        obj = obj->proc_next;
     }
 
 #ifdef DEBUG_COMSERVER
@@ -1592,7 +1598,7 @@ void *ComServer::RefOrAllocSlaveObject(ULONG idProcess, void *pUnknown,
             while (m_ObjIdx == 0 || m_ObjIdx == -1)
                 InterlockedIncrement(&m_ObjIdx);
 
-            List_Insert_After(ObjectsList, NULL, obj);
+            m_SlaveObjects.Insert(obj, ObjectsList);
 
             m_AnySlaveObjectCreated = true;
 
@@ -1616,7 +1622,6 @@ void *ComServer::RefOrAllocSlaveObject(ULONG idProcess, void *pUnknown,
 void ComServer::DeleteSlaveObject(void *_obj, LIST *ObjectsList)
 {
     COM_OBJECT *obj = (COM_OBJECT *)_obj;
-    COM_OBJECT *obj2;
     ULONG refcount, objcount;
 
 #ifdef DEBUG_COMSERVER
@@ -1649,14 +1654,7 @@ void ComServer::DeleteSlaveObject(void *_obj, LIST *ObjectsList)
     // only unlink it from our list
     //
 
-    objcount = 0;
-
-    obj2 = (COM_OBJECT *)List_Head(ObjectsList);
-    while (obj2) {
-        if (obj2->pUnknown == obj->pUnknown)
-            ++objcount;
-        obj2 = (COM_OBJECT *)List_Next(obj2);
-    }
+    objcount = m_SlaveObjects.GetUnknownCount(obj->pUnknown);
 
 #ifdef DEBUG_COMSERVER
     wsprintf(txt, L"DeleteSlaveObject       %d shared objects\n", objcount); OutputDebugString(txt);
@@ -1684,11 +1682,50 @@ void ComServer::DeleteSlaveObject(void *_obj, LIST *ObjectsList)
         }
     }
 
-    List_Remove(ObjectsList, obj);
+    m_SlaveObjects.Remove(obj, ObjectsList);
     HeapFree(m_heap, 0, obj);
 }
 
 
+//---------------------------------------------------------------------------
+// InitSlaveObjects
+//---------------------------------------------------------------------------
+
+
+void ComServer::InitSlaveObjects(void)
+{
+    //
+    // the objects list is indexed by object index, by process and by
+    // interface pointer, see comobjects.h, the indexes allocate from
+    // the slave heap like the objects themselves
+    //
+
+    m_SlaveObjects.Init(m_heap, &SlaveMapAlloc, &SlaveMapFree);
+}
+
+
+//---------------------------------------------------------------------------
+// SlaveMapAlloc
+//---------------------------------------------------------------------------
+
+
+void *ComServer::SlaveMapAlloc(void *pool, size_t size)
+{
+    return HeapAlloc((HANDLE)pool, 0, size);
+}
+
+
+//---------------------------------------------------------------------------
+// SlaveMapFree
+//---------------------------------------------------------------------------
+
+
+void ComServer::SlaveMapFree(void *pool, void *ptr)
+{
+    HeapFree((HANDLE)pool, 0, ptr);
+}
+
+
 //---------------------------------------------------------------------------
 // GetClassObjectSlave
 //---------------------------------------------------------------------------
@@ -1962,7 +1999,7 @@ void ComServer::AddRefReleaseSlave(void *_map, LIST *ObjectsList,
             obj->pChannel->Release();
 
         if (pMap->ProcNum == 0) {
-            List_Remove(ObjectsList, obj);
+            m_SlaveObjects.Remove(obj, ObjectsList);
             HeapFree(m_heap, 0, obj);
         }
 
@@ -2443,19 +2480,18 @@ void ComServer::ProcessNotifySlave(void *_map, LIST *ObjectsList,
 
     COM_OBJECT *obj, *next_obj;
 
-    obj = (COM_OBJECT *)List_Head(ObjectsList);
+    obj = m_SlaveObjects.GetProcessObjects(idProcess);
     while (obj) {
-        next_obj = (COM_OBJECT *)List_Next(obj);
-        if ((obj->idProcess == idProcess) && (obj->Flags & FLAG_COPY_PROXY))
+        next_obj = obj->proc_next;
+        if (obj->Flags & FLAG_COPY_PROXY)
             DeleteSlaveObject(obj, ObjectsList);
         obj = next_obj;
     }
 
-    obj = (COM_OBJECT *)List_Head(ObjectsList);
+    obj = m_SlaveObjects.GetProcessObjects(idProcess);
     while (obj) {
-        next_obj = (COM_OBJECT *)List_Next(obj);
-        if (obj->idProcess == idProcess)
-            DeleteSlaveObject(obj, ObjectsList);
+        next_obj = obj->proc_next;
+        DeleteSlaveObject(obj, ObjectsList);
         obj = next_obj;
     }
 
@@ -25,6 +25,7 @@
 
 
 #include "PipeServer.h"
+#include "comobjects.h"
 
 
 class ComServer
@@ -109,6 +110,12 @@ protected:
 
     static void DeleteSlaveObject(void *_obj, LIST *ObjectsList);
 
+    static void InitSlaveObjects(void);
+
+    static void *SlaveMapAlloc(void *pool, size_t size);
+
+    static void SlaveMapFree(void *pool, void *ptr);
+
     static void GetClassObjectSlave(void *_map, LIST *ObjectsList,
                                     ULONG *exc, HRESULT *hr);
 
@@ -171,6 +178,8 @@ protected:
 
     static bool m_AnySlaveObjectCreated;
 
+    static ComObjectIndex<struct _COM_OBJECT> m_SlaveObjects;
+
 };
 
 
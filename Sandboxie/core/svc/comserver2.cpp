@@ -45,15 +45,14 @@ void *ComServer::FindOrCreateDummySlaveObject(void *_map, LIST *ObjectsList,
 {
     COM_SLAVE_MAP *pMap = (COM_SLAVE_MAP *)_map;
 
-    COM_OBJECT *obj = (COM_OBJECT *)List_Head(ObjectsList);
+    COM_OBJECT *obj = m_SlaveObjects.GetProcessObjects(pMap->idProcess);
     while (obj) {
-        if (pMap->idProcess == obj->idProcess &&
-            pMap->objidx    == -1 &&
+        if (pMap->objidx    == -1 &&
             memcmp(pMap->Buffer, &obj->iid, sizeof(GUID)) == 0)
         {
             break;
         }
-        obj = (COM_OBJECT *)List_Next(obj);
+        obj = obj->proc_next;
     }
 
     if (! obj) {
@@ -75,7 +74,7 @@ void *ComServer::FindOrCreateDummySlaveObject(void *_map, LIST *ObjectsList,
 
                 memcpy(&obj->iid, pMap->Buffer, sizeof(GUID));
 
-                List_Insert_After(ObjectsList, NULL, obj);
+                m_SlaveObjects.Insert(obj, ObjectsList);
 
             } else {
 
@@ -30,6 +30,10 @@
 //---------------------------------------------------------------------------
 
 
+#define MSGID_PORT                              0x1000
+#define MSGID_PORT_BULK_ATTACH                  0x1001
+#define MSGID_PORT_GET_STATS                    0x1002
+
 #define MSGID_PSTORE                            0x1100
 #define MSGID_PSTORE_GET_TYPE_INFO              0x1101
 #define MSGID_PSTORE_GET_SUBTYPE_INFO           0x1102
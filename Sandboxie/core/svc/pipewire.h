@@ -0,0 +1,65 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Pipe Server Statistics -- PipeServer
+//---------------------------------------------------------------------------
+
+
+#ifndef _MY_PIPEWIRE_H
+#define _MY_PIPEWIRE_H
+
+
+#include "msgids.h"
+
+
+//---------------------------------------------------------------------------
+// Get Statistics
+//---------------------------------------------------------------------------
+
+
+struct tagPORT_TARGET_STATS
+{
+    ULONG server_id;                    // MSGID_xxx with a zero low byte
+    ULONG max_time_us;                  // longest single call
+    ULONG64 call_count;
+    ULONG64 total_time_us;
+};
+
+struct tagPORT_GET_STATS_REQ
+{
+    MSG_HEADER h;
+};
+
+struct tagPORT_GET_STATS_RPL
+{
+    MSG_HEADER h;                       // status is NTSTATUS
+    ULONG num_threads;                  // worker threads in the pool
+    ULONG min_threads;
+    ULONG max_threads;
+    ULONG idle_threads;                 // waiting for a message right now
+    ULONG num_targets;
+    ULONG reserved;
+    struct tagPORT_TARGET_STATS targets[1];
+};
+
+typedef struct tagPORT_TARGET_STATS PORT_TARGET_STATS;
+typedef struct tagPORT_GET_STATS_REQ PORT_GET_STATS_REQ;
+typedef struct tagPORT_GET_STATS_RPL PORT_GET_STATS_RPL;
+
+
+#endif /* _MY_PIPEWIRE_H */
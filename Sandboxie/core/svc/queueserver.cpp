@@ -51,7 +51,7 @@ typedef struct _REQUEST_OBJ {
 typedef struct _QUEUE_OBJ {
 
     LIST_ELEM list_elem;
-    FILETIME server_create_time;
+    HANDLE server_process;          // keeps server_pid from being reused
     HANDLE server_pid;
     HANDLE server_event;
     LIST  requests;
@@ -75,6 +75,18 @@ QueueServer::QueueServer(PipeServer *pipeServer)
     InitializeCriticalSectionAndSpinCount(&m_lock, 1000);
     List_Init(&m_queues);
 
+    //
+    // queues are indexed by their lower case name, the key is a pointer
+    // to the queue_name field of the QUEUE_OBJ, see also FindQueueObj
+    //
+
+    map_init(&m_queue_map, m_heap);
+    m_queue_map.func_malloc = &QueueMapAlloc;
+    m_queue_map.func_free = &QueueMapFree;
+    m_queue_map.func_hash_key = &str_map_hash;
+    m_queue_map.func_match_key = &str_map_match;
+    map_resize(&m_queue_map, 64);
+
     m_RequestId = 0x00000001;
 
     pipeServer->Register(MSGID_QUEUE, this, Handler);
@@ -150,6 +162,7 @@ MSG_HEADER *QueueServer::CreateHandler(MSG_HEADER *msg, HANDLE idProcess)
 {
     WCHAR *QueueName = NULL;
     HANDLE hProcess = NULL;
+    HANDLE hServerProcess = NULL;
     HANDLE hEvent = NULL;
     ULONG status;
 
@@ -179,21 +192,22 @@ MSG_HEADER *QueueServer::CreateHandler(MSG_HEADER *msg, HANDLE idProcess)
         goto finish;
     }
 
-    QUEUE_OBJ *QueueObj = (QUEUE_OBJ *)FindQueueObj(QueueName);
+    QUEUE_OBJ *QueueObj = (QUEUE_OBJ *)FindQueueObj(QueueName, true);
     if (QueueObj) {
         status = STATUS_OBJECT_NAME_COLLISION;
         goto finish;
     }
 
     //
-    //
+    // keep a handle on the server process, while we hold it, its process
+    // id can not be reused, so the queue does not need to be re-verified
+    // on every lookup.  the queue is removed when NotifyHandler learns
+    // that the process has ended
     //
 
-    FILETIME time1, time2, time3, time4;
-    if (! GetProcessTimes(hProcess, &time1, &time2, &time3, &time4)) {
-        status = STATUS_INVALID_CID;
+    status = OpenProcess(idProcess, &hServerProcess, SYNCHRONIZE);
+    if (! NT_SUCCESS(status))
         goto finish;
-    }
 
     status = DuplicateEvent(hProcess, req->event_handle, &hEvent);
     if (! NT_SUCCESS(status))
@@ -207,8 +221,8 @@ MSG_HEADER *QueueServer::CreateHandler(MSG_HEADER *msg, HANDLE idProcess)
         goto finish;
     }
 
-    QueueObj->server_create_time.dwHighDateTime = time1.dwHighDateTime;
-    QueueObj->server_create_time.dwLowDateTime  = time1.dwLowDateTime;
+    QueueObj->server_process = hServerProcess;
+    hServerProcess = NULL;
 
     QueueObj->server_pid = idProcess;
     QueueObj->server_event = hEvent;
@@ -219,7 +233,7 @@ MSG_HEADER *QueueServer::CreateHandler(MSG_HEADER *msg, HANDLE idProcess)
     wcscpy(QueueObj->queue_name, QueueName);
     QueueObj->queue_name_len = wcslen(QueueObj->queue_name);
 
-    List_Insert_After(&m_queues, NULL, QueueObj);
+    InsertQueueObj(QueueObj);
 
     status = STATUS_SUCCESS;
 
@@ -230,6 +244,9 @@ finish:
     if (hEvent)
         CloseHandle(hEvent);
 
+    if (hServerProcess)
+        CloseHandle(hServerProcess);
+
     if (hProcess)
         CloseHandle(hProcess);
 
@@ -814,6 +831,13 @@ WCHAR *QueueServer::MakeQueueName(
         *out_status = STATUS_SUCCESS;
     }
 
+    //
+    // queue names are compared case insensitively, lower case them
+    // so they can be used as keys in m_queue_map
+    //
+
+    _wcslwr(name);
+
     return name;
 }
 
@@ -823,43 +847,25 @@ WCHAR *QueueServer::MakeQueueName(
 //---------------------------------------------------------------------------
 
 
-void *QueueServer::FindQueueObj(const WCHAR *QueueName)
+void *QueueServer::FindQueueObj(const WCHAR *QueueName, bool VerifyServer)
 {
-    ULONG QueueNameLen = wcslen(QueueName);
-    QUEUE_OBJ *QueueObj = (QUEUE_OBJ *)List_Head(&m_queues);
-    while (QueueObj) {
-        if (QueueObj->queue_name_len == QueueNameLen
-                && _wcsicmp(QueueObj->queue_name, QueueName) == 0)
-            break;
-        QueueObj = (QUEUE_OBJ *)List_Next(QueueObj);
-    }
-
-    if (QueueObj) {
-        bool ServerProcessIsActive = false;
-
-        HANDLE hProcess = NULL;
-        ULONG status = OpenProcess(QueueObj->server_pid, &hProcess,
-                                   PROCESS_QUERY_INFORMATION);
-        if (status == 0) {
+    //
+    // QueueName was lower cased by MakeQueueName
+    //
 
-            DWORD nExitCode = 0;
+    QUEUE_OBJ *QueueObj = (QUEUE_OBJ *)map_get(&m_queue_map, QueueName);
 
-            if (GetExitCodeProcess(hProcess, &nExitCode) && nExitCode == STILL_ACTIVE)
-            {
-                FILETIME time1, time2, time3, time4;
-                if (GetProcessTimes(hProcess, &time1, &time2, &time3, &time4)) {
-                    time2 = QueueObj->server_create_time;
-                    if (time1.dwHighDateTime == time2.dwHighDateTime &&
-                        time1.dwLowDateTime == time2.dwLowDateTime) {
+    //
+    // NotifyHandler removes the queues of a server process when it ends,
+    // and the process handle we hold keeps its id from being reused, so
+    // lookups don't need to check the server process.  but when a queue
+    // is about to be created, make sure a queue whose end notification
+    // was missed does not block the name
+    //
 
-                        ServerProcessIsActive = true;
-                    }
-                }
-            }
-            CloseHandle(hProcess);
-        }
+    if (QueueObj && VerifyServer) {
 
-        if (! ServerProcessIsActive) {
+        if (WaitForSingleObject(QueueObj->server_process, 0) != WAIT_TIMEOUT) {
             DeleteQueueObj(QueueObj);
             QueueObj = NULL;
         }
@@ -869,6 +875,21 @@ void *QueueServer::FindQueueObj(const WCHAR *QueueName)
 }
 
 
+//---------------------------------------------------------------------------
+// InsertQueueObj
+//---------------------------------------------------------------------------
+
+
+void QueueServer::InsertQueueObj(void *_QueueObj)
+{
+    QUEUE_OBJ *QueueObj = (QUEUE_OBJ *)_QueueObj;
+
+    List_Insert_After(&m_queues, NULL, QueueObj);
+
+    map_insert(&m_queue_map, QueueObj->queue_name, QueueObj, 0);
+}
+
+
 //---------------------------------------------------------------------------
 // NotifyHandler
 //---------------------------------------------------------------------------
@@ -936,11 +957,38 @@ void QueueServer::DeleteQueueObj(void *_QueueObj)
     if (QueueObj->server_event)
         NtClose(QueueObj->server_event);
 
+    if (QueueObj->server_process)
+        NtClose(QueueObj->server_process);
+
+    map_remove(&m_queue_map, QueueObj->queue_name);
+
     List_Remove(&m_queues, QueueObj);
     HeapFree(m_heap, 0, QueueObj);
 }
 
 
+//---------------------------------------------------------------------------
+// QueueMapAlloc
+//---------------------------------------------------------------------------
+
+
+void *QueueServer::QueueMapAlloc(void *pool, size_t size)
+{
+    return HeapAlloc((HANDLE)pool, 0, size);
+}
+
+
+//---------------------------------------------------------------------------
+// QueueMapFree
+//---------------------------------------------------------------------------
+
+
+void QueueServer::QueueMapFree(void *pool, void *ptr)
+{
+    HeapFree((HANDLE)pool, 0, ptr);
+}
+
+
 //---------------------------------------------------------------------------
 // DeleteRequestObj
 //---------------------------------------------------------------------------
@@ -988,7 +1036,7 @@ MSG_HEADER *QueueServer::StartupHandler(MSG_HEADER *msg, HANDLE idProcess)
     if (! QueueName)
         goto finish;
 
-    QUEUE_OBJ *QueueObj = (QUEUE_OBJ *)FindQueueObj(QueueName);
+    QUEUE_OBJ *QueueObj = (QUEUE_OBJ *)FindQueueObj(QueueName, true);
     if (QueueObj) { // already exists
         status = STATUS_SUCCESS;
         goto finish;
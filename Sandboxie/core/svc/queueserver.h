@@ -63,18 +63,25 @@ protected:
     WCHAR *MakeQueueName(
                     HANDLE idProcess, WCHAR *req_name, ULONG *out_status);
 
-    void *FindQueueObj(const WCHAR *QueueName);
+    void *FindQueueObj(const WCHAR *QueueName, bool VerifyServer = false);
+
+    void InsertQueueObj(void *_QueueObj);
 
     void DeleteQueueObj(void *_QueueObj);
 
     void DeleteRequestObj(LIST *RequestsList, void *_RequestObj);
 
+    static void *QueueMapAlloc(void *pool, size_t size);
+
+    static void QueueMapFree(void *pool, void *ptr);
+
 protected:
 
     HANDLE m_heap;
 
     CRITICAL_SECTION m_lock;
     LIST m_queues;
+    HASH_MAP m_queue_map;
 
     volatile LONG m_RequestId;
 };
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Worker Thread Pool -- PipeServer
+//---------------------------------------------------------------------------
+
+
+#ifndef _MY_WORKPOOL_H
+#define _MY_WORKPOOL_H
+
+
+//
+// the bookkeeping of the worker threads of PipeServer.  the pool starts
+// with min_threads, and whenever the last idle thread picks up a message,
+// one more thread is started, up to max_threads.  while the pool is larger
+// than min_threads the threads wait with a timeout, and a thread which
+// times out while other threads are idle as well leaves the pool again.
+//
+// the thread list is changed only while the caller holds its lock, the
+// idle count is changed without it.  this file only needs the Interlocked
+// functions, so it can also be built outside of the service, see
+// tests/work_pool_test.c
+//
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _WORK_POOL {
+
+    HANDLE *threads;                    // max_threads entries
+    ULONG *thread_ids;
+    ULONG num_threads;
+    ULONG min_threads;
+    ULONG max_threads;
+
+    volatile LONG idle_threads;         // waiting for a message right now
+
+} WORK_POOL;
+
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+
+__inline void WorkPool_Init(
+    WORK_POOL *pool, ULONG min_threads, ULONG max_threads,
+    HANDLE *threads, ULONG *thread_ids)
+{
+    pool->threads = threads;
+    pool->thread_ids = thread_ids;
+    pool->num_threads = 0;
+    pool->min_threads = min_threads;
+    pool->max_threads = (max_threads > min_threads) ? max_threads : min_threads;
+    pool->idle_threads = 0;
+}
+
+
+__inline BOOLEAN WorkPool_CanAdd(const WORK_POOL *pool)
+{
+    return (pool->threads && pool->num_threads < pool->max_threads);
+}
+
+
+__inline void WorkPool_Add(WORK_POOL *pool, HANDLE hThread, ULONG idThread)
+{
+    //
+    // called with the lock held, after WorkPool_CanAdd
+    //
+
+    pool->threads[pool->num_threads] = hThread;
+    pool->thread_ids[pool->num_threads] = idThread;
+    ++pool->num_threads;
+}
+
+
+__inline HANDLE WorkPool_Remove(WORK_POOL *pool, ULONG idThread)
+{
+    //
+    // called with the lock held by a thread which is about to leave the
+    // pool.  returns the handle of the thread, which the caller closes,
+    // or NULL if the thread has to stay, as the pool is at min_threads
+    //
+
+    HANDLE hThread;
+    ULONG i;
+
+    if (pool->num_threads <= pool->min_threads)
+        return NULL;
+
+    for (i = 0; i < pool->num_threads; ++i) {
+
+        if (pool->thread_ids[i] == idThread) {
+
+            hThread = pool->threads[i];
+
+            --pool->num_threads;
+            pool->threads[i] = pool->threads[pool->num_threads];
+            pool->thread_ids[i] = pool->thread_ids[pool->num_threads];
+            pool->threads[pool->num_threads] = NULL;
+            pool->thread_ids[pool->num_threads] = 0;
+
+            return hThread;
+        }
+    }
+
+    return NULL;
+}
+
+
+__inline BOOLEAN WorkPool_Waiting(WORK_POOL *pool)
+{
+    //
+    // called before a thread waits for a message, returns TRUE if it
+    // should wait only for the idle timeout
+    //
+
+    InterlockedIncrement(&pool->idle_threads);
+    return (pool->num_threads > pool->min_threads);
+}
+
+
+__inline BOOLEAN WorkPool_Received(WORK_POOL *pool)
+{
+    //
+    // called when the wait returned a message, returns TRUE if this was
+    // the last idle thread, and the caller should add another one
+    //
+
+    return (InterlockedDecrement(&pool->idle_threads) == 0);
+}
+
+
+__inline BOOLEAN WorkPool_TimedOut(WORK_POOL *pool)
+{
+    //
+    // called when the wait timed out, returns TRUE if other threads are
+    // still idle, so the caller may leave with WorkPool_Remove
+    //
+
+    return (InterlockedDecrement(&pool->idle_threads) != 0);
+}
+
+
+#endif /* _MY_WORKPOOL_H */
@@ -0,0 +1,352 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Snapshot Path Bloom Filter Test
+//---------------------------------------------------------------------------
+
+
+//
+// tests the snapshot path filter of common/bloom.h, which is built by
+// CSandBox__WriteSnapshotBloom and checked by File_MayBeInSnapshot, and
+// benchmarks the snapshot probes of a lookup against the chain depth
+//
+// gcc -I.. -o bloom_test bloom_test.c
+// cl /I.. bloom_test.c
+//
+
+
+#include "test_stubs.h"
+#include "common/bloom.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define MAX_PATH_LEN    128
+
+
+typedef struct _TEST_FILTER {
+
+    BLOOM_HEADER Header;
+    UCHAR *Bits;
+
+} TEST_FILTER;
+
+
+//---------------------------------------------------------------------------
+// Test_MakePath
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_MakePath(WCHAR *Path, ULONG Id)
+{
+    //
+    // synthetic relative snapshot path, unique for every id
+    //
+
+    return (ULONG)swprintf(Path, MAX_PATH_LEN,
+        L"drive\\C\\Users\\Someone\\AppData\\Roaming\\Vendor%u\\Sub%u\\File%u.dat",
+        Id % 37, (Id / 37) % 101, Id);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_BuildFilter
+//---------------------------------------------------------------------------
+
+
+static void Test_BuildFilter(TEST_FILTER *Filter, const ULONG *Ids, ULONG Count)
+{
+    //
+    // same steps as CSandBox__WriteSnapshotBloom
+    //
+
+    WCHAR Path[MAX_PATH_LEN];
+    ULONG i, Len;
+
+    Filter->Header.Signature = BLOOM_SIGNATURE;
+    Filter->Header.Version = BLOOM_VERSION;
+    Filter->Header.BitCount = Bloom_BitCount(Count);
+    Filter->Header.HashCount = BLOOM_HASH_COUNT;
+    Filter->Header.PathCount = Count;
+
+    Filter->Bits = calloc(Filter->Header.BitCount / 8, 1);
+
+    for (i = 0; i < Count; ++i) {
+        Len = Test_MakePath(Path, Ids[i]);
+        Bloom_Add(Filter->Bits, Filter->Header.BitCount, Filter->Header.HashCount, Bloom_HashPath(Path, Len));
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_MayContain
+//---------------------------------------------------------------------------
+
+
+static BOOLEAN Test_MayContain(const TEST_FILTER *Filter, const WCHAR *Path, ULONG Len)
+{
+    return Bloom_Test(Filter->Bits, Filter->Header.BitCount, Filter->Header.HashCount, Bloom_HashPath(Path, Len));
+}
+
+
+//---------------------------------------------------------------------------
+// Test_CaseVariant
+//---------------------------------------------------------------------------
+
+
+static void Test_CaseVariant(WCHAR *Path, ULONG Len)
+{
+    //
+    // change the case the way the file system would still match it,
+    // including non ASCII characters which upcase to 'I' and 'S'
+    //
+
+    ULONG i;
+
+    for (i = 0; i < Len; ++i) {
+
+        WCHAR c = Path[i];
+        ULONG r = Test_Rand(4);
+
+        if ((c == L'i' || c == L'I') && r == 0)
+            Path[i] = 0x0131;   // dotless i
+        else if ((c == L's' || c == L'S') && r == 0)
+            Path[i] = 0x017F;   // long s
+        else if (c >= L'a' && c <= L'z' && r == 1)
+            Path[i] = c - L'a' + L'A';
+        else if (c >= L'A' && c <= L'Z' && r == 1)
+            Path[i] = c - L'A' + L'a';
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_NoFalseNegatives
+//---------------------------------------------------------------------------
+
+
+static void Test_NoFalseNegatives(void)
+{
+    WCHAR Path[MAX_PATH_LEN];
+    TEST_FILTER Filter;
+    ULONG Counts[] = { 0, 1, 100, 10000, 200000 };
+    ULONG *Ids;
+    ULONG c, i, Len, Misses, Probes, FalsePositives;
+
+    for (c = 0; c < sizeof(Counts) / sizeof(Counts[0]); ++c) {
+
+        Ids = malloc((Counts[c] + 1) * sizeof(ULONG));
+        for (i = 0; i < Counts[c]; ++i)
+            Ids[i] = i * 2;
+
+        Test_BuildFilter(&Filter, Ids, Counts[c]);
+
+        Misses = 0;
+        for (i = 0; i < Counts[c]; ++i) {
+            Len = Test_MakePath(Path, Ids[i]);
+            Test_CaseVariant(Path, Len);
+            if (! Test_MayContain(&Filter, Path, Len))
+                ++Misses;
+        }
+        TEST_CHECK(Misses == 0);
+
+        //
+        // paths which are not in the snapshot, with 10 bits per path
+        // and 7 hashes about 1% should be let through
+        //
+
+        Probes = 100000;
+        FalsePositives = 0;
+        for (i = 0; i < Probes; ++i) {
+            Len = Test_MakePath(Path, i * 2 + 1);
+            if (Test_MayContain(&Filter, Path, Len))
+                ++FalsePositives;
+        }
+        if (Counts[c] >= 10000)
+            TEST_CHECK(FalsePositives * 100 < Probes * 3);
+        if (Counts[c] == 0)
+            TEST_CHECK(FalsePositives == 0);
+
+        printf("paths %6u  bits %8u  false positives %.2f%%\n",
+            Counts[c], Filter.Header.BitCount, FalsePositives * 100.0 / Probes);
+
+        free(Filter.Bits);
+        free(Ids);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Header
+//---------------------------------------------------------------------------
+
+
+static void Test_Header(void)
+{
+    //
+    // File_LoadSnapshotBloom only accepts a header which passes
+    // Bloom_CheckHeader, anything else makes it probe every path
+    //
+
+    BLOOM_HEADER Header, Bad;
+
+    Header.Signature = BLOOM_SIGNATURE;
+    Header.Version = BLOOM_VERSION;
+    Header.BitCount = Bloom_BitCount(12345);
+    Header.HashCount = BLOOM_HASH_COUNT;
+    Header.PathCount = 12345;
+    TEST_CHECK(Bloom_CheckHeader(&Header));
+
+    TEST_CHECK(Bloom_BitCount(0) == BLOOM_MIN_BITS);
+    TEST_CHECK(Bloom_BitCount(0xFFFFFFFF) == BLOOM_MAX_BITS);
+
+    Bad = Header; Bad.Signature = 0;
+    TEST_CHECK(! Bloom_CheckHeader(&Bad));
+    Bad = Header; Bad.Version = BLOOM_VERSION + 1;
+    TEST_CHECK(! Bloom_CheckHeader(&Bad));
+    Bad = Header; Bad.BitCount = BLOOM_MIN_BITS + 8;
+    TEST_CHECK(! Bloom_CheckHeader(&Bad));
+    Bad = Header; Bad.BitCount = BLOOM_MIN_BITS / 2;
+    TEST_CHECK(! Bloom_CheckHeader(&Bad));
+    Bad = Header; Bad.BitCount = BLOOM_MAX_BITS * 2;
+    TEST_CHECK(! Bloom_CheckHeader(&Bad));
+    Bad = Header; Bad.HashCount = 0;
+    TEST_CHECK(! Bloom_CheckHeader(&Bad));
+    Bad = Header; Bad.HashCount = 33;
+    TEST_CHECK(! Bloom_CheckHeader(&Bad));
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    //
+    // a chain of snapshots which each hold 20000 of a million paths,
+    // most lookups are for true path files which are in no snapshot.
+    // File_FindSnapshotPath probes the snapshots from the newest one
+    // until it finds the path, a probe is a File_GetFileType call, so
+    // the probe count is what the filter saves.  the time is the cost of
+    // making the path, hashing it and testing every filter of the chain
+    //
+
+    #define SNAP_PATHS  20000
+    #define UNIVERSE    1000000
+    #define LOOKUPS     200000
+
+    ULONG Depths[] = { 1, 2, 4, 8, 16, 32 };
+    TEST_FILTER *Filters;
+    UCHAR **Present;
+    ULONG *Ids, *Lookups;
+    WCHAR Path[MAX_PATH_LEN];
+    ULONG d, s, i, Len, Id, Depth, Hits;
+    ULONG64 ProbesOld, ProbesNew;
+    double t0, Time;
+
+    Lookups = malloc(LOOKUPS * sizeof(ULONG));
+
+    printf("depth  probes/lookup old   new   filter ns/lookup\n");
+
+    for (d = 0; d < sizeof(Depths) / sizeof(Depths[0]); ++d) {
+
+        Depth = Depths[d];
+        Filters = malloc(Depth * sizeof(TEST_FILTER));
+        Present = malloc(Depth * sizeof(UCHAR *));
+        Ids = malloc(SNAP_PATHS * sizeof(ULONG));
+
+        for (s = 0; s < Depth; ++s) {
+            Present[s] = calloc(UNIVERSE, 1);
+            for (i = 0; i < SNAP_PATHS; ++i) {
+                Ids[i] = Test_Rand(UNIVERSE);
+                Present[s][Ids[i]] = 1;
+            }
+            Test_BuildFilter(&Filters[s], Ids, SNAP_PATHS);
+        }
+
+        for (i = 0; i < LOOKUPS; ++i)
+            Lookups[i] = (i % 10 == 0) ? Ids[Test_Rand(SNAP_PATHS)] : UNIVERSE + Test_Rand(UNIVERSE);
+
+        ProbesOld = ProbesNew = 0;
+
+        for (i = 0; i < LOOKUPS; ++i) {
+
+            Id = Lookups[i];
+            Len = Test_MakePath(Path, Id);
+
+            for (s = 0; s < Depth; ++s) {
+                ++ProbesOld;
+                if (Id < UNIVERSE && Present[s][Id])
+                    break;
+            }
+
+            for (s = 0; s < Depth; ++s) {
+                if (! Test_MayContain(&Filters[s], Path, Len))
+                    continue;
+                ++ProbesNew;
+                if (Id < UNIVERSE && Present[s][Id])
+                    break;
+            }
+        }
+
+        Hits = 0;
+        t0 = Test_Time();
+        for (i = 0; i < LOOKUPS; ++i) {
+            Len = Test_MakePath(Path, Lookups[i]);
+            for (s = 0; s < Depth; ++s)
+                Hits += Test_MayContain(&Filters[s], Path, Len);
+        }
+        Time = Test_Time() - t0;
+
+        printf("%5u  %17.2f %5.2f %18.1f\n", Depth,
+            (double)ProbesOld / LOOKUPS, (double)ProbesNew / LOOKUPS,
+            Time * 1000000.0 / LOOKUPS);
+
+        for (s = 0; s < Depth; ++s) {
+            free(Filters[s].Bits);
+            free(Present[s]);
+        }
+        free(Filters);
+        free(Present);
+        free(Ids);
+    }
+
+    free(Lookups);
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    Test_Header();
+    Test_NoFalseNegatives();
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        Test_Benchmark();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,428 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Service Message Framing Loopback Test
+//---------------------------------------------------------------------------
+
+
+//
+// passes messages through a loopback port with the framing functions of
+// core/svc/bulkwire.h, PortBulk_Send on the sender side, which is used by
+// SbieDll_CallServer and PipeServer::PortReply, and PortBulk_Accept,
+// PortBulk_ReadView and PortBulk_Append on the receiver side, which are
+// used by PipeServer::PortRequest and the reply loop of SbieDll_CallServer,
+// with and without an attached section.  benchmarks both forms against the
+// payload size
+//
+// gcc -I.. -I../core/svc -o bulkwire_test bulkwire_test.c
+// cl /I.. /I..\core\svc bulkwire_test.c
+//
+
+
+#include "test_stubs.h"
+#include "core/svc/bulkwire.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define PORT_MESSAGE_SIZE   40      // sizeof(PORT_MESSAGE) on 64 bit
+#define MAX_PORTMSG_LENGTH  328     // see common/win32_ntddk.h
+#define MSG_DATA_LEN        (MAX_PORTMSG_LENGTH - PORT_MESSAGE_SIZE)
+
+#define MAX_REQUEST_LENGTH  (0x40000000)  // see PipeServer.cpp
+
+
+typedef struct _TEST_PORT {
+
+    UCHAR *view;                // NULL while no section is attached
+    ULONG view_size;
+
+    UCHAR chunk[MSG_DATA_LEN];  // the data part of one PORT_MESSAGE
+    ULONG chunk_len;
+
+    ULONG64 messages;           // port messages sent so far
+
+} TEST_PORT;
+
+
+//---------------------------------------------------------------------------
+// Test_FailCopy
+//---------------------------------------------------------------------------
+
+
+static BOOLEAN Test_FailCopy(void *dst, const void *src, ULONG len)
+{
+    //
+    // stands in for PipeServer::PortCopyView on a section which the
+    // client has unmapped
+    //
+
+    return FALSE;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Send
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_Send(TEST_PORT *port, const MSG_HEADER *msg, ULONG *offset)
+{
+    port->chunk_len = PortBulk_Send(msg, offset, port->chunk, MSG_DATA_LEN,
+                                    port->view, port->view_size, NULL);
+    ++port->messages;
+    return port->chunk_len;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Receive
+//---------------------------------------------------------------------------
+
+
+static BOOLEAN Test_Receive(
+    TEST_PORT *port, MSG_HEADER **out, ULONG *length, ULONG *received)
+{
+    //
+    // consume one port message the way PipeServer::PortRequest does,
+    // returns TRUE once *out is complete, or with *out NULL if the
+    // message was rejected
+    //
+
+    BOOLEAN in_view;
+
+    if (! *out) {
+
+        *length = PortBulk_Accept(port->chunk, port->chunk_len,
+                                  port->view ? port->view_size : 0, &in_view);
+        if (! *length)
+            return TRUE;
+
+        *out = malloc(*length);
+        *received = 0;
+
+        if (in_view) {
+            TEST_CHECK(PortBulk_ReadView(*out, port->view, port->chunk, NULL));
+            *received = *length;
+            return TRUE;
+        }
+    }
+
+    if (! PortBulk_Append(*out, *length, received, port->chunk, port->chunk_len)) {
+        free(*out);
+        *out = NULL;
+        return TRUE;
+    }
+
+    return (*received >= *length);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Transfer
+//---------------------------------------------------------------------------
+
+
+static MSG_HEADER *Test_Transfer(TEST_PORT *port, const MSG_HEADER *msg)
+{
+    MSG_HEADER *out = NULL;
+    ULONG offset = 0, length = 0, received = 0;
+
+    while (1) {
+
+        Test_Send(port, msg, &offset);
+
+        if (Test_Receive(port, &out, &length, &received))
+            break;
+        if (offset >= msg->length) {
+            free(out);
+            return NULL;
+        }
+    }
+
+    TEST_CHECK(offset == msg->length);
+    return out;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_MakeMessage
+//---------------------------------------------------------------------------
+
+
+static MSG_HEADER *Test_MakeMessage(ULONG length)
+{
+    MSG_HEADER *msg = malloc(length);
+    ULONG i;
+
+    msg->length = length;
+    msg->msgid = 0x1200 + Test_Rand(0x100);
+    for (i = sizeof(MSG_HEADER); i < length; ++i)
+        ((UCHAR *)msg)[i] = (UCHAR)Test_Rand(256);
+
+    return msg;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Loopback
+//---------------------------------------------------------------------------
+
+
+static void Test_Loopback(void)
+{
+    TEST_PORT port;
+    MSG_HEADER *msg, *out;
+    ULONG round, length, expected;
+
+    memzero(&port, sizeof(port));
+
+    for (round = 0; round < 4000; ++round) {
+
+        //
+        // attach, grow or detach the section from time to time, the
+        // way the clients do it in SbieDll_AttachBulkView
+        //
+
+        if (round % 100 == 0) {
+
+            free(port.view);
+            port.view = NULL;
+            port.view_size = 0;
+
+            if (round % 300 != 0) {
+                port.view_size = PortBulk_ViewSize(PORT_BULK_MIN_VIEW << Test_Rand(4));
+                port.view = malloc(port.view_size);
+            }
+        }
+
+        switch (Test_Rand(5)) {
+            case 0:  length = sizeof(MSG_HEADER) + Test_Rand(MSG_DATA_LEN * 2); break;
+            case 1:  length = PORT_BULK_MIN_LENGTH - 2 + Test_Rand(4); break;
+            case 2:  length = sizeof(MSG_HEADER) + Test_Rand(PORT_BULK_MIN_VIEW); break;
+            case 3:  length = port.view_size ? port.view_size - 2 + Test_Rand(4) : MSG_DATA_LEN; break;
+            default: length = sizeof(MSG_HEADER) + Test_Rand(1024 * 1024); break;
+        }
+
+        msg = Test_MakeMessage(length);
+
+        port.messages = 0;
+        out = Test_Transfer(&port, msg);
+
+        TEST_CHECK(out != NULL);
+        if (out) {
+            TEST_CHECK(out->length == msg->length);
+            TEST_CHECK(memcmp(out, msg, msg->length) == 0);
+            free(out);
+        }
+
+        if (port.view && PortBulk_Fits(length, port.view_size))
+            expected = 1;
+        else
+            expected = (length + MSG_DATA_LEN - 1) / MSG_DATA_LEN;
+        TEST_CHECK(port.messages == expected);
+
+        free(msg);
+    }
+
+    free(port.view);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Marker
+//---------------------------------------------------------------------------
+
+
+static void Test_Marker(void)
+{
+    //
+    // the first chunk of a chunked message is never just a header for a
+    // longer message, so it can not be mistaken for the section marker
+    //
+
+    TEST_PORT port;
+    MSG_HEADER *msg, *out, hdr;
+    ULONG length, offset;
+    BOOLEAN in_view;
+
+    memzero(&port, sizeof(port));
+
+    for (length = sizeof(MSG_HEADER); length < 4 * MSG_DATA_LEN; ++length) {
+        msg = Test_MakeMessage(length);
+        offset = 0;
+        Test_Send(&port, msg, &offset);
+        TEST_CHECK(! PortBulk_IsMarker(port.chunk, port.chunk_len));
+        free(msg);
+    }
+
+    //
+    // a marker for a message which does not fit the attached section
+    // is rejected instead of read past the end of the view
+    //
+
+    port.view_size = PORT_BULK_MIN_VIEW;
+    port.view = calloc(port.view_size, 1);
+
+    hdr.length = port.view_size + 1;
+    hdr.msgid = 0x1234;
+    memcpy(port.chunk, &hdr, sizeof(hdr));
+    port.chunk_len = sizeof(hdr);
+
+    msg = NULL;
+    TEST_CHECK(Test_Receive(&port, &msg, &length, &offset) && msg == NULL);
+
+    hdr.length = PORT_BULK_MIN_LENGTH;
+    memcpy(port.chunk, &hdr, sizeof(hdr));
+    TEST_CHECK(Test_Receive(&port, &msg, &length, &offset) && msg == NULL);
+
+    //
+    // without a section the same chunk starts a chunked message, and
+    // first chunks which are shorter than a header or longer than their
+    // message are rejected
+    //
+
+    TEST_CHECK(PortBulk_Accept(port.chunk, port.chunk_len, 0, &in_view) == PORT_BULK_MIN_LENGTH && ! in_view);
+    TEST_CHECK(PortBulk_Accept(port.chunk, sizeof(hdr) - 1, port.view_size, &in_view) == 0);
+
+    hdr.length = sizeof(hdr) + 4;
+    memcpy(port.chunk, &hdr, sizeof(hdr));
+    TEST_CHECK(PortBulk_Accept(port.chunk, sizeof(hdr) + 8, port.view_size, &in_view) == 0);
+
+    //
+    // a section which can not be written or read, like one that was
+    // unmapped by the client, fails the one message.  the header in the
+    // chunk wins over the one in the section
+    //
+
+    msg = Test_MakeMessage(PORT_BULK_MIN_LENGTH * 2);
+    offset = 0;
+    TEST_CHECK(PortBulk_Send(msg, &offset, port.chunk, MSG_DATA_LEN, port.view, port.view_size, Test_FailCopy) == 0);
+    TEST_CHECK(PortBulk_Send(msg, &offset, port.chunk, MSG_DATA_LEN, port.view, port.view_size, NULL) == sizeof(hdr));
+    TEST_CHECK(offset == msg->length);
+
+    TEST_CHECK(PortBulk_Accept(port.chunk, sizeof(hdr), port.view_size, &in_view) == msg->length && in_view);
+    TEST_CHECK(! PortBulk_ReadView(&hdr, port.view, port.chunk, Test_FailCopy));
+
+    ((MSG_HEADER *)port.view)->length = 0xFFFF;
+    ((MSG_HEADER *)port.view)->msgid = 0;
+    out = malloc(msg->length);
+    TEST_CHECK(PortBulk_ReadView(out, port.view, port.chunk, NULL));
+    TEST_CHECK(memcmp(out, msg, msg->length) == 0);
+    free(out);
+    free(msg);
+
+    free(port.view);
+
+    //
+    // view sizes are powers of two between the limits
+    //
+
+    TEST_CHECK(PortBulk_ViewSize(1) == PORT_BULK_MIN_VIEW);
+    TEST_CHECK(PortBulk_ViewSize(PORT_BULK_MIN_VIEW + 1) == PORT_BULK_MIN_VIEW * 2);
+    TEST_CHECK(PortBulk_ViewSize(PORT_BULK_MAX_VIEW) == PORT_BULK_MAX_VIEW);
+    TEST_CHECK(PortBulk_ViewSize(PORT_BULK_MAX_VIEW + 1) == 0);
+    TEST_CHECK(! PortBulk_Fits(PORT_BULK_MIN_LENGTH, PORT_BULK_MAX_VIEW));
+    TEST_CHECK(PortBulk_Fits(PORT_BULK_MIN_LENGTH + 1, PORT_BULK_MAX_VIEW));
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    //
+    // port messages and copy time of one message, chunked and through
+    // the section.  every port message is one LPC round-trip between the
+    // client and the service, which costs more than the copies measured
+    // here, so the message count is the main difference
+    //
+
+    ULONG Sizes[] = { 256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216 };
+    TEST_PORT port;
+    MSG_HEADER *msg, *out;
+    ULONG s, i, runs;
+    ULONG64 messages_chunked, messages_bulk;
+    double t0, t_chunked, t_bulk;
+
+    printf("   payload   messages chunked/section   us chunked   us section\n");
+
+    for (s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); ++s) {
+
+        msg = Test_MakeMessage(Sizes[s]);
+        runs = 64 * 1024 * 1024 / Sizes[s];
+        if (runs > 10000)
+            runs = 10000;
+
+        memzero(&port, sizeof(port));
+        t0 = Test_Time();
+        for (i = 0; i < runs; ++i) {
+            ULONG offset = 0, length = 0, received = 0;
+            out = NULL;
+            while (1) {
+                Test_Send(&port, msg, &offset);
+                if (Test_Receive(&port, &out, &length, &received))
+                    break;
+            }
+            free(out);
+        }
+        t_chunked = Test_Time() - t0;
+        messages_chunked = port.messages / runs;
+
+        port.view_size = PortBulk_ViewSize(Sizes[s]);
+        port.view = port.view_size ? malloc(port.view_size) : NULL;
+        port.messages = 0;
+        t0 = Test_Time();
+        for (i = 0; i < runs; ++i) {
+            out = Test_Transfer(&port, msg);
+            free(out);
+        }
+        t_bulk = Test_Time() - t0;
+        messages_bulk = port.messages / runs;
+        free(port.view);
+
+        printf("%10u   %16llu/%-7llu   %10.2f   %10.2f\n", Sizes[s],
+            messages_chunked, messages_bulk,
+            t_chunked * 1000.0 / runs, t_bulk * 1000.0 / runs);
+
+        free(msg);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    Test_Marker();
+    Test_Loopback();
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        Test_Benchmark();
+
+    return TEST_RESULT();
+}
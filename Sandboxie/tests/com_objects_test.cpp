@@ -0,0 +1,489 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// COM Slave Object Index Stress Test
+//---------------------------------------------------------------------------
+
+
+//
+// churns synthetic COM slave objects through the ComObjectIndex of
+// core/svc/comobjects.h, the way the slave creates, shares, finds and
+// deletes them, and checks every answer against a scan of the objects
+// list, which is how the slave looked objects up before the index
+//
+// gcc -c -DWITHOUT_POOL -include test_stubs.h -I.. ../common/map.c ../common/list.c
+// g++ -I.. -o com_objects_test com_objects_test.cpp map.o list.o
+//
+// cl /c /DWITHOUT_POOL /FItest_stubs.h /I. /I.. ../common/map.c ../common/list.c
+// cl /EHsc /I.. com_objects_test.cpp map.obj list.obj
+//
+
+
+#include "test_stubs.h"
+#include "core/svc/comobjects.h"
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _TEST_OBJECT {
+
+    LIST_ELEM list_elem;
+    ULONG idProcess;
+    ULONG objidx;
+    ULONG iid;
+    void *pUnknown;
+
+    struct _TEST_OBJECT *proc_prev;
+    struct _TEST_OBJECT *proc_next;
+
+} TEST_OBJECT;
+
+
+class TestObjectIndex : public ComObjectIndex<TEST_OBJECT>
+{
+public:
+
+    int CountObjects()      { return m_ObjectsMap.nnodes; }
+    int CountProcesses()    { return m_ProcessMap.nnodes; }
+    int CountUnknowns()     { return m_UnknownMap.nnodes; }
+};
+
+
+#define NUM_PROCESSES   24
+#define NUM_UNKNOWNS    512
+#define NUM_IIDS        8
+
+static char Test_Unknowns[NUM_UNKNOWNS];
+
+static ULONG Test_ObjIdx = 0;
+
+
+//---------------------------------------------------------------------------
+// Test_Alloc
+//---------------------------------------------------------------------------
+
+
+static void *Test_Alloc(void *pool, size_t size)
+{
+    return malloc(size);
+}
+
+
+static void Test_Free(void *pool, void *ptr)
+{
+    free(ptr);
+}
+
+
+//---------------------------------------------------------------------------
+// Reference lookups, a scan of the objects list
+//---------------------------------------------------------------------------
+
+
+static TEST_OBJECT *Ref_Find(LIST *ObjectsList, ULONG idProcess, ULONG objidx)
+{
+    TEST_OBJECT *obj = (TEST_OBJECT *)List_Head(ObjectsList);
+    while (obj) {
+        if (obj->idProcess == idProcess && obj->objidx == objidx)
+            break;
+        obj = (TEST_OBJECT *)List_Next(obj);
+    }
+    return obj;
+}
+
+
+static TEST_OBJECT *Ref_FindUnknown(LIST *ObjectsList, ULONG idProcess, void *pUnknown)
+{
+    TEST_OBJECT *obj = (TEST_OBJECT *)List_Head(ObjectsList);
+    while (obj) {
+        if (obj->idProcess == idProcess && obj->pUnknown == pUnknown)
+            break;
+        obj = (TEST_OBJECT *)List_Next(obj);
+    }
+    return obj;
+}
+
+
+static TEST_OBJECT *Ref_FindDummy(LIST *ObjectsList, ULONG idProcess, ULONG iid)
+{
+    TEST_OBJECT *obj = (TEST_OBJECT *)List_Head(ObjectsList);
+    while (obj) {
+        if (obj->idProcess == idProcess && obj->objidx == -1 && obj->iid == iid)
+            break;
+        obj = (TEST_OBJECT *)List_Next(obj);
+    }
+    return obj;
+}
+
+
+static ULONG Ref_CountUnknown(LIST *ObjectsList, void *pUnknown)
+{
+    ULONG count = 0;
+    TEST_OBJECT *obj = (TEST_OBJECT *)List_Head(ObjectsList);
+    while (obj) {
+        if (obj->pUnknown == pUnknown)
+            ++count;
+        obj = (TEST_OBJECT *)List_Next(obj);
+    }
+    return count;
+}
+
+
+//---------------------------------------------------------------------------
+// Index lookups, as done by the slave
+//---------------------------------------------------------------------------
+
+
+static TEST_OBJECT *Idx_FindUnknown(TestObjectIndex *idx, ULONG idProcess, void *pUnknown)
+{
+    // RefOrAllocSlaveObject
+
+    TEST_OBJECT *obj = NULL;
+    if (idx->GetUnknownCount(pUnknown))
+        obj = idx->GetProcessObjects(idProcess);
+    while (obj) {
+        if (obj->pUnknown == pUnknown)
+            break;
+        obj = obj->proc_next;
+    }
+    return obj;
+}
+
+
+static TEST_OBJECT *Idx_FindDummy(TestObjectIndex *idx, ULONG idProcess, ULONG iid)
+{
+    // FindOrCreateDummySlaveObject
+
+    TEST_OBJECT *obj = idx->GetProcessObjects(idProcess);
+    while (obj) {
+        if (obj->objidx == -1 && obj->iid == iid)
+            break;
+        obj = obj->proc_next;
+    }
+    return obj;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_NewObject
+//---------------------------------------------------------------------------
+
+
+static TEST_OBJECT *Test_NewObject(
+    TestObjectIndex *idx, LIST *ObjectsList,
+    ULONG idProcess, void *pUnknown, ULONG objidx, ULONG iid)
+{
+    TEST_OBJECT *obj = (TEST_OBJECT *)calloc(1, sizeof(TEST_OBJECT));
+    obj->idProcess = idProcess;
+    obj->pUnknown = pUnknown;
+    obj->objidx = objidx;
+    obj->iid = iid;
+    idx->Insert(obj, ObjectsList);
+    return obj;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_DeleteObject
+//---------------------------------------------------------------------------
+
+
+static void Test_DeleteObject(TestObjectIndex *idx, LIST *ObjectsList, TEST_OBJECT *obj)
+{
+    // DeleteSlaveObject only releases pUnknown if no other object shares it
+
+    TEST_CHECK(idx->GetUnknownCount(obj->pUnknown) == Ref_CountUnknown(ObjectsList, obj->pUnknown));
+
+    idx->Remove(obj, ObjectsList);
+    free(obj);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_ProcessExit
+//---------------------------------------------------------------------------
+
+
+static void Test_ProcessExit(TestObjectIndex *idx, LIST *ObjectsList, ULONG idProcess)
+{
+    //
+    // ProcessNotifySlave deletes the objects of the process in the
+    // order of the objects list, check the chain has the same order
+    //
+
+    TEST_OBJECT *ref = (TEST_OBJECT *)List_Head(ObjectsList);
+    TEST_OBJECT *obj = idx->GetProcessObjects(idProcess);
+
+    while (1) {
+        while (ref && ref->idProcess != idProcess)
+            ref = (TEST_OBJECT *)List_Next(ref);
+        TEST_CHECK(ref == obj);
+        if (! ref || ! obj)
+            break;
+        ref = (TEST_OBJECT *)List_Next(ref);
+        obj = obj->proc_next;
+    }
+
+    obj = idx->GetProcessObjects(idProcess);
+    while (obj) {
+        TEST_OBJECT *next_obj = obj->proc_next;
+        Test_DeleteObject(idx, ObjectsList, obj);
+        obj = next_obj;
+    }
+
+    TEST_CHECK(idx->GetProcessObjects(idProcess) == NULL);
+
+    ref = (TEST_OBJECT *)List_Head(ObjectsList);
+    while (ref && ref->idProcess != idProcess)
+        ref = (TEST_OBJECT *)List_Next(ref);
+    TEST_CHECK(ref == NULL);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Churn
+//---------------------------------------------------------------------------
+
+
+static void Test_Churn(ULONG Steps, ULONG MaxObjects)
+{
+    TestObjectIndex idx;
+    LIST ObjectsList;
+    TEST_OBJECT *obj, *ref;
+    ULONG step, op, idProcess, objidx, iid, n;
+    void *pUnknown;
+
+    idx.Init(NULL, Test_Alloc, Test_Free);
+    List_Init(&ObjectsList);
+
+    for (step = 0; step < Steps; ++step) {
+
+        op = Test_Rand(100);
+        idProcess = 1000 + Test_Rand(NUM_PROCESSES) * 4;
+
+        if (op < 40 && (ULONG)List_Count(&ObjectsList) < MaxObjects) {
+
+            //
+            // RefOrAllocSlaveObject, interface pointers are shared
+            // between objects of different processes
+            //
+
+            pUnknown = &Test_Unknowns[Test_Rand(NUM_UNKNOWNS)];
+
+            obj = Idx_FindUnknown(&idx, idProcess, pUnknown);
+            ref = Ref_FindUnknown(&ObjectsList, idProcess, pUnknown);
+            TEST_CHECK(obj == ref);
+
+            if (! obj) {
+                do {
+                    ++Test_ObjIdx;
+                } while (Test_ObjIdx == 0 || Test_ObjIdx == -1);
+                Test_NewObject(&idx, &ObjectsList, idProcess, pUnknown, Test_ObjIdx, 0);
+            }
+
+        } else if (op < 45 && (ULONG)List_Count(&ObjectsList) < MaxObjects) {
+
+            //
+            // FindOrCreateDummySlaveObject, all dummies use index -1
+            //
+
+            iid = Test_Rand(NUM_IIDS);
+
+            obj = Idx_FindDummy(&idx, idProcess, iid);
+            ref = Ref_FindDummy(&ObjectsList, idProcess, iid);
+            TEST_CHECK(obj == ref);
+
+            if (! obj) {
+                pUnknown = &Test_Unknowns[Test_Rand(NUM_UNKNOWNS)];
+                Test_NewObject(&idx, &ObjectsList, idProcess, pUnknown, -1, iid);
+            }
+
+        } else if (op < 80) {
+
+            //
+            // FindSlaveObject, for a live, a stale or a dummy index
+            // and sometimes from the wrong process
+            //
+
+            n = Test_Rand(4);
+            if (n == 0)
+                objidx = -1;
+            else if (n == 1 || Test_ObjIdx == 0)
+                objidx = Test_ObjIdx + 1 + Test_Rand(100);
+            else
+                objidx = Test_ObjIdx - Test_Rand(Test_ObjIdx < 2000 ? Test_ObjIdx : 2000);
+
+            if (objidx != -1 && Test_Rand(2)) {
+                ref = (TEST_OBJECT *)idx.Find(0, objidx);
+                TEST_CHECK(ref == NULL);
+                obj = (TEST_OBJECT *)List_Head(&ObjectsList);
+                while (obj && obj->objidx != objidx)
+                    obj = (TEST_OBJECT *)List_Next(obj);
+                if (obj)
+                    idProcess = obj->idProcess;
+            }
+
+            obj = idx.Find(idProcess, objidx);
+            ref = Ref_Find(&ObjectsList, idProcess, objidx);
+            TEST_CHECK(obj == ref);
+
+        } else if (op < 97) {
+
+            //
+            // AddRefReleaseSlave or DeleteSlaveObject of one object
+            //
+
+            n = List_Count(&ObjectsList);
+            if (n) {
+                n = Test_Rand(n);
+                if (Test_Rand(2)) {
+                    obj = (TEST_OBJECT *)List_Head(&ObjectsList);
+                    while (n-- && obj)
+                        obj = (TEST_OBJECT *)List_Next(obj);
+                } else {
+                    obj = (TEST_OBJECT *)List_Tail(&ObjectsList);
+                    while (n-- && obj)
+                        obj = (TEST_OBJECT *)List_Prev(obj);
+                }
+                if (obj)
+                    Test_DeleteObject(&idx, &ObjectsList, obj);
+            }
+
+        } else {
+
+            //
+            // ProcessNotifySlave when a process ends
+            //
+
+            Test_ProcessExit(&idx, &ObjectsList, idProcess);
+        }
+
+        if (step % 1024 == 0) {
+
+            n = 0;
+            obj = (TEST_OBJECT *)List_Head(&ObjectsList);
+            while (obj) {
+                if (obj->objidx != -1)
+                    ++n;
+                obj = (TEST_OBJECT *)List_Next(obj);
+            }
+            TEST_CHECK(idx.CountObjects() == (int)n);
+
+            for (n = 0; n < NUM_UNKNOWNS; n += 7) {
+                pUnknown = &Test_Unknowns[n];
+                TEST_CHECK(idx.GetUnknownCount(pUnknown) == Ref_CountUnknown(&ObjectsList, pUnknown));
+            }
+        }
+    }
+
+    for (idProcess = 1000; idProcess < 1000 + NUM_PROCESSES * 4; idProcess += 4)
+        Test_ProcessExit(&idx, &ObjectsList, idProcess);
+
+    TEST_CHECK(List_Count(&ObjectsList) == 0);
+    TEST_CHECK(idx.CountObjects() == 0);
+    TEST_CHECK(idx.CountProcesses() == 0);
+    TEST_CHECK(idx.CountUnknowns() == 0);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    //
+    // cost of the lookups of one proxied call, FindSlaveObject and
+    // RefOrAllocSlaveObject, against the number of hosted objects
+    //
+
+    ULONG Counts[] = { 100, 1000, 10000, 50000 };
+    ULONG c, i, n, Lookups;
+    TestObjectIndex idx;
+    LIST ObjectsList;
+    TEST_OBJECT **Objects, *obj;
+    double t0, t_scan, t_index;
+    ULONG_PTR sum;
+
+    printf("objects   scan us/call   index us/call\n");
+
+    for (c = 0; c < sizeof(Counts) / sizeof(Counts[0]); ++c) {
+
+        idx.Init(NULL, Test_Alloc, Test_Free);
+        List_Init(&ObjectsList);
+
+        n = Counts[c];
+        Objects = (TEST_OBJECT **)malloc(n * sizeof(TEST_OBJECT *));
+        for (i = 0; i < n; ++i) {
+            Objects[i] = Test_NewObject(&idx, &ObjectsList, 1000 + Test_Rand(NUM_PROCESSES) * 4,
+                &Test_Unknowns[Test_Rand(NUM_UNKNOWNS)], i + 1, 0);
+        }
+
+        Lookups = 20000000 / n;
+        if (Lookups < 1000)
+            Lookups = 1000;
+        sum = 0;
+
+        t0 = Test_Time();
+        for (i = 0; i < Lookups; ++i) {
+            obj = Objects[Test_Rand(n)];
+            sum += (ULONG_PTR)Ref_Find(&ObjectsList, obj->idProcess, obj->objidx);
+            sum += (ULONG_PTR)Ref_FindUnknown(&ObjectsList, obj->idProcess, obj->pUnknown);
+        }
+        t_scan = Test_Time() - t0;
+
+        t0 = Test_Time();
+        for (i = 0; i < Lookups; ++i) {
+            obj = Objects[Test_Rand(n)];
+            sum += (ULONG_PTR)idx.Find(obj->idProcess, obj->objidx);
+            sum += (ULONG_PTR)Idx_FindUnknown(&idx, obj->idProcess, obj->pUnknown);
+        }
+        t_index = Test_Time() - t0;
+
+        printf("%7u   %12.3f   %13.3f%s\n", n,
+            t_scan * 1000.0 / Lookups, t_index * 1000.0 / Lookups, sum ? "" : " ");
+
+        for (i = 0; i < n; ++i) {
+            idx.Remove(Objects[i], &ObjectsList);
+            free(Objects[i]);
+        }
+        free(Objects);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    Test_Churn(200000, 64);
+    Test_Churn(200000, 4000);
+    Test_Churn(50000, 100000);
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        Test_Benchmark();
+
+    return TEST_RESULT();
+}
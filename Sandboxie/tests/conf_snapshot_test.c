@@ -0,0 +1,372 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Config Snapshot Test
+//---------------------------------------------------------------------------
+
+
+//
+// round trip of the setting values buffer from Conf_Get_Values in the
+// driver to Config_FetchSnapshotEntry in SbieDll, both through the helpers
+// of core/drv/conf_values.h, and a benchmark of the config lookups of a
+// process start with and without the snapshot
+//
+// gcc -DWITHOUT_POOL -I.. -o conf_snapshot_test conf_snapshot_test.c
+// cl /DWITHOUT_POOL /I.. conf_snapshot_test.c
+//
+
+
+#include "test_stubs.h"
+#include "common/map.c"
+#include "core/drv/conf_values.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define MAX_VALUES      200
+#define MAX_VALUE_LEN   120
+
+
+typedef struct _TEST_ENTRY {
+
+    ULONG count;
+    WCHAR **values;
+
+} TEST_ENTRY;
+
+
+typedef struct _TEST_NODE {
+
+    struct _TEST_NODE *next;
+    const WCHAR *value;
+
+} TEST_NODE;
+
+
+//---------------------------------------------------------------------------
+// Test_FetchEntry
+//---------------------------------------------------------------------------
+
+
+static TEST_ENTRY *Test_FetchEntry(const WCHAR **values, ULONG count)
+{
+    //
+    // pack like Conf_Get_Values and unpack like Config_FetchSnapshotEntry,
+    // through the same helpers of conf_values.h
+    //
+
+    UCHAR *buf;
+    ULONG buf_len, size;
+    TEST_ENTRY *entry;
+
+    buf_len = ConfValues_Pack(NULL, values, count);
+    buf = malloc(buf_len);
+    TEST_CHECK(ConfValues_Pack(buf, values, count) == buf_len);
+
+    entry = NULL;
+    if (ConfValues_UnpackSize(buf, buf_len, &count, &size))
+        entry = malloc(sizeof(TEST_ENTRY) + size);
+    if (entry) {
+
+        entry->count = count;
+        entry->values = (WCHAR **)(entry + 1);
+
+        if (! ConfValues_UnpackCopy(entry->values, buf, buf_len)) {
+            free(entry);
+            entry = NULL;
+        }
+    }
+
+    free(buf);
+    return entry;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_RandomValues
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_RandomValues(WCHAR **values, ULONG max_count)
+{
+    ULONG count, i, j, len;
+
+    count = Test_Rand(max_count + 1);
+    for (i = 0; i < count; ++i) {
+        len = Test_Rand(8) ? Test_Rand(MAX_VALUE_LEN) : 0;
+        for (j = 0; j < len; ++j)
+            values[i][j] = (WCHAR)(1 + Test_Rand(0xD7FF));
+        values[i][len] = L'\0';
+    }
+    return count;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_RoundTrip
+//---------------------------------------------------------------------------
+
+
+static void Test_RoundTrip(void)
+{
+    static WCHAR storage[MAX_VALUES][MAX_VALUE_LEN + 1];
+    WCHAR *values[MAX_VALUES];
+    TEST_ENTRY *entry;
+    ULONG round, count, i;
+
+    for (i = 0; i < MAX_VALUES; ++i)
+        values[i] = storage[i];
+
+    for (round = 0; round < 20000; ++round) {
+
+        count = Test_RandomValues(values, (round & 1) ? 4 : MAX_VALUES);
+
+        entry = Test_FetchEntry((const WCHAR **)values, count);
+        TEST_CHECK(entry != NULL);
+        if (! entry)
+            continue;
+
+        TEST_CHECK(entry->count == count);
+        for (i = 0; i < count && i < entry->count; ++i)
+            TEST_CHECK(wcscmp(entry->values[i], values[i]) == 0);
+
+        free(entry);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Truncated
+//---------------------------------------------------------------------------
+
+
+static void Test_Truncated(void)
+{
+    //
+    // a buffer which ends within a value or has fewer values than it
+    // claims must be rejected rather than read past its end
+    //
+
+    const WCHAR *values[3] = { L"alpha", L"", L"gamma" };
+    WCHAR *out[4];
+    UCHAR buf[64];
+    ULONG buf_len, data_len;
+    WCHAR *data;
+
+    buf_len = ConfValues_Pack(buf, values, 3);
+    data = (WCHAR *)(buf + sizeof(ULONG));
+    data_len = buf_len - sizeof(ULONG);
+
+    TEST_CHECK(ConfValues_Unpack(out, 3, data, data_len));
+    TEST_CHECK(! ConfValues_Unpack(out, 4, data, data_len));
+    TEST_CHECK(! ConfValues_Unpack(out, 3, data, data_len - sizeof(WCHAR)));
+    TEST_CHECK(! ConfValues_Unpack(out, 1, data, 3 * sizeof(WCHAR)));
+    TEST_CHECK(ConfValues_Unpack(out, 0, data, 0));
+
+    //
+    // and the whole buffer, a count which does not fit is rejected
+    // before anything is allocated
+    //
+
+    {
+        ULONG count, size;
+        WCHAR *block[3 + 32];
+
+        TEST_CHECK(ConfValues_UnpackSize(buf, buf_len, &count, &size));
+        TEST_CHECK(count == 3 && size == 3 * sizeof(WCHAR *) + data_len);
+        TEST_CHECK(size <= sizeof(block));
+        TEST_CHECK(ConfValues_UnpackCopy(block, buf, buf_len));
+        TEST_CHECK(wcscmp(block[2], L"gamma") == 0);
+
+        TEST_CHECK(! ConfValues_UnpackSize(buf, sizeof(ULONG) - 1, &count, &size));
+        *(ULONG *)buf = 1000;
+        TEST_CHECK(! ConfValues_UnpackSize(buf, buf_len, &count, &size));
+        *(ULONG *)buf = 4;
+        TEST_CHECK(ConfValues_UnpackSize(buf, buf_len, &count, &size));
+        TEST_CHECK(! ConfValues_UnpackCopy(block, buf, buf_len));
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Snapshot
+//---------------------------------------------------------------------------
+
+
+static void Test_Snapshot(void)
+{
+    //
+    // entries are found by the same case insensitive key which
+    // Config_QuerySnapshot builds from flags, section and setting
+    //
+
+    const WCHAR *values[2] = { L"C:\\Windows\\*", L"%AppData%\\Test" };
+    HASH_MAP map;
+    TEST_ENTRY *entry;
+    WCHAR key[8 + 64 + 1 + 64 + 1];
+
+    map_init(&map, NULL);
+    map.func_key_size = map_wcssize;
+
+    entry = Test_FetchEntry(values, 2);
+    swprintf(key, 140, L"%08X%ls\\%ls", 0x20000000, L"DefaultBox", L"OpenFilePath");
+    _wcslwr(key);
+    TEST_CHECK(map_insert(&map, key, entry, 0) != NULL);
+
+    swprintf(key, 140, L"%08X%ls\\%ls", 0x20000000, L"DEFAULTBOX", L"openfilepath");
+    _wcslwr(key);
+    entry = map_get(&map, key);
+    TEST_CHECK(entry && entry->count == 2 && wcscmp(entry->values[1], values[1]) == 0);
+
+    swprintf(key, 140, L"%08X%ls\\%ls", 0, L"DefaultBox", L"OpenFilePath");
+    _wcslwr(key);
+    TEST_CHECK(map_get(&map, key) == NULL);
+
+    free(entry);
+    map_clear(&map);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    //
+    // a process start queries every value of a few dozen list settings
+    // by index.  without the snapshot each index is a driver request,
+    // which in Conf_Get walks the setting list from its first value.  with
+    // the snapshot each setting is one request and the lookups are
+    // answered from the hash map.  the driver transition itself is not
+    // part of the numbers, only the request count shows it
+    //
+
+    static WCHAR storage[MAX_VALUES][MAX_VALUE_LEN + 1];
+    WCHAR *values[MAX_VALUES];
+    WCHAR out[MAX_VALUE_LEN + 1];
+    WCHAR key[8 + 64 + 1 + 64 + 1];
+    ULONG settings[] = { 8, 32, 64 };
+    ULONG per_setting[] = { 4, 32, 128 };
+    ULONG s, v, n, i, k, run, requests_old, requests_new;
+    TEST_NODE *nodes, *node;
+    HASH_MAP map;
+    TEST_ENTRY *entry;
+    ULONG walk;
+    double t0, t_old, t_new;
+
+    for (i = 0; i < MAX_VALUES; ++i) {
+        values[i] = storage[i];
+        swprintf(values[i], MAX_VALUE_LEN, L"%%Personal%%\\Some Folder\\Path%u\\*.dat", i);
+    }
+
+    printf("settings  values  requests old/new   old ms   new ms\n");
+
+    for (s = 0; s < 3; ++s) {
+        for (v = 0; v < 3; ++v) {
+
+            n = per_setting[v];
+            requests_old = requests_new = 0;
+
+            nodes = NULL;
+            for (i = n; i-- > 0; ) {
+                node = malloc(sizeof(TEST_NODE));
+                node->value = values[i];
+                node->next = nodes;
+                nodes = node;
+            }
+
+            t0 = Test_Time();
+            for (run = 0; run < 100; ++run) {
+                for (k = 0; k < settings[s]; ++k) {
+                    for (i = 0; i <= n; ++i) {
+                        TEST_NODE *node = nodes;
+                        ++requests_old;
+                        for (walk = 0; node && walk < i; ++walk)
+                            node = node->next;
+                        if (node)
+                            wcscpy(out, node->value);
+                    }
+                }
+            }
+            t_old = Test_Time() - t0;
+
+            t0 = Test_Time();
+            for (run = 0; run < 100; ++run) {
+
+                map_init(&map, NULL);
+                map.func_key_size = map_wcssize;
+
+                for (k = 0; k < settings[s]; ++k) {
+
+                    swprintf(key, 140, L"%08X%ls\\Setting%u", 0x20000000, L"defaultbox", k);
+
+                    for (i = 0; i <= n; ++i) {
+                        entry = map_get(&map, key);
+                        if (! entry) {
+                            ++requests_new;
+                            entry = Test_FetchEntry((const WCHAR **)values, n);
+                            map_insert(&map, key, entry, 0);
+                        }
+                        if (i < entry->count)
+                            wcscpy(out, entry->values[i]);
+                    }
+                }
+
+                {
+                    map_iter_t iter = map_iter();
+                    while (map_next(&map, &iter))
+                        free(iter.value);
+                    map_clear(&map);
+                }
+            }
+            t_new = Test_Time() - t0;
+
+            while (nodes) {
+                node = nodes->next;
+                free(nodes);
+                nodes = node;
+            }
+
+            printf("%8u  %6u  %8u/%-8u %8.2f %8.2f\n", settings[s], n,
+                requests_old / 100, requests_new / 100, t_old / 100, t_new / 100);
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    Test_RoundTrip();
+    Test_Truncated();
+    Test_Snapshot();
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        Test_Benchmark();
+
+    return TEST_RESULT();
+}
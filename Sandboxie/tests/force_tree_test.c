@@ -0,0 +1,474 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Force Folder Tree Differential Test
+//---------------------------------------------------------------------------
+
+
+//
+// finds the first box forcing a path through the folder tree of
+// core/drv/process_force_tree.c, and through the per box folder scan of
+// Process_CheckForceFolderList, and checks that they always agree.  random
+// folder sets mix upper and lower case, nested and duplicate folders and
+// folders which are a prefix of a longer name.  the benchmark gives the
+// decision time per spawn against the box count, with the folders copied
+// for every spawn as Process_CreateForcePaths did, with the cached folders
+// scanned per box, and with the cached tree.  the copy does not include
+// the expansion and reparse point translation, so its time is a lower bound
+//
+// gcc -I.. -o force_tree_test force_tree_test.c
+// cl /I.. force_tree_test.c
+//
+
+
+#include "test_stubs.h"
+
+#include <wctype.h>
+
+#define Driver_Pool                     NULL
+#define Mem_Alloc(pool,size)            malloc(size)
+#define Mem_Free(ptr,size)              free(ptr)
+#define RtlUpcaseUnicodeChar(c)         ((WCHAR)towupper(c))
+
+#include "core/drv/process_force_tree.c"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define MAX_PATH_LEN    512
+#define MAX_FOLDERS     8
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _TEST_FOLDER {
+
+    ULONG len;
+    WCHAR *buf;
+
+} TEST_FOLDER;
+
+
+typedef struct _TEST_BOX {
+
+    ULONG count;
+    TEST_FOLDER folders[MAX_FOLDERS];
+
+} TEST_BOX;
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static const WCHAR *Test_Words[] = {
+    L"Device", L"HarddiskVolume3", L"Users", L"user", L"Downloads",
+    L"Program Files", L"Program Files (x86)", L"Vendor", L"Vend", L"App",
+    L"Apps", L"tools", L"Tools", L"bin", L"temp", L"AppData", L"Local",
+};
+
+#define NUM_WORDS (sizeof(Test_Words) / sizeof(Test_Words[0]))
+
+
+//---------------------------------------------------------------------------
+// Test_MakePath
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_MakePath(WCHAR *path, ULONG depth)
+{
+    ULONG len = 0;
+    ULONG i, j;
+
+    for (i = 0; i < depth; ++i) {
+
+        const WCHAR *word = Test_Words[Test_Rand(NUM_WORDS)];
+        path[len++] = L'\\';
+
+        for (j = 0; word[j]; ++j) {
+            WCHAR c = word[j];
+            if (Test_Rand(4) == 0)
+                c = Test_Rand(2) ? towupper(c) : towlower(c);
+            path[len++] = c;
+        }
+    }
+
+    path[len] = L'\0';
+    return len;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_MakeBoxes
+//---------------------------------------------------------------------------
+
+
+static TEST_BOX *Test_MakeBoxes(ULONG NumBoxes, ULONG MaxFolders)
+{
+    TEST_BOX *boxes = calloc(NumBoxes, sizeof(TEST_BOX));
+    WCHAR path[MAX_PATH_LEN];
+    ULONG i, j;
+
+    for (i = 0; i < NumBoxes; ++i) {
+
+        boxes[i].count = Test_Rand(MaxFolders + 1);
+
+        for (j = 0; j < boxes[i].count; ++j) {
+
+            TEST_FOLDER *folder = &boxes[i].folders[j];
+            ULONG len = Test_MakePath(path, 1 + Test_Rand(5));
+
+            //
+            // some folders end in the middle of a name, and some keep a
+            // trailing backslash, which Process_AddForceFolders drops
+            // from the length but not from the buffer
+            //
+
+            if (Test_Rand(8) == 0 && len > 2)
+                len -= 1 + Test_Rand(2);
+            if (Test_Rand(8) == 0)
+                path[len++] = L'\\';
+            path[len] = L'\0';
+
+            folder->buf = malloc((len + 1) * sizeof(WCHAR));
+            wmemcpy(folder->buf, path, len + 1);
+            while (len && folder->buf[len - 1] == L'\\')
+                --len;
+            folder->len = len;
+        }
+    }
+
+    return boxes;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_FreeBoxes
+//---------------------------------------------------------------------------
+
+
+static void Test_FreeBoxes(TEST_BOX *boxes, ULONG NumBoxes)
+{
+    ULONG i, j;
+
+    for (i = 0; i < NumBoxes; ++i) {
+        for (j = 0; j < boxes[i].count; ++j)
+            free(boxes[i].folders[j].buf);
+    }
+
+    free(boxes);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_MakeTree
+//---------------------------------------------------------------------------
+
+
+static void Test_MakeTree(FORCE_TREE *tree, TEST_BOX *boxes, ULONG NumBoxes)
+{
+    ULONG i, j;
+
+    Process_ForceTreeInit(tree);
+
+    for (i = 0; i < NumBoxes; ++i) {
+        for (j = 0; j < boxes[i].count; ++j) {
+            Process_ForceTreeInsert(tree,
+                boxes[i].folders[j].buf, boxes[i].folders[j].len, i);
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_NlsStrCmp
+//---------------------------------------------------------------------------
+
+
+static int Test_NlsStrCmp(const WCHAR *s1, const WCHAR *s2, ULONG len)
+{
+    //
+    // like RtlCompareUnicodeString with CaseInSensitive, as used by
+    // Box_NlsStrCmp
+    //
+
+    ULONG i;
+
+    for (i = 0; i < len; ++i) {
+        WCHAR c1 = towupper(s1[i]);
+        WCHAR c2 = towupper(s2[i]);
+        if (c1 != c2)
+            return (int)c1 - (int)c2;
+    }
+
+    return 0;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_ScanBoxes
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_ScanBoxes(
+    TEST_BOX *boxes, ULONG NumBoxes, const WCHAR *path, ULONG prefix_len)
+{
+    //
+    // the folder without wildcards part of Process_CheckForceFolderList,
+    // for every box in order
+    //
+
+    ULONG i, j;
+
+    for (i = 0; i < NumBoxes; ++i) {
+
+        for (j = 0; j < boxes[i].count; ++j) {
+
+            TEST_FOLDER *folder = &boxes[i].folders[j];
+            ULONG folder_len = folder->len;
+            if (folder_len && prefix_len >= folder_len &&
+                    path[folder_len] == L'\\' &&
+                    Test_NlsStrCmp(path, folder->buf, folder_len) == 0) {
+
+                return i;
+            }
+        }
+    }
+
+    return FORCE_TREE_NONE;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_PrefixLen
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_PrefixLen(const WCHAR *path)
+{
+    //
+    // as Process_CheckForceFolder
+    //
+
+    const WCHAR *ptr = wcsrchr(path, L'\\');
+    if (ptr && ptr[1])
+        return (ULONG)(ptr - path);
+    return 0;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Compare
+//---------------------------------------------------------------------------
+
+
+static void Test_Compare(void)
+{
+    WCHAR path[MAX_PATH_LEN];
+    ULONG Round;
+
+    for (Round = 0; Round < 200; ++Round) {
+
+        ULONG NumBoxes = 1 + Test_Rand(Round < 100 ? 4 : 60);
+        TEST_BOX *boxes = Test_MakeBoxes(NumBoxes, 1 + Test_Rand(MAX_FOLDERS));
+        FORCE_TREE tree;
+        ULONG i;
+
+        Test_MakeTree(&tree, boxes, NumBoxes);
+
+        for (i = 0; i < 2000; ++i) {
+
+            ULONG prefix_len, expected;
+
+            //
+            // half of the paths start with a folder of a random box, so
+            // there are enough matches
+            //
+
+            ULONG len = 0;
+            ULONG b = Test_Rand(NumBoxes);
+            if (Test_Rand(2) && boxes[b].count) {
+                TEST_FOLDER *folder = &boxes[b].folders[Test_Rand(boxes[b].count)];
+                len = folder->len;
+                wmemcpy(path, folder->buf, len);
+                for (ULONG k = 0; k < len; ++k) {
+                    if (Test_Rand(4) == 0)
+                        path[k] = Test_Rand(2) ? towupper(path[k]) : towlower(path[k]);
+                }
+            }
+            Test_MakePath(path + len, Test_Rand(4));
+
+            prefix_len = Test_PrefixLen(path);
+            if (! prefix_len)
+                continue;
+
+            expected = Test_ScanBoxes(boxes, NumBoxes, path, prefix_len);
+            TEST_CHECK(Process_ForceTreeMatch(&tree, path, prefix_len) == expected);
+        }
+
+        Process_ForceTreeFree(&tree);
+        TEST_CHECK(tree.root == NULL);
+
+        Test_FreeBoxes(boxes, NumBoxes);
+    }
+
+    //
+    // fixed cases, a folder matches only at a backslash, and never the
+    // last path component
+    //
+
+    {
+        FORCE_TREE tree;
+        WCHAR fixed[MAX_PATH_LEN];
+
+        Process_ForceTreeInit(&tree);
+        Process_ForceTreeInsert(&tree, L"\\Device\\Vol\\Apps", 16, 3);
+        Process_ForceTreeInsert(&tree, L"\\Device\\Vol\\App", 15, 1);
+        Process_ForceTreeInsert(&tree, L"\\device\\vol", 11, 2);
+        Process_ForceTreeInsert(&tree, L"\\Device\\Vol\\Apps", 16, 0);
+
+        wcscpy(fixed, L"\\DEVICE\\VOL\\APPS\\x.exe");
+        TEST_CHECK(Process_ForceTreeMatch(&tree, fixed, Test_PrefixLen(fixed)) == 0);
+        wcscpy(fixed, L"\\Device\\Vol\\App\\x.exe");
+        TEST_CHECK(Process_ForceTreeMatch(&tree, fixed, Test_PrefixLen(fixed)) == 1);
+        wcscpy(fixed, L"\\Device\\Vol\\Appx\\x.exe");
+        TEST_CHECK(Process_ForceTreeMatch(&tree, fixed, Test_PrefixLen(fixed)) == 2);
+        wcscpy(fixed, L"\\Device\\Vol\\Apps");
+        TEST_CHECK(Process_ForceTreeMatch(&tree, fixed, Test_PrefixLen(fixed)) == 2);
+        wcscpy(fixed, L"\\Device\\Volume\\x.exe");
+        TEST_CHECK(Process_ForceTreeMatch(&tree, fixed, Test_PrefixLen(fixed)) == FORCE_TREE_NONE);
+
+        Process_ForceTreeFree(&tree);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    const ULONG Spawns = 2000;
+    WCHAR (*paths)[MAX_PATH_LEN];
+    ULONG *prefix_lens;
+    ULONG NumBoxes;
+    volatile ULONG Sink = 0;
+
+    //
+    // every spawn checks the image path, the current directory and
+    // the document, see Process_GetForcedStartBox
+    //
+
+    paths = malloc(Spawns * 3 * sizeof(*paths));
+    prefix_lens = malloc(Spawns * 3 * sizeof(ULONG));
+
+    printf("\n%8s  %8s  %14s  %14s  %14s\n",
+        "boxes", "folders", "copy us/spawn", "scan us/spawn", "tree us/spawn");
+
+    for (NumBoxes = 1; NumBoxes <= 1000; NumBoxes *= 10) {
+
+        TEST_BOX *boxes = Test_MakeBoxes(NumBoxes, MAX_FOLDERS);
+        FORCE_TREE tree;
+        ULONG folders = 0;
+        double t0, Times[3];
+        ULONG i, j, k;
+
+        for (i = 0; i < NumBoxes; ++i)
+            folders += boxes[i].count;
+
+        Test_MakeTree(&tree, boxes, NumBoxes);
+
+        for (i = 0; i < Spawns * 3; ++i) {
+            Test_MakePath(paths[i], 2 + Test_Rand(5));
+            prefix_lens[i] = Test_PrefixLen(paths[i]);
+        }
+
+        for (int Mode = 0; Mode < 3; ++Mode) {
+
+            t0 = Test_Time();
+
+            for (i = 0; i < Spawns; ++i) {
+
+                TEST_BOX *copy = boxes;
+
+                if (Mode == 0) {
+
+                    copy = malloc(NumBoxes * sizeof(TEST_BOX));
+                    for (j = 0; j < NumBoxes; ++j) {
+                        copy[j].count = boxes[j].count;
+                        for (k = 0; k < boxes[j].count; ++k) {
+                            ULONG size = (ULONG)(wcslen(boxes[j].folders[k].buf) + 1) * sizeof(WCHAR);
+                            copy[j].folders[k].buf = malloc(size);
+                            memcpy(copy[j].folders[k].buf, boxes[j].folders[k].buf, size);
+                            copy[j].folders[k].len = boxes[j].folders[k].len;
+                        }
+                    }
+                }
+
+                for (j = i * 3; j < i * 3 + 3; ++j) {
+
+                    if (Mode == 2)
+                        Sink += Process_ForceTreeMatch(&tree, paths[j], prefix_lens[j]);
+                    else
+                        Sink += Test_ScanBoxes(copy, NumBoxes, paths[j], prefix_lens[j]);
+                }
+
+                if (Mode == 0)
+                    Test_FreeBoxes(copy, NumBoxes);
+            }
+
+            Times[Mode] = (Test_Time() - t0) * 1000.0 / Spawns;
+        }
+
+        printf("%8u  %8u  %14.2f  %14.2f  %14.2f\n",
+            NumBoxes, folders, Times[0], Times[1], Times[2]);
+
+        Process_ForceTreeFree(&tree);
+        Test_FreeBoxes(boxes, NumBoxes);
+    }
+
+    free(prefix_lens);
+    free(paths);
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    BOOLEAN Bench = (argc > 1 && strcmp(argv[1], "bench") == 0);
+
+    Test_Compare();
+
+    if (Bench)
+        Test_Benchmark();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,308 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Image File Batch I/O Test
+//---------------------------------------------------------------------------
+
+
+//
+// drives CImageFileIO of SandboxieTools/ImBox/ImageFileIO.cpp on a plain
+// file in the temp folder.  random batches of reads and writes go through
+// DiskIo, and large requests through DiskRead and DiskWrite, which split
+// them up, every result is checked against a copy of the image kept in
+// memory, also after the image is opened again.  reads beyond the end of a
+// new image must give zeros.  the benchmark compares random reads issued
+// one at a time with batches of several in flight
+//
+// the image is opened unbuffered with overlapped I/O, so this program
+// builds on Windows only
+//
+// cl /EHsc /I..\.. image_io_test.cpp ntdll.lib
+//
+// image_io_test [bench] [path to a folder for the image]
+//
+
+
+#include "SandboxieTools/ImBox/ImageFileIO.cpp"
+
+#include "test_stubs.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define TEST_BLOCK          4096            // sector aligned for the unbuffered image
+#define TEST_IMAGE_SIZE     (64 * 1024 * 1024)
+#define TEST_MAX_BATCH      40
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static std::wstring Test_Path;
+static std::vector<BYTE> Test_Model;    // what the image should hold
+static BYTE *Test_Buffer;               // aligned buffers of the requests
+static BYTE *Test_Buffer2;
+
+
+//---------------------------------------------------------------------------
+// DbgPrint
+//---------------------------------------------------------------------------
+
+
+void DbgPrint(const wchar_t* format, ...)
+{
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Fill
+//---------------------------------------------------------------------------
+
+
+static void Test_Fill(BYTE *buf, int size)
+{
+    for (int i = 0; i < size; i += sizeof(ULONG))
+        *(ULONG *)(buf + i) = Test_Rand(0xFFFFFFFF);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Batch
+//---------------------------------------------------------------------------
+
+
+static void Test_Batch(CImageFileIO *pIO)
+{
+    //
+    // up to TEST_MAX_BATCH requests at distinct blocks of the image, so
+    // their order does not matter, some of them reads and some writes
+    //
+
+    CAbstractIO::SIoRequest req[TEST_MAX_BATCH];
+    int n = 1 + Test_Rand(TEST_MAX_BATCH);
+    int Slots = TEST_IMAGE_SIZE / (16 * TEST_BLOCK);
+    std::set<int> Used;
+    int pos = 0;
+
+    for (int i = 0; i < n; i++) {
+
+        int Slot;
+        do Slot = Test_Rand(Slots); while (Used.count(Slot));
+        Used.insert(Slot);
+
+        req[i].size = (1 + Test_Rand(16)) * TEST_BLOCK;
+        req[i].offset = (__int64)Slot * 16 * TEST_BLOCK;
+        req[i].write = Test_Rand(2) != 0;
+        req[i].buf = Test_Buffer + pos;
+        req[i].ok = false;
+        pos += req[i].size;
+
+        if (req[i].write) {
+            Test_Fill((BYTE *)req[i].buf, req[i].size);
+            memcpy(Test_Model.data() + req[i].offset, req[i].buf, req[i].size);
+        } else
+            memset(req[i].buf, 0xCC, req[i].size);
+    }
+
+    TEST_CHECK(pIO->DiskIo(req, n));
+
+    for (int i = 0; i < n; i++) {
+        TEST_CHECK(req[i].ok);
+        if (!req[i].write)
+            TEST_CHECK(memcmp(req[i].buf, Test_Model.data() + req[i].offset, req[i].size) == 0);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Large
+//---------------------------------------------------------------------------
+
+
+static void Test_Large(CImageFileIO *pIO)
+{
+    //
+    // more than IMAGE_IO_MAX_PENDING chunks, so DiskIoSplit issues
+    // several batches
+    //
+
+    int size = (1 + Test_Rand(1280)) * TEST_BLOCK;
+    __int64 offset = (__int64)Test_Rand((TEST_IMAGE_SIZE - size) / TEST_BLOCK + 1) * TEST_BLOCK;
+
+    Test_Fill(Test_Buffer, size);
+    memcpy(Test_Model.data() + offset, Test_Buffer, size);
+    TEST_CHECK(pIO->DiskWrite(Test_Buffer, size, offset));
+
+    memset(Test_Buffer2, 0xCC, size);
+    TEST_CHECK(pIO->DiskRead(Test_Buffer2, size, offset));
+    TEST_CHECK(memcmp(Test_Buffer2, Test_Model.data() + offset, size) == 0);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Verify
+//---------------------------------------------------------------------------
+
+
+static void Test_Verify(CImageFileIO *pIO)
+{
+    const int size = 4 * 1024 * 1024;
+
+    for (__int64 offset = 0; offset < TEST_IMAGE_SIZE; offset += size) {
+        memset(Test_Buffer, 0xCC, size);
+        TEST_CHECK(pIO->DiskRead(Test_Buffer, size, offset));
+        TEST_CHECK(memcmp(Test_Buffer, Test_Model.data() + offset, size) == 0);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Compare
+//---------------------------------------------------------------------------
+
+
+static void Test_Compare(void)
+{
+    DeleteFile(Test_Path.c_str());
+    Test_Model.assign(TEST_IMAGE_SIZE, 0);
+
+    CImageFileIO *pIO = new CImageFileIO(Test_Path, TEST_IMAGE_SIZE);
+    TEST_CHECK(pIO->Init() == ERR_OK);
+    TEST_CHECK(pIO->CanBeFormated());
+
+    //
+    // a new image is empty, it grows with the writes and reads as zeros
+    // beyond its end
+    //
+
+    memset(Test_Buffer, 0xCC, 16 * TEST_BLOCK);
+    TEST_CHECK(pIO->DiskRead(Test_Buffer, 16 * TEST_BLOCK, TEST_IMAGE_SIZE - 16 * TEST_BLOCK));
+    TEST_CHECK(memcmp(Test_Buffer, Test_Model.data(), 16 * TEST_BLOCK) == 0);
+
+    for (int Round = 0; Round < 400; Round++) {
+        if (Round % 10 == 9)
+            Test_Large(pIO);
+        else
+            Test_Batch(pIO);
+    }
+
+    Test_Verify(pIO);
+    delete pIO;
+
+    //
+    // the same contents after the image is opened again
+    //
+
+    pIO = new CImageFileIO(Test_Path, 0);
+    TEST_CHECK(pIO->Init() == ERR_OK);
+    TEST_CHECK(!pIO->CanBeFormated());
+    Test_Verify(pIO);
+    delete pIO;
+
+    DeleteFile(Test_Path.c_str());
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    const int Count = 4096;
+
+    DeleteFile(Test_Path.c_str());
+
+    CImageFileIO *pIO = new CImageFileIO(Test_Path, TEST_IMAGE_SIZE);
+    TEST_CHECK(pIO->Init() == ERR_OK);
+
+    //
+    // fill the whole image first, so every read is served by the device
+    //
+
+    for (__int64 offset = 0; offset < TEST_IMAGE_SIZE; offset += 1024 * 1024) {
+        Test_Fill(Test_Buffer, 1024 * 1024);
+        pIO->DiskWrite(Test_Buffer, 1024 * 1024, offset);
+    }
+
+    LARGE_INTEGER Freq;
+    QueryPerformanceFrequency(&Freq);
+
+    printf("\n%8s  %8s  %10s  %10s\n", "size", "depth", "MB/s", "IOPS");
+
+    for (int size = TEST_BLOCK; size <= 64 * 1024; size *= 4) {
+        for (int Depth = 1; Depth <= 16; Depth *= 4) {
+
+            CAbstractIO::SIoRequest req[16];
+            LARGE_INTEGER Start, End;
+
+            QueryPerformanceCounter(&Start);
+            for (int i = 0; i < Count; i += Depth) {
+                for (int j = 0; j < Depth; j++) {
+                    req[j].buf = Test_Buffer + j * size;
+                    req[j].size = size;
+                    req[j].offset = (__int64)Test_Rand(TEST_IMAGE_SIZE / size) * size;
+                    req[j].write = false;
+                }
+                pIO->DiskIo(req, Depth);
+            }
+            QueryPerformanceCounter(&End);
+
+            double Seconds = (double)(End.QuadPart - Start.QuadPart) / Freq.QuadPart;
+            printf("%8d  %8d  %10.1f  %10.0f\n", size, Depth,
+                (double)Count * size / (1024 * 1024) / Seconds, Count / Seconds);
+        }
+    }
+
+    delete pIO;
+    DeleteFile(Test_Path.c_str());
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    bool Bench = (argc > 1 && strcmp(argv[1], "bench") == 0);
+
+    WCHAR Folder[MAX_PATH];
+    if (argc > 1 + Bench)
+        swprintf(Folder, MAX_PATH, L"%S\\", argv[1 + Bench]);
+    else
+        GetTempPath(MAX_PATH, Folder);
+    Test_Path = std::wstring(Folder) + L"image_io_test.img";
+
+    Test_Buffer = (BYTE *)VirtualAlloc(NULL, 8 * 1024 * 1024, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    Test_Buffer2 = (BYTE *)VirtualAlloc(NULL, 8 * 1024 * 1024, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    Test_Compare();
+
+    if (Bench)
+        Test_Benchmark();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,966 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Key Merge Cache Replay Test
+//---------------------------------------------------------------------------
+
+
+//
+// replays synthetic registry access traces through the key merge cache of
+// core/dll/key_merge_cache.c, the same steps Key_MergeCache takes, with a
+// simulated tick count, and checks every step against a reference model
+// of the cache policy: least recently used order, release after
+// KEY_MERGE_CACHE_TTL, the KEY_MERGE_CACHE_MAX_SIZE bound, and that the
+// merge being returned is never released
+//
+// also merges synthetic true and copy keys through core/dll/key_merge_index.c
+// and replays enumerations of the merges by index, with subkeys added and
+// removed in between.  the merges are checked against merges built by the
+// search from the head which the insertion did before it kept a hint, and
+// every lookup against the list walk which the enumeration did before the
+// index.  the benchmark plays back the recorded enumeration trace through
+// both, for keys of increasing size
+//
+// gcc -DWITHOUT_POOL -I.. -o key_cache_test key_cache_test.c
+// cl /DWITHOUT_POOL /I.. key_cache_test.c
+//
+
+
+#include "test_stubs.h"
+#include "common/list.c"
+#include "common/map.c"
+
+#define Dll_Alloc   malloc
+#define Dll_Free    free
+
+#include "core/dll/key_merge_cache.c"
+#include "core/dll/key_merge_index.c"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define MAX_PATH_LEN    160
+#define MAX_REF         100000
+#define MAX_TRACE       1000000
+
+#define TRACE_VALUE     0x80000000      // lookup of a value, else a subkey
+
+
+typedef struct _REF_ENTRY {
+
+    WCHAR path[MAX_PATH_LEN];   // lower case
+    ULONG size;
+    ULONG ticks;
+
+} REF_ENTRY;
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_Ticks = 0;            // the simulated GetTickCount
+static KEY_MERGE *Test_Keep = NULL;     // the merge being returned
+static ULONG Test_Live = 0;             // merges allocated and not freed
+
+static REF_ENTRY *Ref_Entries = NULL;   // most recently used first
+static ULONG Ref_Count = 0;
+static ULONG Ref_Size = 0;
+
+
+//---------------------------------------------------------------------------
+// Key_MergeFree
+//---------------------------------------------------------------------------
+
+
+static void Key_MergeFree(KEY_MERGE *merge, BOOLEAN FreeMergeItself)
+{
+    //
+    // as in key_merge.c, and the cache must never release the
+    // merge which Key_MergeCache is about to return
+    //
+
+    while (1) {
+        KEY_MERGE_SUBKEY *subkey = List_Head(&merge->subkeys);
+        if (! subkey)
+            break;
+        List_Remove(&merge->subkeys, subkey);
+        free(subkey);
+    }
+
+    while (1) {
+        KEY_MERGE_VALUE *value = List_Head(&merge->values);
+        if (! value)
+            break;
+        List_Remove(&merge->values, value);
+        free(value);
+    }
+
+    Key_MergeIndexReset(merge);
+
+    if (FreeMergeItself) {
+        TEST_CHECK(merge != Test_Keep);
+        free(merge);
+        --Test_Live;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Build
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_Build(KEY_MERGE *merge, ULONG Subkeys, ULONG Values, ULONG DataLen)
+{
+    //
+    // fill a merge like Key_MergeCacheSubkeys and Key_MergeCacheValues,
+    // returns the size the cache is expected to account for it
+    //
+
+    ULONG i, size = sizeof(KEY_MERGE) + merge->name_len;
+
+    for (i = 0; i < Subkeys; ++i) {
+        ULONG name_len = (4 + i % 13) * sizeof(WCHAR);
+        KEY_MERGE_SUBKEY *subkey = calloc(1, sizeof(KEY_MERGE_SUBKEY) + name_len + sizeof(WCHAR));
+        subkey->name_len = name_len;
+        List_Insert_After(&merge->subkeys, NULL, subkey);
+        size += sizeof(KEY_MERGE_SUBKEY) + name_len;
+    }
+
+    for (i = 0; i < Values; ++i) {
+        ULONG name_len = (3 + i % 7) * sizeof(WCHAR);
+        KEY_MERGE_VALUE *value = calloc(1, sizeof(KEY_MERGE_VALUE) + name_len + sizeof(WCHAR) + DataLen);
+        value->name_len = name_len;
+        value->data_len = DataLen;
+        List_Insert_After(&merge->values, NULL, value);
+        size += sizeof(KEY_MERGE_VALUE) + name_len + DataLen;
+    }
+
+    return size;
+}
+
+
+//---------------------------------------------------------------------------
+// Ref_Lookup
+//---------------------------------------------------------------------------
+
+
+static BOOLEAN Ref_Lookup(const WCHAR *Path, ULONG Size, BOOLEAN Rebuild)
+{
+    //
+    // the cache policy as described in Key_MergeCacheTrim, on a plain
+    // array, returns TRUE if the path was cached
+    //
+
+    WCHAR Lower[MAX_PATH_LEN];
+    ULONG i, found = -1;
+
+    wcscpy(Lower, Path);
+    _wcslwr(Lower);
+
+    for (i = 0; i < Ref_Count; ++i) {
+        if (wcscmp(Ref_Entries[i].path, Lower) == 0) {
+            found = i;
+            break;
+        }
+    }
+
+    if (found != -1) {
+        REF_ENTRY entry = Ref_Entries[found];
+        memmove(&Ref_Entries[1], &Ref_Entries[0], found * sizeof(REF_ENTRY));
+        Ref_Entries[0] = entry;
+        Ref_Entries[0].ticks = Test_Ticks;
+    }
+
+    while (Ref_Count > (found != -1 ? 1 : 0)) {
+        REF_ENTRY *tail = &Ref_Entries[Ref_Count - 1];
+        if (Ref_Size <= KEY_MERGE_CACHE_MAX_SIZE && Test_Ticks - tail->ticks <= KEY_MERGE_CACHE_TTL)
+            break;
+        Ref_Size -= tail->size;
+        --Ref_Count;
+    }
+
+    if (found != -1) {
+        if (Rebuild) {
+            Ref_Size -= Ref_Entries[0].size;
+            Ref_Entries[0].size = Size;
+            Ref_Size += Size;
+        }
+        return TRUE;
+    }
+
+    memmove(&Ref_Entries[1], &Ref_Entries[0], Ref_Count * sizeof(REF_ENTRY));
+    wcscpy(Ref_Entries[0].path, Lower);
+    Ref_Entries[0].size = Size;
+    Ref_Entries[0].ticks = Test_Ticks;
+    Ref_Size += Size;
+    ++Ref_Count;
+
+    return FALSE;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Lookup
+//---------------------------------------------------------------------------
+
+
+static KEY_MERGE *Test_Lookup(const WCHAR *Path,
+    ULONG Subkeys, ULONG Values, ULONG DataLen, BOOLEAN Rebuild, BOOLEAN *Hit)
+{
+    //
+    // the steps of Key_MergeCache, Rebuild stands for a true key which
+    // has changed since it was cached
+    //
+
+    ULONG Path_len = wcslen(Path) * sizeof(WCHAR);
+    KEY_MERGE *merge;
+    ULONG size;
+
+    merge = Key_MergeCacheFind(Path, Test_Ticks);
+
+    Test_Keep = merge;
+    Key_MergeCacheTrim(merge, Test_Ticks);
+    Test_Keep = NULL;
+
+    *Hit = (merge != NULL);
+
+    if (merge) {
+
+        if (! Rebuild)
+            return merge;
+
+        Key_MergeFree(merge, FALSE);
+        Key_MergeCacheAccount(merge);
+
+    } else {
+
+        merge = calloc(1, sizeof(KEY_MERGE) + Path_len + sizeof(WCHAR));
+        merge->ticks = Test_Ticks;
+        merge->name_len = Path_len;
+        memcpy(merge->name, Path, Path_len + sizeof(WCHAR));
+        ++Test_Live;
+
+        Key_MergeCacheInsert(merge);
+    }
+
+    size = Test_Build(merge, Subkeys, Values, DataLen);
+    Key_MergeCacheAccount(merge);
+    TEST_CHECK(merge->cache_size == size);
+
+    return merge;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_CheckState
+//---------------------------------------------------------------------------
+
+
+static void Test_CheckState(BOOLEAN Full)
+{
+    KEY_MERGE *merge;
+    ULONG i, size;
+
+    TEST_CHECK(Key_MergeCacheSize == Ref_Size);
+    TEST_CHECK((ULONG)List_Count(&Key_MergeCacheList) == Ref_Count);
+    TEST_CHECK((ULONG)Key_MergeCacheMap.nnodes == Ref_Count);
+    TEST_CHECK(Test_Live == Ref_Count);
+
+    if (! Full)
+        return;
+
+    size = 0;
+    merge = List_Head(&Key_MergeCacheList);
+    for (i = 0; merge && i < Ref_Count; ++i) {
+        TEST_CHECK(_wcsicmp(merge->name, Ref_Entries[i].path) == 0);
+        TEST_CHECK(merge->ticks == Ref_Entries[i].ticks);
+        TEST_CHECK(map_get(&Key_MergeCacheMap, Ref_Entries[i].path) == merge);
+        size += merge->cache_size;
+        merge = List_Next(merge);
+    }
+    TEST_CHECK(merge == NULL && size == Key_MergeCacheSize);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Reset
+//---------------------------------------------------------------------------
+
+
+static void Test_Reset(ULONG Ticks)
+{
+    while (List_Head(&Key_MergeCacheList))
+        Key_MergeCacheRemove(List_Head(&Key_MergeCacheList));
+
+    TEST_CHECK(Key_MergeCacheSize == 0 && Test_Live == 0);
+
+    Ref_Count = 0;
+    Ref_Size = 0;
+    Test_Ticks = Ticks;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Policy
+//---------------------------------------------------------------------------
+
+
+static void Test_Policy(void)
+{
+    KEY_MERGE *a, *b, *big;
+    BOOLEAN hit;
+
+    //
+    // a merge is released once it was not used for more than the ttl,
+    // a merge used exactly ttl ago stays
+    //
+
+    Test_Reset(1000);
+    a = Test_Lookup(L"\\REGISTRY\\MACHINE\\A", 2, 2, 8, FALSE, &hit);
+    Test_Ticks += 10 * 1000;
+    b = Test_Lookup(L"\\REGISTRY\\MACHINE\\B", 2, 2, 8, FALSE, &hit);
+    Test_Ticks += KEY_MERGE_CACHE_TTL - 10 * 1000;
+    Test_Lookup(L"\\REGISTRY\\MACHINE\\C", 0, 0, 0, FALSE, &hit);
+    TEST_CHECK(! hit && map_get(&Key_MergeCacheMap, L"\\registry\\machine\\a") == a);
+    Test_Ticks += 1;
+    Test_Lookup(L"\\REGISTRY\\MACHINE\\C", 0, 0, 0, FALSE, &hit);
+    TEST_CHECK(hit && ! map_get(&Key_MergeCacheMap, L"\\registry\\machine\\a"));
+    TEST_CHECK(map_get(&Key_MergeCacheMap, L"\\Registry\\Machine\\b") == b);
+
+    //
+    // a merge which is used stays, even after a long idle time, only
+    // the merges behind it in the list get released
+    //
+
+    Test_Ticks += 10 * KEY_MERGE_CACHE_TTL;
+    Test_Lookup(L"\\registry\\machine\\b", 0, 0, 0, FALSE, &hit);
+    TEST_CHECK(hit && List_Count(&Key_MergeCacheList) == 1);
+
+    //
+    // the tick count wraps around after 49.7 days
+    //
+
+    Test_Reset(0xFFFFFFFF - 5000);
+    a = Test_Lookup(L"\\registry\\user\\wrap", 1, 1, 4, FALSE, &hit);
+    Test_Ticks += 10 * 1000;
+    Test_Lookup(L"\\registry\\user\\other", 1, 1, 4, FALSE, &hit);
+    TEST_CHECK(map_get(&Key_MergeCacheMap, L"\\registry\\user\\wrap") == a);
+    Test_Ticks += KEY_MERGE_CACHE_TTL;
+    Test_Lookup(L"\\registry\\user\\other", 1, 1, 4, FALSE, &hit);
+    TEST_CHECK(hit && ! map_get(&Key_MergeCacheMap, L"\\registry\\user\\wrap"));
+
+    //
+    // above the size bound the least recently used merges go first,
+    // a merge which was looked up again is no longer the oldest
+    //
+
+    Test_Reset(5000);
+    a = Test_Lookup(L"\\registry\\machine\\m1", 0, 16, 64 * 1024, FALSE, &hit);
+    Test_Lookup(L"\\registry\\machine\\m2", 0, 16, 64 * 1024, FALSE, &hit);
+    Test_Lookup(L"\\registry\\machine\\m3", 0, 16, 64 * 1024, FALSE, &hit);
+    Test_Lookup(L"\\registry\\machine\\m4", 0, 16, 64 * 1024, FALSE, &hit);
+    TEST_CHECK(Key_MergeCacheSize > KEY_MERGE_CACHE_MAX_SIZE);
+    Test_Lookup(L"\\registry\\machine\\m1", 0, 0, 0, FALSE, &hit);
+    TEST_CHECK(hit && Key_MergeCacheSize <= KEY_MERGE_CACHE_MAX_SIZE);
+    TEST_CHECK(map_get(&Key_MergeCacheMap, L"\\registry\\machine\\m1") == a);
+    TEST_CHECK(! map_get(&Key_MergeCacheMap, L"\\registry\\machine\\m2"));
+    TEST_CHECK(map_get(&Key_MergeCacheMap, L"\\registry\\machine\\m3") != NULL);
+
+    //
+    // a merge which is larger than the bound on its own is released
+    // by the next lookup of another key, but never while it is in use
+    //
+
+    Test_Reset(5000);
+    Test_Lookup(L"\\registry\\machine\\small", 4, 4, 16, FALSE, &hit);
+    big = Test_Lookup(L"\\registry\\machine\\big", 0, 80, 64 * 1024, FALSE, &hit);
+    TEST_CHECK(Key_MergeCacheSize > KEY_MERGE_CACHE_MAX_SIZE);
+    Test_Lookup(L"\\REGISTRY\\MACHINE\\BIG", 0, 0, 0, FALSE, &hit);
+    TEST_CHECK(hit && List_Count(&Key_MergeCacheList) == 1 && List_Head(&Key_MergeCacheList) == big);
+    Test_Lookup(L"\\registry\\machine\\big", 0, 80, 64 * 1024, TRUE, &hit);
+    TEST_CHECK(hit && List_Head(&Key_MergeCacheList) == big);
+    Test_Lookup(L"\\registry\\machine\\small", 4, 4, 16, FALSE, &hit);
+    TEST_CHECK(! hit && List_Count(&Key_MergeCacheList) == 1);
+    TEST_CHECK(! map_get(&Key_MergeCacheMap, L"\\registry\\machine\\big"));
+
+    //
+    // a rebuilt merge is accounted with its new size
+    //
+
+    Test_Reset(5000);
+    a = Test_Lookup(L"\\registry\\machine\\grow", 1, 1, 16, FALSE, &hit);
+    Test_Lookup(L"\\registry\\machine\\grow", 10, 10, 1024, TRUE, &hit);
+    TEST_CHECK(hit && Key_MergeCacheSize == a->cache_size && a->cache_size > 10 * 1024);
+
+    Test_Reset(0);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_MakePath
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_MakePath(WCHAR *Path, ULONG Id)
+{
+    //
+    // a true key path, in a random mix of upper and lower case,
+    // the way different callers spell the same key
+    //
+
+    ULONG i, len;
+
+    len = (ULONG)swprintf(Path, MAX_PATH_LEN,
+        L"\\REGISTRY\\MACHINE\\SOFTWARE\\Vendor%u\\Product%u\\Settings%u",
+        Id % 97, (Id / 97) % 31, Id);
+
+    for (i = 0; i < len; ++i) {
+        if (Test_Rand(4) == 0)
+            Path[i] = towlower(Path[i]);
+    }
+
+    return len;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Replay
+//---------------------------------------------------------------------------
+
+
+static void Test_Replay(ULONG Keys, ULONG Large, ULONG Steps,
+    ULONG *Hits, ULONG *Builds, ULONG *Peak, BOOLEAN Check)
+{
+    //
+    // a trace with a few hot keys, a long tail of rarely used ones,
+    // short gaps between accesses and sometimes an idle time longer
+    // than the ttl.  every Large-th key has large values, and some keys
+    // change while cached
+    //
+
+    WCHAR Path[MAX_PATH_LEN];
+    ULONG step, id, subkeys, values, datalen;
+    BOOLEAN hit, rebuild;
+
+    Test_Reset(123456);
+    *Hits = *Builds = *Peak = 0;
+
+    for (step = 0; step < Steps; ++step) {
+
+        if (Test_Rand(1000) == 0)
+            Test_Ticks += KEY_MERGE_CACHE_TTL + Test_Rand(KEY_MERGE_CACHE_TTL);
+        else
+            Test_Ticks += Test_Rand(20);
+
+        id = Test_Rand(Keys);
+        id = id * id / Keys;            // skew towards low ids
+        Test_MakePath(Path, id);
+
+        subkeys = id % 23;
+        values = id % 11;
+        datalen = (id % Large == 0) ? 256 * 1024 : 16 + id % 200;
+        rebuild = (Test_Rand(500) == 0);
+
+        Test_Lookup(Path, subkeys, values, datalen, rebuild, &hit);
+        if (hit)
+            ++*Hits;
+        if (! hit || rebuild)
+            ++*Builds;
+        if (Key_MergeCacheSize > *Peak)
+            *Peak = Key_MergeCacheSize;
+
+        if (Check) {
+            ULONG size = sizeof(KEY_MERGE) + wcslen(Path) * sizeof(WCHAR)
+                + subkeys * sizeof(KEY_MERGE_SUBKEY) + values * (sizeof(KEY_MERGE_VALUE) + datalen);
+            ULONG i;
+            for (i = 0; i < subkeys; ++i)
+                size += (4 + i % 13) * sizeof(WCHAR);
+            for (i = 0; i < values; ++i)
+                size += (3 + i % 7) * sizeof(WCHAR);
+
+            TEST_CHECK(Ref_Lookup(Path, size, rebuild) == hit);
+            Test_CheckState(step % 97 == 0);
+        }
+    }
+
+    Test_Reset(0);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_MakeName
+//---------------------------------------------------------------------------
+
+
+static void Test_MakeName(WCHAR *Name, ULONG Id)
+{
+    //
+    // names sort by Id, in a random mix of upper and lower case
+    //
+
+    ULONG i, len;
+
+    len = (ULONG)swprintf(Name, 32, L"Entry%06u", Id);
+
+    for (i = 0; i < len; ++i) {
+        if (Test_Rand(2) == 0)
+            Name[i] = towupper(Name[i]);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_NewSubkey
+//---------------------------------------------------------------------------
+
+
+static KEY_MERGE_SUBKEY *Test_NewSubkey(const WCHAR *Name, ULONG Tag)
+{
+    ULONG name_len = wcslen(Name) * sizeof(WCHAR);
+    KEY_MERGE_SUBKEY *subkey = calloc(1, sizeof(KEY_MERGE_SUBKEY) + name_len + sizeof(WCHAR));
+
+    subkey->name_len = name_len;
+    memcpy(subkey->name, Name, name_len + sizeof(WCHAR));
+    subkey->LastWriteTime.QuadPart = Tag;
+
+    return subkey;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_NewValue
+//---------------------------------------------------------------------------
+
+
+static KEY_MERGE_VALUE *Test_NewValue(const WCHAR *Name, ULONG Tag)
+{
+    ULONG name_len = wcslen(Name) * sizeof(WCHAR);
+    KEY_MERGE_VALUE *value = calloc(1, sizeof(KEY_MERGE_VALUE) + name_len + sizeof(WCHAR) + sizeof(ULONG));
+
+    value->name_len = name_len;
+    memcpy(value->name, Name, name_len + sizeof(WCHAR));
+    value->data_ptr = (UCHAR *)value->name + name_len + sizeof(WCHAR);
+    value->data_len = sizeof(ULONG);
+    memcpy(value->data_ptr, &Tag, sizeof(ULONG));
+
+    return value;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Merge
+//---------------------------------------------------------------------------
+
+
+static void Test_Merge(KEY_MERGE *merge, ULONG Count, ULONG Seed, BOOLEAN UseHint)
+{
+    //
+    // the steps of Key_MergeSubkeys and Key_MergeValues, on a true key
+    // and a copy key which take their names from the first Count ids.
+    // the copy key returns its entries mostly in sorted order, some of
+    // them are delete marks.  the same Seed gives the same keys, so a
+    // merge built with the hint can be compared with one built without,
+    // which searches from the head for every entry, as before the hint
+    //
+
+    KEY_MERGE_SUBKEY *subkey_hint = NULL;
+    KEY_MERGE_VALUE *value_hint = NULL;
+    WCHAR Name[32];
+    ULONG *Order;
+    ULONG i, j, n, swaps, tmp;
+
+    Test_Seed = Seed;
+
+    for (i = 0; i < Count; ++i) {
+        if (Test_Rand(2)) {
+            Test_MakeName(Name, i);
+            List_Insert_After(&merge->subkeys, NULL, Test_NewSubkey(Name, i));
+        }
+        if (Test_Rand(2)) {
+            Test_MakeName(Name, i);
+            List_Insert_After(&merge->values, NULL, Test_NewValue(Name, i));
+        }
+    }
+
+    Order = malloc((Count + 1) * sizeof(ULONG));
+    n = 0;
+    for (i = 0; i < Count; ++i) {
+        if (Test_Rand(2))
+            Order[n++] = i;
+    }
+
+    swaps = Test_Rand(4) ? n / 16 : n;
+    for (i = 0; i < swaps; ++i) {
+        j = Test_Rand(n);
+        tmp = Order[i % n];
+        Order[i % n] = Order[j];
+        Order[j] = tmp;
+    }
+
+    for (i = 0; i < n; ++i) {
+
+        BOOLEAN deleted = (Test_Rand(8) == 0);
+
+        if (! UseHint) {
+            subkey_hint = NULL;
+            value_hint = NULL;
+        }
+
+        Test_MakeName(Name, Order[i]);
+        Key_MergeInsertSubkey(merge, Test_NewSubkey(Name, Count + Order[i]), deleted, &subkey_hint);
+        Key_MergeInsertValue(merge, Test_NewValue(Name, Count + Order[i]), deleted, &value_hint);
+    }
+
+    free(Order);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_CheckMerge
+//---------------------------------------------------------------------------
+
+
+static void Test_CheckMerge(KEY_MERGE *merge, KEY_MERGE *ref)
+{
+    KEY_MERGE_SUBKEY *subkey, *subkey2, *prev_subkey = NULL;
+    KEY_MERGE_VALUE *value, *value2, *prev_value = NULL;
+
+    //
+    // the same entries in the same order with the same tags, the tag
+    // tells if the copy key entry replaced the true key entry, and the
+    // names are sorted without duplicates
+    //
+
+    TEST_CHECK(List_Count(&merge->subkeys) == List_Count(&ref->subkeys));
+    subkey = List_Head(&merge->subkeys);
+    subkey2 = List_Head(&ref->subkeys);
+    while (subkey && subkey2) {
+        TEST_CHECK(_wcsicmp(subkey->name, subkey2->name) == 0);
+        TEST_CHECK(subkey->LastWriteTime.QuadPart == subkey2->LastWriteTime.QuadPart);
+        if (prev_subkey)
+            TEST_CHECK(_wcsicmp(prev_subkey->name, subkey->name) < 0);
+        prev_subkey = subkey;
+        subkey = List_Next(subkey);
+        subkey2 = List_Next(subkey2);
+    }
+
+    TEST_CHECK(List_Count(&merge->values) == List_Count(&ref->values));
+    value = List_Head(&merge->values);
+    value2 = List_Head(&ref->values);
+    while (value && value2) {
+        TEST_CHECK(_wcsicmp(value->name, value2->name) == 0);
+        TEST_CHECK(memcmp(value->data_ptr, value2->data_ptr, sizeof(ULONG)) == 0);
+        if (prev_value)
+            TEST_CHECK(_wcsicmp(prev_value->name, value->name) < 0);
+        prev_value = value;
+        value = List_Next(value);
+        value2 = List_Next(value2);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Walk
+//---------------------------------------------------------------------------
+
+
+static void *Test_Walk(KEY_MERGE *merge, BOOLEAN Values, ULONG Index)
+{
+    //
+    // how Key_NtEnumerateKey and Key_NtEnumerateValueKey found the
+    // entry at a position before the index
+    //
+
+    LIST_ELEM *elem = List_Head(Values ? &merge->values : &merge->subkeys);
+    while (elem && Index) {
+        elem = List_Next(elem);
+        --Index;
+    }
+    return elem;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_GetEntry
+//---------------------------------------------------------------------------
+
+
+static void *Test_GetEntry(KEY_MERGE *merge, BOOLEAN Values, ULONG Index,
+    ULONG *Trace, ULONG *TraceLen)
+{
+    void *entry;
+
+    if (Values)
+        entry = Key_GetMergeValue(merge, Index);
+    else
+        entry = Key_GetMergeSubkey(merge, Index);
+
+    TEST_CHECK(entry == Test_Walk(merge, Values, Index));
+
+    if (Trace && *TraceLen < MAX_TRACE)
+        Trace[(*TraceLen)++] = (Values ? TRACE_VALUE : 0) | Index;
+
+    return entry;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Enumerate
+//---------------------------------------------------------------------------
+
+
+static void Test_Enumerate(KEY_MERGE *merge, ULONG Steps, BOOLEAN Change,
+    ULONG *Trace, ULONG *TraceLen)
+{
+    //
+    // the lookups a caller enumerating the merged key makes, whole
+    // enumerations from index 0 and single lookups, also past the end.
+    // with Change, subkeys are added and removed in between, the way
+    // Key_AddSubkeyToParentMerge and Key_RemoveSubkeyFromMerge do, which
+    // reset the index.  Trace records the lookups
+    //
+
+    KEY_MERGE_SUBKEY *subkey, *hint;
+    WCHAR Name[32];
+    ULONG step, op, i, count;
+
+    for (step = 0; step < Steps; ++step) {
+
+        op = Test_Rand(Change ? 100 : 90);
+
+        if (op < 70) {
+
+            BOOLEAN Values = (op >= 40);
+            for (i = 0; Test_GetEntry(merge, Values, i, Trace, TraceLen); ++i)
+                ;
+
+        } else if (op < 90) {
+
+            BOOLEAN Values = (op >= 80);
+            count = List_Count(Values ? &merge->values : &merge->subkeys);
+            Test_GetEntry(merge, Values, Test_Rand(count + 3), Trace, TraceLen);
+
+        } else if (op < 95) {
+
+            Test_MakeName(Name, Test_Rand(20000));
+            hint = NULL;
+            Key_MergeInsertSubkey(merge, Test_NewSubkey(Name, 0), FALSE, &hint);
+            Key_MergeIndexReset(merge);
+
+        } else {
+
+            count = List_Count(&merge->subkeys);
+            if (count) {
+                subkey = Test_Walk(merge, FALSE, Test_Rand(count));
+                List_Remove(&merge->subkeys, subkey);
+                free(subkey);
+                Key_MergeIndexReset(merge);
+            }
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Index
+//---------------------------------------------------------------------------
+
+
+static void Test_Index(void)
+{
+    KEY_MERGE *merge, *ref;
+    ULONG Round, Count, Seed;
+
+    for (Round = 0; Round < 300; ++Round) {
+
+        Count = Test_Rand(Round < 150 ? 20 : 800);
+        Seed = 1 + Test_Rand(0x7FFFFFFF);
+
+        merge = calloc(1, sizeof(KEY_MERGE));
+        ref = calloc(1, sizeof(KEY_MERGE));
+
+        Test_Merge(merge, Count, Seed, TRUE);
+        Test_Merge(ref, Count, Seed, FALSE);
+        Test_CheckMerge(merge, ref);
+
+        Test_Enumerate(merge, 40, TRUE, NULL, NULL);
+
+        Key_MergeFree(merge, FALSE);
+        Key_MergeFree(ref, FALSE);
+        TEST_CHECK(! merge->subkey_index && ! merge->value_index);
+        free(merge);
+        free(ref);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    //
+    // hit rate, merges built and peak size of the replay, and the cost
+    // of finding a path in a full cache through the map and with the
+    // list walk which Key_MergeCache did before
+    //
+
+    ULONG Keys[] = { 500, 5000, 50000 };
+    WCHAR Path[MAX_PATH_LEN];
+    ULONG k, i, Hits, Builds, Peak, Found;
+    KEY_MERGE *merge;
+    BOOLEAN hit;
+    double t0, t_map, t_walk;
+
+    printf("   keys   hit rate   built   peak KB   cached   ns map   ns walk\n");
+
+    for (k = 0; k < sizeof(Keys) / sizeof(Keys[0]); ++k) {
+
+        Test_Replay(Keys[k], 1009, 1000000, &Hits, &Builds, &Peak, FALSE);
+
+        Test_Ticks = 1;
+        for (i = 0; i < Keys[k]; ++i) {
+            Test_MakePath(Path, i);
+            Test_Lookup(Path, 2, 2, 16, FALSE, &hit);
+        }
+
+        Found = 0;
+        t0 = Test_Time();
+        for (i = 0; i < 200000; ++i) {
+            Test_MakePath(Path, Test_Rand(Keys[k]));
+            Found += (map_get(&Key_MergeCacheMap, Path) != NULL);
+        }
+        t_map = Test_Time() - t0;
+
+        t0 = Test_Time();
+        for (i = 0; i < 2000; ++i) {
+            Test_MakePath(Path, Test_Rand(Keys[k]));
+            for (merge = List_Head(&Key_MergeCacheList); merge; merge = List_Next(merge)) {
+                if (_wcsicmp(merge->name, Path) == 0) {
+                    ++Found;
+                    break;
+                }
+            }
+        }
+        t_walk = Test_Time() - t0;
+
+        printf("%7u   %7.1f%%   %5u   %7u   %6u   %6.0f   %7.0f\n", Keys[k],
+            Hits * 100.0 / 1000000, Builds, Peak / 1024, (ULONG)List_Count(&Key_MergeCacheList),
+            t_map * 1000000.0 / 200000, t_walk * 1000000.0 / 2000);
+
+        Test_Reset(0);
+    }
+
+    //
+    // the time to merge a key with the hint and with the search from the
+    // head, and the time per lookup of a recorded enumeration trace, with
+    // the index and with the list walk
+    //
+
+    {
+        ULONG Sizes[] = { 10, 100, 1000, 5000 };
+        ULONG *Trace = malloc(MAX_TRACE * sizeof(ULONG));
+        ULONG TraceLen;
+        KEY_MERGE *merge;
+        double t_hint, t_head, t_index, t_walk;
+
+        printf("\n  entries   ms hint   ms head   lookups   ns index   ns walk\n");
+
+        for (k = 0; k < sizeof(Sizes) / sizeof(Sizes[0]); ++k) {
+
+            merge = calloc(1, sizeof(KEY_MERGE));
+
+            t0 = Test_Time();
+            Test_Merge(merge, 2 * Sizes[k], 77, FALSE);
+            t_head = Test_Time() - t0;
+            Key_MergeFree(merge, FALSE);
+
+            t0 = Test_Time();
+            Test_Merge(merge, 2 * Sizes[k], 77, TRUE);
+            t_hint = Test_Time() - t0;
+
+            TraceLen = 0;
+            Test_Enumerate(merge, 20, FALSE, Trace, &TraceLen);
+
+            Found = 0;
+            t0 = Test_Time();
+            for (i = 0; i < TraceLen; ++i) {
+                if (Trace[i] & TRACE_VALUE)
+                    Found += (Key_GetMergeValue(merge, Trace[i] & ~TRACE_VALUE) != NULL);
+                else
+                    Found += (Key_GetMergeSubkey(merge, Trace[i]) != NULL);
+            }
+            t_index = Test_Time() - t0;
+
+            t0 = Test_Time();
+            for (i = 0; i < TraceLen; ++i)
+                Found += (Test_Walk(merge, (Trace[i] & TRACE_VALUE) != 0, Trace[i] & ~TRACE_VALUE) != NULL);
+            t_walk = Test_Time() - t0;
+
+            printf("%9u   %7.2f   %7.2f   %7u   %8.1f   %7.1f\n",
+                (ULONG)List_Count(&merge->subkeys), t_hint, t_head, TraceLen,
+                t_index * 1000000.0 / TraceLen, t_walk * 1000000.0 / TraceLen);
+
+            Key_MergeFree(merge, FALSE);
+            free(merge);
+        }
+
+        free(Trace);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    ULONG Hits, Builds, Peak;
+
+    List_Init(&Key_MergeCacheList);
+    map_init(&Key_MergeCacheMap, NULL);
+    Key_MergeCacheMap.func_hash_key = Key_MergeCacheHash;
+    Key_MergeCacheMap.func_match_key = str_map_match;
+
+    Ref_Entries = malloc(MAX_REF * sizeof(REF_ENTRY));
+
+    Test_Policy();
+
+    Test_Replay(300, 37, 200000, &Hits, &Builds, &Peak, TRUE);
+    TEST_CHECK(Peak > KEY_MERGE_CACHE_MAX_SIZE);
+    Test_Replay(3000, 101, 50000, &Hits, &Builds, &Peak, TRUE);
+
+    Test_Index();
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        Test_Benchmark();
+
+    free(Ref_Entries);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,479 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Monitor Log Ring Stress Test
+//---------------------------------------------------------------------------
+
+
+//
+// runs writer threads against the monitor log ring of core/drv/log_buff.c
+// the way Session_MonitorPutEx does, each reserves entries under a shared
+// lock with log_buffer_reserve_entry and fills them in parallel, while a
+// reader drains and pops the ring under the exclusive lock like
+// Api_MonitorGet2.  the reader checks that no entry is torn, that sequence
+// numbers only grow and that every writer's entries arrive in order and
+// complete.  the same load is also run with the exclusive lock and
+// log_buffer_push_entry, which is how all writers were serialized before.
+// the benchmark reports events put per second against the number of
+// writers, and the share of them which fit into the ring
+//
+// gcc -O2 -pthread -I.. -o log_ring_test log_ring_test.c
+// cl /O2 /I.. log_ring_test.c
+//
+
+
+#ifndef _WIN32
+#define _GNU_SOURCE             // for the writer preferring rwlock of glibc
+#include <pthread.h>            // before test_stubs.h redefines __inline
+#include <sched.h>
+#endif
+
+#include "test_stubs.h"
+
+#ifdef _WIN32
+
+typedef SRWLOCK TEST_LOCK;
+typedef HANDLE TEST_THREAD;
+
+#define Test_LockInit(l)            InitializeSRWLock(l)
+#define Test_LockShared(l)          AcquireSRWLockShared(l)
+#define Test_UnlockShared(l)        ReleaseSRWLockShared(l)
+#define Test_LockExclusive(l)       AcquireSRWLockExclusive(l)
+#define Test_UnlockExclusive(l)     ReleaseSRWLockExclusive(l)
+
+#define Test_Yield()                SwitchToThread()
+#define Test_Clock()                ((double)GetTickCount64())
+
+#else
+
+typedef pthread_rwlock_t TEST_LOCK;
+typedef pthread_t TEST_THREAD;
+
+static void Test_LockInit(TEST_LOCK *lock)
+{
+    //
+    // like an ERESOURCE, a waiting exclusive owner holds off new shared
+    // owners, otherwise the writers would starve the reader
+    //
+
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+#define Test_LockShared(l)          pthread_rwlock_rdlock(l)
+#define Test_UnlockShared(l)        pthread_rwlock_unlock(l)
+#define Test_LockExclusive(l)       pthread_rwlock_wrlock(l)
+#define Test_UnlockExclusive(l)     pthread_rwlock_unlock(l)
+
+#define Test_Yield()                sched_yield()
+
+static double Test_Clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+#define InterlockedCompareExchange64(p, x, c) \
+    __sync_val_compare_and_swap((p), (c), (x))
+
+#endif
+
+#define LOG_BUFFER_USER_MODE
+#define ExAllocatePoolWithTag(type, size, tag)  malloc(size)
+#define ExFreePoolWithTag(ptr, tag)             free(ptr)
+#define tzuk 0
+
+#include "core/drv/log_buff.c"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define MAX_WRITERS     32
+#define MAX_PAYLOAD     256     // bytes after the entry header
+#define RING_SIZE       (64 * 1024)
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _TEST_ENTRY {
+
+    ULONG writer;
+    ULONG counter;
+    ULONG length;               // of the fill bytes which follow
+
+} TEST_ENTRY;
+
+
+typedef struct _TEST_RUN {
+
+    LOG_BUFFER *log;
+    TEST_LOCK lock;
+    BOOLEAN reserve;            // lock free reservation or serialized push
+    volatile LONG stop;
+
+    ULONG num_writers;
+    ULONG written[MAX_WRITERS];
+    ULONG dropped[MAX_WRITERS];
+
+    ULONG read[MAX_WRITERS];
+    ULONG next[MAX_WRITERS];    // lowest counter still expected per writer
+    ULONG errors;
+    LOG_BUFFER_SEQ_T last_seq;
+
+} TEST_RUN;
+
+
+typedef struct _TEST_WRITER {
+
+    TEST_RUN *run;
+    ULONG index;
+
+} TEST_WRITER;
+
+
+//---------------------------------------------------------------------------
+// Test_Fill
+//---------------------------------------------------------------------------
+
+
+static UCHAR Test_Fill(ULONG writer, ULONG counter, ULONG i)
+{
+    return (UCHAR)(writer * 31 + counter * 7 + i);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Writer
+//---------------------------------------------------------------------------
+
+
+static void Test_WriteEntry(TEST_RUN *run, ULONG writer, ULONG counter, ULONG length)
+{
+    UCHAR fill[MAX_PAYLOAD];
+    TEST_ENTRY entry;
+    CHAR *write_ptr;
+    ULONG i;
+
+    entry.writer = writer;
+    entry.counter = counter;
+    entry.length = length;
+    for (i = 0; i < length; ++i)
+        fill[i] = Test_Fill(writer, counter, i);
+
+    //
+    // like Session_MonitorPutEx, reserve and fill the entry piecewise
+    //
+
+    if (run->reserve) {
+
+        Test_LockShared(&run->lock);
+        write_ptr = log_buffer_reserve_entry(sizeof(entry) + length, run->log);
+
+    } else {
+
+        Test_LockExclusive(&run->lock);
+        write_ptr = log_buffer_push_entry(sizeof(entry) + length, run->log, FALSE);
+    }
+
+    if (write_ptr) {
+        log_buffer_push_bytes((CHAR *)&entry, sizeof(entry), &write_ptr, run->log);
+        log_buffer_push_bytes((CHAR *)fill, length, &write_ptr, run->log);
+        ++run->written[writer];
+    } else
+        ++run->dropped[writer];
+
+    if (run->reserve)
+        Test_UnlockShared(&run->lock);
+    else
+        Test_UnlockExclusive(&run->lock);
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI Test_Writer(void *param)
+#else
+static void *Test_Writer(void *param)
+#endif
+{
+    TEST_WRITER *writer = (TEST_WRITER *)param;
+    TEST_RUN *run = writer->run;
+    ULONG seed = writer->index * 2654435761u + 1;
+    ULONG counter = 0;
+
+    while (! run->stop) {
+
+        seed = seed * 1103515245 + 12345;
+        Test_WriteEntry(run, writer->index, counter, (seed >> 8) % MAX_PAYLOAD);
+
+        //
+        // the counter advances also for a dropped entry, so the reader
+        // sees gaps for drops but never an entry out of order
+        //
+
+        ++counter;
+    }
+
+    return 0;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Drain
+//---------------------------------------------------------------------------
+
+
+static void Test_Drain(TEST_RUN *run)
+{
+    //
+    // like Api_MonitorGet2, read and pop everything under the exclusive lock
+    //
+
+    UCHAR data[sizeof(TEST_ENTRY) + MAX_PAYLOAD];
+
+    Test_LockExclusive(&run->lock);
+
+    while (run->log->buffer_used > 0) {
+
+        CHAR *read_ptr = run->log->buffer_start_ptr;
+        LOG_BUFFER_SIZE_T size = log_buffer_get_size(&read_ptr, run->log);
+        LOG_BUFFER_SEQ_T seq_number = log_buffer_get_seq_num(&read_ptr, run->log);
+        TEST_ENTRY *entry = (TEST_ENTRY *)data;
+        ULONG i;
+
+        if (size < sizeof(TEST_ENTRY) || size > sizeof(data)) {
+            ++run->errors;
+            break;
+        }
+
+        log_buffer_get_bytes((CHAR *)data, size, &read_ptr, run->log);
+        log_buffer_pop_entry(run->log);
+
+        if (seq_number <= run->last_seq)
+            ++run->errors;
+        run->last_seq = seq_number;
+
+        if (entry->writer >= run->num_writers || entry->length != size - sizeof(TEST_ENTRY)) {
+            ++run->errors;
+            continue;
+        }
+
+        for (i = 0; i < entry->length; ++i) {
+            if (data[sizeof(TEST_ENTRY) + i] != Test_Fill(entry->writer, entry->counter, i)) {
+                ++run->errors;
+                break;
+            }
+        }
+
+        if (entry->counter < run->next[entry->writer])
+            ++run->errors;
+        run->next[entry->writer] = entry->counter + 1;
+
+        ++run->read[entry->writer];
+    }
+
+    Test_UnlockExclusive(&run->lock);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Run
+//---------------------------------------------------------------------------
+
+
+static double Test_Run(ULONG num_writers, BOOLEAN reserve, double duration, ULONG *errors, double *kept)
+{
+    TEST_RUN *run = calloc(1, sizeof(TEST_RUN));
+    TEST_WRITER writers[MAX_WRITERS];
+    TEST_THREAD threads[MAX_WRITERS];
+    double t0, elapsed, rate;
+    ULONG64 written = 0, dropped = 0;
+    ULONG i;
+
+    run->log = log_buffer_init(RING_SIZE);
+    run->reserve = reserve;
+    run->num_writers = num_writers;
+    Test_LockInit(&run->lock);
+
+    //
+    // wall clock time in ms, Test_Time counts the CPU time of all threads
+    //
+
+    t0 = Test_Clock();
+
+    for (i = 0; i < num_writers; ++i) {
+        writers[i].run = run;
+        writers[i].index = i;
+#ifdef _WIN32
+        threads[i] = CreateThread(NULL, 0, Test_Writer, &writers[i], 0, NULL);
+#else
+        pthread_create(&threads[i], NULL, Test_Writer, &writers[i]);
+#endif
+    }
+
+    //
+    // the reader polls like the trace view of SandMan, though much
+    // more often, so that the ring does not stay full
+    //
+
+    while (Test_Clock() - t0 < duration) {
+        Test_Drain(run);
+        Test_Yield();
+    }
+
+    run->stop = TRUE;
+
+    for (i = 0; i < num_writers; ++i) {
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+
+    Test_Drain(run);
+
+    elapsed = Test_Clock() - t0;
+
+    for (i = 0; i < num_writers; ++i) {
+        if (run->read[i] != run->written[i])
+            ++run->errors;
+        written += run->written[i];
+        dropped += run->dropped[i];
+    }
+
+    rate = elapsed > 0 ? (written + dropped) * 1000.0 / elapsed : 0;
+    if (kept)
+        *kept = (written + dropped) ? written * 100.0 / (written + dropped) : 0;
+    *errors = run->errors;
+
+    log_buffer_free(run->log);
+    free(run);
+    return rate;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    static const ULONG Writers[] = { 1, 2, 4, 8, 16, 32 };
+    ULONG s;
+
+    printf("\n%8s  %16s  %8s  %16s  %8s\n", "writers", "locked events/s", "kept", "reserve events/s", "kept");
+
+    for (s = 0; s < sizeof(Writers) / sizeof(Writers[0]); ++s) {
+
+        ULONG errors1, errors2;
+        double kept1, kept2;
+        double locked = Test_Run(Writers[s], FALSE, 1000, &errors1, &kept1);
+        double reserve = Test_Run(Writers[s], TRUE, 1000, &errors2, &kept2);
+
+        TEST_CHECK(errors1 == 0 && errors2 == 0);
+
+        printf("%8u  %16.0f  %7.1f%%  %16.0f  %7.1f%%\n", Writers[s], locked, kept1, reserve, kept2);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Wrap
+//---------------------------------------------------------------------------
+
+
+static void Test_Wrap(void)
+{
+    //
+    // entries larger than the space left to the end of the ring are
+    // split, a full ring rejects a reservation but still counts it
+    //
+
+    LOG_BUFFER *log = log_buffer_init(100);
+    CHAR data[40], back[40];
+    CHAR *ptr;
+    ULONG i;
+
+    for (i = 0; i < sizeof(data); ++i)
+        data[i] = (CHAR)i;
+
+    ptr = log_buffer_reserve_entry(40, log);
+    TEST_CHECK(ptr != NULL);
+    log_buffer_push_bytes(data, 40, &ptr, log);
+    TEST_CHECK(log->buffer_used == 52);
+
+    TEST_CHECK(log_buffer_reserve_entry(40, log) == NULL);
+    TEST_CHECK(log->seq_counter == 2 && log->buffer_used == 52);
+
+    log_buffer_pop_entry(log);
+    TEST_CHECK(log->buffer_used == 0);
+
+    ptr = log_buffer_reserve_entry(40, log);
+    TEST_CHECK(ptr != NULL);
+    log_buffer_push_bytes(data, 40, &ptr, log);
+
+    ptr = log->buffer_start_ptr;
+    TEST_CHECK(log_buffer_get_size(&ptr, log) == 40);
+    TEST_CHECK(log_buffer_get_seq_num(&ptr, log) == 3);
+    log_buffer_get_bytes(back, 40, &ptr, log);
+    TEST_CHECK(memcmp(data, back, 40) == 0);
+
+    log_buffer_free(log);
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    BOOLEAN Bench = (argc > 1 && strcmp(argv[1], "bench") == 0);
+    ULONG errors;
+
+    Test_Wrap();
+
+    Test_Run(1, TRUE, 100, &errors, NULL);
+    TEST_CHECK(errors == 0);
+    Test_Run(4, TRUE, 200, &errors, NULL);
+    TEST_CHECK(errors == 0);
+    Test_Run(16, TRUE, 200, &errors, NULL);
+    TEST_CHECK(errors == 0);
+    Test_Run(4, FALSE, 100, &errors, NULL);
+    TEST_CHECK(errors == 0);
+
+    if (Bench)
+        Test_Benchmark();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,335 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Directory Merge Cache Test
+//---------------------------------------------------------------------------
+
+
+//
+// builds the sorted entry list of a directory merge through
+// File_MergeCacheInsert of core/dll/file_merge_cache.c, and through the
+// walk from the list head which File_MergeCache and File_MergeDummy used
+// before, and checks that both give the same order and stop or skip on the
+// same duplicate names.  the benchmark measures the time to cache a
+// directory against its size, for random, sorted and reversed listings
+//
+// gcc -I.. -o merge_cache_test merge_cache_test.c
+// cl /I.. merge_cache_test.c
+//
+
+
+#include "test_stubs.h"
+#include "common/list.c"
+#include "common/rbtree.c"
+
+#include <wctype.h>
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    WCHAR *Buffer;
+} UNICODE_STRING;
+
+
+typedef struct _FILE_MERGE_CACHE_FILE {
+
+    LIST_ELEM list_elem;
+    rbnode_t tree_node;
+    ULONG info_len;
+    UNICODE_STRING name_uni;
+    WCHAR name[24];             // in place of FILE_ID_BOTH_DIR_INFORMATION
+
+} FILE_MERGE_CACHE_FILE;
+
+
+//---------------------------------------------------------------------------
+// RtlCompareUnicodeString
+//---------------------------------------------------------------------------
+
+
+static LONG RtlCompareUnicodeString(
+    UNICODE_STRING *String1, UNICODE_STRING *String2, BOOLEAN CaseInSensitive)
+{
+    //
+    // like ntdll, compare up to the shorter length, then the lengths
+    //
+
+    ULONG len1 = String1->Length / sizeof(WCHAR);
+    ULONG len2 = String2->Length / sizeof(WCHAR);
+    ULONG i;
+
+    for (i = 0; i < len1 && i < len2; ++i) {
+        WCHAR c1 = String1->Buffer[i];
+        WCHAR c2 = String2->Buffer[i];
+        if (CaseInSensitive) {
+            c1 = towupper(c1);
+            c2 = towupper(c2);
+        }
+        if (c1 != c2)
+            return (LONG)c1 - (LONG)c2;
+    }
+
+    return (LONG)len1 - (LONG)len2;
+}
+
+
+#ifndef CONTAINING_RECORD
+#define CONTAINING_RECORD(address, type, field) \
+    ((type *)((char *)(address) - (ULONG_PTR)(&((type *)0)->field)))
+#endif
+
+#include "core/dll/file_merge_cache.c"
+
+
+//---------------------------------------------------------------------------
+// Test_Names
+//---------------------------------------------------------------------------
+
+
+static FILE_MERGE_CACHE_FILE *Test_Names(ULONG Count, ULONG Order, ULONG Dups)
+{
+    //
+    // distinct file names of a directory listing.  order 0 is random,
+    // 1 sorted, 2 reversed.  with dups, some names repeat with a
+    // different case
+    //
+
+    FILE_MERGE_CACHE_FILE *Files = calloc(Count, sizeof(FILE_MERGE_CACHE_FILE));
+    ULONG *Values = malloc(Count * sizeof(ULONG));
+    ULONG i;
+
+    for (i = 0; i < Count; ++i)
+        Values[i] = (Order == 2) ? Count - i : i;
+
+    if (Order == 0) {
+        for (i = Count - 1; i > 0; --i) {
+            ULONG j = Test_Rand(i + 1);
+            ULONG Value = Values[i];
+            Values[i] = Values[j];
+            Values[j] = Value;
+        }
+    }
+
+    for (i = 0; i < Count; ++i) {
+
+        if (Dups && i && Test_Rand(Dups) == 0) {
+            wcscpy(Files[i].name, Files[Test_Rand(i)].name);
+            Files[i].name[0] = towupper(Files[i].name[0]);
+        } else
+            swprintf(Files[i].name, 24, L"file%010u.dat", Values[i]);
+
+        Files[i].name_uni.Buffer = Files[i].name;
+        Files[i].name_uni.Length = (USHORT)(wcslen(Files[i].name) * sizeof(WCHAR));
+        Files[i].name_uni.MaximumLength = Files[i].name_uni.Length;
+    }
+
+    free(Values);
+    return Files;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_InsertLinear
+//---------------------------------------------------------------------------
+
+
+static BOOLEAN Test_InsertLinear(LIST *cache_list, FILE_MERGE_CACHE_FILE *cache_file, BOOLEAN after_equal)
+{
+    //
+    // the insertion of File_MergeCache before the tree, or with
+    // after_equal the one of File_MergeCacheWin2000
+    //
+
+    FILE_MERGE_CACHE_FILE *ins_point = List_Head(cache_list);
+    int cmp = -1;
+
+    while (ins_point) {
+        cmp = RtlCompareUnicodeString(
+            &ins_point->name_uni, &cache_file->name_uni, TRUE);
+        if (cmp > 0 || (cmp == 0 && ! after_equal))
+            break;
+        ins_point = List_Next(ins_point);
+    }
+
+    if (cmp == 0 && ! after_equal)
+        return FALSE;
+
+    if (ins_point)
+        List_Insert_Before(cache_list, ins_point, cache_file);
+    else
+        List_Insert_After(cache_list, NULL, cache_file);
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Build
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_Build(LIST *List, FILE_MERGE_CACHE_FILE *Files, ULONG Count,
+                        BOOLEAN Tree, BOOLEAN Win2000, BOOLEAN Skip)
+{
+    //
+    // Skip continues after a duplicate like File_MergeDummy, otherwise
+    // the first duplicate ends the listing like in File_MergeCache
+    //
+
+    rbtree_t cache_tree;
+    ULONG i;
+
+    List_Init(List);
+    rbtree_init(&cache_tree, Win2000 ? File_MergeCacheCompareEx : File_MergeCacheCompare);
+
+    for (i = 0; i < Count; ++i) {
+
+        BOOLEAN ok;
+        if (Tree)
+            ok = File_MergeCacheInsert(List, &cache_tree, &Files[i]);
+        else
+            ok = Test_InsertLinear(List, &Files[i], Win2000);
+
+        if (! ok && ! Skip)
+            break;
+    }
+
+    return i;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Compare
+//---------------------------------------------------------------------------
+
+
+static void Test_Compare(ULONG Count, ULONG Order, ULONG Dups, BOOLEAN Win2000, BOOLEAN Skip)
+{
+    FILE_MERGE_CACHE_FILE *Files1 = Test_Names(Count, Order, Dups);
+    FILE_MERGE_CACHE_FILE *Files2 = malloc(Count * sizeof(FILE_MERGE_CACHE_FILE));
+    FILE_MERGE_CACHE_FILE *f1, *f2;
+    LIST List1, List2;
+    ULONG n1, n2, i;
+
+    memcpy(Files2, Files1, Count * sizeof(FILE_MERGE_CACHE_FILE));
+    for (i = 0; i < Count; ++i)
+        Files2[i].name_uni.Buffer = Files2[i].name;
+
+    n1 = Test_Build(&List1, Files1, Count, FALSE, Win2000, Skip);
+    n2 = Test_Build(&List2, Files2, Count, TRUE, Win2000, Skip);
+
+    TEST_CHECK(n1 == n2);
+    TEST_CHECK(List_Count(&List1) == List_Count(&List2));
+
+    //
+    // the same entries in the same order, equal names included
+    //
+
+    f1 = List_Head(&List1);
+    f2 = List_Head(&List2);
+    while (f1 && f2) {
+        if (f1 - Files1 != f2 - Files2) {
+            TEST_CHECK(f1 - Files1 == f2 - Files2);
+            break;
+        }
+        f1 = List_Next(f1);
+        f2 = List_Next(f2);
+    }
+    TEST_CHECK(! f1 && ! f2);
+
+    free(Files1);
+    free(Files2);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    static const char *Orders[] = { "random", "sorted", "reversed" };
+    ULONG Count, Order;
+
+    printf("\n%8s  %8s  %12s  %12s\n", "entries", "order", "linear ms", "tree ms");
+
+    for (Count = 1000; Count <= 256000; Count *= 4) {
+        for (Order = 0; Order < 3; ++Order) {
+
+            FILE_MERGE_CACHE_FILE *Files = Test_Names(Count, Order, 0);
+            LIST List;
+            double t0, t_linear = -1, t_tree;
+
+            //
+            // the old walk is quadratic, skip it for the largest folders
+            //
+
+            if (Count <= 16000) {
+                t0 = Test_Time();
+                Test_Build(&List, Files, Count, FALSE, FALSE, FALSE);
+                t_linear = Test_Time() - t0;
+            }
+
+            t0 = Test_Time();
+            Test_Build(&List, Files, Count, TRUE, FALSE, FALSE);
+            t_tree = Test_Time() - t0;
+
+            if (t_linear >= 0)
+                printf("%8u  %8s  %12.2f  %12.2f\n", Count, Orders[Order], t_linear, t_tree);
+            else
+                printf("%8u  %8s  %12s  %12.2f\n", Count, Orders[Order], "-", t_tree);
+
+            free(Files);
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    BOOLEAN Bench = (argc > 1 && strcmp(argv[1], "bench") == 0);
+    ULONG Round;
+
+    for (Round = 0; Round < 300; ++Round) {
+
+        ULONG Count = 1 + Test_Rand(Round < 270 ? 50 : 1000);
+        ULONG Order = Test_Rand(3);
+        ULONG Dups = Test_Rand(3) ? 0 : 2 + Test_Rand(20);
+
+        Test_Compare(Count, Order, Dups, FALSE, FALSE);     // File_MergeCache
+        Test_Compare(Count, Order, Dups, FALSE, TRUE);      // File_MergeDummy
+        Test_Compare(Count, Order, Dups, TRUE, FALSE);      // File_MergeCacheWin2000
+    }
+
+    if (Bench)
+        Test_Benchmark();
+
+    return TEST_RESULT();
+}
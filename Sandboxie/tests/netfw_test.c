@@ -0,0 +1,462 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Network Firewall Rule Index Differential Test
+//---------------------------------------------------------------------------
+
+
+//
+// evaluates connections against the rules of common/netfw_rules.c both with
+// NetFw_BlockTraffic, which tests every rule, and NetFw_BlockTrafficEx with
+// the rule index from NetFw_CompileRules, and checks that they always agree.
+// random rule sets mix program match levels, protocols, and port and address
+// ranges, some of them overlapping or reversed, fixed cases cover a program
+// rule against a global rule and both fallbacks to the linear evaluation
+//
+// gcc -I.. -o netfw_test netfw_test.c
+// cl /I.. netfw_test.c
+//
+
+
+#include "test_stubs.h"
+#include "common/list.c"
+#include "common/rbtree.c"
+
+struct in_addr;
+struct sockaddr;
+
+#include "common/netfw.h"
+
+#define IPPROTO_ICMP    1
+#define IPPROTO_TCP     6
+#define IPPROTO_UDP     17
+#define IPPROTO_ANY     256     // see common/my_wsa.h
+
+#include "common/netfw_rules.c"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define MATCH_EXACT     0       // levels as passed to NetFw_AllocRule
+#define MATCH_NOT       1
+#define MATCH_GLOBAL    2
+
+
+//---------------------------------------------------------------------------
+// Pool_Alloc
+//---------------------------------------------------------------------------
+
+
+void *Pool_Alloc(POOL *pool, ULONG size)
+{
+    return malloc(size);
+}
+
+
+void Pool_Free(void *ptr, ULONG size)
+{
+    free(ptr);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Ip
+//---------------------------------------------------------------------------
+
+
+static IP_ADDRESS *Test_Ip(IP_ADDRESS *Ip, ULONG Value)
+{
+    //
+    // an IPv4 address in the last four bytes, in network order,
+    // so addresses compare like their values
+    //
+
+    memzero(Ip, sizeof(IP_ADDRESS));
+    Ip->Data[12] = (UCHAR)(Value >> 24);
+    Ip->Data[13] = (UCHAR)(Value >> 16);
+    Ip->Data[14] = (UCHAR)(Value >> 8);
+    Ip->Data[15] = (UCHAR)Value;
+    return Ip;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Rule
+//---------------------------------------------------------------------------
+
+
+static NETFW_RULE *Test_Rule(int Level, BOOLEAN Block, int Protocol)
+{
+    NETFW_RULE *rule = NetFw_AllocRule(NULL, Level);
+    NetFw_RuleSetBlockAction(rule, Block);
+    if (Protocol != IPPROTO_ANY)
+        NetFw_RuleSetProtocol(rule, Protocol);
+    return rule;
+}
+
+
+static void Test_RulePorts(NETFW_RULE *rule, USHORT Begin, USHORT End)
+{
+    NetFw_RuleAddPortRange(&rule->port_map, Begin, End, NULL);
+}
+
+
+static void Test_RuleIps(NETFW_RULE *rule, ULONG Begin, ULONG End)
+{
+    IP_ADDRESS IpBegin, IpEnd;
+    NetFw_RuleAddIpRange(&rule->ip_map, Test_Ip(&IpBegin, Begin), Test_Ip(&IpEnd, End), NULL);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_FreeRules
+//---------------------------------------------------------------------------
+
+
+static void Test_FreeRules(LIST *list)
+{
+    NETFW_RULE *rule;
+    while ((rule = List_Head(list)) != NULL) {
+        List_Remove(list, rule);
+        NetFw_FreeRule(rule);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Block
+//---------------------------------------------------------------------------
+
+
+static BOOLEAN Test_Block(LIST *list, NETFW_INDEX *index, ULONG Ip, USHORT Port, int Protocol)
+{
+    //
+    // both evaluations must agree, returns the result
+    //
+
+    IP_ADDRESS Address;
+    BOOLEAN linear, indexed;
+
+    Test_Ip(&Address, Ip);
+    linear = NetFw_BlockTraffic(list, &Address, Port, Protocol);
+    indexed = NetFw_BlockTrafficEx(index, list, &Address, Port, Protocol);
+    TEST_CHECK(linear == indexed);
+
+    return linear;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_ByProg
+//---------------------------------------------------------------------------
+
+
+static void Test_ByProg(void)
+{
+    //
+    // a rule for the program trumps a rule for all programs except others,
+    // which trumps a rule for all programs, even if the global rule names
+    // the port and the address
+    //
+
+    LIST list;
+    NETFW_INDEX *index;
+    NETFW_RULE *rule;
+
+    List_Init(&list);
+
+    rule = Test_Rule(MATCH_GLOBAL, TRUE, IPPROTO_TCP);
+    Test_RulePorts(rule, 443, 443);
+    Test_RuleIps(rule, 0x0A000001, 0x0A000001);
+    NetFw_AddRule(&list, rule);
+
+    rule = Test_Rule(MATCH_NOT, FALSE, IPPROTO_ANY);
+    Test_RulePorts(rule, 400, 500);
+    NetFw_AddRule(&list, rule);
+
+    rule = Test_Rule(MATCH_EXACT, TRUE, IPPROTO_ANY);
+    Test_RuleIps(rule, 0x0A000000, 0x0A0000FF);
+    NetFw_AddRule(&list, rule);
+
+    rule = Test_Rule(MATCH_GLOBAL, TRUE, IPPROTO_ANY);
+    NetFw_AddRule(&list, rule);
+
+    index = NetFw_CompileRules(&list, NULL);
+    TEST_CHECK(index != NULL);
+
+    TEST_CHECK(Test_Block(&list, index, 0x0A000001, 443, IPPROTO_TCP) == TRUE);     // program rule, by address
+    TEST_CHECK(Test_Block(&list, index, 0x0B000001, 443, IPPROTO_TCP) == FALSE);    // all but others, by port
+    TEST_CHECK(Test_Block(&list, index, 0x0B000001, 501, IPPROTO_TCP) == TRUE);     // global rule without ports
+    TEST_CHECK(Test_Block(&list, index, 0x0B000001, 400, IPPROTO_UDP) == FALSE);    // range begin
+    TEST_CHECK(Test_Block(&list, index, 0x0B000001, 500, IPPROTO_UDP) == FALSE);    // range end
+    TEST_CHECK(Test_Block(&list, index, 0x0B000001, 399, IPPROTO_UDP) == TRUE);
+    TEST_CHECK(Test_Block(&list, index, 0x0A0000FF, 450, IPPROTO_UDP) == TRUE);
+    TEST_CHECK(Test_Block(&list, index, 0x0A000100, 450, IPPROTO_UDP) == FALSE);
+
+    NetFw_FreeIndex(index);
+    Test_FreeRules(&list);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Fallback
+//---------------------------------------------------------------------------
+
+
+static void Test_Fallback(void)
+{
+    LIST list;
+    NETFW_INDEX *index;
+    NETFW_RULE *rule;
+    IP_ADDRESS Address;
+    ULONG Candidates[NETFW_INDEX_MAX_CANDIDATES];
+    ULONG Count, i;
+
+    //
+    // more rules whose ranges contain the port than NETFW_INDEX_MAX_CANDIDATES,
+    // the rules differ in ports and addresses, so they are not merged
+    //
+
+    List_Init(&list);
+
+    for (i = 0; i < NETFW_INDEX_MAX_CANDIDATES + 16; ++i) {
+        rule = Test_Rule(MATCH_EXACT, (i & 1) != 0, IPPROTO_TCP);
+        Test_RulePorts(rule, (USHORT)(1000 - i), (USHORT)(1000 + i));
+        Test_RuleIps(rule, 0x0A000000 + i, 0x0A000000 + i);
+        NetFw_AddRule(&list, rule);
+    }
+    TEST_CHECK(List_Count(&list) == NETFW_INDEX_MAX_CANDIDATES + 16);
+
+    index = NetFw_CompileRules(&list, NULL);
+    TEST_CHECK(index != NULL && index->BucketCount == 1);
+
+    Count = 0;
+    TEST_CHECK(! NetFw_CollectCandidates(&index->Buckets[0], Test_Ip(&Address, 0x0A000000), 1000, Candidates, &Count));
+    Count = 0;
+    TEST_CHECK(NetFw_CollectCandidates(&index->Buckets[0], Test_Ip(&Address, 0x0A000000), 1000 - 70, Candidates, &Count));
+    TEST_CHECK(Count == NETFW_INDEX_MAX_CANDIDATES + 16 - 70);
+
+    for (i = 0; i < NETFW_INDEX_MAX_CANDIDATES + 16; ++i) {
+        TEST_CHECK(Test_Block(&list, index, 0x0A000000 + i, 1000, IPPROTO_TCP) == ((i & 1) != 0));
+        TEST_CHECK(Test_Block(&list, index, 0x0A000000 + i, (USHORT)(1000 + i), IPPROTO_TCP) == ((i & 1) != 0));
+        TEST_CHECK(Test_Block(&list, index, 0x0A000000 + i, (USHORT)(1001 + i), IPPROTO_TCP) == FALSE);
+    }
+
+    NetFw_FreeIndex(index);
+    Test_FreeRules(&list);
+
+    //
+    // more combinations of program match level and protocol than
+    // NETFW_INDEX_MAX_BUCKETS, no index is built
+    //
+
+    List_Init(&list);
+
+    for (i = 0; i < NETFW_INDEX_MAX_BUCKETS + 1; ++i) {
+        rule = Test_Rule(MATCH_EXACT, (i & 1) != 0, 100 + i);
+        Test_RulePorts(rule, 80, 80);
+        NetFw_AddRule(&list, rule);
+    }
+
+    index = NetFw_CompileRules(&list, NULL);
+    TEST_CHECK(index == NULL);
+
+    for (i = 0; i < NETFW_INDEX_MAX_BUCKETS + 1; ++i) {
+        TEST_CHECK(Test_Block(&list, index, 0x0A000001, 80, 100 + i) == ((i & 1) != 0));
+        TEST_CHECK(Test_Block(&list, index, 0x0A000001, 81, 100 + i) == FALSE);
+    }
+
+    Test_FreeRules(&list);
+
+    //
+    // one combination less still gets an index
+    //
+
+    List_Init(&list);
+
+    for (i = 0; i < NETFW_INDEX_MAX_BUCKETS; ++i) {
+        rule = Test_Rule(MATCH_EXACT, TRUE, 100 + i);
+        Test_RulePorts(rule, 80, 80);
+        NetFw_AddRule(&list, rule);
+    }
+
+    index = NetFw_CompileRules(&list, NULL);
+    TEST_CHECK(index != NULL && index->BucketCount == NETFW_INDEX_MAX_BUCKETS);
+    TEST_CHECK(Test_Block(&list, index, 0x0A000001, 80, 100) == TRUE);
+    TEST_CHECK(Test_Block(&list, index, 0x0A000001, 80, 99) == FALSE);
+
+    NetFw_FreeIndex(index);
+    Test_FreeRules(&list);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_RandomRules
+//---------------------------------------------------------------------------
+
+
+static void Test_RandomRules(LIST *list, ULONG Count, ULONG Span)
+{
+    //
+    // rules over a small space of ports and addresses, so ranges overlap
+    // and connections hit them often, some ranges are reversed
+    //
+
+    static const int Protocols[] = { IPPROTO_ANY, IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP };
+    ULONG r, k, n;
+
+    for (r = 0; r < Count; ++r) {
+
+        NETFW_RULE *rule = Test_Rule((int)Test_Rand(4), Test_Rand(2) != 0, Protocols[Test_Rand(4)]);
+
+        n = Test_Rand(3) ? 0 : 1 + Test_Rand(3);
+        for (k = 0; k < n; ++k) {
+            USHORT a = (USHORT)Test_Rand(Span);
+            USHORT b = Test_Rand(3) ? a : (USHORT)(a + Test_Rand(8) - 2);
+            Test_RulePorts(rule, a, b);
+        }
+
+        n = Test_Rand(2) ? 0 : 1 + Test_Rand(3);
+        for (k = 0; k < n; ++k) {
+            ULONG a = Test_Rand(Span) + (Test_Rand(5) == 0 ? 0x100 : 0);
+            ULONG b = Test_Rand(3) ? a : a + Test_Rand(8) - 2;
+            Test_RuleIps(rule, a, b);
+        }
+
+        NetFw_AddRule(list, rule);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Differential
+//---------------------------------------------------------------------------
+
+
+static void Test_Differential(void)
+{
+    static const int Protocols[] = { IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP, 50 };
+    ULONG round, q;
+
+    for (round = 0; round < 3000; ++round) {
+
+        LIST list;
+        NETFW_INDEX *index;
+
+        List_Init(&list);
+        Test_RandomRules(&list, 1 + Test_Rand(40), 20);
+
+        index = NetFw_CompileRules(&list, NULL);
+        TEST_CHECK(index != NULL);
+
+        for (q = 0; q < 300; ++q) {
+            ULONG ip = Test_Rand(24) + (Test_Rand(5) == 0 ? 0x100 : 0);
+            Test_Block(&list, index, ip, (USHORT)Test_Rand(24), Protocols[Test_Rand(4)]);
+        }
+
+        if (index)
+            NetFw_FreeIndex(index);
+        Test_FreeRules(&list);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    //
+    // lookups per rule count over a wider space of ports and addresses,
+    // and how many of them fell back to the linear evaluation
+    //
+
+    static const int Protocols[] = { IPPROTO_TCP, IPPROTO_UDP };
+    ULONG Rules[] = { 10, 100, 1000, 5000 };
+    ULONG Queries = 200000;
+    ULONG r, q, fallbacks;
+    double t0, t_linear, t_indexed;
+    volatile BOOLEAN sink = FALSE;
+
+    printf("   rules   merged   us linear   us indexed   fallbacks\n");
+
+    for (r = 0; r < sizeof(Rules) / sizeof(Rules[0]); ++r) {
+
+        LIST list;
+        NETFW_INDEX *index;
+        IP_ADDRESS Address;
+        ULONG Candidates[NETFW_INDEX_MAX_CANDIDATES];
+
+        List_Init(&list);
+        Test_RandomRules(&list, Rules[r], 65535);
+        index = NetFw_CompileRules(&list, NULL);
+
+        t0 = Test_Time();
+        for (q = 0; q < Queries; ++q)
+            sink ^= NetFw_BlockTraffic(&list, Test_Ip(&Address, Test_Rand(65535)), (USHORT)Test_Rand(65535), Protocols[q & 1]);
+        t_linear = Test_Time() - t0;
+
+        t0 = Test_Time();
+        for (q = 0; q < Queries; ++q)
+            sink ^= NetFw_BlockTrafficEx(index, &list, Test_Ip(&Address, Test_Rand(65535)), (USHORT)Test_Rand(65535), Protocols[q & 1]);
+        t_indexed = Test_Time() - t0;
+
+        fallbacks = 0;
+        for (q = 0; index && q < 10000; ++q) {
+            ULONG i, Count = 0;
+            Test_Ip(&Address, Test_Rand(65535));
+            for (i = 0; i < index->BucketCount; ++i) {
+                if (! NetFw_CollectCandidates(&index->Buckets[i], &Address, (USHORT)Test_Rand(65535), Candidates, &Count)) {
+                    ++fallbacks;
+                    break;
+                }
+            }
+        }
+
+        printf("%8u   %6u   %9.3f   %10.3f   %8.1f%%\n", Rules[r], (ULONG)List_Count(&list),
+            t_linear * 1000.0 / Queries, t_indexed * 1000.0 / Queries,
+            index ? fallbacks * 100.0 / 10000 : 100.0);
+
+        if (index)
+            NetFw_FreeIndex(index);
+        Test_FreeRules(&list);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    Test_ByProg();
+    Test_Fallback();
+    Test_Differential();
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        Test_Benchmark();
+
+    return TEST_RESULT();
+}
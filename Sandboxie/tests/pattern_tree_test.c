@@ -0,0 +1,666 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Path Pattern Prefix Tree Differential Test
+//---------------------------------------------------------------------------
+
+
+//
+// matches path streams against the path rules of install/Templates.ini and
+// against random rule sets, once through lists which were compiled with
+// Pattern_CompilePathList and once through the same lists uncompiled, which
+// Pattern_MatchPathList still scans linearly like it did before the tree.
+// the match length, level, exact and auxiliary flags, wildcard count and the
+// found pattern must always agree.  the lists are chained through
+// Pattern_MatchPathListEx in the order Dll_MatchPath uses
+//
+// gcc -I.. -o pattern_tree_test pattern_tree_test.c
+// cl /I.. pattern_tree_test.c
+//
+// pattern_tree_test [bench] [path to Templates.ini]
+//
+
+
+#include "test_stubs.h"
+#include "common/list.c"
+
+#define _Check_return_          // SAL annotations of the wcstol
+#define _CRTIMP                 // declaration in common/pattern.c
+#define __cdecl
+#define _In_z_
+#define _Out_opt_
+#define _Deref_post_z_
+#undef memzero                  // common/defines.h has its own
+
+#include "common/pattern.c"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define MAX_PATH_LEN    512
+#define NUM_LISTS       5       // Closed, Write, Read, Normal, Open
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _TEST_RULES {
+
+    ULONG count;
+    ULONG max;
+    WCHAR **text;
+    UCHAR *list;
+    UCHAR *level;
+
+} TEST_RULES;
+
+
+typedef struct _TEST_MATCH {
+
+    // result of the chained lists
+    ULONG level;
+    ULONG flags;
+    USHORT wildc;
+    int match_len;
+    const WCHAR *patsrc;
+
+    // result of the Open list alone
+    ULONG open_level;
+    ULONG open_flags;
+    USHORT open_wildc;
+    int open_len;
+    const WCHAR *open_src;
+
+} TEST_MATCH;
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static const char *Test_ListNames[NUM_LISTS] = {
+    "ClosedFilePath", "WriteFilePath", "ReadFilePath", "NormalFilePath", "OpenFilePath"
+};
+
+static const WCHAR *Test_Words[] = {
+    L"windows", L"system32", L"program files", L"users", L"appdata", L"local",
+    L"roaming", L"microsoft", L"temp", L"drivers", L"config", L"vendor",
+    L"app.exe", L"data.dat", L"cache", L"namedpipe", L"mailslot", L"afd",
+};
+
+#define NUM_WORDS (sizeof(Test_Words) / sizeof(Test_Words[0]))
+
+
+//---------------------------------------------------------------------------
+// Pool_Alloc
+//---------------------------------------------------------------------------
+
+
+void *Pool_Alloc(POOL *pool, ULONG size)
+{
+    return malloc(size);
+}
+
+
+void Pool_Free(void *ptr, ULONG size)
+{
+    free(ptr);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_AddRule
+//---------------------------------------------------------------------------
+
+
+static void Test_AddRule(TEST_RULES *Rules, const WCHAR *Text, ULONG List, ULONG Level)
+{
+    if (Rules->count == Rules->max) {
+        Rules->max = Rules->max ? Rules->max * 2 : 256;
+        Rules->text = (WCHAR **)realloc(Rules->text, Rules->max * sizeof(WCHAR *));
+        Rules->list = (UCHAR *)realloc(Rules->list, Rules->max);
+        Rules->level = (UCHAR *)realloc(Rules->level, Rules->max);
+    }
+
+    Rules->text[Rules->count] = wcsdup(Text);
+    _wcslwr(Rules->text[Rules->count]);
+    Rules->list[Rules->count] = (UCHAR)List;
+    Rules->level[Rules->count] = (UCHAR)Level;
+    ++Rules->count;
+}
+
+
+static void Test_FreeRules(TEST_RULES *Rules)
+{
+    ULONG i;
+    for (i = 0; i < Rules->count; ++i)
+        free(Rules->text[i]);
+    free(Rules->text);
+    free(Rules->list);
+    free(Rules->level);
+    memzero(Rules, sizeof(TEST_RULES));
+}
+
+
+//---------------------------------------------------------------------------
+// Test_LoadTemplates
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_LoadTemplates(TEST_RULES *Rules, const char *Path)
+{
+    //
+    // collect the file path rules, drop the program part and the '|'
+    // mark of a rule and expand %variables% to a fixed folder, like the DLL sees them after
+    // the driver expanded them
+    //
+
+    FILE *File = fopen(Path, "rb");
+    if (! File)
+        return 0;
+
+    char Line[2048];
+    WCHAR Text[MAX_PATH_LEN];
+    ULONG Count = 0;
+
+    while (fgets(Line, sizeof(Line), File)) {
+
+        char *Value = strchr(Line, '=');
+        if (! Value)
+            continue;
+        *Value++ = '\0';
+        Value[strcspn(Value, "\r\n")] = '\0';
+
+        ULONG List;
+        for (List = 0; List < NUM_LISTS; ++List) {
+            if (_stricmp(Line, Test_ListNames[List]) == 0)
+                break;
+        }
+        if (List == NUM_LISTS || ! *Value)
+            continue;
+
+        if (*Value == '|')
+            ++Value;
+
+        char *Comma = strchr(Value, ',');
+        if (Comma && ! memchr(Value, '\\', Comma - Value))
+            Value = Comma + 1;
+
+        ULONG Len = 0;
+        while (*Value && Len < MAX_PATH_LEN - 64) {
+            if (*Value == '%') {
+                char *End = strchr(Value + 1, '%');
+                if (End) {
+                    const WCHAR *Var = L"\\device\\harddiskvolume2\\var";
+                    while (*Var)
+                        Text[Len++] = *Var++;
+                    Value = End + 1;
+                    continue;
+                }
+            }
+            Text[Len++] = (UCHAR)*Value++;
+        }
+        Text[Len] = L'\0';
+
+        if (Len) {
+            Test_AddRule(Rules, Text, List, Test_Rand(3));
+            ++Count;
+        }
+    }
+
+    fclose(File);
+    return Count;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_RandomRule
+//---------------------------------------------------------------------------
+
+
+static void Test_RandomRule(WCHAR *Text, ULONG Words)
+{
+    //
+    // rules over a small vocabulary, so that constant prefixes are shared
+    // and many rules match the same paths, with stars and question marks
+    // anywhere and sometimes a trailing backslash
+    //
+
+    ULONG Len = 0;
+    ULONG Count = 1 + Test_Rand(4);
+    ULONG i;
+
+    if (Test_Rand(8) == 0)
+        Text[Len++] = L'*';
+
+    for (i = 0; i < Count; ++i) {
+
+        const WCHAR *Word = Test_Words[Test_Rand(Words)];
+
+        Text[Len++] = L'\\';
+        while (*Word) {
+            Text[Len++] = (Test_Rand(40) == 0) ? L'?' : *Word;
+            ++Word;
+        }
+
+        if (Test_Rand(10) == 0)
+            Text[Len++] = L'*';
+    }
+
+    switch (Test_Rand(4)) {
+        case 0: Text[Len++] = L'*'; break;
+        case 1: Text[Len++] = L'\\'; break;
+        case 2: Text[Len++] = L'\\'; Text[Len++] = L'*'; break;
+    }
+
+    Text[Len] = L'\0';
+}
+
+
+//---------------------------------------------------------------------------
+// Test_RandomPath
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_RandomPath(WCHAR *Path, const TEST_RULES *Rules, ULONG Words)
+{
+    //
+    // mostly instances of a rule, with wildcards replaced by words and
+    // sometimes cut short or extended, the rest are paths from words
+    //
+
+    ULONG Len = 0;
+    ULONG i;
+
+    if (Rules->count && Test_Rand(4) != 0) {
+
+        const WCHAR *Src = Rules->text[Test_Rand(Rules->count)];
+
+        while (*Src && Len < MAX_PATH_LEN - 64) {
+
+            if (*Src == L'*') {
+                ULONG n = Test_Rand(3);
+                for (i = 0; i < n; ++i) {
+                    const WCHAR *Word = Test_Words[Test_Rand(Words)];
+                    if (i)
+                        Path[Len++] = L'\\';
+                    while (*Word)
+                        Path[Len++] = *Word++;
+                }
+            }
+            else if (*Src == L'?')
+                Path[Len++] = L'a' + Test_Rand(26);
+            else
+                Path[Len++] = *Src;
+            ++Src;
+        }
+
+        if (Len > 1 && Test_Rand(4) == 0)
+            Len = 1 + Test_Rand(Len);
+
+        if (Test_Rand(4) == 0) {
+            const WCHAR *Word = Test_Words[Test_Rand(Words)];
+            Path[Len++] = L'\\';
+            while (*Word)
+                Path[Len++] = *Word++;
+        }
+    }
+
+    else {
+
+        ULONG Count = 1 + Test_Rand(5);
+        for (i = 0; i < Count; ++i) {
+            const WCHAR *Word = Test_Words[Test_Rand(Words)];
+            Path[Len++] = L'\\';
+            while (*Word)
+                Path[Len++] = *Word++;
+        }
+    }
+
+    if (! Len)
+        Path[Len++] = L'\\';
+
+    //
+    // the auxiliary backslash is appended in place of the terminator,
+    // so the matchers read on to the next null, clear the rest of the
+    // buffer so a cut short path leaves no stale characters behind
+    //
+
+    wmemset(Path + Len, L'\0', MAX_PATH_LEN + 1 - Len);
+    return Len;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_BuildLists
+//---------------------------------------------------------------------------
+
+
+static void Test_BuildLists(LIST *Lists, const TEST_RULES *Rules, BOOLEAN Compile)
+{
+    ULONG List, i;
+
+    for (List = 0; List < NUM_LISTS; ++List)
+        List_Init(&Lists[List]);
+
+    for (i = 0; i < Rules->count; ++i) {
+        PATTERN *pat = Pattern_Create(NULL, Rules->text[i], TRUE, Rules->level[i]);
+        List_Insert_After(&Lists[Rules->list[i]], NULL, pat);
+    }
+
+    if (Compile) {
+        for (List = 0; List < NUM_LISTS; ++List)
+            Pattern_CompilePathList(NULL, &Lists[List]);
+    }
+}
+
+
+static void Test_FreeLists(LIST *Lists)
+{
+    ULONG List;
+    PATTERN *pat;
+
+    for (List = 0; List < NUM_LISTS; ++List) {
+        while ((pat = (PATTERN *)List_Head(&Lists[List])) != NULL) {
+            List_Remove(&Lists[List], pat);
+            Pattern_Free(pat);
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Match
+//---------------------------------------------------------------------------
+
+
+static void Test_Match(TEST_MATCH *Match, LIST *Lists, WCHAR *Path, ULONG Len)
+{
+    //
+    // chain the lists like Dll_MatchPath, and keep the single list
+    // result of the Open list, which is the longest one
+    //
+
+    ULONG List;
+    PATTERN *found = NULL;
+
+    Match->level = 3;
+    Match->flags = 0;
+    Match->wildc = -1;
+    Match->match_len = 0;
+    Match->patsrc = NULL;
+
+    for (List = 0; List < NUM_LISTS; ++List) {
+        Pattern_MatchPathListEx(Path, Len, &Lists[List], &Match->level,
+            &Match->match_len, &Match->flags, &Match->wildc, &Match->patsrc);
+    }
+
+    Match->open_level = 3;
+    Match->open_flags = 0;
+    Match->open_wildc = -1;
+    Match->open_len = Pattern_MatchPathList(Path, Len, &Lists[NUM_LISTS - 1],
+        &Match->open_level, &Match->open_flags, &Match->open_wildc, &found);
+    Match->open_src = Match->open_len ? Pattern_Source(found) : NULL;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Same
+//---------------------------------------------------------------------------
+
+
+static BOOLEAN Test_SameSource(const WCHAR *a, const WCHAR *b)
+{
+    //
+    // the found patterns are different objects in the two lists,
+    // so compare their source text
+    //
+
+    if (! a || ! b)
+        return a == b;
+    return wcscmp(a, b) == 0;
+}
+
+
+static BOOLEAN Test_Same(const TEST_MATCH *a, const TEST_MATCH *b)
+{
+    return a->level == b->level && a->flags == b->flags &&
+        a->wildc == b->wildc && a->match_len == b->match_len &&
+        Test_SameSource(a->patsrc, b->patsrc) &&
+        a->open_level == b->open_level && a->open_flags == b->open_flags &&
+        a->open_wildc == b->open_wildc && a->open_len == b->open_len &&
+        Test_SameSource(a->open_src, b->open_src);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Compare
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_Compare(const TEST_RULES *Rules, ULONG Paths, ULONG Words)
+{
+    LIST Linear[NUM_LISTS];
+    LIST Tree[NUM_LISTS];
+    WCHAR Path[MAX_PATH_LEN + 1];
+    ULONG Mismatches = 0;
+    ULONG i;
+
+    Test_BuildLists(Linear, Rules, FALSE);
+    Test_BuildLists(Tree, Rules, TRUE);
+
+    for (i = 0; i < Paths; ++i) {
+
+        TEST_MATCH a, b;
+        ULONG Len = Test_RandomPath(Path, Rules, Words);
+
+        Test_Match(&a, Linear, Path, Len);
+        Test_Match(&b, Tree, Path, Len);
+
+        if (! Test_Same(&a, &b) && Mismatches++ < 5) {
+            printf("mismatch for %ls: level %u/%u flags %u/%u wildc %u/%u len %d/%d\n",
+                Path, a.level, b.level, a.flags, b.flags, a.wildc, b.wildc,
+                a.match_len, b.match_len);
+        }
+    }
+
+    Test_FreeLists(Linear);
+    Test_FreeLists(Tree);
+
+    return Mismatches;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Modified
+//---------------------------------------------------------------------------
+
+
+static void Test_Modified(void)
+{
+    //
+    // a pattern added to a compiled list is not in the tree, the list
+    // count no longer matches and the linear scan must find it
+    //
+
+    LIST List;
+    PATTERN *pat;
+    WCHAR Path[MAX_PATH_LEN + 1];
+    ULONG level, flags;
+    USHORT wildc;
+
+    List_Init(&List);
+    List_Insert_After(&List, NULL, Pattern_Create(NULL, L"\\windows\\*", TRUE, 1));
+    List_Insert_After(&List, NULL, Pattern_Create(NULL, L"\\users\\*", TRUE, 1));
+    TEST_CHECK(Pattern_CompilePathList(NULL, &List));
+
+    List_Insert_After(&List, NULL, Pattern_Create(NULL, L"\\temp\\file", TRUE, 0));
+
+    wcscpy(Path, L"\\temp\\file");
+    level = 3; flags = 0; wildc = -1;
+    TEST_CHECK(Pattern_MatchPathList(Path, (ULONG)wcslen(Path), &List, &level, &flags, &wildc, NULL) == 10);
+    TEST_CHECK(level == 0 && flags == MATCH_FLAG_EXACT && wildc == 0);
+
+    //
+    // a pattern with a trailing backslash matches the folder itself
+    // through the auxiliary backslash, in the tree as in the list
+    //
+
+    List_Insert_After(&List, NULL, Pattern_Create(NULL, L"\\data\\", TRUE, 2));
+    TEST_CHECK(Pattern_CompilePathList(NULL, &List));
+
+    wcscpy(Path, L"\\data");
+    level = 3; flags = 0; wildc = -1;
+    TEST_CHECK(Pattern_MatchPathList(Path, (ULONG)wcslen(Path), &List, &level, &flags, &wildc, NULL) == 6);
+    TEST_CHECK(level == 2 && flags == (MATCH_FLAG_AUX | MATCH_FLAG_EXACT));
+    TEST_CHECK(Path[5] == L'\0');
+
+    while ((pat = (PATTERN *)List_Head(&List)) != NULL) {
+        List_Remove(&List, pat);
+        Pattern_Free(pat);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(const TEST_RULES *Templates)
+{
+    //
+    // the template rules with random rules added, so the lists grow
+    // like with many enabled templates and box specific rules
+    //
+
+    static const ULONG Extra[] = { 0, 1000, 4000, 16000 };
+    ULONG PATHS = 20000;
+    WCHAR Text[MAX_PATH_LEN];
+    ULONG s, i;
+
+    printf("\n%8s  %8s  %12s  %12s  %8s\n", "rules", "paths", "linear us", "tree us", "speedup");
+
+    for (s = 0; s < sizeof(Extra) / sizeof(Extra[0]); ++s) {
+
+        TEST_RULES Rules;
+        LIST Linear[NUM_LISTS];
+        LIST Tree[NUM_LISTS];
+        WCHAR (*Paths)[MAX_PATH_LEN + 1];
+        ULONG *Lens;
+        ULONG Sum_Linear = 0, Sum_Tree = 0;
+        double t0, t_linear, t_tree;
+
+        memzero(&Rules, sizeof(Rules));
+        for (i = 0; i < Templates->count; ++i)
+            Test_AddRule(&Rules, Templates->text[i], Templates->list[i], Templates->level[i]);
+        for (i = 0; i < Extra[s]; ++i) {
+            Test_RandomRule(Text, NUM_WORDS);
+            Test_AddRule(&Rules, Text, Test_Rand(NUM_LISTS), Test_Rand(3));
+        }
+
+        Paths = malloc(PATHS * sizeof(*Paths));
+        Lens = malloc(PATHS * sizeof(ULONG));
+        for (i = 0; i < PATHS; ++i)
+            Lens[i] = Test_RandomPath(Paths[i], &Rules, NUM_WORDS);
+
+        Test_BuildLists(Linear, &Rules, FALSE);
+        Test_BuildLists(Tree, &Rules, TRUE);
+
+        t0 = Test_Time();
+        for (i = 0; i < PATHS; ++i) {
+            TEST_MATCH m;
+            Test_Match(&m, Linear, Paths[i], Lens[i]);
+            Sum_Linear += m.match_len;
+        }
+        t_linear = Test_Time() - t0;
+
+        t0 = Test_Time();
+        for (i = 0; i < PATHS; ++i) {
+            TEST_MATCH m;
+            Test_Match(&m, Tree, Paths[i], Lens[i]);
+            Sum_Tree += m.match_len;
+        }
+        t_tree = Test_Time() - t0;
+
+        TEST_CHECK(Sum_Linear == Sum_Tree);
+
+        printf("%8u  %8u  %12.3f  %12.3f  %7.1fx\n", Rules.count, PATHS,
+            t_linear * 1000.0 / PATHS, t_tree * 1000.0 / PATHS,
+            t_tree > 0 ? t_linear / t_tree : 0.0);
+
+        Test_FreeLists(Linear);
+        Test_FreeLists(Tree);
+        Test_FreeRules(&Rules);
+        free(Paths);
+        free(Lens);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    BOOLEAN Bench = (argc > 1 && strcmp(argv[1], "bench") == 0);
+    const char *Path = (argc > 1 + Bench) ? argv[1 + Bench] : "../install/Templates.ini";
+    TEST_RULES Templates;
+    TEST_RULES Rules;
+    WCHAR Text[MAX_PATH_LEN];
+    ULONG Round, i;
+
+    memzero(&Templates, sizeof(Templates));
+    ULONG Count = Test_LoadTemplates(&Templates, Path);
+    TEST_CHECK(Count != 0);
+    printf("%u file path rules from %s\n", Count, Path);
+
+    TEST_CHECK(Test_Compare(&Templates, 10000, NUM_WORDS) == 0);
+
+    for (Round = 0; Round < 100; ++Round) {
+
+        ULONG Words = 3 + Test_Rand(NUM_WORDS - 3);
+
+        memzero(&Rules, sizeof(Rules));
+        ULONG Num = 1 + Test_Rand(Round < 50 ? 40 : 200);
+        for (i = 0; i < Num; ++i) {
+            Test_RandomRule(Text, Words);
+            Test_AddRule(&Rules, Text, Test_Rand(NUM_LISTS), Test_Rand(4));
+        }
+
+        TEST_CHECK(Test_Compare(&Rules, 1000, Words) == 0);
+        Test_FreeRules(&Rules);
+    }
+
+    Test_Modified();
+
+    if (Bench)
+        Test_Benchmark(&Templates);
+
+    Test_FreeRules(&Templates);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,443 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Template Check Entry Index Test
+//---------------------------------------------------------------------------
+
+
+//
+// checks the patterns of install/Templates.ini against synthetic object,
+// window class, service and product inventories through the CWildIndex of
+// SandboxiePlus/QSbieAPI/Helpers/WildIndex.h, as CSbieTemplates::RunCheck
+// does, and compares every answer with a scan of the whole inventory, which
+// is how the checks worked before the index.  the index is instantiated
+// with std::wstring here, so no Qt is needed
+//
+// g++ -I../.. -o template_index_test template_index_test.cpp
+// cl /EHsc /I..\.. template_index_test.cpp
+//
+// template_index_test [bench] [path to Templates.ini]
+//
+
+
+#include "test_stubs.h"
+
+#include <string>
+#include <vector>
+
+#include "SandboxiePlus/QSbieAPI/Helpers/WildIndex.h"
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef std::wstring TEST_STRING;
+typedef std::vector<TEST_STRING> TEST_LIST;
+
+
+enum {
+    TEST_OBJECTS = 0,
+    TEST_CLASSES,
+    TEST_SERVICES,
+    TEST_PRODUCTS,
+    TEST_KINDS
+};
+
+
+static const char *Test_KindNames[TEST_KINDS] = {
+    "objects", "classes", "services", "products"
+};
+
+
+static TEST_LIST Test_Patterns[TEST_KINDS];
+
+
+//---------------------------------------------------------------------------
+// Test_WildCompare
+//---------------------------------------------------------------------------
+
+
+static bool Test_WildCompare(const TEST_STRING& Wild, const TEST_STRING& Str)
+{
+    //
+    // same algorithm as wildcmpex behind CSbieUtils::WildCompare
+    //
+
+    const WCHAR *w = Wild.c_str(), *s = Str.c_str();
+    const WCHAR *cp = NULL, *mp = NULL;
+
+    while (*s && *w != L'*') {
+        if (*w != *s && *w != L'?')
+            return false;
+        w++;
+        s++;
+    }
+
+    while (*s) {
+        if (*w == L'*') {
+            if (! *++w)
+                return true;
+            mp = w;
+            cp = s + 1;
+        } else if (*w == *s || *w == L'?') {
+            w++;
+            s++;
+        } else {
+            w = mp;
+            s = cp++;
+        }
+    }
+
+    while (*w == L'*')
+        w++;
+    return ! *w;
+}
+
+
+typedef CWildIndex<TEST_STRING, TEST_LIST, &Test_WildCompare> TEST_INDEX;
+
+
+//---------------------------------------------------------------------------
+// Test_ScanMatch
+//---------------------------------------------------------------------------
+
+
+static bool Test_ScanMatch(const TEST_LIST& List, const TEST_STRING& Wild)
+{
+    for (size_t i = 0; i < List.size(); i++) {
+        if (Test_WildCompare(Wild, List[i]))
+            return true;
+    }
+    return false;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_LoadTemplates
+//---------------------------------------------------------------------------
+
+
+static TEST_STRING Test_Utf8(const char *Str)
+{
+    TEST_STRING Out;
+    const UCHAR *p = (const UCHAR *)Str;
+
+    while (*p) {
+        ULONG c = *p++, n = 0;
+        if (c >= 0xF0)      { c &= 0x07; n = 3; }
+        else if (c >= 0xE0) { c &= 0x0F; n = 2; }
+        else if (c >= 0xC0) { c &= 0x1F; n = 1; }
+        while (n-- && (*p & 0xC0) == 0x80)
+            c = (c << 6) | (*p++ & 0x3F);
+        Out += (WCHAR)c;
+    }
+    return Out;
+}
+
+
+static TEST_STRING Test_Lower(TEST_STRING Str)
+{
+    for (size_t i = 0; i < Str.size(); i++)
+        Str[i] = (WCHAR)towlower(Str[i]);
+    return Str;
+}
+
+
+static ULONG Test_LoadTemplates(const char *Path)
+{
+    //
+    // collect the values CSbieTemplates::CheckTemplate passes to
+    // CheckObjects, CheckClasses, CheckServices and CheckProducts,
+    // lower case like those do
+    //
+
+    static const char *Skip[] = {
+        "\\RPC Control\\epmapper", "\\RPC Control\\OLE*", "\\RPC Control\\LRPC*",
+        "*\\BaseNamedObjects*\\NamedBuffer*mAH*Process*API*", NULL
+    };
+
+    FILE *File = fopen(Path, "rb");
+    if (! File)
+        return 0;
+
+    char Line[2048];
+    ULONG Count = 0;
+
+    while (fgets(Line, sizeof(Line), File)) {
+
+        char *Value = strchr(Line, '=');
+        if (! Value)
+            continue;
+        *Value++ = '\0';
+        Value[strcspn(Value, "\r\n")] = '\0';
+
+        int Kind = -1;
+        if (_stricmp(Line, "OpenIpcPath") == 0 || _stricmp(Line, "Tmpl.ScanIpc") == 0) {
+            int i;
+            for (i = 0; Skip[i] && strcmp(Value, Skip[i]) != 0; i++)
+                ;
+            if (! Skip[i])
+                Kind = TEST_OBJECTS;
+        }
+        else if (_stricmp(Line, "OpenWinClass") == 0 || _stricmp(Line, "Tmpl.ScanWinClass") == 0) {
+            if (strncmp(Value, "*:", 2) != 0)
+                Kind = TEST_CLASSES;
+        }
+        else if (_stricmp(Line, "Tmpl.ScanService") == 0)
+            Kind = TEST_SERVICES;
+        else if (_stricmp(Line, "Tmpl.ScanProduct") == 0)
+            Kind = TEST_PRODUCTS;
+
+        if (Kind != -1 && *Value) {
+            Test_Patterns[Kind].push_back(Test_Lower(Test_Utf8(Value)));
+            ++Count;
+        }
+    }
+
+    fclose(File);
+    return Count;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Inventory
+//---------------------------------------------------------------------------
+
+
+static TEST_STRING Test_RandomName(ULONG MinLen, ULONG MaxLen)
+{
+    static const WCHAR Chars[] = L"abcdefghijklmnopqrstuvwxyz0123456789_-.{}";
+
+    TEST_STRING Name;
+    ULONG Len = MinLen + Test_Rand(MaxLen - MinLen + 1);
+    for (ULONG i = 0; i < Len; i++)
+        Name += Chars[Test_Rand(sizeof(Chars) / sizeof(WCHAR) - 1)];
+    return Name;
+}
+
+
+static TEST_STRING Test_Instance(const TEST_STRING& Wild)
+{
+    //
+    // an entry which the pattern matches, wildcards replaced by text
+    //
+
+    TEST_STRING Str;
+    for (size_t i = 0; i < Wild.size(); i++) {
+        if (Wild[i] == L'*')
+            Str += Test_RandomName(0, 6);
+        else if (Wild[i] == L'?')
+            Str += Test_RandomName(1, 1);
+        else
+            Str += Wild[i];
+    }
+    return Str;
+}
+
+
+static void Test_Inventory(TEST_LIST& List, int Kind, ULONG Count, ULONG Instances)
+{
+    //
+    // synthetic entries shaped like the ones CSbieTemplates collects,
+    // plus a few which match one of the template patterns
+    //
+
+    static const char *ObjDirs[] = {
+        "\\basenamedobjects\\", "\\sessions\\1\\basenamedobjects\\",
+        "\\rpc control\\", "\\device\\", "\\sessions\\1\\windows\\"
+    };
+
+    List.clear();
+    List.reserve(Count + Instances);
+
+    for (ULONG i = 0; i < Count; i++) {
+
+        TEST_STRING Entry;
+        switch (Kind) {
+        case TEST_OBJECTS:
+            Entry = Test_Utf8(ObjDirs[Test_Rand(5)]) + Test_RandomName(4, 40);
+            break;
+        case TEST_CLASSES:
+            Entry = Test_Rand(4) ? Test_RandomName(4, 30) : L"afx:" + Test_RandomName(8, 8) + L":0";
+            break;
+        case TEST_SERVICES:
+            Entry = Test_RandomName(3, 24);
+            break;
+        default:
+            Entry = Test_Rand(2) ? Test_RandomName(4, 30) : L"{" + Test_RandomName(36, 36) + L"}";
+            break;
+        }
+        List.push_back(Entry);
+    }
+
+    const TEST_LIST& Patterns = Test_Patterns[Kind];
+    for (ULONG i = 0; i < Instances && ! Patterns.empty(); i++)
+        List.push_back(Test_Instance(Patterns[Test_Rand((ULONG)Patterns.size())]));
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Compare
+//---------------------------------------------------------------------------
+
+
+static void Test_Compare(void)
+{
+    //
+    // every pattern gives the same answer through the index as through
+    // a scan, for inventories with and without matching entries
+    //
+
+    ULONG Sizes[] = { 0, 1, 50, 2000 };
+    TEST_LIST List;
+    TEST_INDEX Index;
+
+    for (int Kind = 0; Kind < TEST_KINDS; Kind++) {
+        for (ULONG s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++) {
+
+            Test_Inventory(List, Kind, Sizes[s], Sizes[s] / 10);
+            Index.Build(List);
+
+            ULONG Hits = 0;
+            const TEST_LIST& Patterns = Test_Patterns[Kind];
+            for (size_t i = 0; i < Patterns.size(); i++) {
+                bool Expected = Test_ScanMatch(List, Patterns[i]);
+                TEST_CHECK(Index.Match(Patterns[i]) == Expected);
+                Hits += Expected;
+            }
+
+            if (Sizes[s] == 0)
+                TEST_CHECK(Hits == 0);
+        }
+    }
+
+    //
+    // patterns with no literal prefix or suffix, wildcards next to
+    // each other, a '?' right after the prefix, path components which
+    // start the entry or sit in the middle of it and duplicate entries
+    //
+
+    const WCHAR *Entries[] = {
+        L"abc", L"abc", L"abcd", L"xabc", L"a", L"", L"ab*c", L"zzz_tail",
+        L"\\a\\b", L"x\\abc\\d", L"\\sessions\\1\\basenamedobjects\\foo", NULL
+    };
+    const WCHAR *Wilds[] = {
+        L"*", L"?", L"??", L"*?*", L"**", L"abc", L"ab", L"ab?", L"ab?d", L"a*",
+        L"*c", L"*bc*", L"x*c", L"?abc", L"ab*c", L"*tail", L"zz*l", L"zzz?tail",
+        L"q*", L"*q", L"a?*?d", L"", L"*\\a*", L"*\\b*", L"*\\ab*\\?", L"*x\\ab*",
+        L"*\\basenamedobjects*\\foo*", L"*\\basenamedobjects*\\bar*", L"\\a*",
+        L"*\\sessions\\*\\basenamedobjects\\*", L"*\\1*\\basenamedobjects\\*", NULL
+    };
+
+    List.clear();
+    for (int i = 0; Entries[i]; i++)
+        List.push_back(Entries[i]);
+    Index.Build(List);
+    TEST_CHECK(Index.Count() == 10);
+
+    for (int i = 0; Wilds[i]; i++)
+        TEST_CHECK(Index.Match(Wilds[i]) == Test_ScanMatch(List, Wilds[i]));
+
+    Index.Clear();
+    TEST_CHECK(Index.Count() == 0 && ! Index.Match(L"*"));
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    //
+    // time to check all template patterns of a kind, with a scan of the
+    // inventory per pattern and through the index, and the time to build
+    // the index.  a real system has a few hundred to a few thousand
+    // services and products and up to tens of thousands of objects
+    //
+
+    ULONG Sizes[] = { 1000, 10000, 100000 };
+    TEST_LIST List;
+    TEST_INDEX Index;
+    double t0, t_scan, t_index, t_build;
+    ULONG Hits_Scan, Hits_Index;
+
+    printf("kind      patterns   entries    ms scan   ms index   ms build\n");
+
+    for (int Kind = 0; Kind < TEST_KINDS; Kind++) {
+        for (ULONG s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++) {
+
+            const TEST_LIST& Patterns = Test_Patterns[Kind];
+            Test_Inventory(List, Kind, Sizes[s], 10);
+
+            t0 = Test_Time();
+            Hits_Scan = 0;
+            for (size_t i = 0; i < Patterns.size(); i++)
+                Hits_Scan += Test_ScanMatch(List, Patterns[i]);
+            t_scan = Test_Time() - t0;
+
+            t0 = Test_Time();
+            Index.Build(List);
+            t_build = Test_Time() - t0;
+
+            ULONG Runs = 0;
+            t0 = Test_Time();
+            do {
+                Hits_Index = 0;
+                for (size_t i = 0; i < Patterns.size(); i++)
+                    Hits_Index += Index.Match(Patterns[i]);
+                ++Runs;
+            } while (Test_Time() - t0 < 100);
+            t_index = (Test_Time() - t0) / Runs;
+
+            TEST_CHECK(Hits_Scan == Hits_Index);
+
+            printf("%-8s  %8u  %8u  %9.2f  %9.3f  %9.2f\n", Test_KindNames[Kind],
+                (ULONG)Patterns.size(), Sizes[s], t_scan, t_index, t_build);
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    bool Bench = (argc > 1 && strcmp(argv[1], "bench") == 0);
+    const char *Path = (argc > 1 + Bench) ? argv[1 + Bench] : "../install/Templates.ini";
+
+    ULONG Count = Test_LoadTemplates(Path);
+    TEST_CHECK(Count != 0);
+    for (int Kind = 0; Kind < TEST_KINDS; Kind++)
+        TEST_CHECK(! Test_Patterns[Kind].empty());
+
+    printf("%u patterns from %s\n", Count, Path);
+
+    Test_Compare();
+
+    if (Bench)
+        Test_Benchmark();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Test Stubs
+//---------------------------------------------------------------------------
+
+
+#ifndef _MY_TEST_STUBS_H
+#define _MY_TEST_STUBS_H
+
+
+//
+// the harnesses in this folder build portable parts of the tree as plain
+// user mode programs, on Windows with cl and elsewhere with gcc or clang.
+// outside Windows this header provides the few types and helpers which
+// those parts take from the Windows headers
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <time.h>
+
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+#else
+
+#include <wctype.h>
+#include <strings.h>
+
+typedef void VOID;
+typedef unsigned char UCHAR, BOOLEAN;
+typedef unsigned short USHORT;
+typedef unsigned int ULONG;
+typedef int LONG;
+typedef unsigned long long ULONG64, ULONGLONG;
+typedef long long LONG64, LONGLONG;
+typedef unsigned long long ULONG_PTR, UINT_PTR, SIZE_T;
+typedef char CHAR;
+typedef wchar_t WCHAR;
+typedef void *PVOID, *HANDLE;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+#define TRUE    1
+#define FALSE   0
+
+#define __inline static inline
+#define __declspec(x)
+
+static inline int _stricmp(const char *s1, const char *s2)
+{
+    return strcasecmp(s1, s2);
+}
+
+static inline int _wcsicmp(const wchar_t *s1, const wchar_t *s2)
+{
+    return wcscasecmp(s1, s2);
+}
+
+static inline int _wcsnicmp(const wchar_t *s1, const wchar_t *s2, size_t n)
+{
+    return wcsncasecmp(s1, s2, n);
+}
+
+static inline wchar_t *_wcslwr(wchar_t *s)
+{
+    wchar_t *p;
+    for (p = s; *p; ++p)
+        *p = towlower(*p);
+    return s;
+}
+
+#endif
+
+
+#ifndef memzero
+#define memzero(p,n) memset((p),0,(n))
+#endif
+
+#ifndef _FX
+#define _FX
+#endif
+
+
+//---------------------------------------------------------------------------
+// Test Helpers
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_Seed = 1;
+
+static ULONG Test_Rand(ULONG n)
+{
+    Test_Seed = Test_Seed * 1103515245 + 12345;
+    return n ? ((Test_Seed >> 8) % n) : 0;
+}
+
+static double Test_Time(void)
+{
+    return (double)clock() * 1000.0 / CLOCKS_PER_SEC;
+}
+
+static ULONG Test_Failures = 0;
+
+#define TEST_CHECK(cond) do { if (! (cond)) { ++Test_Failures; \
+    printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); } } while (0)
+
+#define TEST_RESULT() (printf("%s\n", Test_Failures ? "FAILED" : "passed"), \
+    Test_Failures ? 1 : 0)
+
+
+#endif /* _MY_TEST_STUBS_H */
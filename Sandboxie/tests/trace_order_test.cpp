@@ -0,0 +1,315 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Trace Order Test
+//---------------------------------------------------------------------------
+
+
+//
+// simulates sandboxed processes which put trace entries both through the
+// batch of SbieDll, which is sent when it is full, before an entry the
+// driver must check right away, or SBIEAPI_MONITOR_BATCH_DELAY after its
+// first entry, and directly into the log of the driver.  a reader takes
+// the log at the intervals of the CSbieAPI thread and passes the entries
+// through the CTraceOrder of SandboxiePlus/QSbieAPI/Helpers/TraceOrder.h,
+// which CSbieAPI instantiates with CTraceEntryPtr, here with a plain
+// struct.  checks that the log itself is out of order, that the released
+// entries are all there and in the order they were made, and how long
+// they are held.  the benchmark gives the time per entry and the number
+// of entries held, against the share of batched entries
+//
+// g++ -std=c++17 -I../.. -o trace_order_test trace_order_test.cpp
+// cl /EHsc /std:c++17 /I..\.. trace_order_test.cpp
+//
+
+
+#include "test_stubs.h"
+
+#include <vector>
+
+#include "SandboxiePlus/QSbieAPI/Helpers/TraceOrder.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define TEST_BATCH_DELAY    100     // ms, SBIEAPI_MONITOR_BATCH_DELAY
+#define TEST_BATCH_MAX      200     // entries which fit into a batch
+#define TEST_POLL_MAX       50      // ms, the longest wait of the reader
+#define TEST_HOLD_TIME      250     // ms, the default of CTraceOrder
+#define TEST_PROCESSES      4
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+struct STestEntry
+{
+    ULONGLONG Time;     // when it was made, in 100 ns
+    ULONG Id;           // in the order the entries were made
+    ULONGLONG Arrived;  // ms
+};
+
+
+struct STestProcess
+{
+    std::vector<STestEntry> Batch;
+    ULONGLONG BatchStart;
+};
+
+
+struct STestRun
+{
+    std::vector<STestEntry> Log;        // the order of the driver log
+    std::vector<STestEntry> Released;   // the order of CSbieAPI::GetTrace
+    ULONGLONG MaxHeld;                  // ms from arrival to release
+    int MaxCount;                       // entries held at once
+    double Ms;                          // spent in CTraceOrder
+};
+
+
+//---------------------------------------------------------------------------
+// Test_Run
+//---------------------------------------------------------------------------
+
+
+static void Test_Run(STestRun& Run, ULONG Duration, ULONG Batched, ULONGLONG HoldTime)
+{
+    //
+    // each ms every process makes up to 3 entries, Batched of 100 go into
+    // its batch.  a direct entry the driver checks sends the batch first,
+    // like SbieApi_MonitorPut2Ex, the others are logged right away
+    //
+
+    CTraceOrder<STestEntry> Order(HoldTime);
+    STestProcess Procs[TEST_PROCESSES];
+    ULONG NextId = 0;
+    ULONGLONG NextPoll = 1 + Test_Rand(TEST_POLL_MAX);
+    size_t Read = 0;
+
+    Run.Log.clear();
+    Run.Released.clear();
+    Run.MaxHeld = 0;
+    Run.MaxCount = 0;
+    Run.Ms = 0;
+
+    auto Send = [&](STestProcess& Proc) {
+        Run.Log.insert(Run.Log.end(), Proc.Batch.begin(), Proc.Batch.end());
+        Proc.Batch.clear();
+    };
+
+    auto Poll = [&](ULONGLONG Now) {
+        double t0 = Test_Time();
+        for (; Read < Run.Log.size(); Read++)
+            Order.Add(Run.Log[Read].Time, Run.Log[Read], Now);
+        if (Order.Count() > Run.MaxCount)
+            Run.MaxCount = Order.Count();
+        Order.Release(Now, [&](STestEntry& Entry) {
+            if (Now - Entry.Arrived > Run.MaxHeld)
+                Run.MaxHeld = Now - Entry.Arrived;
+            Run.Released.push_back(Entry);
+        });
+        Run.Ms += Test_Time() - t0;
+    };
+
+    for (ULONGLONG Now = 0; Now < Duration; Now++) {
+
+        ULONG InMs = 0;
+
+        for (int i = 0; i < TEST_PROCESSES; i++) {
+
+            STestProcess& Proc = Procs[i];
+
+            for (ULONG n = Test_Rand(4); n > 0; n--) {
+
+                STestEntry Entry;
+                Entry.Time = Now * 10000 + InMs++ * 10;
+                Entry.Id = NextId++;
+                Entry.Arrived = 0;
+
+                if (Test_Rand(100) < Batched) {
+                    if (Proc.Batch.size() >= TEST_BATCH_MAX)
+                        Send(Proc);
+                    if (Proc.Batch.empty())
+                        Proc.BatchStart = Now;
+                    Proc.Batch.push_back(Entry);
+                } else {
+                    if (Test_Rand(4) == 0)
+                        Send(Proc);
+                    Run.Log.push_back(Entry);
+                }
+            }
+
+            // the helper thread of SbieApi_MonitorBatchStart
+            if (!Proc.Batch.empty() && Now >= Proc.BatchStart + TEST_BATCH_DELAY)
+                Send(Proc);
+        }
+
+        if (Now >= NextPoll) {
+            for (size_t i = Read; i < Run.Log.size(); i++)
+                Run.Log[i].Arrived = Now;
+            Poll(Now);
+            NextPoll = Now + 1 + Test_Rand(TEST_POLL_MAX);
+        }
+    }
+
+    //
+    // the processes exit and the reader keeps going until all is released
+    //
+
+    for (int i = 0; i < TEST_PROCESSES; i++)
+        Send(Procs[i]);
+
+    for (ULONGLONG Now = Duration; Order.Count() || Read < Run.Log.size(); Now += TEST_POLL_MAX) {
+        for (size_t i = Read; i < Run.Log.size(); i++)
+            Run.Log[i].Arrived = Now;
+        Poll(Now);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Inversions
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_Inversions(const std::vector<STestEntry>& List)
+{
+    ULONG Count = 0;
+    for (size_t i = 1; i < List.size(); i++) {
+        if (List[i].Time < List[i - 1].Time)
+            Count++;
+    }
+    return Count;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Compare
+//---------------------------------------------------------------------------
+
+
+static void Test_Compare(void)
+{
+    STestRun Run;
+
+    for (ULONG Round = 0; Round < 40; Round++) {
+
+        ULONG Batched = Round < 10 ? 50 : Test_Rand(101);
+        Test_Run(Run, 2000 + Test_Rand(3000), Batched, TEST_HOLD_TIME);
+
+        //
+        // every entry is released once, in the order the entries were made,
+        // and none is held much longer than the hold time
+        //
+
+        TEST_CHECK(Run.Released.size() == Run.Log.size());
+
+        std::vector<bool> Seen(Run.Log.size(), false);
+        for (size_t i = 0; i < Run.Released.size(); i++) {
+            ULONG Id = Run.Released[i].Id;
+            TEST_CHECK(Id < Seen.size() && !Seen[Id]);
+            if (Id < Seen.size())
+                Seen[Id] = true;
+            if (i > 0)
+                TEST_CHECK(Run.Released[i].Id > Run.Released[i - 1].Id);
+        }
+
+        TEST_CHECK(Run.MaxHeld <= 2 * TEST_HOLD_TIME);
+
+        //
+        // batches reach the log behind later direct entries, unless all
+        // or none are batched
+        //
+
+        if (Batched > 0 && Batched < 100)
+            TEST_CHECK(Test_Inversions(Run.Log) > 0);
+    }
+
+    //
+    // without a hold time the entries are only sorted within each read,
+    // which does not catch up with a batch held back by SbieDll
+    //
+
+    Test_Run(Run, 3000, 50, 0);
+    TEST_CHECK(Run.Released.size() == Run.Log.size());
+    TEST_CHECK(Test_Inversions(Run.Released) > 0);
+
+    //
+    // entries made at the same time stay in the order they arrived in,
+    // an entry made earlier goes before them, a later one behind them
+    //
+
+    CTraceOrder<STestEntry> Order(10);
+    for (ULONG i = 0; i < 5; i++)
+        Order.Add(7, STestEntry{ 7, i + 1, 0 }, 0);
+    Order.Add(3, STestEntry{ 3, 0, 0 }, 5);
+    Order.Add(9, STestEntry{ 9, 6, 0 }, 5);
+
+    std::vector<ULONG> Ids;
+    Order.Release(9, [&](STestEntry& Entry) { Ids.push_back(Entry.Id); });
+    TEST_CHECK(Ids.empty());    // the entry made at 3 just arrived
+    Order.Release(15, [&](STestEntry& Entry) { Ids.push_back(Entry.Id); });
+    TEST_CHECK(Ids.size() == 7 && Order.Count() == 0);
+    for (ULONG i = 0; i < Ids.size(); i++)
+        TEST_CHECK(Ids[i] == i);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    STestRun Run;
+
+    printf("\n%8s  %8s  %10s  %10s  %10s\n",
+        "entries", "batched", "ns/entry", "max held", "max ms");
+
+    for (ULONG Batched = 0; Batched <= 100; Batched += 25) {
+
+        Test_Run(Run, 20000, Batched, TEST_HOLD_TIME);
+
+        printf("%8u  %7u%%  %10.1f  %10d  %10llu\n", (ULONG)Run.Log.size(), Batched,
+            Run.Ms * 1000000.0 / Run.Log.size(), Run.MaxCount, (ULONGLONG)Run.MaxHeld);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    bool Bench = (argc > 1 && strcmp(argv[1], "bench") == 0);
+
+    Test_Compare();
+
+    if (Bench)
+        Test_Benchmark();
+
+    return TEST_RESULT();
+}
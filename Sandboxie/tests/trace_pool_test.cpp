@@ -0,0 +1,373 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Trace String Pool Test
+//---------------------------------------------------------------------------
+
+
+//
+// parses synthetic API_MONITOR_GET2 buffers the way CSbieAPI::GetMonitor
+// does, once with a fresh copy of every string as before, and once through
+// the CStringPool of SandboxiePlus/QSbieAPI/Helpers/StringPool.h, which
+// CTraceStringPool instantiates with QString.  here it is instantiated with
+// std::wstring, so no Qt is needed.  checks that the interned strings hold
+// the text of the buffer and are shared for equal text, and that the pool
+// is dropped at its size bound.  the benchmark counts the heap bytes held
+// per trace entry for both, against the number of distinct paths
+//
+// g++ -std=c++17 -I../.. -o trace_pool_test trace_pool_test.cpp
+// cl /EHsc /std:c++17 /I..\.. trace_pool_test.cpp
+//
+
+
+#include "test_stubs.h"
+
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "SandboxiePlus/QSbieAPI/Helpers/StringPool.h"
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+struct STestStringTraits
+{
+    typedef std::shared_ptr<const std::wstring> String;
+    typedef std::unordered_map<std::wstring_view, String> Map;
+
+    static const String* Find(const Map& Pool, const wchar_t* str, size_t len)
+    {
+        Map::const_iterator I = Pool.find(std::wstring_view(str, len));
+        return I != Pool.end() ? &I->second : NULL;
+    }
+
+    static String Make(const wchar_t* str, size_t len)
+    {
+        return std::make_shared<const std::wstring>(str, len);
+    }
+
+    static void Insert(Map& Pool, const String& String)
+    {
+        Pool.emplace(std::wstring_view(*String), String);
+    }
+};
+
+typedef CStringPool<STestStringTraits> CTestStringPool;
+
+
+struct STestEntry
+{
+    LONGLONG Timestamp;
+    ULONG Type;
+    ULONG Pid;
+    ULONG Tid;
+    std::vector<STestStringTraits::String> Strings;
+};
+
+typedef std::vector<std::unique_ptr<STestEntry>> TEST_ENTRIES;
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static size_t Test_HeapBytes = 0;
+
+
+//---------------------------------------------------------------------------
+// operator new
+//---------------------------------------------------------------------------
+
+
+//
+// every allocation carries its size in front, so the bytes held on the
+// heap can be counted at any point
+//
+
+void* operator new(size_t size)
+{
+    size_t* ptr = (size_t*)malloc(sizeof(max_align_t) + size);
+    if (! ptr)
+        throw std::bad_alloc();
+    *ptr = size;
+    Test_HeapBytes += size;
+    return (char*)ptr + sizeof(max_align_t);
+}
+
+void operator delete(void* p) noexcept
+{
+    if (p) {
+        size_t* ptr = (size_t*)((char*)p - sizeof(max_align_t));
+        Test_HeapBytes -= *ptr;
+        free(ptr);
+    }
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Put
+//---------------------------------------------------------------------------
+
+
+static UCHAR* Test_Put(UCHAR* ptr, const void* data, size_t len)
+{
+    memcpy(ptr, data, len);
+    return ptr + len;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_MakeBuffer
+//---------------------------------------------------------------------------
+
+
+static std::vector<UCHAR> Test_MakeBuffer(ULONG Count, ULONG Paths)
+{
+    //
+    // entries as Session_MonitorPutEx writes them, an access string, an
+    // object path taken from a set of Paths distinct ones and a status,
+    // then the end of strings marker and no tags.  a zero size ends the
+    // buffer
+    //
+
+    static const wchar_t* Accesses[] = { L"Open", L"Closed", L"Read" };
+    std::vector<UCHAR> Buffer;
+
+    for (ULONG i = 0; i < Count; i++) {
+
+        wchar_t Path[96];
+        swprintf(Path, 96, L"\\Device\\HarddiskVolume3\\Users\\User\\AppData\\Local\\Vendor\\File%05u.dat",
+            Test_Rand(Paths));
+        std::wstring Strings[3] = { Accesses[Test_Rand(3)], Path, L"(00000000)" };
+
+        ULONG uSize = sizeof(LONGLONG) + 3 * sizeof(ULONG) + sizeof(WCHAR);
+        for (int j = 0; j < 3; j++)
+            uSize += (ULONG)(Strings[j].length() + 1) * sizeof(WCHAR);
+
+        size_t Offset = Buffer.size();
+        Buffer.resize(Offset + sizeof(ULONG) + uSize);
+        UCHAR* ptr = Buffer.data() + Offset;
+
+        LONGLONG uTimestamp = i;
+        ULONG uType = 0x0101, uPid = 100 + Test_Rand(8), uTid = uPid + 4;
+        ptr = Test_Put(ptr, &uSize, sizeof(ULONG));
+        ptr = Test_Put(ptr, &uTimestamp, sizeof(LONGLONG));
+        ptr = Test_Put(ptr, &uType, sizeof(ULONG));
+        ptr = Test_Put(ptr, &uPid, sizeof(ULONG));
+        ptr = Test_Put(ptr, &uTid, sizeof(ULONG));
+        for (int j = 0; j < 3; j++)
+            ptr = Test_Put(ptr, Strings[j].c_str(), (Strings[j].length() + 1) * sizeof(WCHAR));
+        WCHAR uEnd = 0xFFFF;
+        ptr = Test_Put(ptr, &uEnd, sizeof(WCHAR));
+    }
+
+    Buffer.resize(Buffer.size() + sizeof(ULONG), 0);
+    return Buffer;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Parse
+//---------------------------------------------------------------------------
+
+
+static void Test_Parse(const std::vector<UCHAR>& Buffer, CTestStringPool* Pool, TEST_ENTRIES& Entries)
+{
+    //
+    // the loop of CSbieAPI::GetMonitor, without a pool every string
+    // is copied like QString::fromWCharArray did
+    //
+
+    for (const UCHAR* ptr = Buffer.data(); *(ULONG*)ptr > 0; ) {
+
+        ULONG uSize = *(ULONG*)ptr;
+        ptr += sizeof(ULONG);
+
+        std::unique_ptr<STestEntry> Entry(new STestEntry);
+
+        Entry->Timestamp = *(LONGLONG*)ptr;
+        ptr += sizeof(LONGLONG);
+        uSize -= sizeof(LONGLONG);
+
+        Entry->Type = *(ULONG*)ptr;
+        ptr += sizeof(ULONG);
+        uSize -= sizeof(ULONG);
+
+        Entry->Pid = *(ULONG*)ptr;
+        ptr += sizeof(ULONG);
+        uSize -= sizeof(ULONG);
+
+        Entry->Tid = *(ULONG*)ptr;
+        ptr += sizeof(ULONG);
+        uSize -= sizeof(ULONG);
+
+        for (; uSize > 0;) {
+            if (*(WCHAR*)ptr == 0xFFFF) { // end of strings marker
+                ptr += sizeof(WCHAR);
+                uSize -= sizeof(WCHAR);
+                break;
+            }
+            size_t len = wcslen((WCHAR*)ptr);
+            if (Pool)
+                Entry->Strings.push_back(Pool->Intern((WCHAR*)ptr, len));
+            else
+                Entry->Strings.push_back(STestStringTraits::Make((WCHAR*)ptr, len));
+            ptr += (len + 1) * sizeof(WCHAR);
+            uSize -= (ULONG)((len + 1) * sizeof(WCHAR));
+        }
+
+        ptr += uSize; // tags
+
+        Entries.push_back(std::move(Entry));
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Compare
+//---------------------------------------------------------------------------
+
+
+static void Test_Compare(void)
+{
+    for (ULONG Round = 0; Round < 50; Round++) {
+
+        ULONG Count = 1 + Test_Rand(2000);
+        ULONG Paths = 1 + Test_Rand(Round < 25 ? 20 : 5000);
+        std::vector<UCHAR> Buffer = Test_MakeBuffer(Count, Paths);
+
+        CTestStringPool Pool(2 + Test_Rand(2) * 100);
+        TEST_ENTRIES Copied, Interned;
+        Test_Parse(Buffer, NULL, Copied);
+        Test_Parse(Buffer, &Pool, Interned);
+
+        TEST_CHECK(Copied.size() == Count);
+        TEST_CHECK(Interned.size() == Count);
+        TEST_CHECK(Pool.Count() <= 102);
+
+        //
+        // the same entries with the same text, and the pool never
+        // hands out two strings of the same text while it is not dropped
+        //
+
+        std::unordered_map<std::wstring, const std::wstring*> Seen;
+        int LastCount = 0;
+
+        for (ULONG i = 0; i < Count && i < Interned.size(); i++) {
+
+            STestEntry* Entry1 = Copied[i].get();
+            STestEntry* Entry2 = Interned[i].get();
+            TEST_CHECK(Entry1->Timestamp == Entry2->Timestamp && Entry1->Pid == Entry2->Pid);
+            TEST_CHECK(Entry1->Strings.size() == 3 && Entry2->Strings.size() == 3);
+
+            for (size_t j = 0; j < Entry1->Strings.size() && j < Entry2->Strings.size(); j++)
+                TEST_CHECK(*Entry1->Strings[j] == *Entry2->Strings[j]);
+        }
+
+        Pool.Clear();
+        for (ULONG i = 0; i < Count; i++) {
+            for (size_t j = 0; j < Copied[i]->Strings.size(); j++) {
+                const std::wstring& Text = *Copied[i]->Strings[j];
+                STestStringTraits::String String = Pool.Intern(Text.c_str(), Text.length());
+                TEST_CHECK(*String == Text);
+                if (Pool.Count() < LastCount)
+                    Seen.clear(); // dropped at the bound
+                LastCount = Pool.Count();
+                auto I = Seen.find(Text);
+                if (I == Seen.end())
+                    Seen.emplace(Text, String.get());
+                else
+                    TEST_CHECK(I->second == String.get());
+            }
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    const ULONG Count = 100000;
+
+    printf("\n%8s  %8s  %14s  %14s  %10s  %10s\n",
+        "entries", "paths", "copy B/entry", "pool B/entry", "copy ms", "pool ms");
+
+    for (ULONG Paths = 10; Paths <= 100000; Paths *= 10) {
+
+        std::vector<UCHAR> Buffer = Test_MakeBuffer(Count, Paths);
+        size_t Bytes[2];
+        double Times[2];
+
+        for (int Mode = 0; Mode < 2; Mode++) {
+
+            CTestStringPool* Pool = Mode ? new CTestStringPool() : NULL;
+            TEST_ENTRIES Entries;
+            Entries.reserve(Count);
+
+            size_t Bytes0 = Test_HeapBytes;
+            double t0 = Test_Time();
+            Test_Parse(Buffer, Pool, Entries);
+            Times[Mode] = Test_Time() - t0;
+
+            //
+            // what the trace log keeps, the pool itself is not counted
+            //
+
+            delete Pool;
+            Bytes[Mode] = Test_HeapBytes - Bytes0;
+        }
+
+        printf("%8u  %8u  %14.1f  %14.1f  %10.2f  %10.2f\n", Count, Paths,
+            (double)Bytes[0] / Count, (double)Bytes[1] / Count, Times[0], Times[1]);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    bool Bench = (argc > 1 && strcmp(argv[1], "bench") == 0);
+
+    Test_Compare();
+
+    if (Bench)
+        Test_Benchmark();
+
+    return TEST_RESULT();
+}
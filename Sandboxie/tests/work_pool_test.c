@@ -0,0 +1,592 @@
+/*
+ * Copyright 2024 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Worker Thread Pool Load Test
+//---------------------------------------------------------------------------
+
+
+//
+// runs the worker loop of PipeServer::Thread on the pool bookkeeping of
+// core/svc/workpool.h, with a queue in place of the LPC port.  bursts of
+// requests with handlers that block for a while are put on the queue, the
+// test checks that the pool grows while all threads are busy, never goes
+// beyond its maximum or below its minimum, that no request waits while the
+// pool could still grow, and that the pool shrinks back to its minimum once
+// it has been idle for the timeout.  the benchmark reports how long the
+// requests of a burst wait to be picked up, with a fixed pool of the
+// minimum size and with the pool that grows
+//
+// gcc -O2 -pthread -I.. -o work_pool_test work_pool_test.c
+// cl /O2 /I.. work_pool_test.c
+//
+
+
+#ifndef _WIN32
+#include <pthread.h>            // before test_stubs.h redefines __inline
+#endif
+
+#include "test_stubs.h"
+
+#ifdef _WIN32
+
+typedef CRITICAL_SECTION TEST_MUTEX;
+typedef CONDITION_VARIABLE TEST_COND;
+typedef HANDLE TEST_THREAD;
+
+#define Test_MutexInit(m)           InitializeCriticalSection(m)
+#define Test_Lock(m)                EnterCriticalSection(m)
+#define Test_Unlock(m)              LeaveCriticalSection(m)
+#define Test_CondInit(c)            InitializeConditionVariable(c)
+#define Test_Broadcast(c)           WakeAllConditionVariable(c)
+#define Test_Signal(c)              WakeConditionVariable(c)
+#define Test_Sleep(ms)              Sleep(ms)
+#define Test_Clock()                ((double)GetTickCount64())
+
+static BOOLEAN Test_CondWait(TEST_COND *cond, TEST_MUTEX *mutex, double ms)
+{
+    return SleepConditionVariableCS(cond, mutex, (ms < 0) ? INFINITE : (DWORD)ms);
+}
+
+static void Test_StartThread(TEST_THREAD *thread, void *(*func)(void *), void *arg)
+{
+    *thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)func, arg, 0, NULL);
+}
+
+static void Test_JoinThread(TEST_THREAD thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+#else
+
+typedef pthread_mutex_t TEST_MUTEX;
+typedef pthread_cond_t TEST_COND;
+typedef pthread_t TEST_THREAD;
+
+#define Test_MutexInit(m)           pthread_mutex_init(m, NULL)
+#define Test_Lock(m)                pthread_mutex_lock(m)
+#define Test_Unlock(m)              pthread_mutex_unlock(m)
+#define Test_CondInit(c)            pthread_cond_init(c, NULL)
+#define Test_Broadcast(c)           pthread_cond_broadcast(c)
+#define Test_Signal(c)              pthread_cond_signal(c)
+
+static double Test_Clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void Test_Sleep(ULONG ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+static BOOLEAN Test_CondWait(TEST_COND *cond, TEST_MUTEX *mutex, double ms)
+{
+    struct timespec ts;
+    double until;
+
+    if (ms < 0)
+        return (pthread_cond_wait(cond, mutex) == 0);
+
+    until = Test_Clock() + ms;
+    ts.tv_sec = (time_t)(until / 1000.0);
+    ts.tv_nsec = (long)((until - ts.tv_sec * 1000.0) * 1000000.0);
+    return (pthread_cond_timedwait(cond, mutex, &ts) == 0);
+}
+
+static void Test_StartThread(TEST_THREAD *thread, void *(*func)(void *), void *arg)
+{
+    pthread_create(thread, NULL, func, arg);
+}
+
+static void Test_JoinThread(TEST_THREAD thread)
+{
+    pthread_join(thread, NULL);
+}
+
+#define InterlockedIncrement(p)     __sync_add_and_fetch((p), 1)
+#define InterlockedDecrement(p)     __sync_sub_and_fetch((p), 1)
+
+#endif
+
+#include "core/svc/workpool.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define MIN_THREADS     4
+#define MAX_THREADS     16
+#define MAX_STARTED     4096            // threads started over the whole run
+#define MAX_QUEUE       1024
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+typedef struct _TEST_REQUEST {
+
+    double queued;                      // Test_Clock when it was put
+    ULONG block_ms;                     // how long the handler blocks
+
+} TEST_REQUEST;
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static TEST_MUTEX Test_PortLock;        // the queue in place of the port
+static TEST_COND Test_PortCond;
+static TEST_COND Test_DoneCond;
+static TEST_REQUEST Test_Queue[MAX_QUEUE];
+static ULONG Test_QueueHead, Test_QueueCount;
+static ULONG Test_Done;
+static BOOLEAN Test_Shutdown;
+
+static TEST_MUTEX Test_PoolLock;        // like PipeServer::m_lock
+static WORK_POOL Test_Pool;
+static HANDLE Test_Handles[MAX_THREADS];
+static ULONG Test_Ids[MAX_THREADS];
+static ULONG Test_IdleTimeout;          // ms
+
+static TEST_THREAD Test_Threads[MAX_STARTED];
+static ULONG Test_Started, Test_Retired;
+static ULONG Test_MaxSeen;
+
+static double Test_MaxDelay;            // ms a request waited on the port
+static double Test_SumDelay;
+static ULONG Test_Picked;
+
+
+//---------------------------------------------------------------------------
+// Test_Wait
+//---------------------------------------------------------------------------
+
+
+static BOOLEAN Test_Wait(TEST_REQUEST *req, BOOLEAN UseTimeout)
+{
+    //
+    // NtReplyWaitReceivePortEx, returns FALSE on a timeout or on shutdown
+    //
+
+    double until = Test_Clock() + Test_IdleTimeout;
+    BOOLEAN ok = FALSE;
+
+    Test_Lock(&Test_PortLock);
+
+    while (! Test_Shutdown && ! Test_QueueCount) {
+
+        double ms = UseTimeout ? until - Test_Clock() : -1;
+        if (UseTimeout && ms <= 0)
+            break;
+        Test_CondWait(&Test_PortCond, &Test_PortLock, ms);
+    }
+
+    if (! Test_Shutdown && Test_QueueCount) {
+
+        *req = Test_Queue[Test_QueueHead];
+        Test_QueueHead = (Test_QueueHead + 1) % MAX_QUEUE;
+        --Test_QueueCount;
+        ok = TRUE;
+    }
+
+    Test_Unlock(&Test_PortLock);
+
+    return ok;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Put
+//---------------------------------------------------------------------------
+
+
+static void Test_Put(ULONG count, ULONG block_ms)
+{
+    ULONG i;
+
+    Test_Lock(&Test_PortLock);
+
+    for (i = 0; i < count && Test_QueueCount < MAX_QUEUE; ++i) {
+
+        TEST_REQUEST *req =
+            &Test_Queue[(Test_QueueHead + Test_QueueCount) % MAX_QUEUE];
+        req->queued = Test_Clock();
+        req->block_ms = block_ms;
+        ++Test_QueueCount;
+    }
+
+    Test_Broadcast(&Test_PortCond);
+    Test_Unlock(&Test_PortLock);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_AddThread
+//---------------------------------------------------------------------------
+
+
+static void *Test_Worker(void *arg);
+
+
+static void Test_AddThread(void)
+{
+    //
+    // PipeServer::AddThread, the index into Test_Threads is the thread id
+    //
+
+    Test_Lock(&Test_PoolLock);
+
+    if (! Test_Shutdown && WorkPool_CanAdd(&Test_Pool) &&
+            Test_Started < MAX_STARTED) {
+
+        ULONG id = Test_Started++;
+        WorkPool_Add(&Test_Pool, (HANDLE)(ULONG_PTR)(id + 1), id + 1);
+        if (Test_Pool.num_threads > Test_MaxSeen)
+            Test_MaxSeen = Test_Pool.num_threads;
+        Test_StartThread(&Test_Threads[id], Test_Worker, (void *)(ULONG_PTR)(id + 1));
+    }
+
+    Test_Unlock(&Test_PoolLock);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_RemoveThread
+//---------------------------------------------------------------------------
+
+
+static BOOLEAN Test_RemoveThread(ULONG id)
+{
+    HANDLE hThread;
+
+    Test_Lock(&Test_PoolLock);
+
+    hThread = Test_Shutdown ? NULL : WorkPool_Remove(&Test_Pool, id);
+    TEST_CHECK(Test_Pool.num_threads >= MIN_THREADS);
+    if (hThread) {
+        TEST_CHECK(hThread == (HANDLE)(ULONG_PTR)id);
+        ++Test_Retired;
+    }
+
+    Test_Unlock(&Test_PoolLock);
+
+    return (hThread != NULL);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Worker
+//---------------------------------------------------------------------------
+
+
+static void *Test_Worker(void *arg)
+{
+    //
+    // the loop of PipeServer::Thread
+    //
+
+    ULONG id = (ULONG)(ULONG_PTR)arg;
+    TEST_REQUEST req;
+    double delay;
+
+    while (1) {
+
+        BOOLEAN UseTimeout = WorkPool_Waiting(&Test_Pool);
+        BOOLEAN ok = Test_Wait(&req, UseTimeout);
+
+        if (Test_Shutdown)
+            break;
+
+        if (! ok) {
+
+            if (WorkPool_TimedOut(&Test_Pool) && Test_RemoveThread(id))
+                return NULL;
+            continue;
+        }
+
+        if (WorkPool_Received(&Test_Pool))
+            Test_AddThread();
+
+        //
+        // how long the request waited on the port, which is longer than
+        // its handler blocks when it had to wait for a busy thread
+        //
+
+        delay = Test_Clock() - req.queued;
+
+        Test_Lock(&Test_PortLock);
+        Test_SumDelay += delay;
+        ++Test_Picked;
+        if (delay > Test_MaxDelay)
+            Test_MaxDelay = delay;
+        Test_Unlock(&Test_PortLock);
+
+        Test_Sleep(req.block_ms);
+
+        Test_Lock(&Test_PortLock);
+        ++Test_Done;
+        Test_Broadcast(&Test_DoneCond);
+        Test_Unlock(&Test_PortLock);
+    }
+
+    return NULL;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Start
+//---------------------------------------------------------------------------
+
+
+static void Test_Start(ULONG min_threads, ULONG max_threads, ULONG idle_timeout)
+{
+    ULONG i;
+
+    Test_QueueHead = Test_QueueCount = Test_Done = 0;
+    Test_Shutdown = FALSE;
+    Test_Started = Test_Retired = Test_MaxSeen = 0;
+    Test_MaxDelay = Test_SumDelay = 0;
+    Test_Picked = 0;
+    Test_IdleTimeout = idle_timeout;
+
+    memzero(Test_Handles, sizeof(Test_Handles));
+    memzero(Test_Ids, sizeof(Test_Ids));
+    WorkPool_Init(&Test_Pool, min_threads, max_threads, Test_Handles, Test_Ids);
+
+    for (i = 0; i < min_threads; ++i)
+        Test_AddThread();
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Stop
+//---------------------------------------------------------------------------
+
+
+static void Test_Stop(void)
+{
+    ULONG i, started;
+
+    Test_Lock(&Test_PoolLock);
+    Test_Lock(&Test_PortLock);
+    Test_Shutdown = TRUE;
+    Test_Broadcast(&Test_PortCond);
+    Test_Unlock(&Test_PortLock);
+    started = Test_Started;
+    Test_Unlock(&Test_PoolLock);
+
+    for (i = 0; i < started; ++i)
+        Test_JoinThread(Test_Threads[i]);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_WaitDone
+//---------------------------------------------------------------------------
+
+
+static void Test_WaitDone(ULONG count)
+{
+    Test_Lock(&Test_PortLock);
+    while (Test_Done < count)
+        Test_CondWait(&Test_DoneCond, &Test_PortLock, -1);
+    Test_Unlock(&Test_PortLock);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Functions
+//---------------------------------------------------------------------------
+
+
+static void Test_Functions(void)
+{
+    //
+    // the bookkeeping alone, a thread can only leave a pool which is
+    // larger than its minimum, and the list stays packed
+    //
+
+    WORK_POOL pool;
+    ULONG i;
+
+    memzero(Test_Handles, sizeof(Test_Handles));
+    memzero(Test_Ids, sizeof(Test_Ids));
+    WorkPool_Init(&pool, 2, 4, Test_Handles, Test_Ids);
+
+    for (i = 1; i <= 4; ++i) {
+        TEST_CHECK(WorkPool_CanAdd(&pool));
+        WorkPool_Add(&pool, (HANDLE)(ULONG_PTR)(i * 10), i);
+    }
+    TEST_CHECK(! WorkPool_CanAdd(&pool));
+
+    TEST_CHECK(WorkPool_Remove(&pool, 9) == NULL);
+    TEST_CHECK(WorkPool_Remove(&pool, 2) == (HANDLE)(ULONG_PTR)20);
+    TEST_CHECK(pool.num_threads == 3 && Test_Ids[1] == 4 && Test_Handles[1] == (HANDLE)(ULONG_PTR)40);
+    TEST_CHECK(WorkPool_Remove(&pool, 4) == (HANDLE)(ULONG_PTR)40);
+    TEST_CHECK(WorkPool_Remove(&pool, 1) == NULL);
+    TEST_CHECK(pool.num_threads == 2 && Test_Ids[0] == 1 && Test_Ids[1] == 3);
+
+    //
+    // the last idle thread to pick up a message asks for another thread,
+    // and a timeout lets a thread leave only while others are idle
+    //
+
+    TEST_CHECK(! WorkPool_Waiting(&pool));
+    TEST_CHECK(! WorkPool_Waiting(&pool));
+    TEST_CHECK(! WorkPool_Received(&pool));
+    TEST_CHECK(WorkPool_Received(&pool));
+
+    WorkPool_Add(&pool, (HANDLE)(ULONG_PTR)50, 5);
+    TEST_CHECK(WorkPool_Waiting(&pool));
+    TEST_CHECK(WorkPool_Waiting(&pool));
+    TEST_CHECK(WorkPool_TimedOut(&pool));
+    TEST_CHECK(! WorkPool_TimedOut(&pool));
+
+    WorkPool_Init(&pool, 4, 2, Test_Handles, Test_Ids);
+    TEST_CHECK(pool.max_threads == 4);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Load
+//---------------------------------------------------------------------------
+
+
+static void Test_Load(void)
+{
+    ULONG round, burst, total = 0;
+
+    Test_Start(MIN_THREADS, MAX_THREADS, 200);
+
+    for (round = 0; round < 20; ++round) {
+
+        //
+        // a burst which fits into the pool is picked up at once, as the
+        // last idle thread always starts another one before it blocks
+        //
+
+        burst = 1 + Test_Rand(round % 4 == 3 ? 3 * MAX_THREADS : MAX_THREADS - 1);
+        Test_MaxDelay = 0;
+
+        Test_Put(burst, 50);
+        total += burst;
+        Test_WaitDone(total);
+
+        TEST_CHECK(Test_MaxSeen <= MAX_THREADS);
+        if (burst < MAX_THREADS)
+            TEST_CHECK(Test_MaxDelay < 40);     // handlers block for 50
+
+        if (round % 5 == 4) {
+
+            //
+            // idle for longer than the timeout, the pool shrinks back
+            //
+
+            double until = Test_Clock() + 3000;
+            while (Test_Pool.num_threads > MIN_THREADS && Test_Clock() < until)
+                Test_Sleep(20);
+            TEST_CHECK(Test_Pool.num_threads == MIN_THREADS);
+            Test_Sleep(50);
+            TEST_CHECK(Test_Pool.idle_threads == (LONG)Test_Pool.num_threads);
+        }
+    }
+
+    TEST_CHECK(Test_MaxSeen > MIN_THREADS);
+    TEST_CHECK(Test_Retired > 0);
+    TEST_CHECK(Test_Started - Test_Retired == Test_Pool.num_threads);
+
+    Test_Stop();
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Benchmark
+//---------------------------------------------------------------------------
+
+
+static void Test_Benchmark(void)
+{
+    ULONG Bursts[] = { 2, 4, 8, 12, 16, 32 };
+    ULONG b, mode, round;
+
+    printf("\n   burst   mean wait ms fixed/pool   max wait ms fixed/pool   threads\n");
+
+    for (b = 0; b < sizeof(Bursts) / sizeof(Bursts[0]); ++b) {
+
+        double mean[2], max[2];
+        ULONG threads = 0;
+
+        for (mode = 0; mode < 2; ++mode) {
+
+            ULONG total = 0;
+
+            Test_Start(MIN_THREADS, mode ? MAX_THREADS : MIN_THREADS, 1000);
+
+            for (round = 0; round < 10; ++round) {
+                Test_Put(Bursts[b], 20);
+                total += Bursts[b];
+                Test_WaitDone(total);
+            }
+
+            mean[mode] = Test_SumDelay / Test_Picked;
+            max[mode] = Test_MaxDelay;
+            if (mode)
+                threads = Test_MaxSeen;
+
+            Test_Stop();
+        }
+
+        printf("%8u   %10.1f/%-10.1f    %10.1f/%-10.1f   %7u\n",
+            Bursts[b], mean[0], mean[1], max[0], max[1], threads);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+    Test_MutexInit(&Test_PortLock);
+    Test_MutexInit(&Test_PoolLock);
+    Test_CondInit(&Test_PortCond);
+    Test_CondInit(&Test_DoneCond);
+
+    Test_Functions();
+    Test_Load();
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        Test_Benchmark();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+//
+// hands out one shared string per distinct text, so that many holders of
+// the same text keep a single copy.  lookups are done on the raw wide char
+// data, so a hit does not allocate anything.  T provides the String type,
+// which must share its data on copy, the Map from a view of wide chars to
+// String, and Find, Make and Insert on them.  once the pool holds MaxCount
+// strings it is dropped, holders keep their strings, so this only costs
+// some sharing
+//
+
+template <class T>
+class CStringPool
+{
+public:
+	CStringPool(int MaxCount = 0x10000) : m_MaxCount(MaxCount) {}
+
+	typename T::String Intern(const wchar_t* str, size_t len)
+	{
+		const typename T::String* Found = T::Find(m_Pool, str, len);
+		if (Found)
+			return *Found;
+
+		if ((int)m_Pool.size() >= m_MaxCount)
+			m_Pool.clear();
+
+		typename T::String String = T::Make(str, len);
+		T::Insert(m_Pool, String);
+		return String;
+	}
+
+	void Clear() { m_Pool.clear(); }
+	int Count() const { return (int)m_Pool.size(); }
+
+protected:
+	typename T::Map m_Pool; // the keys point into the values data
+	int m_MaxCount;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <algorithm>
+
+//
+// puts trace entries back into the order in which they were made.  the
+// driver logs entries in the order they reach it, but SbieDll collects
+// most entries of a process and sends them up to 100 ms later, behind the
+// entries the driver logged directly in the meantime.  each entry carries
+// the time it was made, so the arriving entries are kept sorted by that
+// time and only released once they are older than HoldTime, which must
+// be longer than a batch is held back plus the time between two reads of
+// the log.  entries are released in order, so whoever takes them can
+// simply append them to what was released before.  Time is when the
+// entry was made, in any unit, Now the arrival time in ms
+//
+
+template <class E>
+class CTraceOrder
+{
+public:
+	CTraceOrder(uint64_t HoldTime = 250) : m_HoldTime(HoldTime) {}
+
+	void Add(uint64_t Time, const E& Entry, uint64_t Now)
+	{
+		// most entries arrive in order and are appended, entries with the
+		// same time stay in the order they arrived in
+		auto I = m_Queue.end();
+		if (!m_Queue.empty() && m_Queue.back().Time > Time)
+			I = std::upper_bound(m_Queue.begin(), m_Queue.end(), Time, [](uint64_t Time, const SItem& Item) { return Time < Item.Time; });
+		m_Queue.insert(I, SItem{ Time, Now, Entry });
+	}
+
+	template <class F>
+	void Release(uint64_t Now, F Take)
+	{
+		// an entry which just arrived keeps back the later ones, those
+		// are released with it at most HoldTime after they arrived
+		while (!m_Queue.empty() && m_Queue.front().Arrived + m_HoldTime <= Now) {
+			Take(m_Queue.front().Entry);
+			m_Queue.pop_front();
+		}
+	}
+
+	void Clear() { m_Queue.clear(); }
+	int Count() const { return (int)m_Queue.size(); }
+
+protected:
+	struct SItem
+	{
+		uint64_t Time;
+		uint64_t Arrived;
+		E Entry;
+	};
+
+	std::deque<SItem> m_Queue;
+	uint64_t m_HoldTime;
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+//
+// sorted copies of a list of entries, lets a pattern with a literal prefix,
+// suffix or path component be compared only against the entries which can
+// match.  S is the string type, L a list of S and Compare the wildcard
+// compare, which has to match the whole entry like CSbieUtils::WildCompare
+//
+
+template <class S, class L, bool (*Compare)(const S& Wild, const S& Str)>
+class CWildIndex
+{
+public:
+	void Build(const L& List)
+	{
+		m_Sorted = List;
+		std::sort(m_Sorted.begin(), m_Sorted.end());
+		m_Sorted.erase(std::unique(m_Sorted.begin(), m_Sorted.end()), m_Sorted.end());
+
+		m_Reversed.clear();
+		m_Reversed.reserve(m_Sorted.size());
+		for (int i = 0; i < (int)m_Sorted.size(); i++)
+			m_Reversed.push_back(std::make_pair(Reverse(m_Sorted.at(i)), i));
+		std::sort(m_Reversed.begin(), m_Reversed.end());
+
+		m_Components.clear();
+		for (int i = 0; i < (int)m_Sorted.size(); i++) {
+			const S& Entry = m_Sorted.at(i);
+			for (int j = 0; j < (int)Entry.size(); j++) {
+				if (Entry.at(j) == L'\\')
+					m_Components.push_back(std::make_pair(S(Entry.data() + j, (int)Entry.size() - j), i));
+			}
+		}
+		std::sort(m_Components.begin(), m_Components.end());
+	}
+
+	void Clear()
+	{
+		m_Sorted.clear();
+		m_Reversed.clear();
+		m_Components.clear();
+	}
+
+	bool Match(const S& Wild) const
+	{
+		//
+		// a pattern must match the whole entry, so every entry which can match
+		// starts with the literal text before the first wildcard and ends with
+		// the literal text after the last one.  and the literal text which
+		// follows a backslash in the middle of a pattern like
+		// *\BaseNamedObjects*\Name* has to follow a backslash in the entry.
+		// we look up all of these and only compare the entries of the
+		// smallest range
+		//
+
+		int First = -1;
+		int Last = -1;
+		for (int i = 0; i < (int)Wild.size(); i++) {
+			if (Wild.at(i) == L'*' || Wild.at(i) == L'?') {
+				if (First == -1)
+					First = i;
+				Last = i;
+			}
+		}
+
+		if (First == -1)
+			return std::binary_search(m_Sorted.begin(), m_Sorted.end(), Wild);
+
+		auto Entries = std::make_pair(m_Sorted.begin(), m_Sorted.end());
+		size_t Best = m_Sorted.size();
+
+		S Prefix(Wild.data(), First);
+		if (Prefix.size() != 0) {
+			Entries = Range(m_Sorted, Prefix);
+			Best = Entries.second - Entries.first;
+		}
+
+		// a range of m_Reversed or m_Components, if smaller
+		auto Indexed = std::make_pair(m_Reversed.end(), m_Reversed.end());
+		bool UseIndexed = false;
+
+		S Suffix(Wild.data() + Last + 1, (int)Wild.size() - Last - 1);
+		if (Suffix.size() != 0) {
+			auto Found = Range(m_Reversed, Reverse(Suffix));
+			if ((size_t)(Found.second - Found.first) < Best) {
+				Indexed = Found;
+				UseIndexed = true;
+				Best = Found.second - Found.first;
+			}
+		}
+
+		for (int i = First + 1; i < Last; i++) {
+			if (Wild.at(i) != L'\\')
+				continue;
+			int Start = i;
+			while (i < Last && Wild.at(i) != L'*' && Wild.at(i) != L'?')
+				i++;
+			auto Found = Range(m_Components, S(Wild.data() + Start, i - Start));
+			if ((size_t)(Found.second - Found.first) < Best) {
+				Indexed = Found;
+				UseIndexed = true;
+				Best = Found.second - Found.first;
+			}
+		}
+
+		if (UseIndexed) {
+			for (auto I = Indexed.first; I != Indexed.second; ++I) {
+				if (Compare(Wild, m_Sorted.at(I->second)))
+					return true;
+			}
+			return false;
+		}
+
+		for (auto I = Entries.first; I != Entries.second; ++I) {
+			if (Compare(Wild, *I))
+				return true;
+		}
+		return false;
+	}
+
+	int Count() const { return (int)m_Sorted.size(); }
+
+protected:
+	static S Reverse(const S& Str)
+	{
+		S Reversed = Str;
+		std::reverse(Reversed.begin(), Reversed.end());
+		return Reversed;
+	}
+
+	static const S& KeyOf(const S& Entry) { return Entry; }
+	static const S& KeyOf(const std::pair<S, int>& Entry) { return Entry.first; }
+
+	template <class V>
+	static std::pair<typename V::const_iterator, typename V::const_iterator> Range(const V& List, const S& Key)
+	{
+		// all elements which start with Key
+
+		auto Begin = std::lower_bound(List.begin(), List.end(), Key, [](const typename V::value_type& Entry, const S& Key) {
+			return KeyOf(Entry) < Key;
+		});
+		auto End = std::upper_bound(Begin, List.end(), Key, [](const S& Key, const typename V::value_type& Entry) {
+			const S& Str = KeyOf(Entry);
+			return std::lexicographical_compare(Key.begin(), Key.end(), Str.begin(), Str.begin() + (std::min)(Str.size(), Key.size()));
+		});
+		return std::make_pair(Begin, End);
+	}
+
+	L m_Sorted;
+	std::vector<std::pair<S, int>> m_Reversed;		// reversed entry, index into m_Sorted
+	std::vector<std::pair<S, int>> m_Components;	// entry from each backslash on, index into m_Sorted
+};
@@ -17,6 +17,7 @@ HEADERS += ./qsbieapi_global.h \
     ./Sandboxie/BoxBorder.h \
     ./Sandboxie/SbieTemplates.h \
     ./Helpers/NtIO.h \
+    ./Helpers/WildIndex.h \
     ./Helpers/DbgHelper.h
     
 SOURCES += ./stdafx.cpp \
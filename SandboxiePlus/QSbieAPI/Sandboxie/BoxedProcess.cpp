@@ -51,6 +51,7 @@ CBoxedProcess::CBoxedProcess(quint32 ProcessId, class CSandBox* pBox)
 
 	m_ProcessFlags = 0;
 	m_ImageType = -1;
+	m_IntegrityLevel = 0;
 	m_ReturnCode = STATUS_PENDING;
 
 	m_uTerminated = 0;
@@ -325,6 +326,8 @@ void CBoxedProcess::UpdateProcessInfo()
 	if (m_ProcessFlags == 0 && m_pBox)
 		m_ProcessFlags = m_pBox->Api()->QueryProcessInfo(m_ProcessId);
 	m_ImageType = m_pBox->Api()->QueryProcessInfo(m_ProcessId, 'gpit');
+	if (m_IntegrityLevel == 0 && m_pBox)
+		m_IntegrityLevel = (quint32)m_pBox->Api()->QueryProcessInfo(m_ProcessId, 'pril');
 
 	if (m_bSuspended)
 		TestSuspended();
@@ -41,6 +41,7 @@ public:
 	virtual QDateTime		GetTimeStamp() const { return m_StartTime; }
 	virtual quint32			GetProcessFlags() const { return m_ProcessFlags; }
 	virtual quint32			GetImageType() const { return m_ImageType; }
+	virtual quint32			GetIntegrityLevel() const { return m_IntegrityLevel; }
 	virtual quint32			GetReturnCode() const { return m_ReturnCode; }
 
 	virtual SB_STATUS		Terminate();
@@ -80,6 +81,7 @@ protected:
 	QString			m_ImagePath;
 	quint32			m_ProcessFlags;
 	quint32			m_ImageType;
+	quint32			m_IntegrityLevel;
 	QString			m_CommandLine;
 	QString			m_WorkingDir;
 	quint32			m_SessionId;
@@ -17,6 +17,7 @@
  */
 #include "stdafx.h"
 #include <QtConcurrent>
+#include <QDirIterator>
 #include "SandBox.h"
 #include "../SbieAPI.h"
 
@@ -27,6 +28,7 @@ typedef long NTSTATUS;
 #include <windows.h>
 #include "..\..\Sandboxie\common\win32_ntddk.h"
 #include "..\..\Sandboxie\core\drv\api_flags.h"
+#include "..\..\Sandboxie\common\bloom.h"
 
 #include "..\..\Sandboxie\common\ini.cpp"
 
@@ -445,6 +447,45 @@ SB_STATUS CSandBox__MoveFolder(const QString& SourcePath, const QString& ParentF
 	return SB_OK;
 }
 
+bool CSandBox__WriteSnapshotBloom(const QString& Folder)
+{
+	// hash the relative path of every file and folder in the snapshot,
+	// SbieDll uses the resulting filter to skip snapshots which can not
+	// contain a given path, see common/bloom.h
+	QVector<ULONG64> Hashes;
+	foreach(const QString& BoxSubFolder, CSandBox__BoxSubFolders) 
+	{
+		if (!QDir(Folder + "\\" + BoxSubFolder).exists())
+			continue;
+		std::wstring Path = BoxSubFolder.toStdWString();
+		Hashes.append(Bloom_HashPath(Path.c_str(), (ULONG)Path.length()));
+
+		QDirIterator Iter(Folder + "\\" + BoxSubFolder, QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+		while (Iter.hasNext()) {
+			std::wstring Path = Iter.next().mid(Folder.length() + 1).replace("/", "\\").toStdWString();
+			Hashes.append(Bloom_HashPath(Path.c_str(), (ULONG)Path.length()));
+		}
+	}
+
+	BLOOM_HEADER Header;
+	Header.Signature = BLOOM_SIGNATURE;
+	Header.Version = BLOOM_VERSION;
+	Header.BitCount = Bloom_BitCount(Hashes.count());
+	Header.HashCount = BLOOM_HASH_COUNT;
+	Header.PathCount = Hashes.count();
+
+	QByteArray Bits(Header.BitCount / 8, 0);
+	foreach(ULONG64 Hash, Hashes)
+		Bloom_Add((UCHAR*)Bits.data(), Header.BitCount, Header.HashCount, Hash);
+
+	QFile File(Folder + "\\" + QString::fromWCharArray(BLOOM_FILE_NAME));
+	if (!File.open(QFile::WriteOnly | QFile::Truncate))
+		return false;
+	File.write((char*)&Header, sizeof(Header));
+	File.write(Bits);
+	return true;
+}
+
 SB_PROGRESS CSandBox::TakeSnapshot(const QString& Name)
 {
 	QSettings ini(m_FilePath + "\\Snapshots.ini", QSettings::IniFormat);
@@ -493,6 +534,11 @@ SB_PROGRESS CSandBox::TakeSnapshot(const QString& Name)
 		if (Status.IsError())
 			return Status;
 	}
+
+	// snapshots are not modified once taken, so the filter stays valid,
+	// without it the snapshot still works, only lookups are slower
+	CSandBox__WriteSnapshotBloom(m_FilePath + "\\snapshot-" + ID);
+
 	return SB_OK;
 }
 
@@ -590,6 +636,7 @@ SB_STATUS CSandBox__CleanupSnapshot(const QString& Folder)
 	// remove files which may be in the snapshot
 	foreach(const SBoxDataFile& BoxDataFile, CSandBox__BoxDataFiles) 
 		QFile::remove(Folder + "\\" + BoxDataFile.Name);
+	QFile::remove(Folder + "\\" + QString::fromWCharArray(BLOOM_FILE_NAME));
 
 	// delete snapshot folder, at this stage it should be empty
 	// when its not empty delete will fail
@@ -637,6 +684,19 @@ void CSandBox::MergeSnapshotAsync(const CSbieProgressPtr& pProgress, const QStri
 
 	SB_STATUS Status = SB_OK;
 
+	// the content of both snapshots changes while merging, remove their path
+	// filters first, so a stale filter never hides a path which got merged in
+	QStringList BloomFiles;
+	BloomFiles.append(TargetFolder + "\\" + QString::fromWCharArray(BLOOM_FILE_NAME));
+	if (!IsCurrent)
+		BloomFiles.append(SourceFolder + "\\" + QString::fromWCharArray(BLOOM_FILE_NAME));
+	foreach(const QString& BloomFile, BloomFiles) {
+		if (!QFile::remove(BloomFile) && QFile::exists(BloomFile)) {
+			pProgress->Finish(SB_ERR(SB_DeleteError, QVariantList() << BloomFile, 0xC0000001 /*STATUS_UNSUCCESSFUL*/));
+			return;
+		}
+	}
+
 	// apply source FilePaths.dat on the targetfolder
 	if (QFile::exists(SourceFolder + "\\FilePaths.dat")) 
 	{
@@ -763,6 +823,13 @@ void CSandBox::MergeSnapshotAsync(const CSbieProgressPtr& pProgress, const QStri
 		}
 	}
 
+	// rebuild the path filters of the snapshots which are left, also when the
+	// merge failed half way, after a successful merge only the source remains
+	if (!IsCurrent && QDir(SourceFolder).exists())
+		CSandBox__WriteSnapshotBloom(SourceFolder);
+	if (QDir(TargetFolder).exists())
+		CSandBox__WriteSnapshotBloom(TargetFolder);
+
 	// save changes to the ini
 	if (!Status.IsError())
 	{
@@ -273,6 +273,38 @@ QList<CSbieIni::SbieIniValue> CSbieIni::GetIniSection(qint32* pStatus, bool with
 	if (!withTemplates)
 		uFlags |= CONF_GET_NO_TEMPLS;
 
+	//
+	// without templates, globals and expansion all values come straight from the section,
+	// so we can get all name=value pairs in one call, and fall back to enumerating on failure
+	//
+
+	if (!withTemplates && !withGlobals && noExpand)
+	{
+		QStringList Pairs = SbieIniGetAll(m_Name, uFlags | CONF_GET_ALL_VALUES, &status);
+		if (status == STATUS_RESOURCE_NAME_NOT_FOUND) {
+			if (pStatus) *pStatus = STATUS_SUCCESS;
+			return QList<CSbieIni::SbieIniValue>();
+		}
+
+		QList<CSbieIni::SbieIniValue> Settings;
+		if (status == STATUS_SUCCESS) {
+			foreach(const QString& Pair, Pairs) {
+				int pos = Pair.indexOf("=");
+				if (pos == -1) { // not a name=value pair, the driver does not support bulk queries
+					status = STATUS_NOT_SUPPORTED;
+					break;
+				}
+				Settings.append(SbieIniValue{ Pair.left(pos), (quint32)uFlags, Pair.mid(pos + 1) });
+			}
+		}
+
+		if (status == STATUS_SUCCESS) {
+			if (pStatus) *pStatus = status;
+			return Settings;
+		}
+		status = STATUS_SUCCESS;
+	}
+
 	QSet<QString> Names;
 
 	if (withGlobals)
@@ -409,4 +441,9 @@ QString CSbieIni::SbieIniGet(const QString& Section, const QString& Setting, qui
 QString CSbieIni::SbieIniGetEx(const QString& Section, const QString& Setting) const
 {
 	return m_pAPI->SbieIniGetEx(Section, Setting);
+}
+
+QStringList CSbieIni::SbieIniGetAll(const QString& Section, quint32 Flags, qint32* ErrCode) const
+{
+	return m_pAPI->SbieIniGetAll(Section, Flags, ErrCode);
 }
\ No newline at end of file
@@ -61,6 +61,7 @@ public:
 	virtual SB_STATUS	SbieIniSet(const QString& Section, const QString& Setting, const QString& Value, ESetMode Mode = eIniUpdate, bool bRefresh = true);
 	virtual QString		SbieIniGet(const QString& Section, const QString& Setting, quint32 Index, qint32* ErrCode = NULL, quint32* pType = NULL) const;
 	virtual QString		SbieIniGetEx(const QString& Section, const QString& Setting) const;
+	virtual QStringList	SbieIniGetAll(const QString& Section, quint32 Flags, qint32* ErrCode = NULL) const;
 
 	CSbieAPI*			GetAPI() { return m_pAPI; }
 
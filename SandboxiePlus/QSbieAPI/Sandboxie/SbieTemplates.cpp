@@ -20,6 +20,8 @@
 #include "../SbieAPI.h"
 #include "../SbieUtils.h"
 
+#include <QtConcurrent>
+
 #include <ntstatus.h>
 #define WIN32_NO_STATUS
 typedef long NTSTATUS;
@@ -51,12 +53,28 @@ void CSbieTemplates::RunCheck()
 	QStringList Used = m_pAPI->GetGlobalSettings()->GetTextList("Template", false);
 	QStringList Rejected = m_pAPI->GetGlobalSettings()->GetTextList("TemplateReject", false);
 
-	for(QMap<QString, int>::iterator I = m_Templates.begin(); I != m_Templates.end(); ++I)
+	// the settings are read through the driver one template at a time,
+	// the checks themselves only look at the collected entries, files and
+	// registry keys, so they can run in parallel
+	QList<STemplateScan> Scans;
+	for (QMap<QString, int>::iterator I = m_Templates.begin(); I != m_Templates.end(); ++I)
+	{
+		STemplateScan Scan;
+		LoadTemplate(I.key(), Scan);
+		Scans.append(Scan);
+	}
+
+	QList<bool> Required = QtConcurrent::blockingMapped<QList<bool>>(Scans, [this](const STemplateScan& Scan) {
+		return CheckTemplate(Scan);
+	});
+
+	int Index = 0;
+	for(QMap<QString, int>::iterator I = m_Templates.begin(); I != m_Templates.end(); ++I, ++Index)
 	{
 		int Value = eNone;
 		if (Used.contains(I.key(), Qt::CaseInsensitive))
 			Value |= eEnabled;
-		if (CheckTemplate(I.key()))
+		if (Required.at(Index))
 			Value |= eRequired;
 		if (Rejected.contains(I.key() , Qt::CaseInsensitive))
 			Value |= eDisabled;
@@ -119,6 +137,11 @@ void CSbieTemplates::Reset()
 	m_Classes.clear();
 	m_Services.clear();
 	m_Products.clear();
+
+	m_ObjectIndex.Clear();
+	m_ClassIndex.Clear();
+	m_ServiceIndex.Clear();
+	m_ProductIndex.Clear();
 }
 
 QStringList CSbieTemplates::GetObjects() 
@@ -152,6 +175,7 @@ QStringList CSbieTemplates::GetProducts()
 void CSbieTemplates::CollectObjects()
 {
 	m_Objects.clear();
+	m_ObjectIndex.Clear();
 
 	QStringList objdirs;
 	objdirs.append("\\BaseNamedObjects");
@@ -226,11 +250,14 @@ void CSbieTemplates::CollectObjects()
 	}
 
 	free(info);
+
+	m_ObjectIndex.Build(m_Objects);
 }
 
 void CSbieTemplates::CollectClasses()
 {
 	m_Classes.clear();
+	m_ClassIndex.Clear();
 
 	EnumWindows([](HWND hwnd, LPARAM lparam) 
 	{ 
@@ -246,11 +273,14 @@ void CSbieTemplates::CollectClasses()
 
 		return TRUE;
 	}, (LPARAM)this);
+
+	m_ClassIndex.Build(m_Classes);
 }
 
 void CSbieTemplates::CollectServices()
 {
 	m_Services.clear();
+	m_ServiceIndex.Clear();
 
 	SC_HANDLE hManager = OpenSCManager(NULL, NULL, SC_MANAGER_ENUMERATE_SERVICE);
 	if (!hManager)
@@ -281,6 +311,8 @@ void CSbieTemplates::CollectServices()
 	free(info);
 
 	CloseServiceHandle(hManager);
+
+	m_ServiceIndex.Build(m_Services);
 }
 
 void CSbieTemplates::CollectProducts()
@@ -293,6 +325,7 @@ void CSbieTemplates::CollectProducts()
 #endif _WIN64
 
 	m_Products.clear();
+	m_ProductIndex.Clear();
 
 	QList<HKEY> Roots = QList<HKEY>() << HKEY_LOCAL_MACHINE << HKEY_CURRENT_USER;
 	for (auto Root : Roots) 
@@ -329,6 +362,8 @@ void CSbieTemplates::CollectProducts()
 #endif _WIN64
 		}
 	}
+
+	m_ProductIndex.Build(m_Products);
 }
 
 QStringList CSbieTemplates::GetTemplateNames(const QString& forClass)
@@ -359,22 +394,41 @@ QStringList CSbieTemplates::GetTemplateNames(const QString& forClass)
 	return list;
 }
 
-bool CSbieTemplates::CheckTemplate(const QString& Name)
+bool CSbieTemplates::LoadTemplate(const QString& Name, STemplateScan& Scan)
 {
 	QSharedPointer<CSbieIni> pTemplate = QSharedPointer<CSbieIni>(new CSbieIni("Template_" + Name, m_pAPI));
 
 	QString scan = pTemplate->GetText("Tmpl.Scan", QString(), false, false, true);
-	BOOL scanIpc = (scan.indexOf(L'i') != -1);
-	BOOL scanWindow = (scan.indexOf(L'w') != -1);
-	BOOL scanSoftware = (scan.indexOf(L's') != -1);
-	if (!(scanIpc || scanWindow || scanSoftware))
+	Scan.ScanIpc = (scan.indexOf(L'i') != -1);
+	Scan.ScanWindow = (scan.indexOf(L'w') != -1);
+	Scan.ScanSoftware = (scan.indexOf(L's') != -1);
+	if (!(Scan.ScanIpc || Scan.ScanWindow || Scan.ScanSoftware))
 		return false;
 
 	QList<CSbieIni::SbieIniValue> settings = pTemplate->GetIniSection(0, true);
 	for(QList<CSbieIni::SbieIniValue>::iterator I = settings.begin(); I != settings.end(); ++I)
+		Scan.Settings.append(qMakePair(I->Name, I->Value));
+	return true;
+}
+
+bool CSbieTemplates::CheckTemplate(const QString& Name)
+{
+	STemplateScan Scan;
+	if (!LoadTemplate(Name, Scan))
+		return false;
+	return CheckTemplate(Scan);
+}
+
+bool CSbieTemplates::CheckTemplate(const STemplateScan& Scan)
+{
+	bool scanIpc = Scan.ScanIpc;
+	bool scanWindow = Scan.ScanWindow;
+	bool scanSoftware = Scan.ScanSoftware;
+
+	for(QList<QPair<QString, QString>>::const_iterator I = Scan.Settings.begin(); I != Scan.Settings.end(); ++I)
 	{
-		QString setting = I->Name;
-		QString value = I->Value;
+		const QString& setting = I->first;
+		const QString& value = I->second;
 
 		if (scanIpc && ((setting.compare("OpenIpcPath", Qt::CaseInsensitive) == 0) || setting.compare("Tmpl.ScanIpc", Qt::CaseInsensitive) == 0))
 		{
@@ -465,46 +519,22 @@ bool CSbieTemplates::CheckFile(const QString& Value)
 
 bool CSbieTemplates::CheckClasses(const QString& value)
 {
-	QString Value = value.toLower();
-	for (auto I = m_Classes.begin(); I != m_Classes.end(); ++I)
-	{
-		if (CSbieUtils::WildCompare(Value, *I))
-			return true;
-	}
-	return false;
+	return m_ClassIndex.Match(value.toLower());
 }
 
 bool CSbieTemplates::CheckServices(const QString& value)
 {
-	QString Value = value.toLower();
-	for (auto I = m_Services.begin(); I != m_Services.end(); ++I)
-	{
-		if (CSbieUtils::WildCompare(Value, *I))
-			return true;
-	}
-	return false;
+	return m_ServiceIndex.Match(value.toLower());
 }
 
 bool CSbieTemplates::CheckProducts(const QString& value)
 {
-	QString Value = value.toLower();
-	for (auto I = m_Products.begin(); I != m_Products.end(); ++I)
-	{
-		if (CSbieUtils::WildCompare(Value, *I))
-			return true;
-	}
-	return false;
+	return m_ProductIndex.Match(value.toLower());
 }
 
 bool CSbieTemplates::CheckObjects(const QString& value)
 {
-	QString Value = value.toLower();
-	for (auto I = m_Objects.begin(); I != m_Objects.end(); ++I)
-	{
-		if (CSbieUtils::WildCompare(Value, *I))
-			return true;
-	}
-	return false;
+	return m_ObjectIndex.Match(value.toLower());
 }
 
 void CSbieTemplates::InitExpandPaths(bool WithUser)
@@ -4,6 +4,8 @@
 #include "../qsbieapi_global.h"
 
 #include "../SbieStatus.h"
+#include "../SbieUtils.h"
+#include "../Helpers/WildIndex.h"
 
 class QSBIEAPI_EXPORT CSbieTemplates : public QObject
 {
@@ -51,7 +53,17 @@ protected:
 
 	QStringList GetTemplateNames(const QString& forClass);
 
+	struct STemplateScan
+	{
+		bool ScanIpc = false;
+		bool ScanWindow = false;
+		bool ScanSoftware = false;
+		QList<QPair<QString, QString>> Settings;
+	};
+
+	bool LoadTemplate(const QString& Name, STemplateScan& Scan);
 	bool CheckTemplate(const QString& Name);
+	bool CheckTemplate(const STemplateScan& Scan);
 
 	void InitExpandPaths(bool WithUser);
 
@@ -60,6 +72,13 @@ protected:
 	QStringList m_Services;
 	QStringList m_Products;
 
+	typedef CWildIndex<QString, QStringList, &CSbieUtils::WildCompare> CEntryIndex;
+
+	CEntryIndex m_ObjectIndex;
+	CEntryIndex m_ClassIndex;
+	CEntryIndex m_ServiceIndex;
+	CEntryIndex m_ProductIndex;
+
 	QMap<QString, int> m_Templates;
 
 	QMap<QString, QString> m_Expands;
@@ -38,6 +38,7 @@ typedef long NTSTATUS;
 #include "..\..\Sandboxie\core\svc\GuiWire.h"
 #include "..\..\Sandboxie\core\svc\sbieiniwire.h"
 #include "..\..\Sandboxie\core\svc\QueueWire.h"
+#include "..\..\Sandboxie\core\svc\bulkwire.h"
 #include "..\..\Sandboxie\core\svc\InteractiveWire.h"
 #include "..\..\Sandboxie\core\svc\MountManagerWire.h"
 
@@ -56,6 +57,11 @@ struct SSbieAPI
 		SizeofPortMsg = 0;
 		CallSeqNumber = 0;
 
+		BulkSection = NULL;
+		BulkView = NULL;
+		BulkViewSize = 0;
+		BulkDisabled = false;
+
 		if (!ProcessIdToSessionId(GetCurrentProcessId(), &sessionId))
 			sessionId = 0;
 
@@ -66,6 +72,13 @@ struct SSbieAPI
 		traceBuffer = NULL;
 		traceBufferLen = 0;
 
+		procListSeq = 0;
+		procListAllSessions = false;
+		procListDisabled = false;
+		procListBuffer = NULL;
+		procListBufferLen = 0;
+		procListLen = 0;
+
 		SbieMsgDll = NULL;
 
 		SvcLock = 0;
@@ -73,6 +86,12 @@ struct SSbieAPI
 	~SSbieAPI() {
 		if (traceBuffer) 
 			free(traceBuffer);
+		if (procListBuffer)
+			free(procListBuffer);
+		if (BulkView)
+			UnmapViewOfFile(BulkView);
+		if (BulkSection)
+			CloseHandle(BulkSection);
 	}
 
 	NTSTATUS IoControl(ULONG64 *parms)
@@ -89,6 +108,11 @@ struct SSbieAPI
 	ULONG SizeofPortMsg;
 	ULONG CallSeqNumber;
 
+	HANDLE BulkSection;
+	UCHAR* BulkView;
+	ULONG BulkViewSize;
+	bool BulkDisabled;
+
 	WCHAR QueueName[64];
 
 	QString Password;
@@ -100,6 +124,15 @@ struct SSbieAPI
 	//ULONG lastRecordNum;
 	UCHAR* traceBuffer;
 	ULONG traceBufferLen;
+	CTraceStringPool traceStrings; // used by the monitor thread only
+
+	ULONG procListSeq;
+	bool procListAllSessions;
+	bool procListDisabled;
+	UCHAR* procListBuffer;
+	ULONG procListBufferLen;
+	ULONG procListLen;
+	QSet<quint32> procListPending; // listed before their box was known
 
 	HMODULE SbieMsgDll;
 
@@ -384,6 +417,8 @@ SB_STATUS CSbieAPI::Connect(bool takeOver, bool withQueue)
 	return Status;
 }
 
+void CSbieAPI__FreeBulkView(SSbieAPI* m);
+
 SB_STATUS CSbieAPI::Disconnect()
 {
 	if (!IsConnected())
@@ -405,6 +440,7 @@ SB_STATUS CSbieAPI::Disconnect()
 		NtClose(m->PortHandle);
 		m->PortHandle = NULL;
 	}
+	CSbieAPI__FreeBulkView(m);
 
 	if (m->SbieMsgDll) {
 		FreeLibrary(m->SbieMsgDll);
@@ -466,9 +502,78 @@ SB_STATUS CSbieAPI__ConnectPort(SSbieAPI* m)
 		m->SizeofPortMsg += sizeof(ULONG) * 4;
 	m->MaxDataLen -= m->SizeofPortMsg;
 
+	m->BulkDisabled = false;
+
 	return SB_OK;
 }
 
+void CSbieAPI__FreeBulkView(SSbieAPI* m)
+{
+	if (m->BulkView) {
+		UnmapViewOfFile(m->BulkView);
+		m->BulkView = NULL;
+	}
+	if (m->BulkSection) {
+		CloseHandle(m->BulkSection);
+		m->BulkSection = NULL;
+	}
+	m->BulkViewSize = 0;
+	m->BulkDisabled = false;
+}
+
+SB_STATUS CSbieAPI__CallServer(SSbieAPI* m, MSG_HEADER* req, CSbieAPI::SScopedVoid* prpl);
+
+bool CSbieAPI__AttachBulkView(SSbieAPI* m, ULONG length)
+{
+	// attach a shared section to the service connection, large requests and replies
+	// are then passed in a single round-trip instead of many short LPC chunks, see bulkwire.h
+	if (m->BulkDisabled)
+		return false;
+	if (m->BulkView && length <= m->BulkViewSize)
+		return true;
+
+	ULONG view_size = PortBulk_ViewSize(length);
+	if (!view_size)
+		return false;
+
+	NTSTATUS status = STATUS_NO_MEMORY;
+	UCHAR* pView = NULL;
+	HANDLE hSection = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE | SEC_COMMIT, 0, view_size, NULL);
+	if (hSection)
+		pView = (UCHAR*)MapViewOfFile(hSection, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, view_size);
+	if (pView)
+	{
+		PORT_BULK_ATTACH_REQ req;
+		req.h.length = sizeof(PORT_BULK_ATTACH_REQ);
+		req.h.msgid = MSGID_PORT_BULK_ATTACH;
+		req.view_size = view_size;
+		req.section_handle = (ULONG64)(ULONG_PTR)hSection;
+
+		CSbieAPI::SScoped<MSG_HEADER> rpl;
+		CSbieAPI__CallServer(m, &req.h, &rpl);
+		status = rpl ? rpl->status : STATUS_SERVER_DISABLED;
+	}
+
+	// the service drops any previously attached section when it gets the request,
+	// if it does not support sections or rejected ours, don't try again on this connection
+	CSbieAPI__FreeBulkView(m);
+
+	if (!NT_SUCCESS(status))
+	{
+		if (pView)
+			UnmapViewOfFile(pView);
+		if (hSection)
+			CloseHandle(hSection);
+		m->BulkDisabled = true;
+		return false;
+	}
+
+	m->BulkSection = hSection;
+	m->BulkView = pView;
+	m->BulkViewSize = view_size;
+	return true;
+}
+
 SB_STATUS CSbieAPI__CallServer(SSbieAPI* m, MSG_HEADER* req, CSbieAPI::SScopedVoid* prpl)
 {
 	if (!m->PortHandle) {
@@ -485,11 +590,18 @@ SB_STATUS CSbieAPI__CallServer(SSbieAPI* m, MSG_HEADER* req, CSbieAPI::SScopedVo
 	PORT_MESSAGE* ResHeader = (PORT_MESSAGE*)ResponseBuff;
 	UCHAR* ResData = ResponseBuff + m->SizeofPortMsg;
 
+	// Large requests are placed in the shared section, then only their header is sent
+	ULONG BuffLen = req->length;
+	if (BuffLen > PORT_BULK_MIN_LENGTH && CSbieAPI__AttachBulkView(m, BuffLen))
+	{
+		memcpy(m->BulkView, req, BuffLen);
+		BuffLen = sizeof(MSG_HEADER);
+	}
+
 	UCHAR CurSeqNumber = (UCHAR)m->CallSeqNumber++;
 
 	// Send the request in chunks
 	UCHAR* Buffer = (UCHAR*)req;
-	ULONG BuffLen = req->length;
 	while (BuffLen)
 	{
 		ULONG send_len = BuffLen > m->MaxDataLen ? m->MaxDataLen : BuffLen;
@@ -516,6 +628,7 @@ SB_STATUS CSbieAPI__CallServer(SSbieAPI* m, MSG_HEADER* req, CSbieAPI::SScopedVo
 		{
 			NtClose(m->PortHandle);
 			m->PortHandle = NULL;
+			CSbieAPI__FreeBulkView(m);
 			return SB_ERR(SB_ServiceFail, QVariantList() << QString("request %1").arg(status, 8, 16), status); // 2203
 		}
 
@@ -538,6 +651,20 @@ SB_STATUS CSbieAPI__CallServer(SSbieAPI* m, MSG_HEADER* req, CSbieAPI::SScopedVo
 	if (BuffLen == 0)
 		return SB_ERR(SB_ServiceFail, QVariantList() << QString("null reply (msg %1 len %2)").arg(req->msgid, 8, 16).arg(req->length)); // 2203
 
+	// a reply consisting only of its header was placed in the shared section
+	if (m->BulkView && PortBulk_IsMarker(ResData, ResHeader->u1.s1.DataLength))
+	{
+		if (BuffLen > m->BulkViewSize)
+			return SB_ERR(SB_ServiceFail, QVariantList() << QString("bulk reply")); // 2203
+
+		MSG_HEADER* rpl = (MSG_HEADER*)malloc(BuffLen);
+		memcpy(rpl, m->BulkView, BuffLen);
+		rpl->length = BuffLen;
+		prpl->Assign(rpl, BuffLen);
+		return SB_OK;
+	}
+	ULONG ReplyLen = BuffLen;
+
 	// read remaining chunks
 	MSG_HEADER* rpl = (MSG_HEADER*)malloc(BuffLen);
 	Buffer = (UCHAR*)rpl;
@@ -573,11 +700,16 @@ SB_STATUS CSbieAPI__CallServer(SSbieAPI* m, MSG_HEADER* req, CSbieAPI::SScopedVo
 
 			NtClose(m->PortHandle);
 			m->PortHandle = NULL;
+			CSbieAPI__FreeBulkView(m);
 			return SB_ERR(SB_ServiceFail, QVariantList() << QString("reply %1").arg(status, 8, 16), status); // 2203
 		}
 	}
 	prpl->Assign(rpl, Buffer - (UCHAR*)rpl);
 
+	// a large reply had to be collected in chunks, attach a shared section for the next one
+	if (ReplyLen > PORT_BULK_MIN_LENGTH)
+		CSbieAPI__AttachBulkView(m, ReplyLen);
+
 	return SB_OK;
 }
 
@@ -1406,6 +1538,38 @@ QString CSbieAPI::SbieIniGet2(const QString& Section, const QString& Setting, qu
 	return SbieIniGet(Section, Setting, Index | flags);
 }
 
+QStringList CSbieAPI::SbieIniGetAll(const QString& Section, quint32 Flags, qint32* ErrCode)
+{
+	std::wstring section = Section.toStdWString();
+	std::wstring setting;
+
+	// the driver returns all names, or name=value pairs with CONF_GET_ALL_VALUES, as a multi string
+	std::vector<WCHAR> out_buffer(0x8000, 0);
+
+	__declspec(align(8)) UNICODE_STRING64 Output = { 0, (USHORT)((out_buffer.size() - 1) * sizeof(WCHAR)), (ULONG64)out_buffer.data() };
+	__declspec(align(8)) ULONG64 parms[API_NUM_ARGS];
+
+	quint32 Index = Flags | CONF_GET_ALL;
+
+	memset(parms, 0, sizeof(parms));
+	parms[0] = API_QUERY_CONF;
+	parms[1] = (ULONG64)section.c_str();
+	parms[2] = (ULONG64)setting.c_str();
+	parms[3] = (ULONG64)&Index;
+	parms[4] = (ULONG64)&Output;
+
+	NTSTATUS status = m->IoControl(parms);
+	if (ErrCode)
+		*ErrCode = status;
+	if (!NT_SUCCESS(status))
+		return QStringList();
+
+	QStringList List;
+	for (const WCHAR* ptr = out_buffer.data(); *ptr; ptr += wcslen(ptr) + 1)
+		List.append(QString::fromWCharArray(ptr));
+	return List;
+}
+
 SB_STATUS CSbieAPI::ValidateName(const QString& BoxName)
 {
 	if (BoxName.length() > (BOXNAME_COUNT - 2) || BoxName.isEmpty())
@@ -1497,39 +1661,160 @@ SB_STATUS CSbieAPI__GetProcessPIDs(SSbieAPI* m, const QString& BoxName, bool bAl
 	return SB_OK;
 }
 
+SB_STATUS CSbieAPI__QueryProcessList(SSbieAPI* m, bool bAllSessions, bool* pChanged)
+{
+	if (m->procListAllSessions != bAllSessions) {
+		m->procListAllSessions = bAllSessions;
+		m->procListSeq = 0;
+		m->procListPending.clear();
+	}
+
+	for (;;)
+	{
+		ULONG list_seq = m->procListSeq;
+		ULONG required_len = 0;
+
+		__declspec(align(8)) ULONG64 parms[API_NUM_ARGS];
+		API_QUERY_PROCESS_LIST_ARGS* args = (API_QUERY_PROCESS_LIST_ARGS*)parms;
+
+		memset(parms, 0, sizeof(parms));
+		args->func_code = API_QUERY_PROCESS_LIST;
+		args->list_seq.val = &list_seq;
+		args->all_sessions.val = bAllSessions ? TRUE : FALSE;
+		args->session_id.val = -1;
+		args->buffer.val = m->procListBuffer;
+		args->buffer_len.val = m->procListBufferLen;
+		args->required_len.val = &required_len;
+
+		NTSTATUS status = m->IoControl(parms);
+		if (status == STATUS_BUFFER_TOO_SMALL) {
+			if (m->procListBuffer)
+				free(m->procListBuffer);
+			m->procListBufferLen = required_len + 16 * PAGE_SIZE; // add some extra space
+			m->procListBuffer = (UCHAR*)malloc(m->procListBufferLen);
+			if (!m->procListBuffer) {
+				m->procListBufferLen = 0;
+				return SB_ERR(STATUS_NO_MEMORY);
+			}
+			continue;
+		}
+		if (!NT_SUCCESS(status))
+			return SB_ERR(status);
+
+		*pChanged = (list_seq != m->procListSeq);
+		if (*pChanged) {
+			m->procListSeq = list_seq;
+			m->procListLen = required_len;
+		}
+		return SB_OK;
+	}
+}
+
 SB_STATUS CSbieAPI::UpdateProcesses(int iKeep, bool bAllSessions)
 {
-	ULONG count = 0;
-	SB_STATUS Status = CSbieAPI__GetProcessPIDs(m, "", bAllSessions, NULL, &count); // query count
-	if (Status.IsError()) 
-		return Status;
+	//
+	// the driver returns the list of all processes together with the details
+	// we need in one call, and only when a process was started, has exited,
+	// or has set its image type since the last call, when nothing changed
+	// we keep our list, an older driver does not know API_QUERY_PROCESS_LIST,
+	// then we enumerate the pids and query each new process on its own
+	//
+
+	bool bListed = false;
+	bool bChanged = true;
+	if (!m->procListDisabled)
+	{
+		SB_STATUS Status = CSbieAPI__QueryProcessList(m, bAllSessions, &bChanged);
+		if (!Status.IsError())
+			bListed = true;
+		else if (Status.GetStatus() == STATUS_INVALID_DEVICE_REQUEST)
+			m->procListDisabled = true;
+		else
+			return Status;
+	}
+
+	QList<quint32> ProcessIds;
+	QHash<quint32, const API_PROCESS_LIST_ENTRY*> Entries;
+	QSet<quint32> Pending;
+
+	if (!bListed)
+	{
+		ULONG count = 0;
+		SB_STATUS Status = CSbieAPI__GetProcessPIDs(m, "", bAllSessions, NULL, &count); // query count
+		if (Status.IsError()) 
+			return Status;
 
-	count += 128; // add some extra space
-	ULONG* boxed_pids = new ULONG[count]; 
+		count += 128; // add some extra space
+		ULONG* boxed_pids = new ULONG[count]; 
+
+		Status = CSbieAPI__GetProcessPIDs(m, "", bAllSessions, boxed_pids, &count); // query pids
+		if (Status.IsError()) {
+			delete[] boxed_pids;
+			return Status;
+		}
+
+		for (ULONG i = 0; i < count; i++)
+			ProcessIds.append((quint32)boxed_pids[i]);
 
-	Status = CSbieAPI__GetProcessPIDs(m, "", bAllSessions, boxed_pids, &count); // query pids
-	if (Status.IsError()) {
 		delete[] boxed_pids;
-		return Status;
+	}
+	else if (bChanged)
+	{
+		m->procListPending.clear(); // a changed list has them all again
+
+		for (ULONG offset = 0; offset < m->procListLen; )
+		{
+			const API_PROCESS_LIST_ENTRY* entry = (const API_PROCESS_LIST_ENTRY*)(m->procListBuffer + offset);
+			ProcessIds.append(entry->process_id);
+			Entries.insert(entry->process_id, entry);
+			if (!entry->next_offset)
+				break;
+			offset += entry->next_offset;
+		}
+	}
+	else
+	{
+		foreach(const CSandBoxPtr& pBox, m_SandBoxes) {
+			foreach(const CBoxedProcessPtr& pProcess, pBox->m_ProcessList) {
+				if (!pProcess->IsTerminated())
+					ProcessIds.append(pProcess->m_ProcessId);
+			}
+		}
+
+		// processes whose box was not known yet are queried again on their own
+		Pending.swap(m->procListPending);
+		foreach(quint32 ProcessId, Pending)
+			ProcessIds.append(ProcessId);
 	}
 
 	QMap<quint32, CBoxedProcessPtr>	OldProcessList;
 	foreach(const CSandBoxPtr& pBox, m_SandBoxes)
 		OldProcessList.insert(pBox->m_ProcessList);
 
-	for (int i=0; i < count; i++)
+	foreach(quint32 ProcessId, ProcessIds)
 	{
-		quint32 ProcessId = (quint32)boxed_pids[i];
+		const API_PROCESS_LIST_ENTRY* entry = Entries.value(ProcessId);
 
 		CBoxedProcessPtr pProcess = OldProcessList.take(ProcessId);
 		if (!pProcess)
 		{
 			pProcess = CBoxedProcessPtr(NewBoxedProcess(ProcessId, NULL));
-			UpdateProcessInfo(pProcess);
+			if (entry) {
+				pProcess->m_BoxName = QString::fromWCharArray(entry->names, entry->box_name_len / sizeof(WCHAR));
+				pProcess->m_ImageName = QString::fromWCharArray(entry->names + entry->box_name_len / sizeof(WCHAR), entry->image_name_len / sizeof(WCHAR));
+				pProcess->m_SessionId = entry->session_id;
+				pProcess->m_StartTime = QDateTime::fromMSecsSinceEpoch(FILETIME2ms(entry->create_time));
+				pProcess->m_IntegrityLevel = entry->integrity_level;
+			}
+			else
+				UpdateProcessInfo(pProcess);
 			
 			CSandBoxPtr pBox = GetBoxByName(pProcess->GetBoxName());
-			if (pBox.isNull())
+			if (pBox.isNull()) {
+				if (bListed)
+					m->procListPending.insert(ProcessId); // query it again once the box is known
 				continue;
+			}
 
 			if (pBox->m_ActiveProcessCount == 0) {
 				pBox->m_ActiveProcessCount = 1;
@@ -1546,7 +1831,19 @@ SB_STATUS CSbieAPI::UpdateProcesses(int iKeep, bool bAllSessions)
 			pProcess->InitProcessInfo();
 		}
 
-		pProcess->UpdateProcessInfo();
+		if (entry) {
+			if (pProcess->m_ProcessFlags == 0)
+				pProcess->m_ProcessFlags = (quint32)entry->flags;
+			pProcess->m_ImageType = entry->image_type;
+			if (pProcess->m_bSuspended)
+				pProcess->TestSuspended();
+		}
+		else if (bListed && !Pending.contains(ProcessId)) {
+			if (pProcess->m_bSuspended)
+				pProcess->TestSuspended();
+		}
+		else
+			pProcess->UpdateProcessInfo();
 	}
 
 	foreach(const CBoxedProcessPtr& pProcess, OldProcessList) 
@@ -1581,7 +1878,6 @@ SB_STATUS CSbieAPI::UpdateProcesses(int iKeep, bool bAllSessions)
 		}
 	}
 
-	delete[] boxed_pids;
 	return SB_OK;
 }
 
@@ -3047,7 +3343,7 @@ bool CSbieAPI::GetMonitor()
 	CTraceEntryPtr LogEntry = CTraceEntryPtr(new CTraceEntry(0, pid, tid, type, LogData));
 
 	QMutexLocker Lock(&m_TraceMutex);
-	m_TraceCache.append(LogEntry);
+	m_TraceCache.Add(0, LogEntry, GetTickCount64());
 
 	return true;
 
@@ -3076,6 +3372,8 @@ bool CSbieAPI::GetMonitor()
 	if (m->clearingBuffers)
 		return true; 
 
+	QVector<QPair<quint64, CTraceEntryPtr>> LogEntries; // with the time each entry was made
+
 	for (UCHAR* ptr = buffer; *(ULONG*)ptr > 0; ) {
 
 		ULONG uSize = *(ULONG*)ptr;
@@ -3105,13 +3403,13 @@ bool CSbieAPI::GetMonitor()
 				break;
 			}
 			size_t len = wcslen((WCHAR*)ptr);
-			QString str = QString::fromWCharArray((WCHAR*)ptr, len);
+			LogData.append(m->traceStrings.Intern((WCHAR*)ptr, len));
 			ptr += (len + 1) * sizeof(WCHAR);
 			uSize -= (len + 1) * sizeof(WCHAR);
-			LogData.append(str);
 		}
 
 		QVector<quint64> Stack;
+		ULONG uRepeat = 1;
 
 		for (; uSize > 0;) {
 
@@ -3124,6 +3422,10 @@ bool CSbieAPI::GetMonitor()
 			uSize -= sizeof(ULONG);
 
 			switch (uTagID) {
+			case 'RPTC': // identical entries in a row, batched by SbieDll
+				if (uTagLen >= sizeof(ULONG) && *(ULONG*)ptr > 1)
+					uRepeat = *(ULONG*)ptr;
+				break;
 			case 'STCK':
 				int PtrSize = sizeof(PVOID);
 #ifndef _WIN64
@@ -3150,12 +3452,16 @@ bool CSbieAPI::GetMonitor()
 			uSize -= uTagLen;
 		}
 
-		CTraceEntryPtr LogEntry = CTraceEntryPtr(new CTraceEntry(FILETIME2ms(uTimestamp), uPid, uTid, uType, LogData, Stack));
-
-		QMutexLocker Lock(&m_TraceMutex);
-		m_TraceCache.append(LogEntry);
+		for (ULONG i = 0; i < uRepeat; i++)
+			LogEntries.append(qMakePair((quint64)uTimestamp, CTraceEntryPtr(new CTraceEntry(FILETIME2ms(uTimestamp), uPid, uTid, uType, LogData, Stack))));
 	}
 
+	// hand over the whole batch at once, so the GUI thread is not blocked for every entry
+	quint64 uNow = GetTickCount64();
+	QMutexLocker Lock(&m_TraceMutex);
+	for (const auto& Entry : LogEntries)
+		m_TraceCache.Add(Entry.first, Entry.second, uNow);
+
 	return status == STATUS_MORE_ENTRIES;
 #endif
 }
@@ -3164,14 +3470,13 @@ const QVector<CTraceEntryPtr>& CSbieAPI::GetTrace()
 { 
 	QMutexLocker Lock(&m_TraceMutex);
 
-	for (int i = 0; i < m_TraceCache.count(); i++) 
+	// entries batched by SbieDll arrive late, they are released once they are in order
+	m_TraceCache.Release(GetTickCount64(), [&](CTraceEntryPtr& pEntry)
 	{
-		CTraceEntryPtr& pEntry = m_TraceCache[i];
-
 #ifdef USE_MERGE_TRACE
 		if (!m_TraceList.isEmpty() && m_TraceList.last()->Equals(pEntry)) {
 			m_TraceList.last()->Merge(pEntry);
-			continue;
+			return;
 		}
 #endif
 
@@ -3184,8 +3489,7 @@ const QVector<CTraceEntryPtr>& CSbieAPI::GetTrace()
 		}
 
 		m_TraceList.append(pEntry);
-	}
-	m_TraceCache.clear();
+	});
 
 	return m_TraceList; 
 }
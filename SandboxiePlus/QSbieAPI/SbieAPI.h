@@ -25,6 +25,7 @@
 #include "SbieStatus.h"
 
 #include "SbieTrace.h"
+#include "Helpers/TraceOrder.h"
 
 #include "./Sandboxie/SandBox.h"
 #include "./Sandboxie/BoxedProcess.h"
@@ -88,6 +89,7 @@ public:
 	virtual void			CommitIniChanges();
 	virtual QString			SbieIniGet(const QString& Section, const QString& Setting, quint32 Index = 0, qint32* ErrCode = NULL, quint32* pType = NULL);
 	virtual QString			SbieIniGet2(const QString& Section, const QString& Setting, quint32 Index = 0, bool bWithGlobal = false, bool bNoExpand = true, bool withTemplates = false);
+	virtual QStringList		SbieIniGetAll(const QString& Section, quint32 Flags = 0, qint32* ErrCode = NULL);
 	virtual QString			SbieIniGetEx(const QString& Section, const QString& Setting);
 	virtual SB_STATUS		SbieIniSet(const QString& Section, const QString& Setting, const QString& Value, CSbieIni::ESetMode Mode = CSbieIni::eIniUpdate, bool bRefresh = true);
 	virtual SB_STATUS		SbieIniSetDrv(const QString& Section, const QString& Setting, const QString& Value, CSbieIni::ESetMode Mode = CSbieIni::eIniUpdate);
@@ -143,7 +145,7 @@ public:
 
 	virtual const QVector<CTraceEntryPtr>& GetTrace();
 	virtual int				GetTraceCount() const { return m_TraceList.count(); }
-	virtual void			ClearTrace() { m_TraceList.clear(); QMutexLocker Lock(&m_TraceMutex); m_TraceCache.clear(); }
+	virtual void			ClearTrace() { m_TraceList.clear(); QMutexLocker Lock(&m_TraceMutex); m_TraceCache.Clear(); }
 
 	// Other
 	virtual quint64			QueryProcessInfo(quint32 ProcessId, quint32 InfoClass = 0);
@@ -261,7 +263,7 @@ protected:
 	QMap<quint32, SWndInfo> m_WindowMap;
 
 	mutable QMutex			m_TraceMutex;
-	QVector<CTraceEntryPtr>	m_TraceCache;
+	CTraceOrder<CTraceEntryPtr> m_TraceCache; // sorted by the time the entries were made
 	QVector<CTraceEntryPtr>	m_TraceList;
 
 	mutable QReadWriteLock	m_DriveLettersMutex;
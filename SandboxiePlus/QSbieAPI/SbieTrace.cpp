@@ -94,7 +94,8 @@ CTraceEntry::CTraceEntry(quint64 Timestamp, quint32 ProcessId, quint32 ThreadId,
 	m_Counter = 1;
 #endif
 
-	m_Message = m_Message.replace("\r", "").replace("\n", " ");
+	if (m_Message.contains('\r') || m_Message.contains('\n')) // don't detach interned strings without need
+		m_Message = m_Message.replace("\r", "").replace("\n", " ");
 
 	// if this is a set error, then get the actual error string
 	if (m_Type.Type == MONITOR_OTHER && m_Message.indexOf("SetError:") == 0)
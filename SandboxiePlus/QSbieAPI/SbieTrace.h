@@ -18,10 +18,12 @@
 #pragma once
 
 #include <QThread>
+#include <QHash>
 
 #include "qsbieapi_global.h"
 
 #include "SbieStatus.h"
+#include "Helpers/StringPool.h"
 
 //#define USE_MERGE_TRACE
 
@@ -109,3 +111,28 @@ protected:
 };
 
 typedef QSharedDataPointer<CTraceEntry> CTraceEntryPtr;
+
+///////////////////////////////////////////////////////////////////////////////
+// CTraceStringPool
+//
+// Trace entries repeat the same paths and names over and over, the pool
+// hands out one implicitly shared QString per distinct string so entries
+// don't each keep their own copy, see Helpers/StringPool.h
+//
+
+struct STraceStringTraits
+{
+	typedef QString String;
+	typedef QHash<QStringView, QString> Map;
+
+	static const QString* Find(const Map& Pool, const wchar_t* str, size_t len)
+	{
+		auto I = Pool.find(QStringView(str, (qsizetype)len));
+		return I != Pool.end() ? &I.value() : nullptr;
+	}
+
+	static QString Make(const wchar_t* str, size_t len) { return QString::fromWCharArray(str, (int)len); }
+	static void Insert(Map& Pool, const QString& String) { Pool.insert(QStringView(String), String); }
+};
+
+typedef CStringPool<STraceStringTraits> CTraceStringPool;
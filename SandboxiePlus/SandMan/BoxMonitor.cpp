@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "BoxMonitor.h"
 #include "../MiscHelpers/Common/Common.h"
+#include "../MiscHelpers/Common/Settings.h"
 
 CBoxMonitor::CBoxMonitor() 
 { 
@@ -19,29 +20,277 @@ void CBoxMonitor::Notify(const std::wstring& strDirectory)
 	m_Mutex.unlock();
 }
 
-quint64 CBoxMonitor::CounDirSize(const QString& Directory, SBox* Box) 
+void CBoxMonitor::NotifyChange(const std::wstring& strDirectory, DWORD dwAction, const std::wstring& strFileName)
+{
+	QString Root = QString::fromStdWString(strDirectory);
+	QString Path = QString::fromStdWString(strFileName).mid(Root.length()).toLower();
+	while (Path.startsWith("\\"))
+		Path.remove(0, 1);
+
+	// a changed, added or removed entry only changes the listing of its parent folder,
+	// added or removed sub folders are picked up when the parent gets listed again
+	int Pos = Path.lastIndexOf("\\");
+	QString Parent = Pos == -1 ? QString("") : Path.left(Pos);
+
+	m_Mutex.lock();
+	m_Boxes[Root].DirtyDirs.insert(Parent);
+	m_Mutex.unlock();
+}
+
+void CBoxMonitor::NotifyOverflow(const std::wstring& strDirectory)
+{
+	m_Mutex.lock();
+	m_Boxes[QString::fromStdWString(strDirectory)].Overflow = true;
+	m_Mutex.unlock();
+}
+
+QString CBoxMonitor::GetTreeFile(const QString& BoxName)
+{
+	return theConf->GetConfigDir() + "/SizeCache/" + BoxName + ".dat";
+}
+
+static QString CBoxMonitor__MakePath(const QString& Path, const QString& Name)
+{
+	return Path.isEmpty() ? Name : Path + "\\" + Name;
+}
+
+static std::wstring CBoxMonitor__MakeLongPath(const QString& Root, const QString& Path)
+{
+	QString FullPath = QDir::toNativeSeparators(Root);
+	if (!Path.isEmpty())
+		FullPath += "\\" + Path;
+	if (!FullPath.startsWith("\\\\"))
+		FullPath.prepend("\\\\?\\");
+	return FullPath.toStdWString();
+}
+
+static quint64 CBoxMonitor__FileTime(const FILETIME& Time)
+{
+	return ((quint64)Time.dwHighDateTime << 32) | Time.dwLowDateTime;
+}
+
+bool CBoxMonitor::ListDir(const QString& Root, const QString& Path, SDir& Dir)
+{
+	std::wstring DirPath = CBoxMonitor__MakeLongPath(Root, Path);
+
+	// take the time stamp before listing, so a change made while we list shows up as stale on the next load
+	WIN32_FILE_ATTRIBUTE_DATA DirData;
+	if (!GetFileAttributesExW(DirPath.c_str(), GetFileExInfoStandard, &DirData) || !(DirData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return false;
+
+	Dir.LastWrite = CBoxMonitor__FileTime(DirData.ftLastWriteTime);
+	Dir.FilesSize = 0;
+	Dir.SubDirs.clear();
+
+	// the directory listing provides the file sizes, no need to open or query each file
+	WIN32_FIND_DATAW FindData;
+	HANDLE hFind = FindFirstFileExW((DirPath + L"\\*").c_str(), FindExInfoBasic, &FindData, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return true;
+
+	do {
+		if (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			if (wcscmp(FindData.cFileName, L".") == 0 || wcscmp(FindData.cFileName, L"..") == 0)
+				continue;
+			// don't follow junctions and directory links, they may lead outside the box or into a loop
+			if ((FindData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0)
+				Dir.SubDirs.insert(QString::fromWCharArray(FindData.cFileName).toLower());
+		}
+		else
+			Dir.FilesSize += ((quint64)FindData.nFileSizeHigh << 32) | FindData.nFileSizeLow;
+	} while (FindNextFileW(hFind, &FindData));
+
+	FindClose(hFind);
+	return true;
+}
+
+quint64 CBoxMonitor::ScanDirTree(const QString& Root, const QString& Path, SBox* Box)
 {
-	quint64 TotalSize = 0;
 	if (m_bTerminate || Box->pBox.isNull())
-		return TotalSize;
+		return 0;
 
-	QDir Dir(Directory);
-	foreach(const QFileInfo & Info, Dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot))
-	{
-		if (Info.isDir())
-			TotalSize += CounDirSize(Info.filePath(), Box);
-		else if (Info.isShortcut())
-		{
-			QFile File(Info.filePath());
-			if (File.open(QFile::ReadOnly))
-				TotalSize += File.size();
-			File.close();
+	SDir Dir;
+	if (!ListDir(Root, Path, Dir))
+		return 0;
+	Box->Dirs.insert(Path, Dir);
+
+	quint64 TotalSize = Dir.FilesSize;
+	foreach(const QString& Name, Dir.SubDirs)
+		TotalSize += ScanDirTree(Root, CBoxMonitor__MakePath(Path, Name), Box);
+	return TotalSize;
+}
+
+quint64 CBoxMonitor::RemoveDirTree(const QString& Path, SBox* Box)
+{
+	auto I = Box->Dirs.find(Path);
+	if (I == Box->Dirs.end())
+		return 0;
+	SDir Dir = I.value();
+	Box->Dirs.erase(I);
+
+	quint64 TotalSize = Dir.FilesSize;
+	foreach(const QString& Name, Dir.SubDirs)
+		TotalSize += RemoveDirTree(CBoxMonitor__MakePath(Path, Name), Box);
+	return TotalSize;
+}
+
+void CBoxMonitor::UpdateDir(const QString& Root, QString Path, SBox* Box, QSet<QString>& Done)
+{
+	// a folder which is not in the tree is either new or already removed,
+	// in both cases listing the nearest known parent folder takes care of it
+	while (!Box->Dirs.contains(Path)) {
+		if (Path.isEmpty())
+			return;
+		int Pos = Path.lastIndexOf("\\");
+		Path = Pos == -1 ? QString("") : Path.left(Pos);
+	}
+
+	if (Done.contains(Path))
+		return;
+	Done.insert(Path);
+
+	SDir OldDir = Box->Dirs.value(Path);
+	SDir NewDir;
+	if (!ListDir(Root, Path, NewDir)) {
+		Box->TotalSize -= RemoveDirTree(Path, Box);
+		if (Path.isEmpty()) {
+			// the box root is gone, so is the whole tree, when the box gets created again
+			// nothing would be left to update, so scan it anew on the next change
+			Box->TotalSize = 0;
+			Box->VerifyDirs.clear();
+			Box->TreeLoaded = false;
+			Box->TreeDirty = false;
+			QFile::remove(Box->TreeFile);
+			m_Mutex.lock();
+			Box->Changed = true;
+			m_Mutex.unlock();
 		}
+		return;
+	}
+	Box->Dirs.insert(Path, NewDir);
+
+	Box->TotalSize += NewDir.FilesSize;
+	Box->TotalSize -= OldDir.FilesSize;
+
+	foreach(const QString& Name, OldDir.SubDirs) {
+		if (!NewDir.SubDirs.contains(Name))
+			Box->TotalSize -= RemoveDirTree(CBoxMonitor__MakePath(Path, Name), Box);
+	}
+
+	foreach(const QString& Name, NewDir.SubDirs) {
+		QString SubPath = CBoxMonitor__MakePath(Path, Name);
+		if (!Box->Dirs.contains(SubPath))
+			Box->TotalSize += ScanDirTree(Root, SubPath, Box);
+	}
+}
+
+#define SIZE_TREE_MAGIC		0x45455254	// 'TREE'
+#define SIZE_TREE_VERSION	2
+
+bool CBoxMonitor::LoadTree(const QString& Root, SBox* Box)
+{
+	if (Box->TreeFile.isEmpty())
+		return false;
+
+	QFile File(Box->TreeFile);
+	if (!File.open(QFile::ReadOnly))
+		return false;
+
+	QDataStream Stream(&File);
+	Stream.setVersion(QDataStream::Qt_5_10);
+
+	quint32 Magic = 0, Version = 0, Count = 0;
+	quint64 SaveTime = 0;
+	QString TreeRoot;
+	Stream >> Magic >> Version >> TreeRoot >> SaveTime >> Count;
+	if (Magic != SIZE_TREE_MAGIC || Version != SIZE_TREE_VERSION || TreeRoot.compare(Root, Qt::CaseInsensitive) != 0)
+		return false;
+
+	// a file written by anything else than SaveTree, e.g. an older copy put back in place,
+	// does not have its time stamp right after the save time recorded in it
+	qint64 ModifyTime = QFileInfo(File).lastModified().toMSecsSinceEpoch();
+	if (ModifyTime < (qint64)SaveTime - 2 * 1000 || ModifyTime > (qint64)SaveTime + 60 * 1000)
+		return false;
+
+	QHash<QString, SDir> Dirs;
+	Dirs.reserve(Count);
+	for (quint32 i = 0; i < Count && Stream.status() == QDataStream::Ok; i++) {
+		QString Path;
+		SDir Dir;
+		Stream >> Path >> Dir.FilesSize >> Dir.LastWrite >> Dir.SubDirs;
+		Dirs.insert(Path, Dir);
+	}
+	// a truncated file fails the stream, one with trailing data has not been read to its end
+	if (Stream.status() != QDataStream::Ok || !File.atEnd() || !Dirs.contains(""))
+		return false;
+
+	//
+	// the box may have changed while we were not watching it, adding, removing or renaming
+	// an entry updates the time stamp of its folder, so checking the time stamps of all folders
+	// finds the stale ones without listing them, these get listed again by the next update
+	//
+	// a file which only changed its size does not update the time stamp of its folder though,
+	// so the remaining folders are listed again too, in small batches after the stale ones,
+	// until then the size of the loaded tree is shown
+	//
+
+	QSet<QString> Stale, Verify;
+	quint64 TotalSize = 0;
+	for (auto I = Dirs.begin(); I != Dirs.end(); ++I) {
+		if (m_bTerminate)
+			return false;
+		TotalSize += I->FilesSize;
+		WIN32_FILE_ATTRIBUTE_DATA DirData;
+		if (!GetFileAttributesExW(CBoxMonitor__MakeLongPath(Root, I.key()).c_str(), GetFileExInfoStandard, &DirData)
+		 || CBoxMonitor__FileTime(DirData.ftLastWriteTime) != I->LastWrite)
+			Stale.insert(I.key());
 		else
-			TotalSize += QFile(Info.filePath()).size();
+			Verify.insert(I.key());
 	}
 
-	return TotalSize;
+	Box->Dirs = Dirs;
+	Box->TotalSize = TotalSize;
+
+	Box->VerifyDirs = Verify;
+
+	m_Mutex.lock();
+	Box->DirtyDirs.unite(Stale);
+	m_Mutex.unlock();
+
+	return true;
+}
+
+void CBoxMonitor::SaveTree(const QString& Root, SBox* Box)
+{
+	Box->TreeDirty = false;
+	Box->LastSave = GetCurTick();
+
+	// the copies are cheap, they share the data until the tree gets modified
+	m_Mutex.lock();
+	QString TreeFile = Box->TreeFile;
+	QHash<QString, SDir> Dirs = Box->Dirs;
+	m_Mutex.unlock();
+
+	WriteTree(TreeFile, Root, Dirs);
+}
+
+void CBoxMonitor::WriteTree(const QString& TreeFile, const QString& Root, const QHash<QString, SDir>& Dirs)
+{
+	if (TreeFile.isEmpty())
+		return;
+
+	QDir().mkpath(QFileInfo(TreeFile).path());
+
+	QFile File(TreeFile);
+	if (!File.open(QFile::WriteOnly | QFile::Truncate))
+		return;
+
+	QDataStream Stream(&File);
+	Stream.setVersion(QDataStream::Qt_5_10);
+
+	Stream << (quint32)SIZE_TREE_MAGIC << (quint32)SIZE_TREE_VERSION << Root << (quint64)QDateTime::currentMSecsSinceEpoch() << (quint32)Dirs.count();
+	for (auto I = Dirs.begin(); I != Dirs.end(); ++I)
+		Stream << I.key() << I->FilesSize << I->LastWrite << I->SubDirs;
 }
 
 void CBoxMonitor::run()
@@ -68,27 +317,119 @@ void CBoxMonitor::run()
 			if (MinScanInterval > 30 * 60 * 1000)
 				MinScanInterval = 30 * 60 * 1000;
 
-			if ((Box->Changed && (!Box->IsWatched || Box->LastScan == 0 || (CurTick - Box->LastScan) > MinScanInterval)) || Box->ForceUpdate) {
+			//
+			// while the box is not watched, changes to it are not seen, so the tree is dropped when the watch
+			// gets closed, when it is re-armed the saved tree is loaded again and its folders get listed,
+			// the stale ones first
+			//
+
+			m_Mutex.lock();
+			bool Unwatched = Box->Unwatched;
+			Box->Unwatched = false;
+			m_Mutex.unlock();
+
+			if (Unwatched && Box->TreeLoaded) {
+				if (Box->TreeDirty)
+					SaveTree(Key, Box);
+				Box->Dirs.clear();
+				Box->VerifyDirs.clear();
+				Box->TreeLoaded = false;
+			}
+
+			//
+			// the size tree is kept up to date from the change notifications, a full rescan is only needed
+			// when explicitly requested, when there is no saved tree, or when notifications were lost
+			//
+
+			bool FullScan = Box->ForceUpdate;
+			if (!FullScan && Box->Changed && !Box->TreeLoaded) {
+				if (LoadTree(Key, Box)) {
+					Box->TreeLoaded = true;
+					Box->TreeDirty = true;
+				}
+				else
+					FullScan = true;
+			}
+			if (!FullScan && Box->Overflow && (!Box->IsWatched || Box->LastScan == 0 || (CurTick - Box->LastScan) > MinScanInterval))
+				FullScan = true;
+
+			if (FullScan) {
 
 				qDebug() << "Rescanning:" << Key << "(" + QDateTime::currentDateTime().toString() + ")";
 
+				m_Mutex.lock();
+				Box->DirtyDirs.clear();
+				Box->Changed = false;
+				Box->Overflow = false;
+				m_Mutex.unlock();
+
 				quint64 ScanStart = GetCurTick();
 
 				Box->ScanDuration = -1;
 
-				Box->TotalSize = CounDirSize(Key, Box);
+				Box->Dirs.clear();
+				Box->VerifyDirs.clear();
+				Box->TotalSize = ScanDirTree(Key, QString(""), Box);
 
 				Box->ScanDuration = GetCurTick() - ScanStart;
 				Box->LastScan = GetCurTick();
 
+				// an aborted scan leaves an incomplete tree behind, don't keep it,
+				// neither a tree without a root, which could not be updated
+				Box->TreeLoaded = !m_bTerminate && !Box->pBox.isNull() && Box->Dirs.contains("");
+				if (Box->TreeLoaded)
+					SaveTree(Key, Box);
+
 				QMetaObject::invokeMethod(this, "UpdateBox", Qt::QueuedConnection,
 					//Q_RETURN_ARG(int, retVal),
 					Q_ARG(QString, Key)
 				);
 
-				Box->Changed = false;
 				Box->ForceUpdate = false;
 			}
+			else if (Box->Changed && Box->TreeLoaded && (CurTick - Box->LastUpdate) >= 1000) {
+
+				QSet<QString> DirtyDirs;
+				m_Mutex.lock();
+				DirtyDirs.swap(Box->DirtyDirs);
+				Box->Changed = false;
+				m_Mutex.unlock();
+
+				QSet<QString> Done;
+				foreach(const QString& Path, DirtyDirs)
+					UpdateDir(Key, Path, Box, Done);
+
+				Box->LastUpdate = CurTick;
+				if (Box->TreeLoaded)
+					Box->TreeDirty = true;
+
+				QMetaObject::invokeMethod(this, "UpdateBox", Qt::QueuedConnection,
+					Q_ARG(QString, Key)
+				);
+			}
+			else if (Box->TreeLoaded && !Box->VerifyDirs.isEmpty()) {
+
+				// list the folders of a loaded tree again, to catch size changes made while it was not watched
+				quint64 OldSize = Box->TotalSize;
+				QSet<QString> Done;
+				for (int i = 0; i < 256 && !Box->VerifyDirs.isEmpty() && Box->TreeLoaded; i++) {
+					auto I = Box->VerifyDirs.begin();
+					QString Path = *I;
+					Box->VerifyDirs.erase(I);
+					UpdateDir(Key, Path, Box, Done);
+				}
+
+				if (Box->TotalSize != OldSize) {
+					if (Box->TreeLoaded)
+						Box->TreeDirty = true;
+					QMetaObject::invokeMethod(this, "UpdateBox", Qt::QueuedConnection,
+						Q_ARG(QString, Key)
+					);
+				}
+			}
+
+			if (Box->TreeDirty && (CurTick - Box->LastSave) > 5 * 60 * 1000)
+				SaveTree(Key, Box);
 
 			m_Mutex.lock();
 			if (Box->pBox.isNull())
@@ -96,18 +437,44 @@ void CBoxMonitor::run()
 			m_Mutex.unlock();
 		}
 	}
+
+	// save the trees, so that the next start does not need to scan the boxes again,
+	// take copies of them under the lock and write them once it is released
+	struct STree
+	{
+		QString TreeFile;
+		QString Root;
+		QHash<QString, SDir> Dirs;
+	};
+	QList<STree> Trees;
+	m_Mutex.lock();
+	for (auto I = m_Boxes.begin(); I != m_Boxes.end(); ++I) {
+		if (I->TreeLoaded && I->TreeDirty && !I->pBox.isNull())
+			Trees.append({ I->TreeFile, I.key(), I->Dirs });
+	}
+	m_Mutex.unlock();
+
+	foreach(const STree& Tree, Trees)
+		WriteTree(Tree.TreeFile, Tree.Root, Tree.Dirs);
 }
 
 void CBoxMonitor::UpdateBox(const QString& Path)
 {
 	// Note: this private function runs in the main thread
 
+	// don't copy the whole SBox, the monitor thread may be modifying its size tree right now
+	QPointer<CSandBoxPlus> pBox;
+	quint64 TotalSize = 0;
 	m_Mutex.lock();
-	SBox Box = m_Boxes.value(Path);
+	auto I = m_Boxes.find(Path);
+	if (I != m_Boxes.end()) {
+		pBox = I->pBox;
+		TotalSize = I->TotalSize;
+	}
 	m_Mutex.unlock();
 
-	if (Box.pBox)
-		Box.pBox->SetSize(Box.TotalSize);
+	if (pBox)
+		pBox->SetSize(TotalSize);
 }
 
 void CBoxMonitor::WatchBox(CSandBoxPlus* pBox)
@@ -117,9 +484,13 @@ void CBoxMonitor::WatchBox(CSandBoxPlus* pBox)
 
 	SBox& Box = m_Boxes[pBox->GetFileRoot()];
 	Box.pBox = pBox;
+	Box.TreeFile = GetTreeFile(pBox->GetName());
+
+	// reconcile the size with the box right away, it may have changed while it was not watched
+	Box.Changed = true;
 
 	Box.IsWatched = true;
-	AddDirectory(pBox->GetFileRoot().toStdWString().c_str(), true, FILE_NOTIFY_CHANGE_SIZE);
+	AddDirectory(pBox->GetFileRoot().toStdWString().c_str(), true, FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME, 64 * 1024);
 }
 
 void CBoxMonitor::ScanBox(CSandBoxPlus* pBox)
@@ -129,6 +500,7 @@ void CBoxMonitor::ScanBox(CSandBoxPlus* pBox)
 
 	SBox& Box = m_Boxes[pBox->GetFileRoot()];
 	Box.pBox = pBox;
+	Box.TreeFile = GetTreeFile(pBox->GetName());
 
 	Box.ForceUpdate = true;
 }
@@ -143,8 +515,7 @@ void CBoxMonitor::CloseBox(CSandBoxPlus* pBox)
 	if(Box.IsWatched)
 		DetachDirectory(pBox->GetFileRoot().toStdWString().c_str());
 	Box.IsWatched = false;
-
-	//Box.Changed = true;
+	Box.Unwatched = true;
 }
 
 void CBoxMonitor::RemoveBox(CSandBoxPlus* pBox)
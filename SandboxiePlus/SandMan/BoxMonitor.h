@@ -11,6 +11,8 @@ public:
 	~CBoxMonitor();
 
 	virtual void Notify(const std::wstring& strDirectory);
+	virtual void NotifyChange(const std::wstring& strDirectory, DWORD dwAction, const std::wstring& strFileName);
+	virtual void NotifyOverflow(const std::wstring& strDirectory);
 
 	virtual void run();
 
@@ -23,33 +25,71 @@ public:
 
 	void Stop();
 
+	static QString GetTreeFile(const QString& BoxName);
+
 private slots:
 	void UpdateBox(const QString& Path);
 
 protected:
 
+	struct SDir
+	{
+		SDir() {
+			FilesSize = 0;
+			LastWrite = 0;
+		}
+
+		quint64 FilesSize;		// files directly in this folder
+		quint64 LastWrite;		// folder time stamp when it was listed
+		QSet<QString> SubDirs;	// lower case names
+	};
+
 	struct SBox
 	{
 		SBox() {
 			ForceUpdate = false;
 			Changed = false;
+			Overflow = false;
 			IsWatched = false;
+			Unwatched = false;
 			LastScan = 0;
 			ScanDuration = 0;
+			LastUpdate = 0;
 			TotalSize = 0;
+			TreeLoaded = false;
+			TreeDirty = false;
+			LastSave = 0;
 		}
 
 		QPointer<CSandBoxPlus> pBox;
 		bool ForceUpdate;
 		bool Changed;
+		bool Overflow;
 		bool IsWatched;
+		bool Unwatched;			// the watch was closed, guarded by m_Mutex
 		quint64 LastScan;
 		quint64 ScanDuration;
+		quint64 LastUpdate;
 
 		quint64 TotalSize;
+
+		QSet<QString> DirtyDirs;	// relative lower case paths, guarded by m_Mutex
+		QHash<QString, SDir> Dirs;	// relative lower case paths, "" is the box root
+		QSet<QString> VerifyDirs;	// folders of a loaded tree not listed since
+		bool TreeLoaded;
+		bool TreeDirty;
+		quint64 LastSave;
+		QString TreeFile;
 	};
 
-	quint64 CounDirSize(const QString& Dir, SBox* Box);
+	bool ListDir(const QString& Root, const QString& Path, SDir& Dir);
+	quint64 ScanDirTree(const QString& Root, const QString& Path, SBox* Box);
+	quint64 RemoveDirTree(const QString& Path, SBox* Box);
+	void UpdateDir(const QString& Root, QString Path, SBox* Box, QSet<QString>& Done);
+
+	bool LoadTree(const QString& Root, SBox* Box);
+	void SaveTree(const QString& Root, SBox* Box);
+	static void WriteTree(const QString& TreeFile, const QString& Root, const QHash<QString, SDir>& Dirs);
 
 	QMutex m_Mutex;
 	QMap<QString, SBox> m_Boxes;
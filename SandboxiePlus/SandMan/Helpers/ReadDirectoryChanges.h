@@ -121,6 +121,18 @@ public:
 
 	virtual void Notify( const std::wstring& strDirectory ) {}
 
+	/// <summary>
+	/// Called for each entry of a notification, before Notify.
+	/// strFileName is the full path of the changed file or directory.
+	/// </summary>
+	virtual void NotifyChange( const std::wstring& strDirectory, DWORD dwAction, const std::wstring& strFileName ) {}
+
+	/// <summary>
+	/// Called when the notification buffer overflowed and the individual
+	/// changes were lost, the caller has to rescan the whole directory.
+	/// </summary>
+	virtual void NotifyOverflow( const std::wstring& strDirectory ) {}
+
 	/// <summary>
 	/// Return a handle for the Win32 Wait... functions that will be
 	/// signaled when there is a queue entry.
@@ -124,9 +124,16 @@ VOID CALLBACK CReadChangesRequest::NotificationCompletion(
 		return;
 	}
 
-	// This might mean overflow? Not sure.
-	if(!dwNumberOfBytesTransfered)
+	// The buffer overflowed, the changes are lost, but we still need to
+	// issue a new read to keep watching the directory.
+	if (dwErrorCode == ERROR_NOTIFY_ENUM_DIR || !dwNumberOfBytesTransfered)
+	{
+		pBlock->BeginRead();
+
+		pBlock->m_pServer->m_pBase->NotifyOverflow(pBlock->GetDirectory());
+		pBlock->m_pServer->m_pBase->Notify(pBlock->GetDirectory());
 		return;
+	}
 
 	// Can't use sizeof(FILE_NOTIFY_INFORMATION) because
 	// the structure is padded to 16 bytes.
@@ -139,7 +146,7 @@ VOID CALLBACK CReadChangesRequest::NotificationCompletion(
 	// again once the completion routine is called.
 	pBlock->BeginRead();
 
-	//pBlock->ProcessNotification();
+	pBlock->ProcessNotification();
 
 	pBlock->m_pServer->m_pBase->Notify(pBlock->GetDirectory());
 }
@@ -172,7 +179,7 @@ void CReadChangesRequest::ProcessNotification()
 				wstrFilename = wbuf;
 		}
 
-		//m_pServer->m_pBase->Push(fni.Action, wstrFilename);
+		m_pServer->m_pBase->NotifyChange(m_wstrDirectory, fni.Action, wstrFilename);
 
 		if (!fni.NextEntryOffset)
 			break;
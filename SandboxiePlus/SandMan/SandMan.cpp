@@ -43,6 +43,7 @@
 #include "AddonManager.h"
 #include "Windows/PopUpWindow.h"
 #include "CustomStyles.h"
+#include "BoxMonitor.h"
 #include <QScreen>
 
 CSbiePlusAPI* theAPI = NULL;
@@ -2894,8 +2895,10 @@ void CSandMan::OnStatusChanged()
 			m_pBoxView->ClearUserUIConfig(AllBoxes);
 
 			foreach(const QString & Key, theConf->ListKeys("SizeCache")) {
-				if (!AllBoxes.contains(Key.toLower()) || !theConf->GetBool("Options/WatchBoxSize", false))
+				if (!AllBoxes.contains(Key.toLower()) || !theConf->GetBool("Options/WatchBoxSize", false)) {
 					theConf->DelValue("SizeCache/" + Key);
+					QFile::remove(CBoxMonitor::GetTreeFile(Key));
+				}
 			}
 
 			QString DefaultBox = theAPI->GetGlobalSettings()->GetText("DefaultBox", "DefaultBox");
@@ -51,7 +51,9 @@ bool CSandMan::OpenRecovery(const CSandBoxPtr& pBox, bool& DeleteSnapshots, bool
 
 	CRecoveryWindow* pRecoveryWnd = pBoxEx->m_pRecoveryWnd = new CRecoveryWindow(pBox, false, this);
 	connect(this, SIGNAL(Closed()), pBoxEx->m_pRecoveryWnd, SLOT(close()));
-	if (pBoxEx->m_pRecoveryWnd->FindFiles() == 0 && bCloseEmpty) {
+	pBoxEx->m_pRecoveryWnd->SetCloseEmpty(bCloseEmpty);
+	pBoxEx->m_pRecoveryWnd->FindFiles();
+	if (bCloseEmpty && pBoxEx->m_pRecoveryWnd->WaitForScan(500) && pBoxEx->m_pRecoveryWnd->IsEmpty()) {
 		delete pBoxEx->m_pRecoveryWnd;
 		pBoxEx->m_pRecoveryWnd = NULL;
 		return true;
@@ -240,6 +240,8 @@ CTraceView::CTraceView(bool bStandAlone, QWidget* parent) : QWidget(parent)
 
 	m_LastID = 0;
 	m_LastCount = 0;
+	m_IndexedCount = 0;
+	m_IndexedID = 0;
 	m_bUpdatePending = false;
 
 	m_FilterTid = 0;
@@ -385,6 +387,55 @@ void CTraceView::OnShowStack()
 	m_pTrace->m_pStackView->setVisible(m_pShowStack->isChecked());
 }
 
+bool CTraceView::UpdateIndex(const QVector<CTraceEntryPtr>& ResourceLog)
+{
+	bool bUpdateFilters = false;
+
+	// the log was cleared or replaced, start over
+	if (m_IndexedCount > ResourceLog.count() || (m_IndexedCount > 0 && ResourceLog.at(m_IndexedCount - 1)->GetUID() != m_IndexedID)) {
+		m_IndexedCount = 0;
+		m_PidIndex.clear();
+		m_PidMap.clear();
+		m_MatchCache.clear();
+	}
+
+	for (int i = m_IndexedCount; i < ResourceLog.count(); i++)
+	{
+		const CTraceEntryPtr& pEntry = ResourceLog.at(i);
+
+		SProgInfo& Info = m_PidMap[pEntry->GetProcessId()];
+		if (Info.Name.isEmpty()) {
+			Info.Name = pEntry->GetProcessName();
+			bUpdateFilters = true;
+		}
+		if (!Info.Threads.contains(pEntry->GetThreadId())) {
+			Info.Threads.insert(pEntry->GetThreadId());
+			bUpdateFilters = true;
+		}
+
+		m_PidIndex[pEntry->GetProcessId()].append(i);
+	}
+
+	m_IndexedCount = ResourceLog.count();
+	m_IndexedID = m_IndexedCount ? ResourceLog.last()->GetUID() : 0;
+
+	return bUpdateFilters;
+}
+
+bool CTraceView::MatchFilter(const QString& Str)
+{
+	// many entries carry the same name or message, every distinct string is searched only once per filter
+	auto I = m_MatchCache.find(Str);
+	if (I != m_MatchCache.end())
+		return I.value();
+
+	bool bMatch = Str.contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive);
+	if (m_MatchCache.count() >= 0x10000) // a long trace of unique paths would keep a copy of each, start over instead
+		m_MatchCache.clear();
+	m_MatchCache.insert(Str, bMatch);
+	return bMatch;
+}
+
 void CTraceView::Refresh()
 {
 	QList<CSandBoxPtr>Boxes;
@@ -402,7 +453,6 @@ void CTraceView::Refresh()
 	{
 		m_LastID = 0;
 		m_LastCount = 0;
-		m_PidMap.clear();
 
 		quint64 start = GetCurCycle();
 		m_pTrace->m_pTraceModel->Clear();
@@ -414,7 +464,12 @@ void CTraceView::Refresh()
 
 	const QVector<CTraceEntryPtr> &ResourceLog = theAPI->GetTrace();
 
-	bool bUpdateFilters = false;
+	bool bUpdateFilters = UpdateIndex(ResourceLog);
+
+	if (m_MatchCacheExp != m_pTrace->m_FilterExp) {
+		m_MatchCacheExp = m_pTrace->m_FilterExp;
+		m_MatchCache.clear();
+	}
 
 	int i = 0;
 	if (ResourceLog.count() >= m_LastCount && m_LastCount > 0)
@@ -427,7 +482,6 @@ void CTraceView::Refresh()
 	}
 
 	if (i == 0) {
-		m_PidMap.clear();
 		m_TraceList.clear();
 		m_MonitorMap.clear();
 	}
@@ -438,21 +492,40 @@ void CTraceView::Refresh()
 	//bool bHasFilter = !m_pTrace->m_FilterExp.pattern().isEmpty();
 	bool bHasFilter = !m_pTrace->m_FilterExp.isEmpty();
 
+	//
+	// when only some processes are shown, take the entries from their posting lists,
+	// so a full refresh doesn't need to go over the entries of all the other processes
+	//
+
+	bool bUsePidIndex = !m_ShowPids.isEmpty();
+	QVector<int> Positions;
+	if (bUsePidIndex) {
+		foreach(quint32 pid, m_ShowPids) {
+			const QVector<int> PidPositions = m_PidIndex.value(pid);
+			for (auto I = std::lower_bound(PidPositions.begin(), PidPositions.end(), i); I != PidPositions.end(); ++I)
+				Positions.append(*I);
+		}
+		if (m_ShowPids.count() > 1)
+			std::sort(Positions.begin(), Positions.end());
+	}
+
 	quint64 start = GetCurCycle();
-	for (; i < ResourceLog.count(); i++)
+	for (int n = 0; ; n++)
 	{
-		const CTraceEntryPtr& pEntry = ResourceLog.at(i);
-
-		SProgInfo& Info = m_PidMap[pEntry->GetProcessId()];
-		if (Info.Name.isEmpty()) {
-			Info.Name = pEntry->GetProcessName();
-			bUpdateFilters = true;
+		int k;
+		if (bUsePidIndex) {
+			if (n >= Positions.count())
+				break;
+			k = Positions.at(n);
 		}
-		if (!Info.Threads.contains(pEntry->GetThreadId())) {
-			Info.Threads.insert(pEntry->GetThreadId());
-			bUpdateFilters = true;
+		else {
+			k = i + n;
+			if (k >= ResourceLog.count())
+				break;
 		}
 
+		const CTraceEntryPtr& pEntry = ResourceLog.at(k);
+
 		if (m_pCurrentBox != NULL && m_pCurrentBox != pEntry->GetBoxPtr())
 			continue;
 
@@ -485,11 +558,11 @@ void CTraceView::Refresh()
 		else
 		{
 			if (bHasFilter && !m_pTrace->m_bHighLight) {
-				if (!pEntry->GetName().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive)
-					&& !pEntry->GetMessage().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive)
+				if (!MatchFilter(pEntry->GetName())
+					&& !MatchFilter(pEntry->GetMessage())
 					//&& !pEntry->GetTypeStr().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive) // don't filter on non static strings !!!
 					//&& !pEntry->GetStautsStr().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive) // don't filter on non static strings !!!
-					&& !pEntry->GetProcessName().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive))
+					&& !MatchFilter(pEntry->GetProcessName()))
 						continue;
 			}
 	
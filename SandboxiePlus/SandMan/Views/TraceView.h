@@ -98,6 +98,9 @@ protected:
 
 	static void			SaveToFileAsync(const CSbieProgressPtr& pProgress, QVector<CTraceEntryPtr> ResourceLog, QIODevice* pFile);
 
+	bool				UpdateIndex(const QVector<CTraceEntryPtr>& ResourceLog);
+	bool				MatchFilter(const QString& Str);
+
 	struct SProgInfo
 	{
 		QString Name;
@@ -105,6 +108,11 @@ protected:
 	};
 
 	QMap<quint32, SProgInfo>m_PidMap;
+	QHash<quint32, QVector<int>> m_PidIndex; // positions in the trace log by process id
+	int						m_IndexedCount;
+	quint64					m_IndexedID;
+	QHash<QString, bool>	m_MatchCache; // text filter results by string, bounded
+	QString					m_MatchCacheExp;
 	bool					m_FullRefresh;
 	quint64					m_LastID;
 	int						m_LastCount;
@@ -52,11 +52,14 @@ CRecoveryWindow::CRecoveryWindow(const CSandBoxPtr& pBox, bool bImmediate, QWidg
 	m_pBox = pBox;
 
 	m_pCounter = NULL;
+	m_pScanner = NULL;
 
 	m_LastTargetIndex = 0;
 	m_bTargetsChanged = false;
 	m_bReloadPending = false;
+	m_bSyncPending = false;
 	m_DeleteSnapshots = false;
+	m_bCloseEmpty = false;
 
 	QStyle* pStyle = QStyleFactory::create("windows");
 	ui.treeFiles->setStyle(pStyle);
@@ -95,7 +98,7 @@ CRecoveryWindow::CRecoveryWindow(const CSandBoxPtr& pBox, bool bImmediate, QWidg
 
 	connect(ui.btnAddFolder, SIGNAL(clicked(bool)), this, SLOT(OnAddFolder()));
 	connect(ui.chkShowAll, SIGNAL(clicked(bool)), this, SLOT(FindFiles()));
-	connect(ui.btnRefresh, SIGNAL(clicked(bool)), this, SLOT(FindFiles()));
+	connect(ui.btnRefresh, SIGNAL(clicked(bool)), this, SLOT(OnRefresh()));
 	connect(ui.btnRecover, SIGNAL(clicked(bool)), this, SLOT(OnRecover()));
 	connect(ui.btnDelete, SIGNAL(clicked(bool)), this, SLOT(OnDelete()));
 	connect(ui.cmbRecover, SIGNAL(currentIndexChanged(int)), this, SLOT(OnTargetChanged()));
@@ -151,6 +154,8 @@ CRecoveryWindow::CRecoveryWindow(const CSandBoxPtr& pBox, bool bImmediate, QWidg
 
 CRecoveryWindow::~CRecoveryWindow()
 {
+	CancelScan();
+
 	theConf->SetBlob("RecoveryWindow/Window_Geometry",saveGeometry());
 
 	theConf->SetBlob("RecoveryWindow/TreeView_Columns", ui.treeFiles->header()->saveState());
@@ -187,10 +192,14 @@ void CRecoveryWindow::OnAddFolder()
 	m_RecoveryFolders.append(Folder);
 	m_pBox->AppendText("RecoverFolder", Folder);
 
-	FindFiles(Folder);
+	FindFiles();
+}
 
-	m_pFileModel->Sync(m_FileMap);
-	ui.treeFiles->expandAll();
+void CRecoveryWindow::OnRefresh()
+{
+	m_DirCache.clear();
+
+	FindFiles();
 }
 
 void CRecoveryWindow::OnTargetChanged()
@@ -283,8 +292,10 @@ void CRecoveryWindow::AddFile(const QString& FilePath, const QString& BoxPath)
 
 	m_NewFiles.insert(FilePath);
 
-	if (m_FileMap.isEmpty())
+	if (m_FileMap.isEmpty() && !m_pScanner) {
 		FindFiles();
+		WaitForScan(500);
+	}
 	else if (!m_bReloadPending)
 	{
 		m_bReloadPending = true;
@@ -292,7 +303,7 @@ void CRecoveryWindow::AddFile(const QString& FilePath, const QString& BoxPath)
 	}
 }
 
-int CRecoveryWindow::FindFiles()
+void CRecoveryWindow::FindFiles()
 {
 	m_bReloadPending = false;
 	if (!m_NewFiles.isEmpty()) {
@@ -303,46 +314,142 @@ int CRecoveryWindow::FindFiles()
 		connect(m_pCounter, SIGNAL(Count(quint32, quint32, quint64)), this, SLOT(OnCount(quint32, quint32, quint64)));
 	}
 
-	m_FileMap.clear();
-	int Count = 0;
+	QList<CRecoveryScanner::SRoot> Roots;
 
 	if (ui.chkShowAll->checkState() == Qt::Checked)
 	{
 		//for(char drive = 'A'; drive <= 'Z'; drive++)
 		QDir Dir(m_pBox->GetFileRoot() + "\\drive\\");
 		foreach(const QFileInfo & Info, Dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot))
-			Count += FindBoxFiles("\\drive\\" + Info.fileName());
+			AddBoxFolder(Roots, "\\drive\\" + Info.fileName());
 
 		if (m_pBox->GetBool("SeparateUserFolders", true, true)) {
-			Count += FindBoxFiles("\\user\\current");
-			Count += FindBoxFiles("\\user\\all");
-			Count += FindBoxFiles("\\user\\public");
+			AddBoxFolder(Roots, "\\user\\current");
+			AddBoxFolder(Roots, "\\user\\all");
+			AddBoxFolder(Roots, "\\user\\public");
 		}
 
-		//Count += FindBoxFiles("\\share");
+		//AddBoxFolder(Roots, "\\share");
 		QDir DirSvr(m_pBox->GetFileRoot() + "\\share\\");
 		foreach(const QFileInfo & InfoSrv, DirSvr.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
 			QDir DirPub(m_pBox->GetFileRoot() + "\\share\\" + InfoSrv.fileName());
 			foreach(const QFileInfo & InfoPub, DirPub.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot))
-				Count += FindBoxFiles("\\share\\" + InfoSrv.fileName() + "\\" + InfoPub.fileName());
+				AddBoxFolder(Roots, "\\share\\" + InfoSrv.fileName() + "\\" + InfoPub.fileName());
 		}
 	}
 	else
 	{
 		foreach(const QString & Folder, m_RecoveryFolders)
-			Count += FindFiles(Folder);
+			AddFolder(Roots, Folder);
 	}
 
-	if (m_bImmediate && m_FileMap.isEmpty())
+	// the folders are crawled by a worker thread and the files are added to the list as they are found,
+	// the entries of the last scan stay in place until the new scan completes, a running scan is cancelled
+	CancelScan();
+	m_ScanMap.clear();
+
+	m_pScanner = new CRecoveryScanner(Roots, m_NewFiles, ui.chkShowAll->checkState() == Qt::PartiallyChecked, m_DirCache, this);
+	connect(m_pScanner, SIGNAL(Results()), this, SLOT(OnScanResults()));
+	connect(m_pScanner, SIGNAL(finished()), this, SLOT(OnScanFinished()));
+	m_pScanner->start(QThread::LowPriority);
+}
+
+void CRecoveryWindow::CancelScan()
+{
+	if (!m_pScanner)
+		return;
+
+	// the scanner may be waiting for a large directory listing, so do not block the GUI thread on it,
+	// it is detached from this window and deletes itself once it has stopped
+	disconnect(m_pScanner, 0, this, 0);
+	m_pScanner->Cancel();
+	m_pScanner->setParent(NULL);
+	connect(m_pScanner, SIGNAL(finished()), m_pScanner, SLOT(deleteLater()));
+	if (m_pScanner->isFinished())
+		m_pScanner->deleteLater();
+	m_pScanner = NULL;
+}
+
+bool CRecoveryWindow::WaitForScan(int msecs)
+{
+	if (m_pScanner && !m_pScanner->wait(msecs))
+		return false;
+	OnScanFinished();
+	return true;
+}
+
+void CRecoveryWindow::OnScanResults()
+{
+	if (!m_pScanner)
+		return;
+
+	QList<QVariantMap> Results = m_pScanner->TakeResults();
+	if (Results.isEmpty())
+		return;
+
+	foreach(QVariantMap Item, Results)
+	{
+		QString ID = Item["ID"].toString();
+		QVariantMap Old = m_FileMap.value(ID);
+
+		if (Item["IsDir"].toBool()) {
+			Item["Icon"] = m_IconProvider.icon(QFileIconProvider::Folder);
+			if (!Item.contains("FileSize")) // not known until the folder is done
+				Item["FileSize"] = Old["FileSize"];
+		}
+		else if (!Old.isEmpty() && !Old["IsDir"].toBool())
+			Item["Icon"] = Old["Icon"];
+		else
+			Item["Icon"] = m_IconProvider.icon(QFileInfo(Item["BoxPath"].toString()));
+
+		m_ScanMap.insert(ID, Item);
+		m_FileMap.insert(ID, Item);
+	}
+
+	// syncing the model and expanding the tree walks the whole list, so do it at most every 500 ms
+	if (!m_bSyncPending) {
+		m_bSyncPending = true;
+		QTimer::singleShot(500, this, SLOT(OnSyncFiles()));
+	}
+}
+
+void CRecoveryWindow::OnSyncFiles()
+{
+	if (!m_bSyncPending)
+		return; // the scan has finished in the mean time
+	m_bSyncPending = false;
+
+	m_pFileModel->Sync(m_FileMap);
+	ui.treeFiles->expandAll();
+}
+
+void CRecoveryWindow::OnScanFinished()
+{
+	if (!m_pScanner || !m_pScanner->isFinished())
+		return; // from a cancelled scan
+
+	OnScanResults();
+
+	m_DirCache = m_pScanner->GetDirCache();
+	m_pScanner->deleteLater();
+	m_pScanner = NULL;
+
+	m_FileMap = m_ScanMap;
+	m_ScanMap.clear();
+	m_bSyncPending = false;
+
+	if (m_FileMap.isEmpty() && (m_bImmediate || (m_bCloseEmpty && isVisible()))) {
+		if (m_bCloseEmpty)
+			this->setResult(1);
 		this->close();
+		return;
+	}
 
 	m_pFileModel->Sync(m_FileMap);
 	ui.treeFiles->expandAll();
 	
 	if(m_bImmediate)
 		SelectFiles();
-
-	return Count;
 }
 
 void CRecoveryWindow::SelectFiles()
@@ -402,80 +509,19 @@ SelectFile:
 	}
 }
 
-int CRecoveryWindow::FindFiles(const QString& Folder)
+void CRecoveryWindow::AddFolder(QList<CRecoveryScanner::SRoot>& Roots, const QString& Folder)
 {
-	//int Count = 0;
 	//foreach(const QString & Path, theAPI->GetBoxedPath(m_pBox, Folder))
-	//	Count += FindFiles(Folder, Path, Folder);
-	//return Count;
-	return FindFiles(theAPI->GetBoxedPath(m_pBox.data(), Folder), Folder, Folder).first;
+	//	Roots.append(CRecoveryScanner::SRoot{ Path, Folder });
+	Roots.append(CRecoveryScanner::SRoot{ theAPI->GetBoxedPath(m_pBox.data(), Folder), Folder });
 }
 
-int CRecoveryWindow::FindBoxFiles(const QString& Folder)
+void CRecoveryWindow::AddBoxFolder(QList<CRecoveryScanner::SRoot>& Roots, const QString& Folder)
 {
 	QString RealFolder = theAPI->GetRealPath(m_pBox.data(), m_pBox->GetFileRoot() + Folder);
 	if (RealFolder.isEmpty())
-		return 0;
-	return FindFiles(m_pBox->GetFileRoot() + Folder, RealFolder, RealFolder).first;
-}
-
-QPair<int, quint64>	CRecoveryWindow::FindFiles(const QString& BoxedFolder, const QString& RealFolder, const QString& Name, const QString& ParentID)
-{
-	int Count = 0;
-	quint64 Size = 0;
-
-	QDir Dir(BoxedFolder);
-	foreach(const QFileInfo& Info, Dir.entryInfoList(QDir::AllEntries))
-	{
-		QString Name = Info.fileName();
-		if (Name == "." || Name == "..")
-			continue;
-		QString Path = Info.filePath().replace("/", "\\");
-
-		if (Info.isFile())
-		{
-			QString RealPath = RealFolder + Path.mid(BoxedFolder.length());
-
-			if (!m_NewFiles.contains(RealPath) && ui.chkShowAll->checkState() == Qt::PartiallyChecked)
-				continue;
-
-			Count++;
-			Size += Info.size();
-
-			QVariantMap RecFile;
-			RecFile["ID"] = RealPath;
-			RecFile["ParentID"] = RealFolder;
-			RecFile["FileName"] = Name;
-			RecFile["FileSize"] = FormatSize(Info.size());
-			RecFile["DiskPath"] = RealPath;
-			RecFile["BoxPath"] = Path;
-			RecFile["Icon"] = m_IconProvider.icon(Info);
-			RecFile["IsDir"] = false;
-			m_FileMap.insert(RealPath, RecFile);
-		}
-		else
-		{
-			auto CountSize = FindFiles(Path, RealFolder + "\\" + Name, Name, RealFolder);
-			Count += CountSize.first;
-			Size += CountSize.second;
-		}
-	}
-
-	if (Count > 0) 
-	{
-		QVariantMap RecFolder;
-		RecFolder["ID"] = RealFolder;
-		RecFolder["ParentID"] = ParentID;
-		RecFolder["FileName"] = Name;
-		RecFolder["FileSize"] = FormatSize(Size);
-		RecFolder["DiskPath"] = RealFolder;
-		RecFolder["BoxPath"] = BoxedFolder;
-		RecFolder["Icon"] = m_IconProvider.icon(QFileIconProvider::Folder);
-		RecFolder["IsDir"] = true;
-		m_FileMap.insert(RealFolder, RecFolder);
-	}
-
-	return qMakePair(Count, Size);
+		return;
+	Roots.append(CRecoveryScanner::SRoot{ m_pBox->GetFileRoot() + Folder, RealFolder });
 }
 
 QMap<QString, CRecoveryWindow::SRecItem> CRecoveryWindow::GetFiles()
@@ -641,4 +687,140 @@ void CRecoveryCounter::run()
 	} while (!Folders.isEmpty());
 
 	emit Count(fileCount, folderCount, totalSize);
-}
\ No newline at end of file
+}
+
+QList<QVariantMap> CRecoveryScanner::TakeResults()
+{
+	QMutexLocker Lock(&m_Mutex);
+	QList<QVariantMap> Results;
+	Results.swap(m_Results);
+	return Results;
+}
+
+void CRecoveryScanner::Push(const QVariantMap& Item)
+{
+	QMutexLocker Lock(&m_Mutex);
+	m_Results.append(Item);
+	if (m_Results.count() >= 1000 || m_LastResults.elapsed() >= 250) {
+		m_LastResults.start();
+		emit Results();
+	}
+}
+
+void CRecoveryScanner::run()
+{
+	m_LastResults.start();
+
+	foreach(const SRoot& Root, m_Roots)
+	{
+		if (!m_run) break;
+
+		Scan(Root.BoxedFolder, Root.RealFolder, Root.RealFolder, QString());
+	}
+
+	emit Results();
+}
+
+QList<CRecoveryScanner::SDirEntry> CRecoveryScanner::ListDir(const QString& BoxedFolder)
+{
+	// adding, removing or renaming an entry updates the modification time of the directory,
+	// as long as it did not change the listing from the last scan is still good
+	QDateTime Modified = QFileInfo(BoxedFolder).lastModified();
+
+	TDirCache::const_iterator I = m_DirCache.find(BoxedFolder);
+	if (I != m_DirCache.end() && Modified.isValid() && I->Modified == Modified)
+		return I->Entries;
+
+	SDirInfo DirInfo;
+	DirInfo.Modified = Modified;
+
+	QDir Dir(BoxedFolder);
+	foreach(const QFileInfo& Info, Dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot))
+	{
+		SDirEntry Entry;
+		Entry.Name = Info.fileName();
+		Entry.IsDir = !Info.isFile();
+		Entry.Size = Entry.IsDir ? 0 : Info.size();
+		DirInfo.Entries.append(Entry);
+	}
+
+	m_DirCache.insert(BoxedFolder, DirInfo);
+	return DirInfo.Entries;
+}
+
+QPair<int, quint64> CRecoveryScanner::Scan(const QString& BoxedFolder, const QString& RealFolder, const QString& Name, const QString& ParentID)
+{
+	int Count = 0;
+	quint64 Size = 0;
+
+	m_Folders.append(SFolder{ BoxedFolder, RealFolder, Name, ParentID, false });
+
+	foreach(const SDirEntry& Entry, ListDir(BoxedFolder))
+	{
+		if (!m_run) break;
+
+		QString Path = BoxedFolder + "\\" + Entry.Name;
+
+		if (!Entry.IsDir)
+		{
+			QString RealPath = RealFolder + Path.mid(BoxedFolder.length());
+
+			if (m_bNewOnly && !m_NewFiles.contains(RealPath))
+				continue;
+
+			Count++;
+			Size += Entry.Size;
+
+			// the folders leading to a file are listed right away, their size follows when they are done
+			for (int i = 0; i < m_Folders.count(); i++)
+			{
+				SFolder& Folder = m_Folders[i];
+				if (Folder.Emitted)
+					continue;
+				Folder.Emitted = true;
+
+				QVariantMap RecFolder;
+				RecFolder["ID"] = Folder.RealFolder;
+				RecFolder["ParentID"] = Folder.ParentID;
+				RecFolder["FileName"] = Folder.Name;
+				RecFolder["DiskPath"] = Folder.RealFolder;
+				RecFolder["BoxPath"] = Folder.BoxedFolder;
+				RecFolder["IsDir"] = true;
+				Push(RecFolder);
+			}
+
+			QVariantMap RecFile;
+			RecFile["ID"] = RealPath;
+			RecFile["ParentID"] = RealFolder;
+			RecFile["FileName"] = Entry.Name;
+			RecFile["FileSize"] = FormatSize(Entry.Size);
+			RecFile["DiskPath"] = RealPath;
+			RecFile["BoxPath"] = Path;
+			RecFile["IsDir"] = false;
+			Push(RecFile);
+		}
+		else
+		{
+			auto CountSize = Scan(Path, RealFolder + "\\" + Entry.Name, Entry.Name, RealFolder);
+			Count += CountSize.first;
+			Size += CountSize.second;
+		}
+	}
+
+	m_Folders.removeLast();
+
+	if (Count > 0) 
+	{
+		QVariantMap RecFolder;
+		RecFolder["ID"] = RealFolder;
+		RecFolder["ParentID"] = ParentID;
+		RecFolder["FileName"] = Name;
+		RecFolder["FileSize"] = FormatSize(Size);
+		RecFolder["DiskPath"] = RealFolder;
+		RecFolder["BoxPath"] = BoxedFolder;
+		RecFolder["IsDir"] = true;
+		Push(RecFolder);
+	}
+
+	return qMakePair(Count, Size);
+}
@@ -2,6 +2,8 @@
 
 #include <QtWidgets/QMainWindow>
 #include <QFileIconProvider>
+#include <QMutex>
+#include <QElapsedTimer>
 #include "ui_RecoveryWindow.h"
 #include "SbiePlusAPI.h"
 class CSimpleTreeModel;
@@ -31,6 +33,76 @@ protected:
 	bool		m_run;
 };
 
+class CRecoveryScanner : public QThread
+{
+	Q_OBJECT
+public:
+	struct SRoot {
+		QString BoxedFolder;
+		QString RealFolder;
+	};
+
+	struct SDirEntry {
+		QString Name;
+		bool IsDir;
+		quint64 Size;
+	};
+
+	struct SDirInfo {
+		QDateTime Modified;
+		QList<SDirEntry> Entries;
+	};
+
+	typedef QHash<QString, SDirInfo> TDirCache;
+
+	CRecoveryScanner(const QList<SRoot>& Roots, const QSet<QString>& NewFiles, bool bNewOnly, const TDirCache& DirCache, QObject* parent = Q_NULLPTR) : QThread(parent) {
+		m_Roots = Roots;
+		m_NewFiles = NewFiles;
+		m_bNewOnly = bNewOnly;
+		m_DirCache = DirCache;
+		m_run = true;
+	}
+	~CRecoveryScanner() {
+		m_run = false;
+		wait();
+	}
+
+	void		Cancel()				{ m_run = false; }
+
+	QList<QVariantMap>	TakeResults();
+	TDirCache			GetDirCache() const		{ return m_DirCache; } // only once the thread has finished
+
+signals:
+	void		Results();
+
+protected:
+	void		run();
+
+	QPair<int, quint64> Scan(const QString& BoxedFolder, const QString& RealFolder, const QString& Name, const QString& ParentID);
+	QList<SDirEntry> ListDir(const QString& BoxedFolder);
+	void		Push(const QVariantMap& Item);
+
+	struct SFolder {
+		QString BoxedFolder;
+		QString RealFolder;
+		QString Name;
+		QString ParentID;
+		bool Emitted;
+	};
+
+	QList<SRoot> m_Roots;
+	QSet<QString> m_NewFiles;
+	bool		m_bNewOnly;
+	TDirCache	m_DirCache;
+	bool		m_run;
+
+	QList<SFolder> m_Folders;
+
+	QMutex		m_Mutex;
+	QList<QVariantMap> m_Results;
+	QElapsedTimer m_LastResults;
+};
+
 class CRecoveryWindow : public QDialog
 {
 	Q_OBJECT
@@ -42,6 +114,10 @@ public:
 	bool		IsDeleteDialog() const;
 	bool		IsDeleteSnapshots() { return m_DeleteSnapshots; }
 
+	bool		WaitForScan(int msecs);
+	bool		IsEmpty() const { return m_FileMap.isEmpty(); }
+	void		SetCloseEmpty(bool bCloseEmpty) { m_bCloseEmpty = bCloseEmpty; }
+
 	virtual void accept() {}
 	virtual void reject() { this->close(); }
 
@@ -51,12 +127,16 @@ signals:
 public slots:
 	int			exec();
 
-	int			FindFiles();
+	void		FindFiles();
 	void		SelectFiles();
 	void		AddFile(const QString& FilePath, const QString& BoxPath);
 
 private slots:
 	void		OnAddFolder();
+	void		OnRefresh();
+	void		OnScanResults();
+	void		OnScanFinished();
+	void		OnSyncFiles();
 	void		OnRecover();
 	void		OnDelete();
 	void		OnTargetChanged();
@@ -69,9 +149,10 @@ private slots:
 protected:
 	void		closeEvent(QCloseEvent *e);
 
-	int			FindFiles(const QString& Folder);
-	int			FindBoxFiles(const QString& Folder);
-	QPair<int, quint64> FindFiles(const QString& BoxedFolder, const QString& RealFolder, const QString& Name, const QString& ParentID = QString());
+	void		CancelScan();
+
+	void		AddFolder(QList<CRecoveryScanner::SRoot>& Roots, const QString& Folder);
+	void		AddBoxFolder(QList<CRecoveryScanner::SRoot>& Roots, const QString& Folder);
 
 	struct SRecItem {
 		QString FullPath;
@@ -85,17 +166,22 @@ protected:
 	CSandBoxPtr m_pBox;
 
 	QMap<QVariant, QVariantMap> m_FileMap;
+	QMap<QVariant, QVariantMap> m_ScanMap;
 	QSet<QString> m_NewFiles;
 
 	QStringList m_RecoveryFolders;
 
 	CRecoveryCounter* m_pCounter;
+	CRecoveryScanner* m_pScanner;
+	CRecoveryScanner::TDirCache m_DirCache;
 
 	int m_LastTargetIndex;
 	bool m_bTargetsChanged;
 	bool m_bReloadPending;
+	bool m_bSyncPending;
 	bool m_DeleteSnapshots;
 	bool m_bImmediate;
+	bool m_bCloseEmpty;
 
 private:
 	Ui::RecoveryWindow ui;
@@ -15,4 +15,26 @@ public:
 	virtual bool DiskWrite(void* buf, int size, __int64 offset) = 0;
 	virtual bool DiskRead(void* buf, int size, __int64 offset) = 0;
 	virtual void TrimProcess(DEVICE_DATA_SET_RANGE* range, int n) = 0;
+	virtual bool Flush() { return true; }
+
+	// positional I/O for several requests at once, implementations may keep all of them in flight,
+	// the default issues them one by one, returns true only when all requests succeeded
+	struct SIoRequest
+	{
+		void* buf;
+		int size;
+		__int64 offset;
+		bool write;
+		bool ok;
+	};
+
+	virtual bool DiskIo(SIoRequest* req, int n)
+	{
+		bool ret = true;
+		for (SIoRequest* req2 = req; req2 < req + n; req2++) {
+			req2->ok = req2->write ? DiskWrite(req2->buf, req2->size, req2->offset) : DiskRead(req2->buf, req2->size, req2->offset);
+			ret = ret && req2->ok;
+		}
+		return ret;
+	}
 };
@@ -0,0 +1,529 @@
+#include "framework.h"
+#include <unordered_map>
+#include "CacheIO.h"
+#include "ImBox.h"
+#include "..\Common\helpers.h"
+
+// the cache works on blocks of this size, requests only need to be sector aligned
+#define CACHE_BLOCK_SIZE		0x1000
+#define CACHE_MIN_BLOCKS		1024		// at least 4 times the largest request
+#define CACHE_FLUSH_INTERVAL	1000		// ms
+#define CACHE_MAX_RUN			256			// blocks written back with one request
+
+//
+// by default the cache is write-through, a write completes only once the layer below
+// has written it, just like without the cache.
+//
+// in write-back mode writes complete once they are in the cache, dirty blocks are written
+// back at the latest after CACHE_FLUSH_INTERVAL, when evicted, before a trim and on unmount,
+// so a crash or power loss loses the writes of up to the last CACHE_FLUSH_INTERVAL.
+// a block stays dirty until it was written back, a failed write back is retried with the
+// next flush and reported by Flush, or by the next read or write when it happened on its own.
+//
+// the cached blocks hold plain text, all buffers holding cached data are locked in memory
+// so they never get paged out, and are wiped when freed
+//
+
+struct SCacheBlock
+{
+	__int64 Index;
+	bool Dirty;
+	std::list<SCacheBlock*>::iterator Lru;
+	BYTE* Data;							// CACHE_BLOCK_SIZE bytes in SCacheIO::Arena
+};
+
+struct SCacheIO
+{
+	CRITICAL_SECTION Lock;
+
+	bool Enabled;
+	bool WriteBack;
+	size_t MaxBlocks;
+	std::unordered_map<__int64, SCacheBlock*> Blocks;
+	std::list<SCacheBlock*> Lru;		// most recently used first
+	std::set<__int64> Dirty;			// ordered, so adjacent blocks are written back together
+
+	// all blocks are allocated up front, the data in one locked arena
+	SCacheBlock* Slots;
+	std::vector<SCacheBlock*> FreeSlots;
+	BYTE* Arena;
+
+	// aligned buffers for the layer below, which may use unbuffered I/O
+	BYTE* ReadBuf;
+	size_t ReadBufSize;
+	BYTE* FlushBuf;
+
+	HANDLE hThread;
+	HANDLE hStopEvent;
+
+	bool WriteError;					// a write back failed since the last request
+
+	CCacheIO::SStats Stats;
+};
+
+CCacheIO::CCacheIO(CAbstractIO* pIO, ULONG64 uCacheSize, bool bWriteBack)
+{
+	m = new SCacheIO;
+	InitializeCriticalSection(&m->Lock);
+
+	m->Enabled = false;
+	m->WriteBack = bWriteBack;
+	m->MaxBlocks = (size_t)(uCacheSize / CACHE_BLOCK_SIZE);
+	if (m->MaxBlocks < CACHE_MIN_BLOCKS)
+		m->MaxBlocks = CACHE_MIN_BLOCKS;
+
+	m->Slots = NULL;
+	m->Arena = NULL;
+
+	m->ReadBuf = NULL;
+	m->ReadBufSize = 0;
+	m->FlushBuf = NULL;
+
+	m->hThread = NULL;
+	m->hStopEvent = NULL;
+
+	m->WriteError = false;
+
+	memset(&m->Stats, 0, sizeof(m->Stats));
+
+	m_pIO = pIO;
+}
+
+BYTE* CCacheIO_AllocLocked(size_t size)
+{
+	BYTE* ptr = (BYTE*)VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!ptr)
+		return NULL;
+
+	if (!VirtualLock(ptr, size)) {
+
+		//
+		// the working set must be large enough to hold all locked pages, try to grow it
+		//
+
+		SIZE_T MinSize, MaxSize;
+		if (!GetProcessWorkingSetSize(GetCurrentProcess(), &MinSize, &MaxSize)
+		 || !SetProcessWorkingSetSize(GetCurrentProcess(), MinSize + size, MaxSize + size)
+		 || !VirtualLock(ptr, size)) {
+			VirtualFree(ptr, 0, MEM_RELEASE);
+			return NULL;
+		}
+	}
+
+	return ptr;
+}
+
+void CCacheIO_FreeLocked(BYTE* ptr, size_t size)
+{
+	SecureZeroMemory(ptr, size);
+	VirtualUnlock(ptr, size);
+	VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+CCacheIO::~CCacheIO()
+{
+	if (m->hThread) {
+		SetEvent(m->hStopEvent);
+		WaitForSingleObject(m->hThread, INFINITE);
+		CloseHandle(m->hThread);
+	}
+	if (m->hStopEvent)
+		CloseHandle(m->hStopEvent);
+
+	Flush();
+
+	if (m->Arena)
+		CCacheIO_FreeLocked(m->Arena, m->MaxBlocks * CACHE_BLOCK_SIZE);
+	delete[] m->Slots;
+
+	if (m->ReadBuf)
+		CCacheIO_FreeLocked(m->ReadBuf, m->ReadBufSize);
+	if (m->FlushBuf)
+		CCacheIO_FreeLocked(m->FlushBuf, CACHE_MAX_RUN * CACHE_BLOCK_SIZE);
+
+	DeleteCriticalSection(&m->Lock);
+
+	delete m;
+}
+
+DWORD WINAPI CCacheIO_Thread(LPVOID lpThreadParameter)
+{
+	CCacheIO* This = (CCacheIO*)lpThreadParameter;
+
+	while (WaitForSingleObject(This->m->hStopEvent, CACHE_FLUSH_INTERVAL) == WAIT_TIMEOUT) {
+		EnterCriticalSection(&This->m->Lock);
+		This->FlushLocked();
+		LeaveCriticalSection(&This->m->Lock);
+	}
+
+	return 0;
+}
+
+int CCacheIO::Init()
+{
+	int ret = m_pIO ? m_pIO->Init() : ERR_UNKNOWN_TYPE;
+	if (ret != ERR_OK)
+		return ret;
+
+	//
+	// only full blocks are cached, if the disk size is not a multiple
+	// of the block size we just pass all requests through
+	//
+
+	if (m_pIO->GetDiskSize() % CACHE_BLOCK_SIZE != 0) {
+		DbgPrint(L"Disk size not block aligned, cache disabled.\n");
+		return ERR_OK;
+	}
+
+	//
+	// plain text must not end up in the page file, if we can not lock the
+	// memory for the cache we rather run without it
+	//
+
+	m->Arena = CCacheIO_AllocLocked(m->MaxBlocks * CACHE_BLOCK_SIZE);
+	if (!m->Arena) {
+		DbgPrint(L"Failed to lock %I64u bytes for the cache, cache disabled.\n", (ULONG64)m->MaxBlocks * CACHE_BLOCK_SIZE);
+		return ERR_OK;
+	}
+
+	m->Slots = new SCacheBlock[m->MaxBlocks];
+	m->FreeSlots.reserve(m->MaxBlocks);
+	for (size_t i = m->MaxBlocks; i-- > 0; ) {
+		m->Slots[i].Data = m->Arena + i * CACHE_BLOCK_SIZE;
+		m->FreeSlots.push_back(&m->Slots[i]);
+	}
+
+	if (m->WriteBack) {
+
+		m->FlushBuf = CCacheIO_AllocLocked(CACHE_MAX_RUN * CACHE_BLOCK_SIZE);
+		m->hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!m->FlushBuf || !m->hStopEvent)
+			return ERR_MALLOC_ERROR;
+
+		m->hThread = CreateThread(NULL, 0, CCacheIO_Thread, this, 0, NULL);
+		if (!m->hThread)
+			return ERR_INTERNAL;
+	}
+
+	m->Enabled = true;
+	return ERR_OK;
+}
+
+BYTE* CCacheIO_GetReadBuf(SCacheIO* m, size_t size)
+{
+	if (m->ReadBufSize < size) {
+		if (m->ReadBuf)
+			CCacheIO_FreeLocked(m->ReadBuf, m->ReadBufSize);
+		m->ReadBuf = CCacheIO_AllocLocked(size);
+		m->ReadBufSize = m->ReadBuf ? size : 0;
+	}
+	return m->ReadBuf;
+}
+
+SCacheBlock* CCacheIO_Lookup(SCacheIO* m, __int64 Index)
+{
+	auto I = m->Blocks.find(Index);
+	if (I == m->Blocks.end())
+		return NULL;
+
+	SCacheBlock* pBlock = I->second;
+	m->Lru.splice(m->Lru.begin(), m->Lru, pBlock->Lru);
+	return pBlock;
+}
+
+void CCacheIO_Drop(SCacheIO* m, SCacheBlock* pBlock)
+{
+	if (pBlock->Dirty)
+		m->Dirty.erase(pBlock->Index);
+	m->Lru.erase(pBlock->Lru);
+	m->Blocks.erase(pBlock->Index);
+	SecureZeroMemory(pBlock->Data, CACHE_BLOCK_SIZE);
+	m->FreeSlots.push_back(pBlock);
+}
+
+bool CCacheIO::FlushLocked()
+{
+	bool ret = true;
+
+	//
+	// write back runs of adjacent dirty blocks with one request each,
+	// the data is copied out as the layer below may encrypt in place
+	//
+
+	while (!m->Dirty.empty()) {
+
+		__int64 First = *m->Dirty.begin();
+		int Count = 0;
+
+		auto I = m->Dirty.begin();
+		for (; I != m->Dirty.end() && *I == First + Count && Count < CACHE_MAX_RUN; ++I) {
+			memcpy(m->FlushBuf + Count * CACHE_BLOCK_SIZE, m->Blocks[*I]->Data, CACHE_BLOCK_SIZE);
+			Count++;
+		}
+
+		//
+		// the blocks stay dirty until they are written, on an error we leave them
+		// all for the next flush, retrying now would most likely fail again
+		//
+
+		if (!m_pIO->DiskWrite(m->FlushBuf, Count * CACHE_BLOCK_SIZE, First * CACHE_BLOCK_SIZE)) {
+			DbgPrint(L"Cache write back error, %d dirty blocks remain.\n", (int)m->Dirty.size());
+			m->WriteError = true;
+			ret = false;
+			break;
+		}
+
+		for (auto J = m->Dirty.begin(); J != I; ++J)
+			m->Blocks[*J]->Dirty = false;
+		m->Dirty.erase(m->Dirty.begin(), I);
+
+		m->Stats.Flushed += Count;
+	}
+
+	return ret;
+}
+
+SCacheBlock* CCacheIO_Insert(CCacheIO* This, SCacheIO* m, __int64 Index, const BYTE* Data)
+{
+	if (m->FreeSlots.empty()) {
+
+		SCacheBlock* pOld = m->Lru.back();
+		if (pOld->Dirty) {
+			This->FlushLocked(); // writing all dirty blocks now costs less than writing them one by one
+			if (pOld->Dirty)
+				return NULL; // the write back failed, the block must not be lost
+		}
+
+		CCacheIO_Drop(m, pOld);
+	}
+
+	SCacheBlock* pBlock = m->FreeSlots.back();
+	m->FreeSlots.pop_back();
+
+	pBlock->Index = Index;
+	pBlock->Dirty = false;
+	if (Data)
+		memcpy(pBlock->Data, Data, CACHE_BLOCK_SIZE);
+
+	m->Lru.push_front(pBlock);
+	pBlock->Lru = m->Lru.begin();
+	m->Blocks[Index] = pBlock;
+
+	return pBlock;
+}
+
+bool CCacheIO::DiskRead(void* buf, int size, __int64 offset)
+{
+	if (!m->Enabled)
+		return m_pIO->DiskRead(buf, size, offset);
+
+	EnterCriticalSection(&m->Lock);
+
+	// a write back which failed on its own is reported with the next request
+	bool ret = !m->WriteError;
+	m->WriteError = false;
+
+	__int64 First = offset / CACHE_BLOCK_SIZE;
+	__int64 Last = (offset + size - 1) / CACHE_BLOCK_SIZE;
+
+	//
+	// find the span of missing blocks, this also marks the cached ones as used
+	// so that they don't get evicted while we read in the missing ones
+	//
+
+	__int64 MissFirst = -1, MissLast = -1;
+	for (__int64 Index = First; Index <= Last; Index++) {
+		if (CCacheIO_Lookup(m, Index)) {
+			m->Stats.Hits++;
+			continue;
+		}
+		m->Stats.Misses++;
+		if (MissFirst == -1)
+			MissFirst = Index;
+		MissLast = Index;
+	}
+
+	if (MissFirst != -1) {
+
+		int SpanSize = (int)(MissLast - MissFirst + 1) * CACHE_BLOCK_SIZE;
+		BYTE* pSpan = CCacheIO_GetReadBuf(m, SpanSize);
+		if (!pSpan || !m_pIO->DiskRead(pSpan, SpanSize, MissFirst * CACHE_BLOCK_SIZE)) {
+			LeaveCriticalSection(&m->Lock);
+			return false;
+		}
+
+		for (__int64 Index = MissFirst; Index <= MissLast; Index++) {
+			if (m->Blocks.find(Index) == m->Blocks.end()) // cached blocks in the span may be newer
+				CCacheIO_Insert(this, m, Index, pSpan + (Index - MissFirst) * CACHE_BLOCK_SIZE); // if this fails the block is read again below
+		}
+	}
+
+	for (__int64 Index = First; Index <= Last; Index++) {
+
+		__int64 BlockStart = Index * CACHE_BLOCK_SIZE;
+		__int64 From = max(offset, BlockStart);
+		__int64 To = min(offset + size, BlockStart + CACHE_BLOCK_SIZE);
+
+		SCacheBlock* pBlock = CCacheIO_Lookup(m, Index);
+		if (!pBlock) { // evicted by the blocks read in after it, or not inserted
+			ret = m_pIO->DiskRead((BYTE*)buf + (From - offset), (int)(To - From), From) && ret;
+			continue;
+		}
+
+		memcpy((BYTE*)buf + (From - offset), pBlock->Data + (From - BlockStart), (size_t)(To - From));
+	}
+
+	LeaveCriticalSection(&m->Lock);
+
+	return ret;
+}
+
+bool CCacheIO::DiskWrite(void* buf, int size, __int64 offset)
+{
+	if (!m->Enabled)
+		return m_pIO->DiskWrite(buf, size, offset);
+
+	EnterCriticalSection(&m->Lock);
+
+	bool ret = !m->WriteError;
+	m->WriteError = false;
+
+	__int64 First = offset / CACHE_BLOCK_SIZE;
+	__int64 Last = (offset + size - 1) / CACHE_BLOCK_SIZE;
+
+	bool ok = true;
+
+	for (__int64 Index = First; Index <= Last; Index++) {
+
+		__int64 BlockStart = Index * CACHE_BLOCK_SIZE;
+		__int64 From = max(offset, BlockStart);
+		__int64 To = min(offset + size, BlockStart + CACHE_BLOCK_SIZE);
+
+		SCacheBlock* pBlock = CCacheIO_Lookup(m, Index);
+		if (!pBlock) {
+
+			//
+			// a block we only write a part of must be read in first,
+			// when writing through we just don't cache it
+			//
+
+			BYTE* pData = NULL;
+			if (To - From < CACHE_BLOCK_SIZE) {
+				if (!m->WriteBack)
+					continue;
+				pData = CCacheIO_GetReadBuf(m, CACHE_BLOCK_SIZE);
+				if (!pData || !m_pIO->DiskRead(pData, CACHE_BLOCK_SIZE, BlockStart)) {
+					ok = false;
+					break;
+				}
+			}
+
+			pBlock = CCacheIO_Insert(this, m, Index, pData);
+			if (!pBlock) {
+
+				//
+				// all blocks are dirty and can not be written back, when writing through
+				// the write below covers this block, else we write it on its own
+				//
+
+				if (!m->WriteBack)
+					continue;
+				if (!pData && !(pData = CCacheIO_GetReadBuf(m, CACHE_BLOCK_SIZE))) {
+					ok = false;
+					break;
+				}
+				memcpy(pData + (From - BlockStart), (BYTE*)buf + (From - offset), (size_t)(To - From));
+				if (!m_pIO->DiskWrite(pData, CACHE_BLOCK_SIZE, BlockStart)) {
+					ok = false;
+					break;
+				}
+				continue;
+			}
+		}
+
+		memcpy(pBlock->Data + (From - BlockStart), (BYTE*)buf + (From - offset), (size_t)(To - From));
+
+		if (m->WriteBack && !pBlock->Dirty) {
+			pBlock->Dirty = true;
+			m->Dirty.insert(Index);
+		}
+
+		m->Stats.Writes++;
+	}
+
+	//
+	// the cache is updated first as the layer below may encrypt the buffer in place,
+	// if the write fails the blocks would not match the disk anymore, so drop them
+	//
+
+	if (!m->WriteBack && ok && !m_pIO->DiskWrite(buf, size, offset)) {
+
+		for (__int64 Index = First; Index <= Last; Index++) {
+			auto I = m->Blocks.find(Index);
+			if (I != m->Blocks.end())
+				CCacheIO_Drop(m, I->second);
+		}
+
+		ok = false;
+	}
+
+	LeaveCriticalSection(&m->Lock);
+
+	return ret && ok;
+}
+
+void CCacheIO::TrimProcess(DEVICE_DATA_SET_RANGE* range, int n)
+{
+	if (m->Enabled) {
+
+		EnterCriticalSection(&m->Lock);
+
+		//
+		// write back first, blocks only partly trimmed still hold valid data,
+		// then drop all blocks the trimmed ranges touch, blocks which could not
+		// be written back are kept, their data in the trimmed part is undefined anyway
+		//
+
+		FlushLocked();
+
+		for (DEVICE_DATA_SET_RANGE* range2 = range; range2 < range + n; range2++) {
+			if (range2->LengthInBytes == 0)
+				continue;
+			__int64 First = range2->StartingOffset / CACHE_BLOCK_SIZE;
+			__int64 Last = (range2->StartingOffset + range2->LengthInBytes - 1) / CACHE_BLOCK_SIZE;
+			for (__int64 Index = First; Index <= Last; Index++) {
+				auto I = m->Blocks.find(Index);
+				if (I != m->Blocks.end() && !I->second->Dirty)
+					CCacheIO_Drop(m, I->second);
+			}
+		}
+
+		LeaveCriticalSection(&m->Lock);
+	}
+
+	m_pIO->TrimProcess(range, n);
+}
+
+bool CCacheIO::Flush()
+{
+	if (!m->Enabled)
+		return true;
+
+	EnterCriticalSection(&m->Lock);
+	bool ret = FlushLocked();
+	m->WriteError = false; // reported now
+	LeaveCriticalSection(&m->Lock);
+
+	DbgPrint(L"Cache stats: %I64u hits, %I64u misses, %I64u blocks written, %I64u blocks flushed\n",
+		m->Stats.Hits, m->Stats.Misses, m->Stats.Writes, m->Stats.Flushed);
+
+	return ret;
+}
+
+CCacheIO::SStats CCacheIO::GetStats() const
+{
+	EnterCriticalSection(&m->Lock);
+	SStats Stats = m->Stats;
+	LeaveCriticalSection(&m->Lock);
+	return Stats;
+}
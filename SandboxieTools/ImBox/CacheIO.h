@@ -0,0 +1,42 @@
+#pragma once
+#include "AbstractIO.h"
+
+class CCacheIO : public CAbstractIO
+{
+public:
+	CCacheIO(CAbstractIO* pIO, ULONG64 uCacheSize, bool bWriteBack = false);
+	virtual ~CCacheIO();
+
+	virtual ULONG64 GetAllocSize() const { return m_pIO->GetAllocSize(); }
+	virtual ULONG64 GetDiskSize() const { return m_pIO->GetDiskSize(); }
+	virtual bool CanBeFormated() const { return m_pIO->CanBeFormated(); }
+
+	virtual int Init();
+	virtual void PrepViewOfFile(BYTE* p) { m_pIO->PrepViewOfFile(p); }
+
+	virtual bool DiskWrite(void* buf, int size, __int64 offset);
+	virtual bool DiskRead(void* buf, int size, __int64 offset);
+	virtual void TrimProcess(DEVICE_DATA_SET_RANGE* range, int n);
+	virtual bool Flush();
+
+	struct SStats
+	{
+		ULONG64 Hits;
+		ULONG64 Misses;
+		ULONG64 Writes;
+		ULONG64 Flushed;
+	};
+
+	virtual SStats GetStats() const;
+
+protected:
+	friend DWORD WINAPI CCacheIO_Thread(LPVOID lpThreadParameter);
+	friend struct SCacheBlock* CCacheIO_Insert(CCacheIO* This, struct SCacheIO* m, __int64 Index, const BYTE* Data);
+
+	virtual bool FlushLocked();
+
+	struct SCacheIO* m;
+
+public:
+	CAbstractIO* m_pIO;
+};
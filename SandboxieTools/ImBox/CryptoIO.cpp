@@ -57,6 +57,11 @@ struct SSecureBuffer
 	T* ptr;
 };
 
+// requests of at least this size are split up across the crypto workers
+#define CRYPTO_PARALLEL_MIN		(128 * 1024)
+#define CRYPTO_CHUNK_SIZE		(64 * 1024)	// multiple of XTS_SECTOR_SIZE
+#define CRYPTO_MAX_WORKERS		8
+
 struct SCryptoIO
 {
 	std::wstring Cipher;
@@ -67,8 +72,89 @@ struct SCryptoIO
 	xts_key benc_k;
 
 	SSection* section;
+
+	// crypto worker pool, requests are served one at a time so there is only ever one batch
+	std::vector<HANDLE> Workers;
+	HANDLE hWorkSemaphore;
+	HANDLE hDoneEvent;
+	bool Terminate;
+
+	BYTE* BatchBuf;
+	__int64 BatchOffset;
+	int BatchSize;
+	bool BatchEncrypt;
+	LONG BatchChunks;
+	volatile LONG NextChunk;
+	volatile LONG Pending;			// chunks not yet done plus workers not yet returned
 };
 
+void CCryptoIO_ProcessChunks(SCryptoIO* m)
+{
+	for (;;) {
+		LONG i = InterlockedIncrement(&m->NextChunk) - 1;
+		if (i >= m->BatchChunks)
+			break;
+
+		int pos = i * CRYPTO_CHUNK_SIZE;
+		int len = min(CRYPTO_CHUNK_SIZE, m->BatchSize - pos);
+		if (m->BatchEncrypt)
+			xts_encrypt(m->BatchBuf + pos, m->BatchBuf + pos, len, m->BatchOffset + pos, &m->benc_k);
+		else
+			xts_decrypt(m->BatchBuf + pos, m->BatchBuf + pos, len, m->BatchOffset + pos, &m->benc_k);
+
+		if (InterlockedDecrement(&m->Pending) == 0)
+			SetEvent(m->hDoneEvent);
+	}
+}
+
+DWORD WINAPI CCryptoIO_Thread(LPVOID lpThreadParameter)
+{
+	SCryptoIO* m = (SCryptoIO*)lpThreadParameter;
+
+	for (;;) {
+		WaitForSingleObject(m->hWorkSemaphore, INFINITE);
+		if (m->Terminate)
+			break;
+
+		CCryptoIO_ProcessChunks(m);
+
+		// the batch is only done once every worker woken for it is back, so a late one can't touch the next batch
+		if (InterlockedDecrement(&m->Pending) == 0)
+			SetEvent(m->hDoneEvent);
+	}
+
+	return 0;
+}
+
+void CCryptoIO_Crypt(SCryptoIO* m, BYTE* buf, int size, __int64 offset, bool encrypt)
+{
+	if (size < CRYPTO_PARALLEL_MIN || m->Workers.empty()) {
+		if (encrypt)
+			xts_encrypt(buf, buf, size, offset, &m->benc_k);
+		else
+			xts_decrypt(buf, buf, size, offset, &m->benc_k);
+		return;
+	}
+
+	m->BatchBuf = buf;
+	m->BatchOffset = offset;
+	m->BatchSize = size;
+	m->BatchEncrypt = encrypt;
+	m->BatchChunks = (size + CRYPTO_CHUNK_SIZE - 1) / CRYPTO_CHUNK_SIZE;
+
+	LONG Wake = min((LONG)m->Workers.size(), m->BatchChunks - 1);
+	m->Pending = m->BatchChunks + Wake;
+	ResetEvent(m->hDoneEvent);
+	InterlockedExchange(&m->NextChunk, 0);
+
+	ReleaseSemaphore(m->hWorkSemaphore, Wake, NULL);
+
+	// the calling thread does its share of the work
+	CCryptoIO_ProcessChunks(m);
+
+	WaitForSingleObject(m->hDoneEvent, INFINITE);
+}
+
 CCryptoIO::CCryptoIO(CAbstractIO* pIO, const WCHAR* pKey, const std::wstring& Cipher)
 {
 	m = new SCryptoIO;
@@ -84,6 +170,12 @@ CCryptoIO::CCryptoIO(CAbstractIO* pIO, const WCHAR* pKey, const std::wstring& Ci
 
 	m->section = NULL;
 
+	m->hWorkSemaphore = NULL;
+	m->hDoneEvent = NULL;
+	m->Terminate = false;
+	m->NextChunk = 0;
+	m->BatchChunks = 0;
+
 	m_pIO = pIO;
 
 	xts_init(1);
@@ -91,9 +183,42 @@ CCryptoIO::CCryptoIO(CAbstractIO* pIO, const WCHAR* pKey, const std::wstring& Ci
 
 CCryptoIO::~CCryptoIO()
 {
+	if (!m->Workers.empty()) {
+		m->Terminate = true;
+		ReleaseSemaphore(m->hWorkSemaphore, (LONG)m->Workers.size(), NULL);
+		WaitForMultipleObjects((DWORD)m->Workers.size(), m->Workers.data(), TRUE, INFINITE);
+		for (HANDLE hThread : m->Workers)
+			CloseHandle(hThread);
+	}
+	if (m->hWorkSemaphore)
+		CloseHandle(m->hWorkSemaphore);
+	if (m->hDoneEvent)
+		CloseHandle(m->hDoneEvent);
+
 	delete m;
 }
 
+void CCryptoIO::InitWorkers()
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	int Count = min((int)si.dwNumberOfProcessors - 1, CRYPTO_MAX_WORKERS);
+	if (Count <= 0)
+		return;
+
+	m->hWorkSemaphore = CreateSemaphore(NULL, 0, Count, NULL);
+	m->hDoneEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!m->hWorkSemaphore || !m->hDoneEvent)
+		return;
+
+	for (int i = 0; i < Count; i++) {
+		HANDLE hThread = CreateThread(NULL, 0, CCryptoIO_Thread, m, 0, NULL);
+		if (!hThread)
+			break;
+		m->Workers.push_back(hThread);
+	}
+}
+
 ULONG64 CCryptoIO::GetDiskSize() const 
 { 
 	ULONG64 uSize = m_pIO->GetDiskSize();
@@ -200,6 +325,9 @@ int CCryptoIO::Init()
 
 	if (ret == ERR_OK)
 		ret = InitCrypto();
+
+	if (ret == ERR_OK && m->Workers.empty())
+		InitWorkers();
 	
 	m->password.free();
 
@@ -278,7 +406,7 @@ bool CCryptoIO::DiskWrite(void* buf, int size, __int64 offset)
 		DbgPrint(L"DiskWrite not full sector\n");
 #endif
 
-	xts_encrypt((BYTE*)buf, (BYTE*)buf, size, offset, &m->benc_k);
+	CCryptoIO_Crypt(m, (BYTE*)buf, size, offset, true);
 
 	bool ret = m_pIO->DiskWrite(buf, size, offset + DC_AREA_SIZE);
 
@@ -297,7 +425,7 @@ bool CCryptoIO::DiskRead(void* buf, int size, __int64 offset)
 	bool ret = m_pIO->DiskRead(buf, size, offset + DC_AREA_SIZE);
 
 	if (ret)
-		xts_decrypt((BYTE*)buf, (BYTE*)buf, size, offset, &m->benc_k);
+		CCryptoIO_Crypt(m, (BYTE*)buf, size, offset, false);
 
 	return ret;
 }
@@ -18,6 +18,7 @@ public:
 	virtual bool DiskWrite(void* buf, int size, __int64 offset);
 	virtual bool DiskRead(void* buf, int size, __int64 offset);
 	virtual void TrimProcess(DEVICE_DATA_SET_RANGE* range, int n);
+	virtual bool Flush() { return m_pIO->Flush(); }
 
 	static int BackupHeader(CAbstractIO* pIO, const std::wstring& Path);
 	static int RestoreHeader(CAbstractIO* pIO, const std::wstring& Path);
@@ -29,6 +30,7 @@ public:
 
 protected:
 	virtual int InitCrypto();
+	virtual void InitWorkers();
 	virtual int WriteHeader(struct _dc_header* header);
 
 	struct SCryptoIO* m;
@@ -23,6 +23,7 @@
 #include "PhysicalMemoryIO.h"
 #include "ImageFileIO.h"
 #include "CryptoIO.h"
+#include "CacheIO.h"
 #include "..\Common\helpers.h"
 
 bool HasFlag(const std::vector<std::wstring>& arguments, std::wstring name)
@@ -61,6 +62,91 @@ SArgument GetArgumentEx(const std::vector<std::wstring>& arguments, std::wstring
     return arg;
 }
 
+//
+// bench=<MB> image=<file> [cipher=<name>] writes and reads back a plain file through
+// CImageFileIO and CCryptoIO with each cipher, or only the given one, and prints the
+// throughput, "none" is the image file alone, the file is deleted after each run
+//
+
+int RunBenchmark(std::wstring image, ULONG64 uTotal, const std::wstring& cipher)
+{
+    static const WCHAR* Ciphers[] = { L"none", L"AES", L"TWOFISH", L"SERPENT", L"AES-TWOFISH", L"TWOFISH-SERPENT", L"SERPENT-AES", L"AES-TWOFISH-SERPENT", NULL };
+    const int uRequest = 1024 * 1024;
+
+    if (AttachConsole(ATTACH_PARENT_PROCESS) == FALSE)
+        AllocConsole();
+    freopen("CONOUT$", "w", stdout);
+
+    uTotal = (uTotal + uRequest - 1) / uRequest * uRequest;
+
+    ULONG64* buf = (ULONG64*)VirtualAlloc(NULL, uRequest, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE); // sector aligned for the unbuffered image
+    if (!buf)
+        return ERR_MALLOC_ERROR;
+
+    LARGE_INTEGER Freq;
+    QueryPerformanceFrequency(&Freq);
+
+    wprintf(L"%-20s %12s %12s %8s\n", L"cipher", L"write MB/s", L"read MB/s", L"verify");
+
+    int ret = ERR_OK;
+    for (const WCHAR** pCipher = Ciphers; *pCipher; pCipher++) {
+        if (!cipher.empty() && _wcsicmp(cipher.c_str(), *pCipher) != 0)
+            continue;
+
+        DeleteFile(image.c_str());
+
+        CAbstractIO* pFile = new CImageFileIO(image, uTotal + 1024 * 1024);
+        CAbstractIO* pIO = pFile;
+        if (_wcsicmp(*pCipher, L"none") != 0)
+            pIO = new CCryptoIO(pFile, L"benchmark", *pCipher);
+
+        ret = pIO->Init();
+        if (ret != ERR_OK) {
+            wprintf(L"%-20s failed to open the image, error %d\n", *pCipher, ret);
+            if (pIO != pFile)
+                delete pIO;
+            delete pFile;
+            break;
+        }
+
+        bool ok = true;
+        LARGE_INTEGER Start, End;
+
+        // every qword holds its offset, the crypto layer encrypts the buffer in place so it is filled again for each request
+        QueryPerformanceCounter(&Start);
+        for (ULONG64 offset = 0; offset < uTotal && ok; offset += uRequest) {
+            for (int i = 0; i < (int)(uRequest / sizeof(ULONG64)); i++)
+                buf[i] = offset + i * sizeof(ULONG64);
+            ok = pIO->DiskWrite(buf, uRequest, offset);
+        }
+        ok = ok && pIO->Flush();
+        QueryPerformanceCounter(&End);
+        double WriteRate = (double)uTotal / (1024 * 1024) * Freq.QuadPart / max(End.QuadPart - Start.QuadPart, 1);
+
+        bool verified = ok;
+        QueryPerformanceCounter(&Start);
+        for (ULONG64 offset = 0; offset < uTotal && ok; offset += uRequest) {
+            ok = pIO->DiskRead(buf, uRequest, offset);
+            for (int i = 0; i < (int)(uRequest / sizeof(ULONG64)) && verified; i++)
+                verified = buf[i] == offset + i * sizeof(ULONG64);
+        }
+        QueryPerformanceCounter(&End);
+        double ReadRate = (double)uTotal / (1024 * 1024) * Freq.QuadPart / max(End.QuadPart - Start.QuadPart, 1);
+
+        wprintf(L"%-20s %12.1f %12.1f %8s\n", *pCipher, WriteRate, ReadRate, !ok ? L"io error" : verified ? L"ok" : L"FAILED");
+        if (!ok || !verified)
+            ret = ERR_INTERNAL;
+
+        if (pIO != pFile)
+            delete pIO;
+        delete pFile;
+        DeleteFile(image.c_str());
+    }
+
+    VirtualFree(buf, 0, MEM_RELEASE);
+    return ret;
+}
+
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     _In_opt_ HINSTANCE hPrevInstance,
     _In_ LPWSTR    lpCmdLine,
@@ -88,6 +174,8 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     std::wstring cipher = GetArgument(arguments, L"cipher");
     std::wstring format = GetArgument(arguments, L"format");
     std::wstring params = GetArgument(arguments, L"params");
+    std::wstring cache = GetArgument(arguments, L"cache");
+    std::wstring cache_mode = GetArgument(arguments, L"cache_mode");
 
     SArgument new_key = GetArgumentEx(arguments, L"new_key");
     std::wstring backup = GetArgument(arguments, L"backup");
@@ -101,6 +189,10 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     SArgument set_data = GetArgumentEx(arguments, L"set_data");
     SArgument get_data = GetArgumentEx(arguments, L"get_data");
 
+    std::wstring bench = GetArgument(arguments, L"bench");
+    if (!bench.empty())
+        return RunBenchmark(image, _wtoi64(bench.c_str()) * 1024 * 1024, cipher);
+
     ULONG64 uSize = 0;
     if(size.empty())
         uSize = 2ull * (1024 * 1024 * 1024); // 2GB;
@@ -200,6 +292,14 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
             pCrypto->SetDataSection(pSection);
     }
 
+    //
+    // optionally cache plain text blocks, the size is given in MB, the cache is
+    // write-through unless cache_mode=writeback is given, see CacheIO.cpp
+    //
+
+    if (!cache.empty() && _wtoi64(cache.c_str()) > 0)
+        pIO = new CCacheIO(pIO, _wtoi64(cache.c_str()) * 1024 * 1024, _wcsicmp(cache_mode.c_str(), L"writeback") == 0);
+
     int ret = pIO ? pIO->Init() : ERR_UNKNOWN_TYPE;
     if (ret)
         return ret;
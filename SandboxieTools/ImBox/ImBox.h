@@ -19,6 +19,7 @@
 #define ERR_INVALID_PARAM	14
 #define ERR_DATA_TO_LONG	15
 #define ERR_DATA_NOT_FOUND	16
+#define ERR_WRITE_FAILED	17
 
 #define DC_MAX_PASSWORD 128
 
@@ -1,5 +1,6 @@
 #include "framework.h"
 #include <stdio.h>
+#include <errno.h>
 #include "..\Common\helpers.h"
 #include "..\ImDisk\inc\imdproxy.h"
 #include "..\ImDisk\inc\imdisk.h"
@@ -356,20 +357,33 @@ int CImDiskIO::DoComm()
 	for (;;) {
 		NtSignalAndWaitForSingleObject(shm_response_event, shm_request_event, FALSE, NULL);
 
+		// a failed request is reported to the proxy with an errno value, a cache below may also
+		// report a failed write back of earlier writes with the next request
+		unsigned char errorno = 0;
+
 		if (req_block->request_code == IMDPROXY_REQ_READ) {
 			if (!m_pIO->DiskRead(main_buf, req_block->length, req_block->offset)) {
 				DbgPrint(L"DiskRead error.\n");
+				errorno = EIO;
 			}
 		}
 		else if (req_block->request_code == IMDPROXY_REQ_WRITE) {
 			if (!m_pIO->DiskWrite(main_buf, req_block->length, req_block->offset)) {
 				DbgPrint(L"DiskWrite error, SOME DATA WILL BE LOST.");
+				errorno = EIO;
 			}
 		}
 		else if (req_block->request_code == IMDPROXY_REQ_UNMAP) {
 			m_pIO->TrimProcess((DEVICE_DATA_SET_RANGE*)main_buf, trim_block->length / sizeof(DEVICE_DATA_SET_RANGE));
 		}
 		else if (req_block->request_code == IMDPROXY_REQ_CLOSE) {
+			if (!m_pIO->Flush()) {
+				DbgPrint(L"Flush error, SOME DATA WILL BE LOST.");
+				resp_block->errorno = EIO;
+				resp_block->length = 0;
+				SetEvent(shm_response_event);
+				return ERR_WRITE_FAILED;
+			}
 			return ERR_OK;
 		}
 		else { // unknown command
@@ -377,8 +391,8 @@ int CImDiskIO::DoComm()
 			return ERR_UNKNOWN_COMMAND;
 		}
 
-		resp_block->errorno = 0;
-		resp_block->length = req_block->length;
+		resp_block->errorno = errorno;
+		resp_block->length = errorno ? 0 : req_block->length;
 	}
 }
 
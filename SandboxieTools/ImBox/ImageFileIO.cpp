@@ -114,6 +114,11 @@ NtSetInformationFile(
 
 BOOL GetSparseRanges(HANDLE hFile);
 
+// the image is read and written with overlapped I/O, large requests are split up
+// so the device gets to see several requests at once instead of one at a time
+#define IMAGE_IO_CHUNK_SIZE     (256 * 1024)    // multiple of the sector size
+#define IMAGE_IO_MAX_PENDING    16
+
 struct SImageFileIO
 {
 	std::wstring FilePath;
@@ -125,6 +130,8 @@ struct SImageFileIO
     LARGE_INTEGER fileLastWriteTime = { 0, 0 };
     LARGE_INTEGER fileLastChangeTime = { 0, 0 };
     BOOL bTimeStampValid = FALSE;
+
+    HANDLE hEvents[IMAGE_IO_MAX_PENDING] = { 0 };
 };
 
 CImageFileIO::CImageFileIO(std::wstring& FilePath, ULONG64 uSize)
@@ -156,6 +163,10 @@ CImageFileIO::~CImageFileIO()
         }
 
         CloseHandle(m->Handle);
+    }
+    for (int i = 0; i < IMAGE_IO_MAX_PENDING; i++) {
+        if (m->hEvents[i])
+            CloseHandle(m->hEvents[i]);
     }
 	delete m;
 }
@@ -196,7 +207,7 @@ int CImageFileIO::Init()
 
     bool bCreating = false;
 
-	m->Handle = CreateFile(m->FilePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, NULL);
+	m->Handle = CreateFile(m->FilePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH | FILE_FLAG_OVERLAPPED, NULL);
     if (m->Handle == INVALID_HANDLE_VALUE) {
         
         //
@@ -206,7 +217,7 @@ int CImageFileIO::Init()
         bCreating = true;
 
         if(m->uSize)
-            m->Handle = CreateFile(m->FilePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_NEW, FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, NULL);
+            m->Handle = CreateFile(m->FilePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_NEW, FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH | FILE_FLAG_OVERLAPPED, NULL);
 
         if (m->Handle == INVALID_HANDLE_VALUE)
             return ERR_FILE_NOT_OPENED;
@@ -223,6 +234,12 @@ int CImageFileIO::Init()
             m->uSize = uSize;
     }
 
+    for (int i = 0; i < IMAGE_IO_MAX_PENDING; i++) {
+        m->hEvents[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (!m->hEvents[i])
+            return ERR_INTERNAL;
+    }
+
 	//
 	// make file sparse if it is not yet already
 	//
@@ -241,7 +258,7 @@ int CImageFileIO::Init()
             // the FSCTL_SET_ZERO_DATA control code will actually write zero bytes to
             // the file instead of marking the region as sparse zero area.
             DWORD dwTemp;
-            if (!DeviceIoControl(m->Handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &dwTemp, NULL)) {
+            if (!DeviceIoControlSync(FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &dwTemp)) {
                 DbgPrint(L"Failed to make image file sparse: %s\n", m->FilePath.c_str());
             }
         }
@@ -280,16 +297,101 @@ int CImageFileIO::Init()
 
 bool CImageFileIO::DiskWrite(void* buf, int size, __int64 offset)
 {
-	SetFilePointerEx(m->Handle, *(LARGE_INTEGER*)&offset, NULL, FILE_BEGIN);
-    DWORD BytesWritten;
-	return !!WriteFile(m->Handle, buf, size, &BytesWritten, NULL);
+    return DiskIoSplit(buf, size, offset, true);
 }
 
 bool CImageFileIO::DiskRead(void* buf, int size, __int64 offset)
 {
-	SetFilePointerEx(m->Handle, *(LARGE_INTEGER*)&offset, NULL, FILE_BEGIN);
-    DWORD BytesRead;
-	return !!ReadFile(m->Handle, buf, size, &BytesRead, NULL);
+    return DiskIoSplit(buf, size, offset, false);
+}
+
+bool CImageFileIO::DiskIoSplit(void* buf, int size, __int64 offset, bool write)
+{
+    SIoRequest req[IMAGE_IO_MAX_PENDING];
+    int n = 0;
+
+    for (int pos = 0; pos < size; pos += IMAGE_IO_CHUNK_SIZE) {
+        if (n == IMAGE_IO_MAX_PENDING) {
+            if (!DiskIo(req, n))
+                return false;
+            n = 0;
+        }
+        req[n].buf = (BYTE*)buf + pos;
+        req[n].size = min(IMAGE_IO_CHUNK_SIZE, size - pos);
+        req[n].offset = offset + pos;
+        req[n].write = write;
+        n++;
+    }
+
+    return DiskIo(req, n);
+}
+
+bool CImageFileIO::DiskIo(SIoRequest* req, int n)
+{
+    bool ret = true;
+
+    while (n > 0) {
+
+        int count = min(n, IMAGE_IO_MAX_PENDING);
+
+        //
+        // issue all requests first, then collect the results
+        //
+
+        OVERLAPPED ov[IMAGE_IO_MAX_PENDING];
+        bool eof[IMAGE_IO_MAX_PENDING];
+        for (int i = 0; i < count; i++) {
+            memset(&ov[i], 0, sizeof(OVERLAPPED));
+            ov[i].Offset = (DWORD)req[i].offset;
+            ov[i].OffsetHigh = (DWORD)(req[i].offset >> 32);
+            ov[i].hEvent = m->hEvents[i];
+
+            BOOL ok = req[i].write ? WriteFile(m->Handle, req[i].buf, req[i].size, NULL, &ov[i]) : ReadFile(m->Handle, req[i].buf, req[i].size, NULL, &ov[i]);
+            DWORD err = ok ? ERROR_SUCCESS : GetLastError();
+            eof[i] = !req[i].write && err == ERROR_HANDLE_EOF;
+            req[i].ok = ok || eof[i] || err == ERROR_IO_PENDING;
+        }
+
+        for (int i = 0; i < count; i++) {
+            DWORD Bytes = 0;
+            if (req[i].ok && !eof[i] && !GetOverlappedResult(m->Handle, &ov[i], &Bytes, TRUE)) {
+                eof[i] = !req[i].write && GetLastError() == ERROR_HANDLE_EOF;
+                req[i].ok = eof[i];
+            }
+
+            if (req[i].ok && Bytes != (DWORD)req[i].size) {
+
+                //
+                // a short transfer is a failure, except for a read which reached the end of
+                // the file, a new image grows only with the writes and reads as zeros beyond
+                //
+
+                LARGE_INTEGER FileSize;
+                req[i].ok = !req[i].write && (eof[i] || (GetFileSizeEx(m->Handle, &FileSize) && req[i].offset + Bytes >= FileSize.QuadPart));
+                if (req[i].ok)
+                    memset((BYTE*)req[i].buf + Bytes, 0, req[i].size - Bytes);
+            }
+
+            ret = ret && req[i].ok;
+        }
+
+        req += count;
+        n -= count;
+    }
+
+    return ret;
+}
+
+BOOL CImageFileIO::DeviceIoControlSync(DWORD code, void* in_buf, DWORD in_size, void* out_buf, DWORD out_size, DWORD* pReturned)
+{
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(OVERLAPPED));
+    ov.hEvent = m->hEvents[0];
+
+    BOOL ok = DeviceIoControl(m->Handle, code, in_buf, in_size, out_buf, out_size, pReturned, &ov);
+    if (!ok && GetLastError() == ERROR_IO_PENDING)
+        ok = GetOverlappedResult(m->Handle, &ov, pReturned, TRUE);
+    return ok;
 }
 
 void CImageFileIO::TrimProcess(DEVICE_DATA_SET_RANGE* range, int n)
@@ -302,7 +404,7 @@ void CImageFileIO::TrimProcess(DEVICE_DATA_SET_RANGE* range, int n)
         fzdi.BeyondFinalZero.QuadPart = range->StartingOffset + range->LengthInBytes;
 
         DWORD dwTemp;
-        DeviceIoControl(m->Handle, FSCTL_SET_ZERO_DATA, &fzdi, sizeof(fzdi), NULL, 0, &dwTemp, NULL);
+        DeviceIoControlSync(FSCTL_SET_ZERO_DATA, &fzdi, sizeof(fzdi), NULL, 0, &dwTemp);
 
 		range++;
 		n--;
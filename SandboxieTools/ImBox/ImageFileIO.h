@@ -18,6 +18,12 @@ public:
 	virtual bool DiskRead(void* buf, int size, __int64 offset);
 	virtual void TrimProcess(DEVICE_DATA_SET_RANGE* range, int n);
 
+	virtual bool DiskIo(SIoRequest* req, int n);
+
+protected:
+	virtual bool DiskIoSplit(void* buf, int size, __int64 offset, bool write);
+	virtual BOOL DeviceIoControlSync(DWORD code, void* in_buf, DWORD in_size, void* out_buf, DWORD out_size, DWORD* pReturned);
+
 protected:
 	struct SImageFileIO* m;
 };